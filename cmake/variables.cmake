@@ -9,6 +9,15 @@ if(PROJECT_IS_TOP_LEVEL)
   option(BUILD_SHARED_LIBS "Build shared libs." OFF)
 endif()
 
+# ---- Library options ----
+
+# Quadrupoles make every accepted node more expensive, but allow for a much larger theta at the same error
+set(
+    SolarSim_MULTIPOLE_ORDER 0 CACHE STRING
+    "Highest multipole moment of Barnes-Hut octree nodes: 0 (monopole) or 2 (quadrupole)"
+)
+set_property(CACHE SolarSim_MULTIPOLE_ORDER PROPERTY STRINGS 0 2)
+
 # ---- Warning guard ----
 
 # target_include_directories with the SYSTEM modifier will request the compiler
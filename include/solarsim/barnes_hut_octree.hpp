@@ -22,13 +22,25 @@
 #endif
 
 #include "solarsim/types.hpp"
+#include "solarsim/math.hpp"
 
 #include <array>
 #include <span>
-#include <memory>
+#include <vector>
+#include <cstdint>
+#include <limits>
 
 SOLARSIM_NS_BEGIN
 
+// Nodes live in a single contiguous pool owned by the tree and refer to each other by index.
+// 32 bits are plenty: even 10^8 bodies need less than 2^31 nodes.
+using octree_node_index = std::uint32_t;
+
+inline constexpr octree_node_index invalid_octree_node_index = std::numeric_limits<octree_node_index>::max();
+
+// Accepted nodes act as a point mass at their center of mass (0) or additionally apply their quadrupole moment (2).
+inline constexpr int octree_multipole_order = SOLARSIM_MULTIPOLE_ORDER;
+
 struct barnes_hut_octree_node
 {
   barnes_hut_octree_node() = default;
@@ -39,37 +51,265 @@ struct barnes_hut_octree_node
   {
   }
 
-  [[nodiscard]] bool is_leaf() const noexcept { return !children[0]; }
+  [[nodiscard]] bool is_leaf() const noexcept { return child_mask == 0; }
+  [[nodiscard]] bool has_child(std::size_t slot) const noexcept { return (child_mask & (1u << slot)) != 0; }
 
-  barnes_hut_octree_node& get_child_for_position(const triple& pos) const;
-  void insert_body(const triple& body_position, real body_mass);
-
-  void merge_from(barnes_hut_octree_node&& other);
-
-  template <typename F>
-  void recursively_apply_node_gravity(const triple& body_position, real softening, F&& apply_gravity) const;
-
-  void finalize();
-
-private:
-  void subdivide_node();
+  // Slot (0-7) of the child that covers |pos|. See get_child_position() for the order.
+  [[nodiscard]] std::size_t get_child_slot(const triple& pos) const noexcept;
+  [[nodiscard]] triple get_child_position(std::size_t slot) const noexcept;
 
   // Octree data
   triple position = {}; // top-left corner
   real length     = 0.0;
-  std::array<std::unique_ptr<barnes_hut_octree_node>, 8> children;
+
+  // Only populated children are allocated - |child_mask| tells us which ones.
+  std::uint8_t child_mask = 0;
+  std::array<octree_node_index, 8> children{invalid_octree_node_index, invalid_octree_node_index,
+                                            invalid_octree_node_index, invalid_octree_node_index,
+                                            invalid_octree_node_index, invalid_octree_node_index,
+                                            invalid_octree_node_index, invalid_octree_node_index};
 
   // Barnes-Hut bounds for this node
   real total_mass       = 0.0;
   triple center_of_mass = {};
 
-  // Contained object (if any)
-  bool has_contained_body        = false;
-  triple contained_body_position = {};
-  real contained_body_mass       = 0.0;
+  // Contained bodies (leaves only), chained via partial_barnes_hut_octree::next_body_ starting at |first_body|.
+  std::uint32_t first_body = 0;
+  std::uint32_t body_count = 0;
+};
+
+// What the force calculation walks over: the non-empty nodes of a finished tree in depth-first order.
+// A node's first child (if any) directly follows it, |next| skips its whole subtree.
+struct alignas(64) linear_octree_node
+{
+  // Center of mass (xyz) and total mass times G (w), i.e. what the walk needs of accepted nodes in a single
+  // aligned load
+  quad mass_point = {};
+
+  // The node is opened for bodies closer than this to its center of mass (squared, so we don't need a sqrt)
+  real critical_radius_squared = 0.0;
+  real length_squared          = 0.0;
+
+  std::uint32_t next = 0;
+
+  // Bodies of the whole subtree, see barnes_hut_octree::linear_bodies_
+  std::uint32_t first_body = 0;
+  std::uint32_t body_count = 0;
+
+  // Children follow directly, so only leaves can skip to the node right after them.
+  [[nodiscard]] bool is_leaf(std::uint32_t index) const noexcept { return next == index + 1; }
+};
+
+static_assert(sizeof(linear_octree_node) == 64);
+
+// How barnes_hut_octree stores the nodes it walks over
+enum class octree_node_format
+{
+  // linear_octree_node: doubles throughout, 64 bytes
+  linear,
+  // compact_octree_node: float32 relative to the parent, 32 bytes. Bodies and force sums stay in double.
+  compact,
+  // wide_octree_node: all children of a node side by side, so they're tested at once
+  wide,
+};
+
+// linear_octree_node squeezed into 32 bytes, so twice as many of them fit into the caches.
+// Centers of mass are stored relative to the parent's, which keeps the float32 rounding error relative to the
+// parent's size instead of the whole tree's. The offsets are taken from the parent's decoded center, so the errors
+// don't add up along the path from the root either.
+struct compact_octree_node
+{
+  std::array<float, 3> center_offset = {};
+  // Times G, like linear_octree_node::mass_point
+  float total_mass                   = 0.0f;
+  float critical_radius_squared      = 0.0f;
+
+  // Distance from the root. All nodes of a depth have the same size, so that's all we need to know about it.
+  std::uint32_t depth = 0;
+  std::uint32_t next  = 0;
+
+  // Bodies of the whole subtree, up to the |first_body| of the node at |next| (there's a sentinel at the end).
+  std::uint32_t first_body = 0;
+};
+
+static_assert(sizeof(compact_octree_node) == 32);
+
+// The children of an inner node, stored as SoA so the opening test runs on all of them at once (SIMD).
+// Leaves don't need a wide node of their own, their parent holds everything we need to know about them.
+struct alignas(64) wide_octree_node
+{
+  static constexpr std::size_t width         = 8;
+  static constexpr std::uint32_t no_children = ~std::uint32_t(0);
+
+  std::array<real, width> x                       = {};
+  std::array<real, width> y                       = {};
+  std::array<real, width> z                       = {};
+  // Times G, like linear_octree_node::mass_point
+  std::array<real, width> total_mass              = {};
+  std::array<real, width> critical_radius_squared = {};
+  std::array<real, width> length_squared          = {};
+
+  // Wide node of each child, no_children for leaves
+  std::array<std::uint32_t, width> children = {};
+  // Index of each child in the linear nodes, for its higher multipole moments
+  std::array<std::uint32_t, width> linear_index = {};
+  // Bodies of leaf children
+  std::array<std::uint32_t, width> first_body = {};
+  std::array<std::uint32_t, width> body_count = {};
+
+  std::uint32_t child_count = 0;
+};
+
+// A few bodies close to each other that share a single tree walk, see barnes_hut_octree::recompute_group_acceleration()
+struct octree_body_group
+{
+  // Bounding sphere of the group's bodies
+  triple center = {};
+  real radius   = 0.0;
+
+  // See barnes_hut_octree::linear_bodies_
+  std::uint32_t first_body = 0;
+  std::uint32_t body_count = 0;
+};
+
+// A body found by barnes_hut_octree::find_nearest_bodies()
+struct octree_neighbor
+{
+  // Index into the body arrays the tree was built from
+  std::uint32_t body    = 0;
+  real distance_squared = 0.0;
+};
+
+// Point masses a body group interacts with: the centers of mass of accepted nodes and the bodies of opened leaves.
+// Stored as SoA for calculate_scaled_acceleration_soa(). Keep one per thread around to avoid reallocations.
+struct octree_interaction_list
+{
+  void clear() noexcept
+  {
+    x.clear();
+    y.clear();
+    z.clear();
+    mass.clear();
+    nodes.clear();
+    node_centers.clear();
+  }
+
+  void push_back(const triple& position, real scaled_mass)
+  {
+    x.push_back(position[0]);
+    y.push_back(position[1]);
+    z.push_back(position[2]);
+    mass.push_back(scaled_mass);
+  }
+
+  void push_back_node(std::uint32_t index, const triple& center_of_mass)
+  {
+    nodes.push_back(index);
+    node_centers.push_back(center_of_mass);
+  }
+
+  // Pad to a multiple of soa_lane_count with massless entries, far enough away not to cause any trouble.
+  void pad()
+  {
+    constexpr real far_away = 1e100;
+    while (x.size() % soa_lane_count != 0)
+      push_back({far_away, far_away, far_away}, 0.0);
+  }
+
+  [[nodiscard]] std::size_t size() const noexcept { return x.size(); }
+
+  std::vector<real> x;
+  std::vector<real> y;
+  std::vector<real> z;
+  std::vector<real> mass;
+
+  // Accepted nodes (linear indices) and their centers of mass, for their higher multipole moments
+  std::vector<std::uint32_t> nodes;
+  std::vector<triple> node_centers;
+};
+
+// When a node is far enough away for its center of mass to stand in for its bodies (multipole acceptance criterion)
+struct opening_criterion
+{
+  enum class kind
+  {
+    // size / distance < theta, with the node's side length as size (Barnes & Hut)
+    geometric,
+    // Like geometric, but with the largest distance between the center of mass and any point of the node as
+    // size (Salmon & Warren). Accounts for centers of mass close to a node's edge.
+    bmax,
+    // G * M * size^2 / distance^4 <= alpha * |a|, where |a| is the body's acceleration of the previous tick.
+    // Bodies with a strong field tolerate larger absolute errors. Uses geometric with |theta| while |a| is unknown.
+    relative_acceleration,
+  };
+
+  kind type  = kind::geometric;
+  real theta = 0.5;
+  real alpha = 0.0025;
+};
+
+// Adjusts theta between ticks, so the energy error stays close to a target.
+// The force error of a monopole approximation grows roughly with theta^2, which is what the update assumes.
+class theta_controller
+{
+public:
+  /**
+   * @param target_energy_error Desired relative energy change per update() interval.
+   * @param min_theta Lower bound for theta.
+   * @param max_theta Upper bound for theta.
+   * @param initial_theta Starting value.
+   */
+  explicit theta_controller(real target_energy_error, real min_theta = 0.1, real max_theta = 1.0,
+                            real initial_theta = 0.5);
+
+  /**
+   * Feed the relative energy error of the last interval, i.e. |E - E_previous| / |E_initial|.
+   * @return The theta to use from now on.
+   */
+  real update(real energy_error) noexcept;
+
+  [[nodiscard]] real theta() const noexcept { return theta_; }
+
+private:
+  real target_energy_error_;
+  real min_theta_;
+  real max_theta_;
+  real theta_;
+};
+
+class morton_octree_builder;
+class merged_octree_builder;
+
+// When barnes_hut_octree::refit() gives up on the current topology and rebuilds from scratch
+struct octree_refit_options
+{
+  // Fraction of the bodies that may have moved to another leaf since the last rebuild.
+  // Moves can leave empty leaves behind and split full ones.
+  real max_moved_fraction = 0.25;
+
+  // Minimum extent of the bodies' bounds relative to the root node. Contracting systems would
+  // otherwise end up in a small corner of the tree. Bodies leaving the root always cause a rebuild.
+  real min_bounds_fill = 0.5;
+
+  // Margin added around the bodies' bounds on rebuilds (relative to their extent), so bodies on the
+  // outside don't leave the root right away.
+  real bounds_margin = 0.05;
+};
+
+// How many bodies a leaf holds before it is split
+struct octree_leaf_options
+{
+  // Forces within a leaf are summed directly, so this trades tree depth (and node count) for leaf work.
+  std::uint32_t max_bodies = 8;
+
+  // Leaves this far below the root are never split, no matter how many bodies they hold.
+  // Keeps (near-)duplicate bodies from subdividing the tree until we run out of precision.
+  std::uint32_t max_depth = 32;
 };
 
 axis_aligned_bounding_box build_bounding_box(std::span<const triple> positions);
+// Of the xyz part, e.g. of bodies with their masses in the 4th lane
+axis_aligned_bounding_box build_bounding_box(std::span<const quad> positions);
 
 class partial_barnes_hut_octree
 {
@@ -78,10 +318,85 @@ public:
   partial_barnes_hut_octree(const axis_aligned_bounding_box& bounds, std::span<const triple> body_positions,
                             std::span<const real> body_masses);
 
+  /**
+   * Throw away the current contents and insert a new set of bodies.
+   * The node pool keeps its capacity, so rebuilding every tick doesn't hit the allocator.
+   * @param bounds Bounding box of all bodies.
+   * @param body_positions Positions of the bodies to insert.
+   * @param body_masses Masses of the bodies to insert.
+   * @param first_body_id Id of the first body, the others are numbered consecutively.
+   */
+  void rebuild(const axis_aligned_bounding_box& bounds, std::span<const triple> body_positions,
+               std::span<const real> body_masses, std::uint32_t first_body_id = 0);
+
+  // The body's id is the number of bodies inserted before it.
+  void insert_body(const triple& body_position, real body_mass);
+
+  /**
+   * Merge all bodies of |other| into this tree.
+   * @param other Tree with the same bounds as this one.
+   */
+  void merge_from(const partial_barnes_hut_octree& other);
+
+  // Used by all builds from now on. Trees that get merged need to agree on these.
+  void set_leaf_options(const octree_leaf_options& options) noexcept { leaf_options_ = options; }
+  [[nodiscard]] const octree_leaf_options& get_leaf_options() const noexcept { return leaf_options_; }
+
+  [[nodiscard]] std::size_t node_count() const noexcept { return nodes_.size(); }
+  [[nodiscard]] std::size_t allocated_bytes() const noexcept
+  {
+    return nodes_.capacity() * sizeof(barnes_hut_octree_node) + body_positions_.capacity() * sizeof(triple) +
+           body_masses_.capacity() * sizeof(real) +
+           (body_ids_.capacity() + next_body_.capacity()) * sizeof(std::uint32_t);
+  }
+
 protected:
+  friend class morton_octree_builder;
+  friend class merged_octree_builder;
+
   partial_barnes_hut_octree(const axis_aligned_bounding_box& bounds);
 
-  barnes_hut_octree_node root_ = {};
+  void reset(const axis_aligned_bounding_box& bounds);
+
+  octree_node_index allocate_node(const triple& position, real length);
+  octree_node_index get_or_create_child(octree_node_index index, std::size_t slot);
+  octree_node_index copy_subtree(const partial_barnes_hut_octree& other, octree_node_index other_index);
+  std::uint32_t append_body(const triple& body_position, real body_mass, std::uint32_t body_id);
+
+  void add_leaf_body(barnes_hut_octree_node& node, std::uint32_t body) noexcept;
+  void remove_leaf_body(barnes_hut_octree_node& node, std::uint32_t body) noexcept;
+
+  template <typename F>
+  void for_each_leaf_body(const barnes_hut_octree_node& node, F&& f) const
+  {
+    for (std::uint32_t body = node.first_body, count = node.body_count; count != 0; --count, body = next_body_[body])
+      f(body);
+  }
+
+  void insert_body(octree_node_index index, std::uint32_t body);
+  // Move the bodies of a full leaf into (new) children
+  void split_leaf(octree_node_index index);
+  void merge_from(octree_node_index index, const partial_barnes_hut_octree& other, octree_node_index other_index);
+  void finalize(octree_node_index index);
+  // Like finalize(), but stops |depth| levels below |index|. Nodes at that depth need to be finalized already.
+  void finalize_top(octree_node_index index, std::size_t depth);
+  void update_moments(octree_node_index index);
+  void collect_nodes_at_depth(octree_node_index index, std::size_t depth, std::vector<octree_node_index>& nodes) const;
+
+  // nodes_[0] is the root (if any)
+  std::vector<barnes_hut_octree_node> nodes_;
+
+  // Our own copy of all bodies. Leaves refer to contiguous ranges in here.
+  std::vector<triple> body_positions_;
+  std::vector<real> body_masses_;
+  // Where the bodies came from, i.e. their index in the caller's body arrays
+  std::vector<std::uint32_t> body_ids_;
+  // Next body in the same leaf
+  std::vector<std::uint32_t> next_body_;
+
+  octree_leaf_options leaf_options_;
+  // Side length of nodes at |leaf_options_.max_depth|
+  real min_leaf_length_ = 0.0;
 };
 
 class barnes_hut_octree : public partial_barnes_hut_octree
@@ -101,7 +416,217 @@ public:
   // simple interface for single-threaded usage
   barnes_hut_octree(std::span<const triple> body_positions, std::span<const real> body_masses);
 
+  void rebuild(const axis_aligned_bounding_box& bounds, std::span<const triple> body_positions,
+               std::span<const real> body_masses);
+  void rebuild(std::span<const triple> body_positions, std::span<const real> body_masses);
+
+  /**
+   * Update the tree for the new body positions / masses while keeping its topology.
+   * Only bodies that left their leaf are re-inserted, then the moments are recomputed bottom-up.
+   * Falls back to a full rebuild on the first call, when the number of bodies changed or
+   * when |options| deem the tree too degraded.
+   * @param body_positions Positions of all bodies, in the same order as on the previous call.
+   * @param body_masses Masses of all bodies.
+   * @param options Thresholds for the full rebuild.
+   * @return Whether the tree was rebuilt from scratch.
+   */
+  bool refit(std::span<const triple> body_positions, std::span<const real> body_masses,
+             const octree_refit_options& options = {});
+
+  // Takes effect immediately, no rebuild necessary.
+  void set_opening_criterion(const opening_criterion& criterion);
+  [[nodiscard]] const opening_criterion& get_opening_criterion() const noexcept { return criterion_; }
+
+  // Takes effect immediately, no rebuild necessary. Trees deeper than |max_compact_depth| stay linear,
+  // whatever the format.
+  void set_node_format(octree_node_format format);
+  [[nodiscard]] octree_node_format get_node_format() const noexcept { return node_format_; }
+
+  static constexpr std::uint32_t max_compact_depth = 64;
+
+  // Takes effect immediately, for every walk below. Defaults to calculate_acceleration()'s linear softening.
+  void set_softening_kind(softening_kind kind) noexcept { softening_kind_ = kind; }
+  [[nodiscard]] softening_kind get_softening_kind() const noexcept { return softening_kind_; }
+
+  // Add the acceleration caused by all bodies of the tree to |acceleration|.
   void apply_forces_to(const triple& body_position, real softening, triple& acceleration) const;
+
+  // Replace |acceleration| (the body's acceleration of the previous tick, needed for relative criteria)
+  // with the one caused by all bodies of the tree.
+  void recompute_acceleration(const triple& body_position, real softening, triple& acceleration) const;
+
+  /**
+   * Add the short-range part of the acceleration caused by all bodies of the tree (see
+   * calculate_scaled_short_range_acceleration()). Bodies and accepted nodes beyond |cutoff| are skipped, so the walk
+   * never gets far from the body. Always walks the linear nodes, with monopoles only.
+   * @param body_position Position of the body.
+   * @param softening Softening factor.
+   * @param split_radius Scale r_s of the force split.
+   * @param cutoff Distance beyond which the short-range force is neglected, usually a few r_s.
+   * @param acceleration Acceleration to add to.
+   */
+  void apply_short_range_forces_to(const triple& body_position, real softening, real split_radius, real cutoff,
+                                   triple& acceleration) const;
+
+  // Indices of all bodies in depth-first order. Walks of consecutive bodies in this order touch the same nodes.
+  [[nodiscard]] std::span<const std::uint32_t> body_order() const noexcept { return linear_body_ids_; }
+
+  // Spatial queries. They only read the tree, so any number of threads can run them at once, e.g. from the workers
+  // of a bulk over all bodies. Massless bodies are found like any other.
+
+  /**
+   * Find all bodies within |radius| of |center|.
+   * @param center Center of the query sphere.
+   * @param radius Radius of the query sphere. Bodies exactly on its surface are found as well.
+   * @param bodies Indices of the bodies found (see octree_neighbor::body) are appended here, in no particular order.
+   */
+  void find_bodies_in_radius(const triple& center, real radius, std::vector<std::uint32_t>& bodies) const;
+
+  /**
+   * Find the |k| bodies closest to |point|. A body at |point| itself is found as well, ask for k + 1 to skip it.
+   * @param point Position to search around.
+   * @param k Number of bodies to find.
+   * @param neighbors Replaced with the bodies found, closest first. Fewer than |k| if the tree doesn't have as many.
+   */
+  void find_nearest_bodies(const triple& point, std::size_t k, std::vector<octree_neighbor>& neighbors) const;
+
+  // Number of nodes and bodies apply_forces_to() would interact with
+  [[nodiscard]] std::size_t count_interactions(const triple& body_position) const;
+
+  // Grouped mode: bodies close to each other walk the tree once, with the opening test against their bounding
+  // sphere. The resulting interaction list is then evaluated for each of them with a vectorized kernel.
+  // Cheaper than a walk per body, and slightly more accurate since the test is more conservative.
+  static constexpr std::uint32_t max_group_size = 32;
+
+  [[nodiscard]] std::size_t group_count() const noexcept { return groups_.size(); }
+  // Their bodies are body_order()[first_body, first_body + body_count)
+  [[nodiscard]] std::span<const octree_body_group> groups() const noexcept { return groups_; }
+
+  /**
+   * Like recompute_acceleration(), but for all bodies of one group.
+   * Groups are disjoint, so they can be processed concurrently with separate |list|s.
+   * @param group Index of the group (< group_count()).
+   * @param softening Softening factor.
+   * @param acceleration Acceleration of all bodies, indexed like the body arrays the tree was built from.
+   *                     The group's bodies get their values replaced.
+   * @param list Scratch space.
+   */
+  void recompute_group_acceleration(std::size_t group, real softening, std::span<triple> acceleration,
+                                    octree_interaction_list& list) const;
+
+  // Single-threaded convenience version for all groups. They cover every body, massless ones included.
+  void recompute_group_accelerations(real softening, std::span<triple> acceleration) const;
+
+  // Packet mode: |packet_size| bodies walk the tree together, one per SIMD lane. A node is opened if any of them
+  // needs it, the others take its monopole and sit out its subtree. Pays off for bodies close to each other.
+  static constexpr std::size_t packet_size = soa_lane_count;
+  // Bodies per chunk, see recompute_chunk_accelerations()
+  static constexpr std::size_t packet_chunk_size = 256;
+
+  /**
+   * Batched apply_forces_to(), walking the tree once per packet of |packet_size| consecutive bodies.
+   * Always walks the linear nodes, with the same opening test as apply_forces_to().
+   * @param body_positions Positions of the bodies, ideally sorted spatially (e.g. in tree order).
+   * @param softening Softening factor.
+   * @param acceleration Acceleration of each body, the tree's is added to it.
+   */
+  void apply_forces_to(std::span<const triple> body_positions, real softening, std::span<triple> acceleration) const;
+
+  [[nodiscard]] std::size_t chunk_count() const noexcept
+  {
+    return (linear_bodies_.size() + packet_chunk_size - 1) / packet_chunk_size;
+  }
+
+  /**
+   * Packet walks for one chunk of our bodies in tree order, so the packets are spatially coherent.
+   * Same opening tests as recompute_acceleration(), relative criteria included. Chunks cover every body, massless
+   * ones included, and are disjoint, so they can be processed concurrently.
+   * @param chunk Index of the chunk (< chunk_count()).
+   * @param softening Softening factor.
+   * @param acceleration Acceleration of all bodies, indexed like the body arrays the tree was built from.
+   *                     The chunk's bodies get their values replaced.
+   */
+  void recompute_chunk_accelerations(std::size_t chunk, real softening, std::span<triple> acceleration) const;
+
+  [[nodiscard]] std::size_t allocated_bytes() const noexcept
+  {
+    return partial_barnes_hut_octree::allocated_bytes() + linear_nodes_.capacity() * sizeof(linear_octree_node) +
+           linear_bodies_.capacity() * sizeof(quad) + linear_body_ids_.capacity() * sizeof(std::uint32_t) +
+           groups_.capacity() * sizeof(octree_body_group) +
+           linear_quadrupoles_.capacity() * sizeof(quadrupole_moment) +
+           linear_body_bounds_.capacity() * sizeof(axis_aligned_bounding_box) +
+           compact_nodes_.capacity() * sizeof(compact_octree_node) +
+           wide_nodes_.capacity() * sizeof(wide_octree_node);
+  }
+
+private:
+  friend class morton_octree_builder;
+  friend class merged_octree_builder;
+
+  // Flatten the finished tree into |linear_nodes_|. Needs to run after every (re)build.
+  void linearize();
+  void linearize_node(octree_node_index index);
+  // Encode |linear_nodes_| as |compact_nodes_|
+  void compact();
+  bool compact_node(std::uint32_t index, std::uint32_t depth, const triple& parent_center);
+  // Encode |linear_nodes_| as |wide_nodes_|
+  void widen();
+  bool widen_child(std::uint32_t parent, std::uint32_t slot, std::uint32_t index, std::uint32_t depth);
+
+  // Walk for everything within |radius| of |center| (radius 0 for a single body).
+  // |previous_acceleration| is only used by opening_criterion::kind::relative_acceleration
+  // |apply_multipoles| is called with the linear index and center of mass of every accepted node
+  // if we have more than monopoles.
+  template <typename F, typename M>
+  void apply_node_gravity(const triple& center, real radius, real previous_acceleration, F&& apply_gravity,
+                          M&& apply_multipoles) const;
+
+  // One packet of apply_forces_to(), up to |packet_size| bodies. |previous_accelerations| (|a| of each body, or
+  // empty) is only used by opening_criterion::kind::relative_acceleration.
+  void apply_packet_forces(std::span<const triple> body_positions, std::span<const real> previous_accelerations,
+                           real softening, softening_kind kind, std::span<triple> acceleration) const;
+
+  void compute_groups();
+  void compute_body_bounds();
+
+  // Descend into |index| (and its children closest first) if it may contain bodies closer than |neighbors|' farthest
+  void find_nearest_bodies(std::uint32_t index, const triple& point, std::size_t k,
+                           std::vector<octree_neighbor>& neighbors) const;
+
+  void rebuild_for_refit(std::span<const triple> body_positions, std::span<const real> body_masses,
+                         const octree_refit_options& options);
+  void refit_node(octree_node_index index);
+
+  opening_criterion criterion_;
+  softening_kind softening_kind_ = softening_kind::linear;
+
+  // Depth-first copy of the tree, bodies included. Empty nodes are left out.
+  std::vector<linear_octree_node> linear_nodes_;
+  // Position (xyz) and mass times G (w) of every body
+  std::vector<quad> linear_bodies_;
+  std::vector<std::uint32_t> linear_body_ids_;
+  // Indexed like |linear_nodes_|, only used with octree_multipole_order >= 2. Summed up from G * m like the rest.
+  std::vector<quadrupole_moment> linear_quadrupoles_;
+  // Indexed like |linear_nodes_|: bounding boxes of each subtree's bodies, for the spatial queries.
+  // Usually a lot tighter than the nodes themselves.
+  std::vector<axis_aligned_bounding_box> linear_body_bounds_;
+
+  // Walked instead of |linear_nodes_| if |node_format_| is compact. The root's center is kept in double,
+  // along with the squared side length of each depth.
+  octree_node_format node_format_ = octree_node_format::linear;
+  std::vector<compact_octree_node> compact_nodes_;
+  triple compact_root_center_ = {};
+  std::vector<real> compact_lengths_squared_;
+
+  // Walked instead of |linear_nodes_| if |node_format_| is wide. The first one only holds the root.
+  std::vector<wide_octree_node> wide_nodes_;
+
+  // Maximal subtrees with at most |max_group_size| bodies
+  std::vector<octree_body_group> groups_;
+
+  // Leaf of every body, only valid for trees built by refit()
+  std::vector<octree_node_index> body_leaves_;
+  std::size_t moved_since_rebuild_ = 0;
 };
 
 SOLARSIM_NS_END
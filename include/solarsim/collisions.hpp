@@ -0,0 +1,167 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef SOLARSIM_COLLISIONS_HPP
+#define SOLARSIM_COLLISIONS_HPP
+
+#include "solarsim/detail/config.hpp"
+
+#if SOLARSIM_HAS_PRAGMA_ONCE
+#  pragma once
+#endif
+
+#include "solarsim/barnes_hut_octree.hpp"
+#include "solarsim/simulation_state.hpp"
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+SOLARSIM_NS_BEGIN
+
+// Two bodies touching each other, first < second
+struct body_collision
+{
+  std::uint32_t first  = 0;
+  std::uint32_t second = 0;
+};
+
+/**
+ * Whether two spheres touch at any time t in [-sweep_time, sweep_time], assuming both move in straight lines.
+ * @param relative_position Position of the second sphere relative to the first one, at t = 0.
+ * @param relative_velocity Velocity of the second sphere relative to the first one.
+ * @param radius_sum Sum of both radii.
+ * @param sweep_time Half the time span to check. 0 only checks whether they overlap right now.
+ */
+bool spheres_touch(const triple& relative_position, const triple& relative_velocity, real radius_sum,
+                   real sweep_time) noexcept;
+
+/// Merges colliding bodies of a simulation_state, using the octree built from its positions.
+///
+/// Every body group of the tree (see barnes_hut_octree::groups()) asks the tree for all bodies its members could
+/// touch: those within the group's bounding sphere plus the largest radii, widened by how far bodies may move within
+/// the sweep time. Candidate pairs are then checked exactly with spheres_touch().
+///
+/// Bodies connected by collisions are merged into the one with the lowest index: masses and momenta add up, position
+/// and acceleration become the mass weighted means and the volumes add up. The surviving bodies are then compacted
+/// in parallel, keeping their order, so the state shrinks without having to be reloaded.
+///
+/// The leapfrog integrator builds its tree at the half-step positions, so a sweep time of dT / 2 covers the
+/// whole step. Subtrees without mass aren't part of the walked tree (see barnes_hut_octree), their bodies never
+/// collide.
+///
+/// The phases have to be run in order, with all tasks of a phase finished before the next one starts:
+///
+///   prepare(state, num_tasks)                                [serial]
+///   detect(task, octree, sweep_time)  for task < num_tasks() [parallel]
+///   resolve()                                                [serial]
+///   compact(task)                     for task < num_tasks() [parallel]
+///   finish(state)                                            [serial]
+///
+/// The state may be moved between phases, its arrays must not be touched though.
+class collision_merger
+{
+public:
+  // Chunking of the parallel phases. Each task gets at least |min_bodies_per_task| bodies.
+  static constexpr std::size_t default_num_tasks   = 32;
+  static constexpr std::size_t min_bodies_per_task = 1024;
+
+  collision_merger() = default;
+
+  /**
+   * Set up a new pass over |state|. It needs to have radii for all bodies.
+   * @param state Bodies to merge. The tree passed to detect() has to be built from its positions and masses.
+   * @param num_tasks Number of chunks the bodies are split into for the parallel phases.
+   */
+  void prepare(simulation_state& state, std::size_t num_tasks);
+
+  [[nodiscard]] std::size_t num_tasks() const noexcept { return num_tasks_; }
+
+  /**
+   * Find the collisions of one chunk of bodies.
+   * @param task Chunk to process.
+   * @param octree Tree built from the state's positions and masses.
+   * @param sweep_time Bodies are checked for contact within [-sweep_time, sweep_time], see spheres_touch().
+   */
+  void detect(std::size_t task, const barnes_hut_octree& octree, real sweep_time);
+
+  // Merge the groups of colliding bodies and plan the compaction
+  void resolve();
+
+  void compact(std::size_t task);
+
+  // Move the surviving bodies into |state|, the one passed to prepare() (or where it was moved to)
+  void finish(simulation_state& state);
+
+  /**
+   * Run all phases with the given parallel loop.
+   * @param for_each Callable as for_each(count, f), invoking f(i) for all i < count and returning when done.
+   */
+  template <typename ForEach>
+  void merge(simulation_state& state, const barnes_hut_octree& octree, real sweep_time, std::size_t num_tasks,
+             ForEach&& for_each)
+  {
+    prepare(state, num_tasks);
+    for_each(num_tasks_, [this, &octree, sweep_time](std::size_t task) { detect(task, octree, sweep_time); });
+    resolve();
+    for_each(num_tasks_, [this](std::size_t task) { compact(task); });
+    finish(state);
+  }
+
+  // Single-threaded convenience version
+  void merge(simulation_state& state, const barnes_hut_octree& octree, real sweep_time);
+
+  // All collisions found by the last pass, valid after resolve()
+  [[nodiscard]] std::span<const body_collision> collisions() const noexcept { return collisions_; }
+  // Number of bodies the last pass merged into others
+  [[nodiscard]] std::size_t removed_count() const noexcept { return removed_count_; }
+
+private:
+  [[nodiscard]] std::size_t task_begin(std::size_t task) const noexcept;
+  [[nodiscard]] std::uint32_t find_root(std::uint32_t body) noexcept;
+
+  std::span<triple> positions_;
+  std::span<triple> velocities_;
+  std::span<real> masses_;
+  std::span<real> radii_;
+  std::span<triple> acceleration_;
+  std::size_t num_tasks_ = 1;
+
+  // Largest radius and speed of all bodies, to size the tree queries
+  real max_radius_ = 0.0;
+  real max_speed_  = 0.0;
+
+  // Collisions found by each task, then all of them
+  std::vector<std::vector<body_collision>> task_collisions_;
+  std::vector<body_collision> collisions_;
+
+  // Union-find forest over all bodies, roots are the lowest index of their group
+  std::vector<std::uint32_t> parents_;
+  // Non-zero for bodies merged into others
+  std::vector<std::uint8_t> removed_;
+  std::size_t removed_count_ = 0;
+  // Where each task's survivors go (num_tasks + 1 entries)
+  std::vector<std::size_t> task_offsets_;
+
+  // The compacted bodies, swapped into the state by finish()
+  std::vector<triple> compact_positions_;
+  std::vector<triple> compact_velocities_;
+  std::vector<real> compact_masses_;
+  std::vector<real> compact_radii_;
+  std::vector<triple> compact_acceleration_;
+};
+
+SOLARSIM_NS_END
+
+#endif
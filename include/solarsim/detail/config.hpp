@@ -35,6 +35,25 @@
 #  define SOLARSIM_DECL
 #endif
 
+// Cache hint for data we're about to read. Purely an optimization, so a no-op is fine.
+#if defined(__GNUC__) || defined(__clang__)
+#  define SOLARSIM_PREFETCH(addr) __builtin_prefetch(addr)
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#  include <xmmintrin.h>
+#  define SOLARSIM_PREFETCH(addr) _mm_prefetch(reinterpret_cast<const char*>(addr), _MM_HINT_T0)
+#else
+#  define SOLARSIM_PREFETCH(addr) ((void)(addr))
+#endif
+
+// Highest multipole moment of our octree nodes: 0 (monopole only) or 2 (quadrupole).
+// Set through the SolarSim_MULTIPOLE_ORDER CMake option, since it changes what the library computes.
+#if !defined(SOLARSIM_MULTIPOLE_ORDER)
+#  define SOLARSIM_MULTIPOLE_ORDER 0
+#endif
+#if SOLARSIM_MULTIPOLE_ORDER != 0 && SOLARSIM_MULTIPOLE_ORDER != 2
+#  error SOLARSIM_MULTIPOLE_ORDER needs to be 0 or 2
+#endif
+
 // Every supported compiler has that?
 #define SOLARSIM_HAS_PRAGMA_ONCE 1
 
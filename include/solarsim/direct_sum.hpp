@@ -0,0 +1,198 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef SOLARSIM_DIRECTSUM_HPP
+#define SOLARSIM_DIRECTSUM_HPP
+
+#include "solarsim/detail/config.hpp"
+
+#if SOLARSIM_HAS_PRAGMA_ONCE
+#  pragma once
+#endif
+
+#include "solarsim/math.hpp"
+#include "solarsim/simd.hpp"
+#include "solarsim/types.hpp"
+
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+SOLARSIM_NS_BEGIN
+
+// What direct_sum_kernel computes the pairwise forces in
+enum class force_precision : std::uint8_t
+{
+  // doubles throughout
+  full,
+  // float32 relative to the center of the i tile, twice the lanes per vector. Each tile pair's sums are added up
+  // in double, as is everything outside the kernel (e.g. integration).
+  mixed
+};
+
+std::string_view to_string(force_precision precision) noexcept;
+
+/// All-pairs gravity with vectorized kernels.
+///
+/// The bodies are copied into one array per coordinate (SoA) along with their G * m, padded with massless bodies
+/// to a multiple of |lane_count|. The interaction matrix is then walked tile by tile, so the bodies of the tile
+/// being streamed stay in L1. The result matches calculate_acceleration() up to rounding, except that bodies at
+/// exactly the same position don't interact (calculate_acceleration() divides by zero there without softening).
+///
+/// Like naive_sync_simulator_impl, there are two variants:
+///  * per body: every body sums up all others. Twice the pairs, but bodies are independent.
+///  * fused: every pair is computed once and applied to both bodies (Newton's third law).
+///
+/// For parallel use, the phases have to be run in order:
+///
+///   load(...)                                        [serial]
+///   prepare(...)                                     [serial]
+///   accumulate(task)          for task < num_tasks()  [parallel]
+///   reduce(chunk, ...)        for chunk < num_chunks() [parallel]
+///
+/// Per body, every task owns a range of i tiles and writes their sums directly. Fused, the tile pairs (i <= j)
+/// are split evenly among the tasks, and since any of them can touch any body, every task sums up into a buffer of
+/// its own. reduce() then adds the buffers up. All buffers start at 64 byte boundaries and tiles span whole cache
+/// lines, so tasks never write to the same line. The buffers cost 24 bytes per body and task,
+/// so |num_tasks| should be about the number of threads and not much more.
+class direct_sum_kernel
+{
+public:
+  // Widest vector we have kernels for (8 doubles / 16 floats in an AVX-512 register)
+  static constexpr std::size_t lane_count       = 8;
+  static constexpr std::size_t float_lane_count = 16;
+  // Bodies per tile. A tile's positions, masses and accelerations take 28 KiB.
+  static constexpr std::size_t tile_size = 512;
+
+  direct_sum_kernel()
+    : direct_sum_kernel(active_simd_instruction_set())
+  {
+  }
+  explicit direct_sum_kernel(simd_instruction_set instruction_set) noexcept;
+
+  [[nodiscard]] simd_instruction_set instruction_set() const noexcept { return instruction_set_; }
+
+  // Takes effect on the next prepare(). The float32 rounding error grows with the size of a tile relative to the
+  // distances within it, so bodies in some spatial order (e.g. an octree's) fare better than random ones.
+  void set_precision(force_precision precision) noexcept { precision_ = precision; }
+  [[nodiscard]] force_precision get_precision() const noexcept { return precision_; }
+
+  // Takes effect on the next prepare(). The default matches calculate_acceleration(), Plummer softening saves the
+  // sqrt (and the division, where the CPU has a reciprocal square root estimate).
+  void set_softening_kind(softening_kind kind) noexcept { softening_kind_ = kind; }
+  [[nodiscard]] softening_kind get_softening_kind() const noexcept { return softening_kind_; }
+
+  /**
+   * Copy the bodies into our SoA arrays. Their capacity is kept, so loading every tick doesn't hit the allocator.
+   * @param body_positions Positions of all bodies.
+   * @param body_masses Masses of all bodies.
+   */
+  void load(std::span<const triple> body_positions, std::span<const real> body_masses);
+
+  [[nodiscard]] std::size_t body_count() const noexcept { return body_count_; }
+
+  /**
+   * Set up a parallel computation of the loaded bodies' accelerations.
+   * @param softening Softening factor, like calculate_acceleration().
+   * @param fused Whether to compute each pair only once, see above.
+   * @param num_tasks Number of tasks the interaction matrix is split into. Clamped to the available work.
+   */
+  void prepare(real softening, bool fused, std::size_t num_tasks);
+
+  [[nodiscard]] std::size_t num_tasks() const noexcept { return num_tasks_; }
+  // Chunks of |tile_size| bodies
+  [[nodiscard]] std::size_t num_chunks() const noexcept { return (body_count_ + tile_size - 1) / tile_size; }
+
+  void accumulate(std::size_t task);
+
+  /**
+   * Sum up the accelerations of one chunk of bodies.
+   * @param chunk Index of the chunk (< num_chunks()).
+   * @param acceleration Receives the acceleration of all bodies.
+   */
+  void reduce(std::size_t chunk, std::span<triple> acceleration) const;
+
+  /**
+   * Run all phases after load() with the given parallel loop.
+   * @param for_each Callable as for_each(count, f), invoking f(i) for all i < count and returning when done.
+   */
+  template <typename ForEach>
+  void compute_accelerations(real softening, bool fused, std::span<triple> acceleration, std::size_t num_tasks,
+                             ForEach&& for_each)
+  {
+    prepare(softening, fused, num_tasks);
+    for_each(num_tasks_, [this](std::size_t task) { accumulate(task); });
+    for_each(num_chunks(), [this, acceleration](std::size_t chunk) { reduce(chunk, acceleration); });
+  }
+
+  /**
+   * Compute the accelerations of all loaded bodies, single-threaded.
+   * @param softening Softening factor, like calculate_acceleration().
+   * @param fused Whether to compute each pair only once, see above.
+   * @param acceleration Receives the acceleration of all bodies.
+   */
+  void compute_accelerations(real softening, bool fused, std::span<triple> acceleration);
+
+  [[nodiscard]] std::size_t allocated_bytes() const noexcept
+  {
+    return storage_.capacity() * sizeof(real) + mixed_storage_.capacity() * sizeof(float) +
+           tile_pairs_.capacity() * sizeof(tile_pairs_[0]);
+  }
+
+private:
+  // Positions and G * m, followed by three arrays (x, y, z) per acceleration buffer. All of them have
+  // |padded_count_| elements and |storage_| starts them at its first 64 byte boundary.
+  static constexpr std::size_t body_array_count = 4;
+
+  [[nodiscard]] real* array(std::size_t index) noexcept;
+  [[nodiscard]] const real* array(std::size_t index) const noexcept;
+  [[nodiscard]] std::size_t tile_count() const noexcept { return num_chunks(); }
+
+  // First tile / tile pair (fused) of |task|, see prepare()
+  [[nodiscard]] std::size_t task_begin(std::size_t task) const noexcept;
+
+  // accumulate() for force_precision::mixed
+  void accumulate_mixed(std::size_t task);
+
+  // Every task converts the two tiles it's working on to floats: |mixed_array_count| arrays (positions, G * m,
+  // accelerations) of 2 * |tile_size| each, starting at the first 64 byte boundary of |mixed_storage_|
+  static constexpr std::size_t mixed_array_count = 7;
+
+  [[nodiscard]] float* mixed_array(std::size_t task, std::size_t index) noexcept;
+
+  simd_instruction_set instruction_set_;
+  force_precision precision_     = force_precision::full;
+  softening_kind softening_kind_ = softening_kind::linear;
+  std::size_t body_count_        = 0;
+  std::size_t padded_count_      = 0;
+  std::vector<real> storage_;
+
+  real softening_        = 0;
+  bool fused_            = false;
+  bool mixed_            = false;
+  bool plummer_          = false;
+  std::size_t num_tasks_ = 1;
+  // Tile pairs (i <= j) in row order, only set up if fused
+  std::vector<std::pair<std::uint32_t, std::uint32_t>> tile_pairs_;
+  std::vector<float> mixed_storage_;
+  // Positions and G * m are multiplied by these before they're converted to floats
+  real length_scale_ = 1;
+  real mass_scale_   = 1;
+};
+
+SOLARSIM_NS_END
+
+#endif
@@ -0,0 +1,223 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef SOLARSIM_FMMOCTREE_HPP
+#define SOLARSIM_FMMOCTREE_HPP
+
+#include "solarsim/detail/config.hpp"
+
+#if SOLARSIM_HAS_PRAGMA_ONCE
+#  pragma once
+#endif
+
+#include "solarsim/barnes_hut_octree.hpp"
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+SOLARSIM_NS_BEGIN
+
+struct fmm_options
+{
+  // Highest order of the Taylor expansions. The error drops roughly like theta^(order + 1).
+  std::uint32_t order = 4;
+
+  // Cells A and B interact through their expansions if (r_A + r_B) < theta * |z_A - z_B|,
+  // with r being the radius of a cell's bodies around its expansion center z.
+  real theta = 0.7;
+
+  // Higher orders make M2L a lot more expensive than direct sums, so we want larger leaves than Barnes-Hut.
+  octree_leaf_options leaf_options = {32};
+};
+
+// What the last fmm_octree::interact() did
+struct fmm_statistics
+{
+  // Mutual cell-cell interactions (M2L)
+  std::size_t cell_interactions = 0;
+  // Mutual body-body interactions (P2P)
+  std::size_t body_interactions = 0;
+};
+
+/// Fast multipole method with Cartesian Taylor expansions (Dehnen 2002).
+///
+/// Every cell gets a multipole expansion around its center of mass. A dual tree walk then lets pairs of cells
+/// interact: well-separated pairs through their expansions (M2L), close leaves directly (P2P). Both are evaluated
+/// once per pair and applied to both sides, so every interaction is only computed once. The local expansions are
+/// then pushed down the tree (L2L) and evaluated for every body (L2P). That makes for O(n) work instead of
+/// Barnes-Hut's O(n log n).
+///
+/// The phases have to be run in order:
+///
+///   rebuild(...)                                  [serial]
+///   interact(softening)                           [serial]
+///   evaluate(body, acceleration)  for body < n   [parallel]
+class fmm_octree : public partial_barnes_hut_octree
+{
+public:
+  // Bounds the size of our stack buffers. (max_order + 1)(max_order + 2)(max_order + 3) / 6 terms.
+  static constexpr std::uint32_t max_order = 10;
+  static constexpr std::size_t max_terms   = (max_order + 1) * (max_order + 2) * (max_order + 3) / 6;
+
+  fmm_octree()
+    : fmm_octree(fmm_options())
+  {
+  }
+  explicit fmm_octree(const fmm_options& options);
+
+  // Takes effect on the next rebuild(). Overrides set_leaf_options().
+  void set_options(const fmm_options& options);
+  [[nodiscard]] const fmm_options& get_options() const noexcept { return options_; }
+
+  // Takes effect on the next interact(), for the body-body interactions
+  void set_softening_kind(softening_kind kind) noexcept { softening_kind_ = kind; }
+  [[nodiscard]] softening_kind get_softening_kind() const noexcept { return softening_kind_; }
+
+  /**
+   * Build the tree and compute the multipole expansions of all cells (P2M, M2M).
+   * The node pool and expansions keep their capacity, so rebuilding every tick doesn't hit the allocator.
+   * @param body_positions Positions of the bodies to insert.
+   * @param body_masses Masses of the bodies to insert.
+   */
+  void rebuild(std::span<const triple> body_positions, std::span<const real> body_masses);
+
+  /**
+   * Dual tree walk (M2L, P2P), followed by the downward pass (L2L).
+   * @param softening Softening factor for body-body interactions. The far field isn't softened.
+   */
+  void interact(real softening);
+
+  [[nodiscard]] std::size_t body_count() const noexcept { return cell_body_positions_.size(); }
+
+  /**
+   * Evaluate the local expansion for one body (L2P) and store its final acceleration.
+   * Bodies are independent, so this can be done in parallel.
+   * @param body Index of the body in tree order (< body_count()).
+   * @param acceleration Acceleration of all bodies, indexed like the body arrays passed to rebuild().
+   */
+  void evaluate(std::size_t body, std::span<triple> acceleration) const;
+
+  // Single-threaded convenience version of all phases
+  void compute_accelerations(std::span<const triple> body_positions, std::span<const real> body_masses,
+                             real softening, std::span<triple> acceleration);
+
+  [[nodiscard]] std::size_t cell_count() const noexcept { return cells_.size(); }
+  [[nodiscard]] const fmm_statistics& statistics() const noexcept { return statistics_; }
+
+  [[nodiscard]] std::size_t allocated_bytes() const noexcept
+  {
+    return partial_barnes_hut_octree::allocated_bytes() + cells_.capacity() * sizeof(cell) +
+           (multipoles_.capacity() + locals_.capacity()) * sizeof(real) +
+           (cell_body_positions_.capacity() + near_field_.capacity()) * sizeof(triple) +
+           cell_body_masses_.capacity() * sizeof(real) +
+           (cell_body_ids_.capacity() + body_cells_.capacity()) * sizeof(std::uint32_t);
+  }
+
+private:
+  // Nodes in depth-first order, like linear_octree_node
+  struct cell
+  {
+    // Expansion center, i.e. the center of mass
+    triple center = {};
+    // Distance of the farthest body from |center|
+    real radius = 0.0;
+
+    std::uint32_t parent = 0;
+    std::uint32_t next   = 0;
+
+    // Bodies of the whole subtree, see |cell_body_positions_|
+    std::uint32_t first_body = 0;
+    std::uint32_t body_count = 0;
+
+    [[nodiscard]] bool is_leaf(std::uint32_t index) const noexcept { return next == index + 1; }
+  };
+
+  // A multi-index n = (n_x, n_y, n_z) of our expansions. Terms are sorted by degree n_x + n_y + n_z.
+  struct term
+  {
+    std::array<std::uint32_t, 3> n = {};
+    std::uint32_t degree           = 0;
+
+    // Some term with one index less, and the axis it differs in. Used to compute monomials recursively.
+    std::uint32_t lower      = 0;
+    std::uint32_t lower_axis = 0;
+
+    // Index of n + e_i, if it's part of our expansions
+    std::array<std::uint32_t, 3> plus_one = {};
+
+    // Recursion for D_n from D_{n-e_i} and D_{n-2e_i}, see compute_derivatives().
+    // Missing terms have index 0 and weight 0, so the recursion doesn't need any branches.
+    std::array<std::uint32_t, 3> minus_one = {};
+    std::array<std::uint32_t, 3> minus_two = {};
+    std::array<real, 3> minus_one_weight   = {};
+    std::array<real, 3> minus_two_weight   = {};
+  };
+
+  // (a, b, a + b) for all pairs of terms with a combined degree <= order
+  struct term_pair
+  {
+    std::uint32_t a   = 0;
+    std::uint32_t b   = 0;
+    std::uint32_t sum = 0;
+  };
+
+  void compute_tables();
+  [[nodiscard]] std::uint32_t term_index(std::uint32_t x, std::uint32_t y, std::uint32_t z) const noexcept;
+
+  void linearize_node(octree_node_index index, std::uint32_t parent);
+  void compute_multipoles();
+  void compute_locals();
+
+  // y^n / n! for all terms n
+  void compute_monomials(const triple& y, real* monomials) const noexcept;
+  // D_n 1/|r| for all terms n
+  void compute_derivatives(const triple& r, real* derivatives) const noexcept;
+
+  void interact_self(std::uint32_t a, real softening);
+  void interact_cells(std::uint32_t a, std::uint32_t b, real softening);
+  void interact_multipoles(std::uint32_t a, std::uint32_t b);
+  void interact_bodies(std::uint32_t a, std::uint32_t b, real softening);
+
+  fmm_options options_;
+  fmm_statistics statistics_;
+  softening_kind softening_kind_ = softening_kind::linear;
+
+  // Expansion tables for |options_.order|
+  std::vector<term> terms_;
+  std::vector<term_pair> term_pairs_;
+  // Start of each term's pairs with it as |b| (terms + 1 entries)
+  std::vector<std::uint32_t> term_pair_offsets_;
+  // Offsets of each degree's terms (order + 2 entries)
+  std::vector<std::uint32_t> degree_offsets_;
+
+  std::vector<cell> cells_;
+  // Expansion coefficients of the masses times G, terms_.size() per cell. The local expansions lack the factor -1.
+  std::vector<real> multipoles_;
+  std::vector<real> locals_;
+
+  // Our bodies in cell order, masses times G
+  std::vector<triple> cell_body_positions_;
+  std::vector<real> cell_body_masses_;
+  std::vector<std::uint32_t> cell_body_ids_;
+  // Leaf of every body
+  std::vector<std::uint32_t> body_cells_;
+  // Acceleration from all P2P interactions
+  std::vector<triple> near_field_;
+};
+
+SOLARSIM_NS_END
+
+#endif
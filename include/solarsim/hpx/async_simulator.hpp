@@ -24,6 +24,8 @@
 #include "solarsim/hpx/namespaces.hpp"
 #include "solarsim/simulation_state.hpp"
 #include "solarsim/barnes_hut_octree.hpp"
+#include "solarsim/merged_octree_builder.hpp"
+#include "solarsim/morton_octree_builder.hpp"
 
 #include <hpx/execution/traits/is_execution_policy.hpp>
 #include <hpx/parallel/algorithms/for_loop.hpp>
@@ -41,21 +43,66 @@ auto tick_simulation_phase1(ExPolicy&& policy, any_simulation_state auto&& state
 {
   return hpx::experimental::for_loop_n(
       std::forward<ExPolicy>(policy), std::size_t(), get_dataset_size(state), [=](std::size_t i) {
-        integrate_leapfrog_phase1(state.body_positions[i], state.body_velocities[i], time_step);
+        leapfrog_integrator::phase1(state.body_positions[i], state.body_velocities[i], state.acceleration[i],
+                                    time_step);
       });
 }
 
 template <execution_policy ExPolicy>
-auto tick_barnes_hut(ExPolicy&& policy, any_simulation_state auto&& state)
+auto tick_barnes_hut(ExPolicy&& policy, any_simulation_state auto&& state, const opening_criterion& criterion = {})
 {
-  std::fill(state.acceleration.begin(), state.acceleration.end(), triple{});
-
   // Ugh, our function needs to be copyable. Just make it a shared ptr then!
   // Compared to the work we're performing, the cost is negligible.
-  auto shared_octree = std::make_shared<barnes_hut_octree>(state.body_positions, state.body_masses);
+  auto shared_octree = std::make_shared<barnes_hut_octree>();
+  shared_octree->set_opening_criterion(criterion);
+  shared_octree->rebuild(state.body_positions, state.body_masses);
+  return hpx::experimental::for_loop_n(
+      std::forward<ExPolicy>(policy), std::size_t(), get_dataset_size(state), [=](std::size_t i) {
+        shared_octree->recompute_acceleration(state.body_positions[i], state.softening_factor, state.acceleration[i]);
+      });
+}
+
+template <execution_policy ExPolicy>
+auto tick_barnes_hut_morton(ExPolicy&& policy, any_simulation_state auto&& state,
+                            const opening_criterion& criterion = {})
+{
+  // The tree build is a sequence of parallel loops, each of which has to be done before the next one starts.
+  auto for_each = [&policy](std::size_t count, auto&& f) {
+    if constexpr (hpx::is_async_execution_policy_v<std::decay_t<ExPolicy>>)
+      hpx::experimental::for_loop_n(policy, std::size_t(), count, f).get();
+    else
+      hpx::experimental::for_loop_n(policy, std::size_t(), count, f);
+  };
+
+  morton_octree_builder builder;
+  builder.set_opening_criterion(criterion);
+  auto shared_octree = std::make_shared<barnes_hut_octree>(
+      builder.build(build_bounding_box(state.body_positions), state.body_positions, state.body_masses,
+                    morton_octree_builder::default_num_tasks, for_each));
+  return hpx::experimental::for_loop_n(
+      std::forward<ExPolicy>(policy), std::size_t(), get_dataset_size(state), [=](std::size_t i) {
+        shared_octree->recompute_acceleration(state.body_positions[i], state.softening_factor, state.acceleration[i]);
+      });
+}
+
+template <execution_policy ExPolicy>
+auto tick_barnes_hut_merged(ExPolicy&& policy, any_simulation_state auto&& state,
+                            const opening_criterion& criterion = {})
+{
+  auto for_each = [&policy](std::size_t count, auto&& f) {
+    if constexpr (hpx::is_async_execution_policy_v<std::decay_t<ExPolicy>>)
+      hpx::experimental::for_loop_n(policy, std::size_t(), count, f).get();
+    else
+      hpx::experimental::for_loop_n(policy, std::size_t(), count, f);
+  };
+
+  merged_octree_builder builder;
+  builder.set_opening_criterion(criterion);
+  auto shared_octree = std::make_shared<barnes_hut_octree>(builder.build(
+      build_bounding_box(state.body_positions), state.body_positions, state.body_masses, for_each));
   return hpx::experimental::for_loop_n(
       std::forward<ExPolicy>(policy), std::size_t(), get_dataset_size(state), [=](std::size_t i) {
-        shared_octree->apply_forces_to(state.body_positions[i], state.softening_factor, state.acceleration[i]);
+        shared_octree->recompute_acceleration(state.body_positions[i], state.softening_factor, state.acceleration[i]);
       });
 }
 
@@ -64,7 +111,8 @@ auto tick_simulation_phase2(ExPolicy&& policy, any_simulation_state auto&& state
 {
   return hpx::experimental::for_loop_n(
       std::forward<ExPolicy>(policy), std::size_t(), get_dataset_size(state), [=](std::size_t i) {
-        integrate_leapfrog_phase2(state.body_positions[i], state.body_velocities[i], state.acceleration[i], time_step);
+        leapfrog_integrator::phase2(state.body_positions[i], state.body_velocities[i], state.acceleration[i],
+                                    time_step);
       });
 }
 
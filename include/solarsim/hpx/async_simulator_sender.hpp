@@ -25,6 +25,14 @@
 #include "solarsim/simulation_state.hpp"
 // Logic fragments come from the sync simulators:
 #include "solarsim/barnes_hut_octree.hpp"
+#include "solarsim/collisions.hpp"
+#include "solarsim/direct_sum.hpp"
+#include "solarsim/fmm_octree.hpp"
+#include "solarsim/kd_tree.hpp"
+#include "solarsim/lazy_octree.hpp"
+#include "solarsim/merged_octree_builder.hpp"
+#include "solarsim/morton_octree_builder.hpp"
+#include "solarsim/treepm.hpp"
 #include "solarsim/sync_simulator.hpp"
 
 #include <hpx/execution/algorithms/bulk.hpp>
@@ -70,22 +78,73 @@ inline constexpr struct async_tick_naive_t
   }
 } async_tick_naive{};
 
+// Direct summation on |sch|: the interaction matrix is split into tiles among |num_tasks| tasks, whose partial
+// sums are then reduced in parallel. See direct_sum_kernel for the phases, |fused| and |precision|.
+template <typename Scheduler>
+auto schedule_naive_tiled(Scheduler sch, any_simulation_state auto&& state, std::size_t num_tasks, bool fused,
+                          force_precision precision)
+{
+  hpx::scoped_annotation annotation("async_tick_naive_tiled");
+  direct_sum_kernel kernel;
+  kernel.set_precision(precision);
+  kernel.load(state.body_positions, state.body_masses);
+  kernel.prepare(state.softening_factor, fused, num_tasks);
+  const auto tasks  = kernel.num_tasks();
+  const auto chunks = kernel.num_chunks();
+
+  return ex::transfer_just(sch, std::move(state), std::move(kernel)) |
+         ex::bulk(tasks,
+                  [](std::size_t task, any_simulation_state auto&, direct_sum_kernel& kernel) {
+                    hpx::scoped_annotation annotation("async_tick_naive_tiled::accumulate");
+                    kernel.accumulate(task);
+                  }) |
+         ex::bulk(chunks,
+                  [](std::size_t chunk, any_simulation_state auto& state, const direct_sum_kernel& kernel) {
+                    hpx::scoped_annotation annotation("async_tick_naive_tiled::reduce");
+                    kernel.reduce(chunk, state.acceleration);
+                  }) |
+         ex::then([](any_simulation_state auto&& state, const direct_sum_kernel&) { return std::move(state); });
+}
+
+// Parallel version of async_tick_naive. |num_tasks| should be about the number of threads behind |sch|.
+inline constexpr struct async_tick_naive_tiled_t
+{
+  CONSTEXPR_FOR_HPX_SR auto operator()(auto sch, std::size_t num_tasks, bool fused = true,
+                                       force_precision precision = force_precision::full) const
+  {
+    return ex::let_value([sch, num_tasks, fused, precision](any_simulation_state auto&& state) {
+      return schedule_naive_tiled(sch, std::move(state), num_tasks, fused, precision);
+    });
+  }
+
+  template <sender Sender>
+  CONSTEXPR_FOR_HPX_SR auto operator()(Sender&& sender, auto sch, std::size_t num_tasks, bool fused = true,
+                                       force_precision precision = force_precision::full) const
+  {
+    return ex::let_value(std::forward<Sender>(sender),
+                         [sch, num_tasks, fused, precision](any_simulation_state auto&& state) {
+                           return schedule_naive_tiled(sch, std::move(state), num_tasks, fused, precision);
+                         });
+  }
+} async_tick_naive_tiled{};
+
 inline constexpr struct async_tick_barnes_hut_t
 {
-  CONSTEXPR_FOR_HPX_SR auto operator()(auto sch) const
+  CONSTEXPR_FOR_HPX_SR auto operator()(auto sch, const opening_criterion& criterion = {}) const
   {
-    return ex::let_value([sch](any_simulation_state auto&& state) {
+    return ex::let_value([sch, criterion](any_simulation_state auto&& state) {
       hpx::scoped_annotation annotation("async_tick_barnes_hut");
-      std::fill(state.acceleration.begin(), state.acceleration.end(), triple{});
-
-      barnes_hut_octree octree(state.body_positions, state.body_masses);
+      barnes_hut_octree octree;
+      octree.set_opening_criterion(criterion);
+      octree.rebuild(state.body_positions, state.body_masses);
       const auto n = get_dataset_size(state);
 
       return ex::transfer_just(sch, std::move(state), std::move(octree)) |
              ex::bulk(n,
                       [](std::size_t i, any_simulation_state auto& state, const barnes_hut_octree& octree) {
                         hpx::scoped_annotation annotation("async_tick_barnes_hut::apply_forces_to");
-                        octree.apply_forces_to(state.body_positions[i], state.softening_factor, state.acceleration[i]);
+                        octree.recompute_acceleration(state.body_positions[i], state.softening_factor,
+                                                      state.acceleration[i]);
                       }) |
              ex::then([=](any_simulation_state auto&& state, const barnes_hut_octree&) {
                return std::move(state);
@@ -94,20 +153,22 @@ inline constexpr struct async_tick_barnes_hut_t
   }
 
   template <sender Sender>
-  CONSTEXPR_FOR_HPX_SR auto operator()(Sender&& sender, auto sch, const std::size_t& num_bodies) const
+  CONSTEXPR_FOR_HPX_SR auto operator()(Sender&& sender, auto sch, const std::size_t& num_bodies,
+                                       const opening_criterion& criterion = {}) const
   {
-    return ex::let_value(std::forward<Sender>(sender), [sch](any_simulation_state auto&& state) {
+    return ex::let_value(std::forward<Sender>(sender), [sch, criterion](any_simulation_state auto&& state) {
       hpx::scoped_annotation annotation("async_tick_barnes_hut");
-      std::fill(state.acceleration.begin(), state.acceleration.end(), triple{});
-
-      barnes_hut_octree octree(state.body_positions, state.body_masses);
+      barnes_hut_octree octree;
+      octree.set_opening_criterion(criterion);
+      octree.rebuild(state.body_positions, state.body_masses);
       const auto n = get_dataset_size(state);
 
       return ex::transfer_just(sch, std::move(state), std::move(octree)) |
              ex::bulk(n,
                       [](std::size_t i, any_simulation_state auto& state, const barnes_hut_octree& octree) {
                         hpx::scoped_annotation annotation("async_tick_barnes_hut::apply_forces_to");
-                        octree.apply_forces_to(state.body_positions[i], state.softening_factor, state.acceleration[i]);
+                        octree.recompute_acceleration(state.body_positions[i], state.softening_factor,
+                                                      state.acceleration[i]);
                       }) |
              ex::then([=](any_simulation_state auto&& state, const barnes_hut_octree&) {
                return std::move(state);
@@ -116,17 +177,514 @@ inline constexpr struct async_tick_barnes_hut_t
   }
 } async_tick_barnes_hut{};
 
+// Refit the persistent |octree| to the new body positions, then apply its forces to all bodies on |sch|.
+template <typename Scheduler>
+auto schedule_barnes_hut_refit(Scheduler sch, any_simulation_state auto&& state, barnes_hut_octree* octree,
+                               const octree_refit_options& options)
+{
+  hpx::scoped_annotation annotation("async_tick_barnes_hut_refit");
+  octree->refit(state.body_positions, state.body_masses, options);
+
+  const auto n = get_dataset_size(state);
+  return ex::transfer_just(sch, std::move(state)) |
+         ex::bulk(n, [octree](std::size_t i, any_simulation_state auto& state) {
+           hpx::scoped_annotation annotation("async_tick_barnes_hut_refit::apply_forces_to");
+           octree->recompute_acceleration(state.body_positions[i], state.softening_factor, state.acceleration[i]);
+         });
+}
+
+// Like async_tick_barnes_hut, but keeps the tree between ticks. |octree| needs to outlive all senders using it
+// and mustn't be shared by concurrently running chains.
+inline constexpr struct async_tick_barnes_hut_refit_t
+{
+  CONSTEXPR_FOR_HPX_SR auto operator()(auto sch, barnes_hut_octree& octree,
+                                       const octree_refit_options& options = {}) const
+  {
+    return ex::let_value([sch, octree = &octree, options](any_simulation_state auto&& state) {
+      return schedule_barnes_hut_refit(sch, std::move(state), octree, options);
+    });
+  }
+
+  template <sender Sender>
+  CONSTEXPR_FOR_HPX_SR auto operator()(Sender&& sender, auto sch, barnes_hut_octree& octree,
+                                       const octree_refit_options& options = {}) const
+  {
+    return ex::let_value(std::forward<Sender>(sender),
+                         [sch, octree = &octree, options](any_simulation_state auto&& state) {
+                           return schedule_barnes_hut_refit(sch, std::move(state), octree, options);
+                         });
+  }
+} async_tick_barnes_hut_refit{};
+
+// Build the octree, then walk it once per body group on |sch|, see barnes_hut_octree::recompute_group_accelerations()
+template <typename Scheduler>
+auto schedule_barnes_hut_grouped(Scheduler sch, any_simulation_state auto&& state, const opening_criterion& criterion)
+{
+  hpx::scoped_annotation annotation("async_tick_barnes_hut_grouped");
+  barnes_hut_octree octree;
+  octree.set_opening_criterion(criterion);
+  octree.rebuild(state.body_positions, state.body_masses);
+  const auto n = octree.group_count();
+
+  return ex::transfer_just(sch, std::move(state), std::move(octree)) |
+         ex::bulk(n,
+                  [](std::size_t group, any_simulation_state auto& state, const barnes_hut_octree& octree) {
+                    hpx::scoped_annotation annotation("async_tick_barnes_hut_grouped::apply_forces_to");
+                    // One list per worker thread, so its buffers are reused by every group it walks
+                    thread_local octree_interaction_list list;
+                    octree.recompute_group_acceleration(group, state.softening_factor, state.acceleration, list);
+                  }) |
+         ex::then([](any_simulation_state auto&& state, const barnes_hut_octree&) { return std::move(state); });
+}
+
+inline constexpr struct async_tick_barnes_hut_grouped_t
+{
+  CONSTEXPR_FOR_HPX_SR auto operator()(auto sch, const opening_criterion& criterion = {}) const
+  {
+    return ex::let_value([sch, criterion](any_simulation_state auto&& state) {
+      return schedule_barnes_hut_grouped(sch, std::move(state), criterion);
+    });
+  }
+
+  template <sender Sender>
+  CONSTEXPR_FOR_HPX_SR auto operator()(Sender&& sender, auto sch, const opening_criterion& criterion = {}) const
+  {
+    return ex::let_value(std::forward<Sender>(sender), [sch, criterion](any_simulation_state auto&& state) {
+      return schedule_barnes_hut_grouped(sch, std::move(state), criterion);
+    });
+  }
+} async_tick_barnes_hut_grouped{};
+
+// Build the octree, then walk it with packets of adjacent bodies, one chunk of them per bulk task on |sch|.
+// See barnes_hut_octree::recompute_chunk_accelerations()
+template <typename Scheduler>
+auto schedule_barnes_hut_packet(Scheduler sch, any_simulation_state auto&& state, const opening_criterion& criterion)
+{
+  hpx::scoped_annotation annotation("async_tick_barnes_hut_packet");
+  barnes_hut_octree octree;
+  octree.set_opening_criterion(criterion);
+  octree.rebuild(state.body_positions, state.body_masses);
+  const auto n = octree.chunk_count();
+
+  return ex::transfer_just(sch, std::move(state), std::move(octree)) |
+         ex::bulk(n,
+                  [](std::size_t chunk, any_simulation_state auto& state, const barnes_hut_octree& octree) {
+                    hpx::scoped_annotation annotation("async_tick_barnes_hut_packet::apply_forces_to");
+                    octree.recompute_chunk_accelerations(chunk, state.softening_factor, state.acceleration);
+                  }) |
+         ex::then([](any_simulation_state auto&& state, const barnes_hut_octree&) { return std::move(state); });
+}
+
+inline constexpr struct async_tick_barnes_hut_packet_t
+{
+  CONSTEXPR_FOR_HPX_SR auto operator()(auto sch, const opening_criterion& criterion = {}) const
+  {
+    return ex::let_value([sch, criterion](any_simulation_state auto&& state) {
+      return schedule_barnes_hut_packet(sch, std::move(state), criterion);
+    });
+  }
+
+  template <sender Sender>
+  CONSTEXPR_FOR_HPX_SR auto operator()(Sender&& sender, auto sch, const opening_criterion& criterion = {}) const
+  {
+    return ex::let_value(std::forward<Sender>(sender), [sch, criterion](any_simulation_state auto&& state) {
+      return schedule_barnes_hut_packet(sch, std::move(state), criterion);
+    });
+  }
+} async_tick_barnes_hut_packet{};
+
+// Set up a lazy octree, then walk it for all bodies on |sch|. The walks share the tree and expand it as they go.
+template <typename Scheduler>
+auto schedule_barnes_hut_lazy(Scheduler sch, any_simulation_state auto&& state, const opening_criterion& criterion)
+{
+  hpx::scoped_annotation annotation("async_tick_barnes_hut_lazy");
+  lazy_octree octree;
+  octree.set_opening_criterion(criterion);
+  octree.rebuild(state.body_positions, state.body_masses);
+  const auto n = get_dataset_size(state);
+
+  return ex::transfer_just(sch, std::move(state), std::move(octree)) |
+         ex::bulk(n,
+                  [](std::size_t i, any_simulation_state auto& state, lazy_octree& octree) {
+                    hpx::scoped_annotation annotation("async_tick_barnes_hut_lazy::apply_forces_to");
+                    octree.recompute_acceleration(state.body_positions[i], state.softening_factor,
+                                                  state.acceleration[i]);
+                  }) |
+         ex::then([](any_simulation_state auto&& state, const lazy_octree&) { return std::move(state); });
+}
+
+inline constexpr struct async_tick_barnes_hut_lazy_t
+{
+  CONSTEXPR_FOR_HPX_SR auto operator()(auto sch, const opening_criterion& criterion = {}) const
+  {
+    return ex::let_value([sch, criterion](any_simulation_state auto&& state) {
+      return schedule_barnes_hut_lazy(sch, std::move(state), criterion);
+    });
+  }
+
+  template <sender Sender>
+  CONSTEXPR_FOR_HPX_SR auto operator()(Sender&& sender, auto sch, const opening_criterion& criterion = {}) const
+  {
+    return ex::let_value(std::forward<Sender>(sender), [sch, criterion](any_simulation_state auto&& state) {
+      return schedule_barnes_hut_lazy(sch, std::move(state), criterion);
+    });
+  }
+} async_tick_barnes_hut_lazy{};
+
+// Build the tree and run the serial FMM passes, then evaluate the local expansions of all bodies on |sch|.
+template <typename Scheduler>
+auto schedule_fmm(Scheduler sch, any_simulation_state auto&& state, const fmm_options& options)
+{
+  hpx::scoped_annotation annotation("async_tick_fmm");
+  fmm_octree octree(options);
+  octree.rebuild(state.body_positions, state.body_masses);
+  octree.interact(state.softening_factor);
+  const auto n = octree.body_count();
+
+  return ex::transfer_just(sch, std::move(state), std::move(octree)) |
+         ex::bulk(n,
+                  [](std::size_t i, any_simulation_state auto& state, const fmm_octree& octree) {
+                    hpx::scoped_annotation annotation("async_tick_fmm::evaluate");
+                    octree.evaluate(i, state.acceleration);
+                  }) |
+         ex::then([](any_simulation_state auto&& state, const fmm_octree&) { return std::move(state); });
+}
+
+inline constexpr struct async_tick_fmm_t
+{
+  CONSTEXPR_FOR_HPX_SR auto operator()(auto sch, const fmm_options& options = {}) const
+  {
+    return ex::let_value([sch, options](any_simulation_state auto&& state) {
+      return schedule_fmm(sch, std::move(state), options);
+    });
+  }
+
+  template <sender Sender>
+  CONSTEXPR_FOR_HPX_SR auto operator()(Sender&& sender, auto sch, const fmm_options& options = {}) const
+  {
+    return ex::let_value(std::forward<Sender>(sender), [sch, options](any_simulation_state auto&& state) {
+      return schedule_fmm(sch, std::move(state), options);
+    });
+  }
+} async_tick_fmm{};
+
+// Build a kd-tree, then apply its forces to all bodies on |sch|. For clustered datasets, see kd_tree.
+template <typename Scheduler>
+auto schedule_kd_tree(Scheduler sch, any_simulation_state auto&& state, const kd_tree_options& options,
+                      const opening_criterion& criterion)
+{
+  hpx::scoped_annotation annotation("async_tick_kd_tree");
+  kd_tree tree(options);
+  tree.set_opening_criterion(criterion);
+  tree.rebuild(state.body_positions, state.body_masses);
+  const auto n = get_dataset_size(state);
+
+  return ex::transfer_just(sch, std::move(state), std::move(tree)) |
+         ex::bulk(n,
+                  [](std::size_t i, any_simulation_state auto& state, const kd_tree& tree) {
+                    hpx::scoped_annotation annotation("async_tick_kd_tree::apply_forces_to");
+                    tree.recompute_acceleration(state.body_positions[i], state.softening_factor,
+                                                state.acceleration[i]);
+                  }) |
+         ex::then([](any_simulation_state auto&& state, const kd_tree&) { return std::move(state); });
+}
+
+inline constexpr struct async_tick_kd_tree_t
+{
+  CONSTEXPR_FOR_HPX_SR auto operator()(auto sch, const kd_tree_options& options = {},
+                                       const opening_criterion& criterion = {}) const
+  {
+    return ex::let_value([sch, options, criterion](any_simulation_state auto&& state) {
+      return schedule_kd_tree(sch, std::move(state), options, criterion);
+    });
+  }
+
+  template <sender Sender>
+  CONSTEXPR_FOR_HPX_SR auto operator()(Sender&& sender, auto sch, const kd_tree_options& options = {},
+                                       const opening_criterion& criterion = {}) const
+  {
+    return ex::let_value(std::forward<Sender>(sender), [sch, options, criterion](any_simulation_state auto&& state) {
+      return schedule_kd_tree(sch, std::move(state), options, criterion);
+    });
+  }
+} async_tick_kd_tree{};
+
+// Assign the masses to the mesh, then run the FFT and finite difference phases and the short-range tree walks on
+// |sch|. See treepm_solver.
+template <typename Scheduler>
+auto schedule_treepm(Scheduler sch, any_simulation_state auto&& state, treepm_solver* solver)
+{
+  hpx::scoped_annotation annotation("async_tick_treepm");
+  solver->prepare(state.body_positions, state.body_masses);
+  const auto n         = solver->body_count();
+  const auto mesh_size = solver->mesh_size();
+
+  return ex::transfer_just(sch, std::move(state)) |
+         ex::bulk(mesh_size,
+                  [solver](std::size_t i, any_simulation_state auto&) {
+                    hpx::scoped_annotation annotation("async_tick_treepm::transform_plane");
+                    solver->transform_plane(i);
+                  }) |
+         ex::bulk(2 * mesh_size,
+                  [solver](std::size_t i, any_simulation_state auto&) {
+                    hpx::scoped_annotation annotation("async_tick_treepm::convolve_column");
+                    solver->convolve_column(i);
+                  }) |
+         ex::bulk(mesh_size,
+                  [solver](std::size_t i, any_simulation_state auto&) {
+                    solver->inverse_transform_plane(i);
+                  }) |
+         ex::bulk(mesh_size,
+                  [solver](std::size_t i, any_simulation_state auto&) {
+                    solver->differentiate_plane(i);
+                  }) |
+         ex::bulk(n,
+                  [solver](std::size_t i, any_simulation_state auto& state) {
+                    hpx::scoped_annotation annotation("async_tick_treepm::compute_acceleration");
+                    solver->compute_acceleration(i, state.softening_factor, state.acceleration);
+                  });
+}
+
+// |solver| keeps its Green's function between ticks, see treepm_solver::set_options(). It needs to outlive all
+// senders using it and mustn't be shared by concurrently running chains.
+inline constexpr struct async_tick_treepm_t
+{
+  CONSTEXPR_FOR_HPX_SR auto operator()(auto sch, treepm_solver& solver) const
+  {
+    return ex::let_value([sch, solver = &solver](any_simulation_state auto&& state) {
+      return schedule_treepm(sch, std::move(state), solver);
+    });
+  }
+
+  template <sender Sender>
+  CONSTEXPR_FOR_HPX_SR auto operator()(Sender&& sender, auto sch, treepm_solver& solver) const
+  {
+    return ex::let_value(std::forward<Sender>(sender), [sch, solver = &solver](any_simulation_state auto&& state) {
+      return schedule_treepm(sch, std::move(state), solver);
+    });
+  }
+} async_tick_treepm{};
+
+// Build the octree from Morton-sorted bodies on |sch|, then apply its forces to all bodies.
+template <typename Scheduler>
+auto schedule_barnes_hut_morton(Scheduler sch, any_simulation_state auto&& state, const opening_criterion& criterion)
+{
+  hpx::scoped_annotation annotation("async_tick_barnes_hut_morton");
+  morton_octree_builder builder;
+  builder.set_opening_criterion(criterion);
+  builder.prepare(build_bounding_box(state.body_positions), state.body_positions, state.body_masses,
+                  morton_octree_builder::default_num_tasks);
+  const auto num_tasks = builder.num_tasks();
+
+  // Serial phases are run as a bulk of one, that way (state, builder) keep flowing through the chain.
+  return ex::transfer_just(sch, std::move(state), std::move(builder)) |
+         ex::bulk(num_tasks,
+                  [](std::size_t i, any_simulation_state auto&, morton_octree_builder& builder) {
+                    builder.compute_keys(i);
+                  }) |
+         ex::bulk(1, [](std::size_t, any_simulation_state auto&,
+                        morton_octree_builder& builder) { builder.scan_cells(); }) |
+         ex::bulk(num_tasks,
+                  [](std::size_t i, any_simulation_state auto&, morton_octree_builder& builder) {
+                    builder.scatter_keys(i);
+                  }) |
+         ex::bulk(morton_octree_builder::num_cells,
+                  [](std::size_t i, any_simulation_state auto&, morton_octree_builder& builder) {
+                    hpx::scoped_annotation annotation("async_tick_barnes_hut_morton::build_cell");
+                    builder.build_cell(i);
+                  }) |
+         ex::bulk(1, [](std::size_t, any_simulation_state auto&,
+                        morton_octree_builder& builder) { builder.link_cells(); }) |
+         ex::bulk(morton_octree_builder::num_cells,
+                  [](std::size_t i, any_simulation_state auto&, morton_octree_builder& builder) {
+                    builder.emit_cell(i);
+                  }) |
+         ex::let_value([sch](any_simulation_state auto& state, morton_octree_builder& builder) {
+           const auto n = get_dataset_size(state);
+           return ex::transfer_just(sch, std::move(state), builder.release()) |
+                  ex::bulk(n,
+                           [](std::size_t i, any_simulation_state auto& state, const barnes_hut_octree& octree) {
+                             hpx::scoped_annotation annotation("async_tick_barnes_hut_morton::apply_forces_to");
+                             octree.recompute_acceleration(state.body_positions[i], state.softening_factor,
+                                                           state.acceleration[i]);
+                           }) |
+                  ex::then([](any_simulation_state auto&& state, const barnes_hut_octree&) {
+                    return std::move(state);
+                  });
+         });
+}
+
+inline constexpr struct async_tick_barnes_hut_morton_t
+{
+  CONSTEXPR_FOR_HPX_SR auto operator()(auto sch, const opening_criterion& criterion = {}) const
+  {
+    return ex::let_value([sch, criterion](any_simulation_state auto&& state) {
+      return schedule_barnes_hut_morton(sch, std::move(state), criterion);
+    });
+  }
+
+  template <sender Sender>
+  CONSTEXPR_FOR_HPX_SR auto operator()(Sender&& sender, auto sch, const opening_criterion& criterion = {}) const
+  {
+    return ex::let_value(std::forward<Sender>(sender), [sch, criterion](any_simulation_state auto&& state) {
+      return schedule_barnes_hut_morton(sch, std::move(state), criterion);
+    });
+  }
+} async_tick_barnes_hut_morton{};
+
+// Build partial octrees of body chunks on |sch| and merge them, then apply the forces to all bodies.
+template <typename Scheduler>
+auto schedule_barnes_hut_merged(Scheduler sch, any_simulation_state auto&& state, const opening_criterion& criterion)
+{
+  hpx::scoped_annotation annotation("async_tick_barnes_hut_merged");
+  merged_octree_builder builder;
+  builder.set_opening_criterion(criterion);
+  builder.prepare(build_bounding_box(state.body_positions), state.body_positions, state.body_masses);
+
+  // The number of tasks per phase is fixed, idle tasks return immediately.
+  // merged_octree_builder::num_merge_rounds rounds of pairwise merging follow the partial builds.
+  static_assert(merged_octree_builder::num_merge_rounds == 4);
+  return ex::transfer_just(sch, std::move(state), std::move(builder)) |
+         ex::bulk(merged_octree_builder::max_num_tasks,
+                  [](std::size_t i, any_simulation_state auto&, merged_octree_builder& builder) {
+                    hpx::scoped_annotation annotation("async_tick_barnes_hut_merged::build_partial");
+                    builder.build_partial(i);
+                  }) |
+         ex::bulk(merged_octree_builder::num_merges(0),
+                  [](std::size_t i, any_simulation_state auto&, merged_octree_builder& builder) {
+                    builder.merge(0, i);
+                  }) |
+         ex::bulk(merged_octree_builder::num_merges(1),
+                  [](std::size_t i, any_simulation_state auto&, merged_octree_builder& builder) {
+                    builder.merge(1, i);
+                  }) |
+         ex::bulk(merged_octree_builder::num_merges(2),
+                  [](std::size_t i, any_simulation_state auto&, merged_octree_builder& builder) {
+                    builder.merge(2, i);
+                  }) |
+         ex::bulk(merged_octree_builder::num_merges(3),
+                  [](std::size_t i, any_simulation_state auto&, merged_octree_builder& builder) {
+                    builder.merge(3, i);
+                  }) |
+         ex::bulk(1, [](std::size_t, any_simulation_state auto&,
+                        merged_octree_builder& builder) { builder.prepare_finalize(); }) |
+         ex::bulk(merged_octree_builder::max_num_subtrees,
+                  [](std::size_t i, any_simulation_state auto&, merged_octree_builder& builder) {
+                    builder.finalize_subtree(i);
+                  }) |
+         ex::bulk(1, [](std::size_t, any_simulation_state auto&,
+                        merged_octree_builder& builder) { builder.finalize_top(); }) |
+         ex::let_value([sch](any_simulation_state auto& state, merged_octree_builder& builder) {
+           const auto n = get_dataset_size(state);
+           return ex::transfer_just(sch, std::move(state), builder.release()) |
+                  ex::bulk(n,
+                           [](std::size_t i, any_simulation_state auto& state, const barnes_hut_octree& octree) {
+                             hpx::scoped_annotation annotation("async_tick_barnes_hut_merged::apply_forces_to");
+                             octree.recompute_acceleration(state.body_positions[i], state.softening_factor,
+                                                           state.acceleration[i]);
+                           }) |
+                  ex::then([](any_simulation_state auto&& state, const barnes_hut_octree&) {
+                    return std::move(state);
+                  });
+         });
+}
+
+inline constexpr struct async_tick_barnes_hut_merged_t
+{
+  CONSTEXPR_FOR_HPX_SR auto operator()(auto sch, const opening_criterion& criterion = {}) const
+  {
+    return ex::let_value([sch, criterion](any_simulation_state auto&& state) {
+      return schedule_barnes_hut_merged(sch, std::move(state), criterion);
+    });
+  }
+
+  template <sender Sender>
+  CONSTEXPR_FOR_HPX_SR auto operator()(Sender&& sender, auto sch, const opening_criterion& criterion = {}) const
+  {
+    return ex::let_value(std::forward<Sender>(sender), [sch, criterion](any_simulation_state auto&& state) {
+      return schedule_barnes_hut_merged(sch, std::move(state), criterion);
+    });
+  }
+} async_tick_barnes_hut_merged{};
+
+// Build the octree and apply its forces on |sch|, then merge all bodies colliding within [-sweep_time, sweep_time]
+// using the same tree (see collision_merger). The resulting state may have fewer bodies, so whatever follows
+// has to take its size from the state rather than the one it started with, like the integration phases do.
+template <typename Scheduler>
+auto schedule_barnes_hut_collisions(Scheduler sch, simulation_state&& state, real sweep_time,
+                                    const opening_criterion& criterion)
+{
+  hpx::scoped_annotation annotation("async_tick_barnes_hut_collisions");
+  barnes_hut_octree octree;
+  octree.set_opening_criterion(criterion);
+  octree.rebuild(state.body_positions, state.body_masses);
+  const auto n = get_dataset_size(state);
+
+  collision_merger merger;
+  merger.prepare(state, collision_merger::default_num_tasks);
+  const auto num_tasks = merger.num_tasks();
+
+  // Serial phases are run as a bulk of one, that way (state, octree, merger) keep flowing through the chain.
+  return ex::transfer_just(sch, std::move(state), std::move(octree), std::move(merger)) |
+         ex::bulk(n,
+                  [](std::size_t i, simulation_state& state, const barnes_hut_octree& octree, collision_merger&) {
+                    hpx::scoped_annotation annotation("async_tick_barnes_hut_collisions::apply_forces_to");
+                    octree.recompute_acceleration(state.body_positions[i], state.softening_factor,
+                                                  state.acceleration[i]);
+                  }) |
+         ex::bulk(num_tasks,
+                  [sweep_time](std::size_t i, simulation_state&, const barnes_hut_octree& octree,
+                               collision_merger& merger) {
+                    hpx::scoped_annotation annotation("async_tick_barnes_hut_collisions::detect");
+                    merger.detect(i, octree, sweep_time);
+                  }) |
+         ex::bulk(1, [](std::size_t, simulation_state&, const barnes_hut_octree&,
+                        collision_merger& merger) { merger.resolve(); }) |
+         ex::bulk(num_tasks, [](std::size_t i, simulation_state&, const barnes_hut_octree&,
+                                collision_merger& merger) { merger.compact(i); }) |
+         ex::bulk(1, [](std::size_t, simulation_state& state, const barnes_hut_octree&,
+                        collision_merger& merger) { merger.finish(state); }) |
+         ex::then([](any_simulation_state auto&& state, const barnes_hut_octree&, const collision_merger&) {
+           return std::move(state);
+         });
+}
+
+inline constexpr struct async_tick_barnes_hut_collisions_t
+{
+  CONSTEXPR_FOR_HPX_SR auto operator()(auto sch, real sweep_time, const opening_criterion& criterion = {}) const
+  {
+    return ex::let_value([sch, sweep_time, criterion](any_simulation_state auto&& state) {
+      return schedule_barnes_hut_collisions(sch, std::move(state), sweep_time, criterion);
+    });
+  }
+
+  template <sender Sender>
+  CONSTEXPR_FOR_HPX_SR auto operator()(Sender&& sender, auto sch, real sweep_time,
+                                       const opening_criterion& criterion = {}) const
+  {
+    return ex::let_value(std::forward<Sender>(sender),
+                         [sch, sweep_time, criterion](any_simulation_state auto&& state) {
+                           return schedule_barnes_hut_collisions(sch, std::move(state), sweep_time, criterion);
+                         });
+  }
+} async_tick_barnes_hut_collisions{};
+
+// Integration phases of all bodies. |num_bodies| is an upper bound: bodies past the end of the state are skipped, so
+// the phases can follow async_tick_barnes_hut_collisions, which may have merged some of them.
 inline constexpr struct async_tick_simulation_phase1_t
 {
   CONSTEXPR_FOR_HPX_SR auto operator()(const std::size_t& num_bodies, real dT) const
   {
     return ex::bulk(num_bodies, [=](std::size_t i, any_simulation_state auto& state) {
+      if (i >= state.body_positions.size())
+        return;
       hpx::scoped_annotation annotation("async_tick_simulation_phase1");
       if constexpr (true) {
-        integrate_leapfrog_phase1(state.body_positions[i], state.body_velocities[i], dT);
+        leapfrog_integrator::phase1(state.body_positions[i], state.body_velocities[i], state.acceleration[i], dT);
       } else {
         // needs previous acceleration!
-        integrate_velocity_verlet_phase1(state.body_positions[i], state.body_velocities[i], state.acceleration[i], dT);
+        velocity_verlet_integrator::phase1(state.body_positions[i], state.body_velocities[i], state.acceleration[i],
+                                           dT);
       }
     });
   }
@@ -135,12 +693,15 @@ inline constexpr struct async_tick_simulation_phase1_t
   CONSTEXPR_FOR_HPX_SR auto operator()(Sender&& sender, const std::size_t& num_bodies, real dT) const
   {
     return ex::bulk(std::forward<Sender>(sender), num_bodies, [=](std::size_t i, any_simulation_state auto& state) {
+      if (i >= state.body_positions.size())
+        return;
       hpx::scoped_annotation annotation("async_tick_simulation_phase1");
       if constexpr (true) {
-        integrate_leapfrog_phase1(state.body_positions[i], state.body_velocities[i], dT);
+        leapfrog_integrator::phase1(state.body_positions[i], state.body_velocities[i], state.acceleration[i], dT);
       } else {
         // needs previous acceleration!
-        integrate_velocity_verlet_phase1(state.body_positions[i], state.body_velocities[i], state.acceleration[i], dT);
+        velocity_verlet_integrator::phase1(state.body_positions[i], state.body_velocities[i], state.acceleration[i],
+                                           dT);
       }
     });
   }
@@ -151,11 +712,14 @@ inline constexpr struct async_tick_simulation_phase2_t
   CONSTEXPR_FOR_HPX_SR auto operator()(const std::size_t& num_bodies, real dT) const
   {
     return ex::bulk(num_bodies, [=](std::size_t i, any_simulation_state auto& state) {
+      if (i >= state.body_positions.size())
+        return;
       hpx::scoped_annotation annotation("async_tick_simulation_phase2");
       if constexpr (true) {
-        integrate_leapfrog_phase2(state.body_positions[i], state.body_velocities[i], state.acceleration[i], dT);
+        leapfrog_integrator::phase2(state.body_positions[i], state.body_velocities[i], state.acceleration[i], dT);
       } else {
-        integrate_velocity_verlet_phase2(state.body_velocities[i], state.acceleration[i], dT);
+        velocity_verlet_integrator::phase2(state.body_positions[i], state.body_velocities[i], state.acceleration[i],
+                                           dT);
       }
     });
   }
@@ -164,11 +728,14 @@ inline constexpr struct async_tick_simulation_phase2_t
   CONSTEXPR_FOR_HPX_SR auto operator()(Sender&& sender, const std::size_t& num_bodies, real dT) const
   {
     return ex::bulk(std::forward<Sender>(sender), num_bodies, [=](std::size_t i, any_simulation_state auto& state) {
+      if (i >= state.body_positions.size())
+        return;
       hpx::scoped_annotation annotation("async_tick_simulation_phase2");
       if constexpr (true) {
-        integrate_leapfrog_phase2(state.body_positions[i], state.body_velocities[i], state.acceleration[i], dT);
+        leapfrog_integrator::phase2(state.body_positions[i], state.body_velocities[i], state.acceleration[i], dT);
       } else {
-        integrate_velocity_verlet_phase2(state.body_velocities[i], state.acceleration[i], dT);
+        velocity_verlet_integrator::phase2(state.body_positions[i], state.body_velocities[i], state.acceleration[i],
+                                           dT);
       }
     });
   }
@@ -0,0 +1,157 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef SOLARSIM_KDTREE_HPP
+#define SOLARSIM_KDTREE_HPP
+
+#include "solarsim/detail/config.hpp"
+
+#if SOLARSIM_HAS_PRAGMA_ONCE
+#  pragma once
+#endif
+
+#include "solarsim/barnes_hut_octree.hpp"
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+SOLARSIM_NS_BEGIN
+
+// Where kd_tree puts the plane that splits a node's bodies in two
+enum class kd_split_rule
+{
+  // Half of the bodies on each side, along the longest axis of their bounding box.
+  // Keeps the tree balanced (depth log2(n / max_leaf_bodies)) no matter how clustered the bodies are.
+  median,
+  // Minimize (surface area * body count) of both halves, over |kd_tree_options::sah_bins| candidate planes per
+  // axis. Cuts through the empty space between clusters, which makes for smaller (and sooner accepted) nodes.
+  surface_area,
+};
+
+struct kd_tree_options
+{
+  kd_split_rule split_rule = kd_split_rule::median;
+
+  // Nodes with at most this many bodies aren't split any further
+  std::uint32_t max_leaf_bodies = 8;
+
+  // Candidate planes per axis of kd_split_rule::surface_area
+  std::uint32_t sah_bins = 16;
+};
+
+/// Barnes-Hut tree code on a kd-tree instead of an octree.
+///
+/// Octrees split space into equal halves, so tightly clustered bodies (moons around their planet, galaxies) end up
+/// in long chains of nodes with a single populated child. A kd-tree splits the bodies instead, each node into two
+/// with tight bounding boxes, and stays balanced for any distribution.
+///
+/// The walk is the same as barnes_hut_octree's: nodes in depth-first order, monopoles only, with the node's longest
+/// side as its size for the opening criteria.
+class kd_tree
+{
+public:
+  kd_tree() = default;
+  explicit kd_tree(const kd_tree_options& options)
+    : options_(options)
+  {
+  }
+
+  // Both take effect on the next rebuild()
+  void set_options(const kd_tree_options& options) noexcept { options_ = options; }
+  [[nodiscard]] const kd_tree_options& get_options() const noexcept { return options_; }
+  void set_opening_criterion(const opening_criterion& criterion) noexcept { criterion_ = criterion; }
+  [[nodiscard]] const opening_criterion& get_opening_criterion() const noexcept { return criterion_; }
+
+  // Takes effect immediately, see barnes_hut_octree::set_softening_kind()
+  void set_softening_kind(softening_kind kind) noexcept { softening_kind_ = kind; }
+  [[nodiscard]] softening_kind get_softening_kind() const noexcept { return softening_kind_; }
+
+  /**
+   * Build the tree from scratch. Our buffers keep their capacity, so rebuilding every tick doesn't hit the allocator.
+   * @param body_positions Positions of the bodies to insert.
+   * @param body_masses Masses of the bodies to insert.
+   */
+  void rebuild(std::span<const triple> body_positions, std::span<const real> body_masses);
+
+  // Add the acceleration caused by all bodies of the tree to |acceleration|.
+  void apply_forces_to(const triple& body_position, real softening, triple& acceleration) const;
+
+  // Replace |acceleration| (the body's acceleration of the previous tick, needed for relative criteria)
+  // with the one caused by all bodies of the tree.
+  void recompute_acceleration(const triple& body_position, real softening, triple& acceleration) const;
+
+  [[nodiscard]] std::size_t node_count() const noexcept { return nodes_.size(); }
+  // Longest path from the root to a leaf, in nodes
+  [[nodiscard]] std::size_t depth() const noexcept { return depth_; }
+
+  [[nodiscard]] std::size_t allocated_bytes() const noexcept
+  {
+    return nodes_.capacity() * sizeof(linear_octree_node) + bodies_.capacity() * sizeof(body) +
+           bins_.capacity() * sizeof(sah_bin) + upper_costs_.capacity() * sizeof(real);
+  }
+
+private:
+  struct body
+  {
+    triple position  = {};
+    real scaled_mass = 0.0; // G * m
+  };
+
+  // Bodies of one candidate slab of kd_split_rule::surface_area
+  struct sah_bin
+  {
+    std::uint32_t count = 0;
+    triple lower        = {};
+    triple upper        = {};
+  };
+
+  // Beyond this depth we always split at the median, which halves the bodies every level.
+  // Keeps the surface area heuristic from building deep trees out of pathological inputs.
+  static constexpr std::size_t max_surface_area_depth = 64;
+
+  // Append the node for |bodies_[first, first + count)| and its subtree
+  void build_node(std::uint32_t first, std::uint32_t count, std::size_t depth);
+
+  // Partition |bodies_[first, first + count)| and return the size of the lower half (0 < result < count)
+  [[nodiscard]] std::uint32_t split_median(std::uint32_t first, std::uint32_t count, const triple& lower,
+                                           const triple& upper);
+  [[nodiscard]] std::uint32_t split_surface_area(std::uint32_t first, std::uint32_t count, const triple& lower,
+                                                 const triple& upper);
+
+  // |gravity| is the pairwise_gravity for |softening_kind_|
+  template <typename F, typename G>
+  void apply_node_gravity(const triple& body_position, F&& is_far_enough, const G& gravity,
+                          triple& acceleration) const;
+
+  kd_tree_options options_;
+  opening_criterion criterion_;
+  softening_kind softening_kind_ = softening_kind::linear;
+
+  // Same layout as barnes_hut_octree's (masses times G included), with the longest side of the bounding box as
+  // |length_squared|
+  std::vector<linear_octree_node> nodes_;
+  std::size_t depth_ = 0;
+
+  // Bodies in tree order. Building partitions them in place.
+  std::vector<body> bodies_;
+
+  // Scratch space of split_surface_area(): |sah_bins| per axis, and the cost of the upper half above each bin
+  std::vector<sah_bin> bins_;
+  std::vector<real> upper_costs_;
+};
+
+SOLARSIM_NS_END
+
+#endif
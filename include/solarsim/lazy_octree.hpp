@@ -0,0 +1,182 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef SOLARSIM_LAZYOCTREE_HPP
+#define SOLARSIM_LAZYOCTREE_HPP
+
+#include "solarsim/detail/config.hpp"
+
+#if SOLARSIM_HAS_PRAGMA_ONCE
+#  pragma once
+#endif
+
+#include "solarsim/barnes_hut_octree.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <vector>
+
+SOLARSIM_NS_BEGIN
+
+struct lazy_octree_node
+{
+  enum state_type : std::uint32_t
+  {
+    // Few enough bodies (or deep enough) to never be split
+    leaf,
+    // Children haven't been created yet
+    unexpanded,
+    // Some thread is creating the children right now
+    expanding,
+    // |children| is valid
+    expanded,
+  };
+
+  // Smallest cube around the node's bodies, so clustered bodies don't end up in long chains of single children
+  triple position = {}; // top-left corner
+  real length     = 0.0;
+
+  real total_mass       = 0.0; // Times G, like lazy_octree::body_masses_
+  triple center_of_mass = {};
+  // Largest distance between the center of mass and any point of the node, see opening_criterion::kind::bmax
+  real bmax = 0.0;
+
+  // The node's bodies in lazy_octree::body_positions_ etc. Unsorted until the node is expanded.
+  std::uint32_t first_body = 0;
+  std::uint32_t body_count = 0;
+  std::uint32_t depth      = 0;
+
+  // Only valid once |state| is expanded. Children are contiguous.
+  lazy_octree_node* children = nullptr;
+  std::uint32_t child_count  = 0;
+
+  std::atomic<state_type> state = leaf;
+};
+
+// Allocates nodes in fixed-size chunks, so they never move and can be used while others are being allocated.
+// Chunks are kept by reset(), which makes rebuilding free of allocations once we've seen the largest tree.
+class lazy_octree_node_pool
+{
+public:
+  static constexpr std::size_t chunk_size = 4096;
+
+  lazy_octree_node_pool() = default;
+  lazy_octree_node_pool(lazy_octree_node_pool&& other) noexcept;
+  lazy_octree_node_pool& operator=(lazy_octree_node_pool&& other) noexcept;
+
+  // |count| contiguous nodes (at most 8). Safe to call concurrently.
+  lazy_octree_node* allocate(std::size_t count);
+  void reset() noexcept;
+
+  [[nodiscard]] std::size_t size() const noexcept;
+  [[nodiscard]] std::size_t allocated_bytes() const noexcept
+  {
+    return chunks_.size() * chunk_size * sizeof(lazy_octree_node);
+  }
+
+private:
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<lazy_octree_node[]>> chunks_;
+  // Chunk we're allocating from and how much of it is used
+  std::size_t current_chunk_ = 0;
+  std::size_t current_used_  = 0;
+  // Nodes handed out since the last reset()
+  std::size_t size_ = 0;
+};
+
+/// Barnes-Hut octree that only splits nodes the first time a traversal needs to open them.
+///
+/// rebuild() just copies the bodies and computes the root's moments. Opening a node partitions its (so far unsorted)
+/// body range into its children and computes their moments, which is about the work an eager build does for that
+/// node. Subtrees whose monopole is always accepted are never built. Since the children's cubes are shrunk to their
+/// bodies, clustered datasets also skip the empty levels around their clusters.
+///
+/// All traversals may run concurrently. Every node is expanded exactly once, threads opening a node that's being
+/// expanded wait for it. Bodies of different nodes are disjoint, so expansions don't get in each other's way.
+///
+/// Accepted nodes only act as point masses, even if octree_multipole_order asks for more.
+class lazy_octree
+{
+public:
+  lazy_octree() = default;
+  lazy_octree(std::span<const triple> body_positions, std::span<const real> body_masses);
+
+  // Throw away the current contents. Must not run concurrently with anything else.
+  void rebuild(std::span<const triple> body_positions, std::span<const real> body_masses);
+
+  // Takes effect immediately, every node keeps what all criteria need. Must not run concurrently with walks.
+  void set_opening_criterion(const opening_criterion& criterion);
+  [[nodiscard]] const opening_criterion& get_opening_criterion() const noexcept { return criterion_; }
+
+  // Takes effect on the next rebuild()
+  void set_leaf_options(const octree_leaf_options& options) noexcept { leaf_options_ = options; }
+
+  // Takes effect immediately, see barnes_hut_octree::set_softening_kind(). Must not run concurrently with walks.
+  void set_softening_kind(softening_kind kind) noexcept { softening_kind_ = kind; }
+  [[nodiscard]] softening_kind get_softening_kind() const noexcept { return softening_kind_; }
+
+  // Add the acceleration caused by all bodies of the tree to |acceleration|. Safe to call concurrently.
+  void apply_forces_to(const triple& body_position, real softening, triple& acceleration);
+
+  // Replace |acceleration| (the body's acceleration of the previous tick, needed for relative criteria)
+  // with the one caused by all bodies of the tree. Safe to call concurrently.
+  void recompute_acceleration(const triple& body_position, real softening, triple& acceleration);
+
+  // Expand all nodes, i.e. turn this into an eagerly built tree
+  void expand_all();
+
+  // Nodes created so far
+  [[nodiscard]] std::size_t node_count() const noexcept { return pool_.size(); }
+
+  [[nodiscard]] std::size_t allocated_bytes() const noexcept
+  {
+    return pool_.allocated_bytes() + (body_positions_.capacity() + scratch_positions_.capacity()) * sizeof(triple) +
+           (body_masses_.capacity() + scratch_masses_.capacity()) * sizeof(real);
+  }
+
+private:
+  // Set the node's moments, bounds and state from its body range
+  void initialize_node(lazy_octree_node& node, std::uint32_t first_body, std::uint32_t body_count,
+                       std::uint32_t depth);
+  // Make sure the node's children exist. Waits if another thread is expanding it.
+  void open(lazy_octree_node& node);
+  void expand(lazy_octree_node& node);
+  void expand_all(lazy_octree_node& node);
+
+  // |gravity| is the pairwise_gravity for |softening_kind_|
+  template <typename F, typename G>
+  void apply_node_gravity(lazy_octree_node& node, const triple& body_position, F&& is_far_enough,
+                          const G& gravity, triple& acceleration);
+
+  opening_criterion criterion_;
+  octree_leaf_options leaf_options_;
+  softening_kind softening_kind_ = softening_kind::linear;
+
+  lazy_octree_node_pool pool_;
+  lazy_octree_node* root_ = nullptr;
+
+  // Bodies get partitioned in place as nodes are expanded. Masses are multiplied by G once in rebuild().
+  std::vector<triple> body_positions_;
+  std::vector<real> body_masses_;
+  // Partitioning goes through here. Expansions only touch their node's range, so they can share it.
+  std::vector<triple> scratch_positions_;
+  std::vector<real> scratch_masses_;
+};
+
+SOLARSIM_NS_END
+
+#endif
@@ -23,7 +23,10 @@
 
 #include "solarsim/types.hpp"
 
+#include <array>
 #include <cmath>
+#include <cstdint>
+#include <span>
 
 SOLARSIM_NS_BEGIN
 
@@ -61,25 +64,98 @@ constexpr real squared_length(const triple& v)
   return std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
 }
 
+// Of the xyz part, the 4th lane is ignored
+constexpr real squared_length(const quad& v)
+{
+  return v[0] * v[0] + v[1] * v[1] + v[2] * v[2];
+}
+
+// How pairwise forces are kept finite at small distances. Every engine takes it through set_softening_kind().
+enum class softening_kind : std::uint8_t
+{
+  // G m / (r + eps)^3, what calculate_acceleration() uses
+  linear,
+  // G m / (r^2 + eps^2)^(3/2), the force of a Plummer sphere. Needs no sqrt, just a reciprocal one.
+  plummer
+};
+
+// 1 / d for the softened distance d, given r^2. The pairwise factor G m / d^3 is then computed as
+// G m * inverse * inverse^2, which leaves a single division (or none) per pair.
+inline real softened_inverse_distance(real squared_distance, real softening, softening_kind kind)
+{
+  if (kind == softening_kind::plummer)
+    return 1 / std::sqrt(squared_distance + softening * softening);
+  return 1 / (std::sqrt(squared_distance) + softening);
+}
+
 void calculate_acceleration(const triple& x_i, const triple& x_j, real unadjusted_mass, real softening,
                             triple& acceleration);
 void calculate_acceleration(const triple& x_i, const triple& x_j, real unadjusted_mass_i, real unadjusted_mass_j,
                             real softening, triple& acceleration_i, triple& acceleration_j);
 
+// calculate_acceleration() with masses already multiplied by the gravitational constant (G * m), which is best
+// done once per body and tick rather than once per pair. Out-of-line version of pairwise_gravity.
+void calculate_scaled_acceleration(const triple& x_i, const triple& x_j, real scaled_mass, real softening,
+                                   softening_kind kind, triple& acceleration);
+void calculate_scaled_acceleration(const triple& x_i, const triple& x_j, real scaled_mass_i, real scaled_mass_j,
+                                   real softening, softening_kind kind, triple& acceleration_i,
+                                   triple& acceleration_j);
+
+// Short-range part of calculate_scaled_acceleration() for a TreePM force split at scale |split_radius| (r_s):
+// Newton's force times erfc(r / 2 r_s) + r / (r_s sqrt(pi)) exp(-r^2 / 4 r_s^2). The rest is smooth enough for a
+// mesh.
+void calculate_scaled_short_range_acceleration(const triple& x_i, const triple& x_j, real scaled_mass,
+                                               real softening, softening_kind kind, real split_radius,
+                                               triple& acceleration);
+
+// Lane width of calculate_scaled_acceleration_soa(). 8 doubles fill an AVX-512 register.
+inline constexpr std::size_t soa_lane_count = 8;
+
+// Acceleration caused by |count| point masses (G * m), stored as one array per coordinate (SoA).
+// |count| needs to be a multiple of soa_lane_count - pad with massless entries far away.
+// Runs the kernel built for active_simd_instruction_set().
+void calculate_scaled_acceleration_soa(const triple& x_i, const real* x_j, const real* y_j, const real* z_j,
+                                       const real* scaled_mass_j, std::size_t count, real softening,
+                                       softening_kind kind, triple& acceleration);
+
+// Traceless quadrupole tensor sum m * (3 x x^T - |x|^2 I) of a mass distribution around its center of mass.
+// Symmetric, so we only store xx, xy, xz, yy, yz, zz.
+using quadrupole_moment = std::array<real, 6>;
+
+// Add the quadrupole of a point mass at |offset| from the center of mass. Pass G * m for a quadrupole that
+// calculate_scaled_quadrupole_acceleration() can use.
+void add_point_quadrupole(const triple& offset, real mass, quadrupole_moment& quadrupole);
+
+// Acceleration caused by the quadrupole term of a distant mass distribution (the monopole term isn't included),
+// with |quadrupole| summed up from G * m. No softening, this is only meant for the far field.
+void calculate_scaled_quadrupole_acceleration(const triple& x_i, const triple& center_of_mass,
+                                              const quadrupole_moment& quadrupole, triple& acceleration);
+
+// Out-of-line versions of velocity_verlet_integrator and leapfrog_integrator
 void integrate_velocity_verlet_phase1(triple& position, triple& velocity, const triple& acceleration, real dT);
 void integrate_velocity_verlet_phase2(triple& velocity, const triple& acceleration, real dT);
 
 void integrate_leapfrog_phase1(triple& position, const triple& velocity, real dT);
 void integrate_leapfrog_phase2(triple& position, triple& velocity, const triple& acceleration, real dT);
 
+// The same for all bodies at once, using the kernels of active_simd_instruction_set(). All spans have the same size.
+void integrate_velocity_verlet_phase1(std::span<triple> positions, std::span<triple> velocities,
+                                      std::span<const triple> accelerations, real dT);
+void integrate_velocity_verlet_phase2(std::span<triple> velocities, std::span<const triple> accelerations, real dT);
+
+void integrate_leapfrog_phase1(std::span<triple> positions, std::span<const triple> velocities, real dT);
+void integrate_leapfrog_phase2(std::span<triple> positions, std::span<triple> velocities,
+                               std::span<const triple> accelerations, real dT);
+
 // System energy
 real calculate_kinetic_energy(real unadjusted_mass, const triple& velocity);
 real calculate_potential_energy(real unadjusted_mass_i, real unadjusted_mass_j, const triple& x_i, const triple& x_j);
 
 // Data validation
-#if defined(_DEBUG)
 bool almost_equal_ulps(real a, real b, int max_ulps_diff = 4);
 bool almost_equal_ulps(const triple& a, const triple& b, int max_ulps_diff = 4);
+
+#if defined(_DEBUG)
 void debug_validate_finite(const triple& v);
 #else
 constexpr void debug_validate_finite(const triple&)
@@ -90,4 +166,6 @@ constexpr void debug_validate_finite(const triple&)
 
 SOLARSIM_NS_END
 
+#include "solarsim/math_inlines.hpp"
+
 #endif
@@ -0,0 +1,171 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef SOLARSIM_MATH_INLINES_HPP
+#define SOLARSIM_MATH_INLINES_HPP
+
+#include "solarsim/detail/config.hpp"
+
+#if SOLARSIM_HAS_PRAGMA_ONCE
+#  pragma once
+#endif
+
+SOLARSIM_NS_BEGIN
+
+// The kernels of math.hpp as inline policy objects. The out-of-line functions there are just calls into these,
+// but calling them from another translation unit keeps the compiler from inlining (and without that, from
+// vectorizing) the loops around them. Hot loops should use these directly.
+
+/// Pairwise Newtonian gravity, see calculate_scaled_acceleration().
+/// Masses are G * m, which callers should compute once per body rather than once per pair.
+template <softening_kind Kind = softening_kind::linear>
+struct pairwise_gravity
+{
+  real softening = 0;
+
+  void operator()(const triple& x_i, const triple& x_j, real scaled_mass, triple& acceleration) const noexcept
+  {
+    const triple displacement = x_j - x_i;
+
+    const real inverse = softened_inverse_distance(squared_length(displacement), softening, Kind);
+    const real factor  = scaled_mass * inverse * (inverse * inverse);
+
+    acceleration[0] += factor * displacement[0];
+    acceleration[1] += factor * displacement[1];
+    acceleration[2] += factor * displacement[2];
+    debug_validate_finite(acceleration);
+  }
+
+  // Both directions of the pair at once (Newton's third law)
+  void operator()(const triple& x_i, const triple& x_j, real scaled_mass_i, real scaled_mass_j,
+                  triple& acceleration_i, triple& acceleration_j) const noexcept
+  {
+    const triple displacement = x_j - x_i;
+
+    const real inverse  = softened_inverse_distance(squared_length(displacement), softening, Kind);
+    const real inverse3 = inverse * (inverse * inverse);
+    const real factor_i = scaled_mass_j * inverse3;
+    const real factor_j = scaled_mass_i * inverse3;
+
+    acceleration_i[0] += factor_i * displacement[0];
+    acceleration_i[1] += factor_i * displacement[1];
+    acceleration_i[2] += factor_i * displacement[2];
+    debug_validate_finite(acceleration_i);
+
+    acceleration_j[0] -= factor_j * displacement[0];
+    acceleration_j[1] -= factor_j * displacement[1];
+    acceleration_j[2] -= factor_j * displacement[2];
+    debug_validate_finite(acceleration_j);
+  }
+
+  // Padded version: |mass_point_j| carries its scaled mass in the 4th lane, that of |acceleration| is left alone.
+  void operator()(const quad& x_i, const quad& mass_point_j, quad& acceleration) const noexcept
+  {
+    quad displacement = mass_point_j - x_i;
+    displacement.w()  = 0;
+
+    const real inverse = softened_inverse_distance(squared_length(displacement), softening, Kind);
+    const real factor  = mass_point_j.w() * inverse * (inverse * inverse);
+
+    acceleration += displacement * factor;
+    debug_validate_finite(to_triple(acceleration));
+  }
+};
+
+// Call |f| with the pairwise_gravity for |kind|, so the loop inside is instantiated (and inlined) once per kind
+template <typename F>
+void with_pairwise_gravity(softening_kind kind, real softening, F&& f)
+{
+  if (kind == softening_kind::plummer)
+    f(pairwise_gravity<softening_kind::plummer>{softening});
+  else
+    f(pairwise_gravity<softening_kind::linear>{softening});
+}
+
+// Both integrators take the same arguments in both phases, so they can be swapped for one another.
+// Phase 1 runs before the accelerations are re-calculated for the new positions, phase 2 after.
+// Updated values are kept in locals rather than read back, as the compiler has to assume that position, velocity
+// and acceleration alias otherwise. 0.5 * dT is exact, so this matches multiplying by 0.5 and dT in turn.
+
+/// Velocity Verlet. Phase 1 needs the acceleration of the previous time step.
+struct velocity_verlet_integrator
+{
+  static constexpr void phase1(triple& position, triple& velocity, const triple& acceleration, real dT) noexcept
+  {
+    // v_{i+1/2} = v_i + 0.5 \times a[i] \times \Delta t
+    const triple half_step = velocity + acceleration * (0.5 * dT);
+    velocity               = half_step;
+
+    // x_{i+1} = x_i + v_{i+1/2} \times \Delta t
+    position += half_step * dT;
+  }
+
+  static constexpr void phase2(const triple& /*position*/, triple& velocity, const triple& acceleration,
+                               real dT) noexcept
+  {
+    // v_{i+1} = v_{i+1/2} + 0.5 \times a_{i+1} \times \Delta t
+    velocity += acceleration * (0.5 * dT);
+  }
+
+  // All bodies at once, through the kernels of active_simd_instruction_set()
+  static void phase1(std::span<triple> positions, std::span<triple> velocities,
+                     std::span<const triple> accelerations, real dT)
+  {
+    integrate_velocity_verlet_phase1(positions, velocities, accelerations, dT);
+  }
+
+  static void phase2(std::span<triple> /*positions*/, std::span<triple> velocities,
+                     std::span<const triple> accelerations, real dT)
+  {
+    integrate_velocity_verlet_phase2(velocities, accelerations, dT);
+  }
+};
+
+/// Leapfrog, i.e. velocity Verlet shifted by half a step. Doesn't need to keep the previous acceleration around.
+struct leapfrog_integrator
+{
+  static constexpr void phase1(triple& position, const triple& velocity, const triple& /*acceleration*/,
+                               real dT) noexcept
+  {
+    // x_{i+1/2} = x_i + 0.5 \times v_{i} \times \Delta t
+    position += velocity * (0.5 * dT);
+  }
+
+  static constexpr void phase2(triple& position, triple& velocity, const triple& acceleration, real dT) noexcept
+  {
+    // v_{i+1} = v_i + a_{i+1/2} \times \Delta t
+    const triple next = velocity + acceleration * dT;
+    velocity          = next;
+
+    // x_{i+1} = x_{i+1/2} + 0.5 \times v_{i+1} \times \Delta t
+    position += next * (0.5 * dT);
+  }
+
+  // All bodies at once, through the kernels of active_simd_instruction_set()
+  static void phase1(std::span<triple> positions, std::span<triple> velocities,
+                     std::span<const triple> /*accelerations*/, real dT)
+  {
+    integrate_leapfrog_phase1(positions, velocities, dT);
+  }
+
+  static void phase2(std::span<triple> positions, std::span<triple> velocities,
+                     std::span<const triple> accelerations, real dT)
+  {
+    integrate_leapfrog_phase2(positions, velocities, accelerations, dT);
+  }
+};
+
+SOLARSIM_NS_END
+
+#endif
@@ -0,0 +1,123 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef SOLARSIM_MERGEDOCTREEBUILDER_HPP
+#define SOLARSIM_MERGEDOCTREEBUILDER_HPP
+
+#include "solarsim/detail/config.hpp"
+
+#if SOLARSIM_HAS_PRAGMA_ONCE
+#  pragma once
+#endif
+
+#include "solarsim/barnes_hut_octree.hpp"
+
+#include <span>
+#include <vector>
+
+SOLARSIM_NS_BEGIN
+
+/// Octree construction from concurrently built partial trees.
+///
+/// The bodies are split into chunks, each of which gets its own partial_barnes_hut_octree with the shared bounds.
+/// These are merged pairwise in a tree reduction, after which the subtrees below |finalize_depth| are finalized
+/// independently. The phases have to be run in order, with all tasks of a phase finished before the next one starts:
+///
+///   prepare(...)                                             [serial]
+///   build_partial(task)      for task < max_num_tasks         [parallel]
+///   merge(round, i)          for i < num_merges(round)        [parallel, once per round < num_merge_rounds]
+///   prepare_finalize()                                       [serial]
+///   finalize_subtree(i)      for i < max_num_subtrees         [parallel]
+///   finalize_top()                                           [serial]
+///   release()                                                [serial]
+///
+/// Task counts are fixed upper bounds, so they can be baked into a sender chain. Excess tasks do nothing.
+class merged_octree_builder
+{
+public:
+  static constexpr std::size_t max_num_tasks       = 16;
+  static constexpr std::size_t num_merge_rounds    = 4; // log2(max_num_tasks)
+  static constexpr std::size_t min_bodies_per_task = 1024;
+
+  // Nodes at this depth are finalized in parallel. 8^2 = 64 subtrees at most.
+  static constexpr std::size_t finalize_depth   = 2;
+  static constexpr std::size_t max_num_subtrees = std::size_t(1) << (3 * finalize_depth);
+
+  static constexpr std::size_t num_merges(std::size_t round) noexcept { return max_num_tasks >> (round + 1); }
+
+  merged_octree_builder() = default;
+
+  /**
+   * Set up a new build. The body spans need to stay valid until release() is called.
+   * @param bounds Bounding box of all bodies.
+   * @param body_positions Positions of the bodies to insert.
+   * @param body_masses Masses of the bodies to insert.
+   * @param num_tasks Number of partial trees to build (at most |max_num_tasks|).
+   */
+  void prepare(const axis_aligned_bounding_box& bounds, std::span<const triple> body_positions,
+               std::span<const real> body_masses, std::size_t num_tasks = max_num_tasks);
+
+  [[nodiscard]] std::size_t num_tasks() const noexcept { return num_tasks_; }
+
+  void build_partial(std::size_t task);
+  void merge(std::size_t round, std::size_t index);
+  void prepare_finalize();
+  void finalize_subtree(std::size_t index);
+  void finalize_top();
+
+  // Used by all trees built from now on
+  void set_opening_criterion(const opening_criterion& criterion) noexcept { criterion_ = criterion; }
+  void set_leaf_options(const octree_leaf_options& options) noexcept { leaf_options_ = options; }
+
+  // Hand out the finished tree. The remaining partial trees keep their memory for the next build.
+  barnes_hut_octree release();
+
+  /**
+   * Run all phases with the given parallel loop.
+   * @param for_each Callable as for_each(count, f), invoking f(i) for all i < count and returning when done.
+   */
+  template <typename ForEach>
+  barnes_hut_octree build(const axis_aligned_bounding_box& bounds, std::span<const triple> body_positions,
+                          std::span<const real> body_masses, ForEach&& for_each)
+  {
+    prepare(bounds, body_positions, body_masses);
+    for_each(num_tasks_, [this](std::size_t task) { build_partial(task); });
+    for (std::size_t round = 0; round != num_merge_rounds; ++round)
+      for_each(num_merges(round), [this, round](std::size_t i) { merge(round, i); });
+    prepare_finalize();
+    for_each(subtree_roots_.size(), [this](std::size_t i) { finalize_subtree(i); });
+    finalize_top();
+    return release();
+  }
+
+  // Single-threaded convenience version
+  barnes_hut_octree build(std::span<const triple> body_positions, std::span<const real> body_masses);
+
+private:
+  axis_aligned_bounding_box bounds_ = {};
+  std::span<const triple> input_positions_;
+  std::span<const real> input_masses_;
+  std::size_t num_tasks_ = 1;
+
+  std::vector<partial_barnes_hut_octree> partial_trees_;
+
+  barnes_hut_octree octree_;
+  opening_criterion criterion_;
+  octree_leaf_options leaf_options_;
+  std::vector<octree_node_index> subtree_roots_;
+};
+
+SOLARSIM_NS_END
+
+#endif
@@ -0,0 +1,158 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef SOLARSIM_MORTONOCTREEBUILDER_HPP
+#define SOLARSIM_MORTONOCTREEBUILDER_HPP
+
+#include "solarsim/detail/config.hpp"
+
+#if SOLARSIM_HAS_PRAGMA_ONCE
+#  pragma once
+#endif
+
+#include "solarsim/barnes_hut_octree.hpp"
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+SOLARSIM_NS_BEGIN
+
+// Interleave the lower 21 bits of x, y and z into a 63-bit Morton (Z-order) key.
+// x ends up in the most significant bit of each 3-bit group, matching the child slot order of our octree nodes.
+std::uint64_t encode_morton_key(std::uint32_t x, std::uint32_t y, std::uint32_t z) noexcept;
+
+/// Bottom-up octree construction over Morton-sorted bodies.
+///
+/// Unlike inserting body after body, every phase here is a set of independent tasks,
+/// so the caller can run them on whatever parallel backend it likes.
+/// The phases have to be run in order, with all tasks of a phase finished before the next one starts:
+///
+///   prepare(...)                                    [serial]
+///   compute_keys(task)        for task < num_tasks() [parallel]
+///   scan_cells()                                    [serial]
+///   scatter_keys(task)        for task < num_tasks() [parallel]
+///   build_cell(cell)          for cell < num_cells   [parallel]
+///   link_cells()                                    [serial]
+///   emit_cell(cell)           for cell < num_cells   [parallel]
+///   release()                                       [serial]
+///
+/// The radix sort is split into a parallel MSD pass over the top |cell_levels| octree levels, followed by
+/// independent LSD sorts of every top-level cell. The subtree of a cell is then built from its sorted range,
+/// with the moments computed on the way back up. Leaves refer to contiguous ranges of the sorted bodies,
+/// and are split just like the ones of insertion-built trees (see octree_leaf_options).
+class morton_octree_builder
+{
+public:
+  // Octree levels covered by the parallel MSD pass. 8^4 = 4096 cells.
+  static constexpr std::size_t cell_levels = 4;
+  static constexpr std::size_t num_cells   = std::size_t(1) << (3 * cell_levels);
+
+  // Levels representable by our 63-bit keys
+  static constexpr std::size_t max_levels = 21;
+
+  // Chunking of the key computation / scatter phases. Each task gets at least |min_bodies_per_task| bodies.
+  static constexpr std::size_t default_num_tasks   = 32;
+  static constexpr std::size_t min_bodies_per_task = 4096;
+
+  morton_octree_builder() = default;
+
+  /**
+   * Set up a new build. The body spans need to stay valid until release() is called.
+   * @param bounds Bounding box of all bodies.
+   * @param body_positions Positions of the bodies to insert.
+   * @param body_masses Masses of the bodies to insert.
+   * @param num_tasks Number of chunks the bodies are split into for the parallel phases.
+   */
+  void prepare(const axis_aligned_bounding_box& bounds, std::span<const triple> body_positions,
+               std::span<const real> body_masses, std::size_t num_tasks);
+
+  [[nodiscard]] std::size_t num_tasks() const noexcept { return num_tasks_; }
+
+  void compute_keys(std::size_t task);
+  void scan_cells();
+  void scatter_keys(std::size_t task);
+  void build_cell(std::size_t cell);
+  void link_cells();
+  void emit_cell(std::size_t cell);
+
+  // Used by all trees built from now on
+  void set_opening_criterion(const opening_criterion& criterion) noexcept { criterion_ = criterion; }
+  // Depths below |cell_levels| or above |max_levels| are clamped.
+  void set_leaf_options(const octree_leaf_options& options) noexcept { leaf_options_ = options; }
+
+  // Hand out the finished tree. Our scratch buffers are kept for the next build.
+  barnes_hut_octree release();
+
+  /**
+   * Run all phases with the given parallel loop.
+   * @param for_each Callable as for_each(count, f), invoking f(i) for all i < count and returning when done.
+   */
+  template <typename ForEach>
+  barnes_hut_octree build(const axis_aligned_bounding_box& bounds, std::span<const triple> body_positions,
+                          std::span<const real> body_masses, std::size_t num_tasks, ForEach&& for_each)
+  {
+    prepare(bounds, body_positions, body_masses, num_tasks);
+    for_each(num_tasks_, [this](std::size_t task) { compute_keys(task); });
+    scan_cells();
+    for_each(num_tasks_, [this](std::size_t task) { scatter_keys(task); });
+    for_each(num_cells, [this](std::size_t cell) { build_cell(cell); });
+    link_cells();
+    for_each(num_cells, [this](std::size_t cell) { emit_cell(cell); });
+    return release();
+  }
+
+  // Single-threaded convenience version
+  barnes_hut_octree build(std::span<const triple> body_positions, std::span<const real> body_masses);
+
+private:
+  [[nodiscard]] std::size_t task_begin(std::size_t task) const noexcept;
+  [[nodiscard]] std::uint32_t region_begin(std::size_t level, std::uint64_t prefix) const noexcept;
+  [[nodiscard]] bool is_region_empty(std::size_t level, std::uint64_t prefix) const noexcept;
+  // Whether the region has few enough bodies to end up in a single leaf
+  [[nodiscard]] bool is_region_leaf(std::size_t level, std::uint64_t prefix) const noexcept;
+
+  octree_node_index build_node(std::vector<barnes_hut_octree_node>& nodes, std::uint32_t begin, std::uint32_t end,
+                               std::size_t level, std::uint64_t prefix);
+  void link_node(octree_node_index index, std::size_t level, std::uint64_t prefix);
+
+  barnes_hut_octree octree_;
+  opening_criterion criterion_;
+  octree_leaf_options leaf_options_;
+
+  std::span<const triple> input_positions_;
+  std::span<const real> input_masses_;
+  std::size_t num_tasks_ = 1;
+
+  // Keys are computed in input order, then scattered into |sorted_keys_| by top-level cell
+  std::vector<std::uint64_t> keys_;
+  std::vector<std::uint64_t> sorted_keys_;
+  std::vector<std::uint32_t> sorted_indices_;
+  // Ping-pong buffers of the per-cell LSD sorts, indexed like |sorted_keys_|
+  std::vector<std::uint64_t> scratch_keys_;
+  std::vector<std::uint32_t> scratch_indices_;
+
+  // Per task histograms / write offsets of the MSD pass, laid out as [task][cell]
+  std::vector<std::uint32_t> cell_histograms_;
+  // Start of each cell in the sorted arrays (num_cells + 1 entries)
+  std::vector<std::uint32_t> cell_offsets_;
+
+  // Subtrees built for each top-level cell and where they end up in the final tree
+  std::vector<std::vector<barnes_hut_octree_node>> cell_nodes_;
+  std::vector<octree_node_index> cell_node_offsets_;
+};
+
+SOLARSIM_NS_END
+
+#endif
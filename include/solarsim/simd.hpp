@@ -0,0 +1,59 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef SOLARSIM_SIMD_HPP
+#define SOLARSIM_SIMD_HPP
+
+#include "solarsim/detail/config.hpp"
+
+#if SOLARSIM_HAS_PRAGMA_ONCE
+#  pragma once
+#endif
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+SOLARSIM_NS_BEGIN
+
+// Instruction sets the SIMD kernels are built for
+enum class simd_instruction_set : std::uint8_t
+{
+  // Plain C++, vectorized by the compiler for the library's baseline ISA
+  portable,
+  avx2,
+  avx512
+};
+
+std::string_view to_string(simd_instruction_set instruction_set) noexcept;
+// Inverse of to_string()
+std::optional<simd_instruction_set> parse_simd_instruction_set(std::string_view name) noexcept;
+
+// Best instruction set the library has kernels for and the CPU supports, as reported by cpuid.
+// This includes checking that the OS saves the wider registers on context switches.
+simd_instruction_set detect_simd_instruction_set() noexcept;
+
+/// Instruction set of the kernels the library uses unless told otherwise (e.g. by direct_sum_kernel's constructor).
+///
+/// Picked on first use: the SOLARSIM_SIMD environment variable if it names one (see to_string()),
+/// detect_simd_instruction_set() otherwise. Either way, instruction sets the CPU lacks are replaced by the best one
+/// it has, and the choice is logged with SOLARSIM_LOG_INFO.
+simd_instruction_set active_simd_instruction_set();
+
+// Override the choice of active_simd_instruction_set(), e.g. from a command line flag. Same fallback as above.
+void set_active_simd_instruction_set(simd_instruction_set instruction_set);
+
+SOLARSIM_NS_END
+
+#endif
@@ -37,6 +37,8 @@ struct simulation_state
   std::vector<real> body_masses;
   real softening_factor;
   std::vector<triple> acceleration;
+  // Only needed for collisions, see collision_merger. Views don't carry them.
+  std::vector<real> body_radii;
 };
 
 template <typename T>
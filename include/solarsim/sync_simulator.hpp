@@ -23,10 +23,19 @@
 
 #include "solarsim/types.hpp"
 #include "solarsim/math.hpp"
+#include "solarsim/barnes_hut_octree.hpp"
+#include "solarsim/direct_sum.hpp"
+#include "solarsim/fmm_octree.hpp"
+#include "solarsim/kd_tree.hpp"
+#include "solarsim/treepm.hpp"
+#include "solarsim/lazy_octree.hpp"
 
 #include <vector>
 #include <span>
+#include <optional>
+#include <type_traits>
 #include <cassert>
+#include <utility>
 
 SOLARSIM_NS_BEGIN
 
@@ -43,8 +52,9 @@ class basic_sync_simulator
 {
 public:
   basic_sync_simulator(std::span<triple> body_positions, std::span<triple> body_velocities,
-                       std::span<const real> body_masses, real softening_factor)
-    : body_positions_(body_positions)
+                       std::span<const real> body_masses, real softening_factor, A algorithm = {})
+    : algorithm_(std::move(algorithm))
+    , body_positions_(body_positions)
     , body_velocities_(body_velocities)
     , body_masses_(body_masses)
     , softening_factor_(softening_factor)
@@ -60,9 +70,21 @@ public:
    */
   void tick(real dT);
 
+  /**
+   * \brief Total (kinetic + potential) energy of the system
+   * Takes O(n^2) time, so it's meant for occasional checks only.
+   */
+  [[nodiscard]] real total_energy() const;
+
+  [[nodiscard]] A& algorithm() noexcept { return algorithm_; }
+  [[nodiscard]] const A& algorithm() const noexcept { return algorithm_; }
+
 private:
   void update_acceleration();
 
+  // Algorithms may keep state (e.g. memory) around between ticks
+  A algorithm_;
+
   // SoA layout is much more cache-friendly and decouples us from the bodies'
   // details we don't need.
   std::span<triple> body_positions_;
@@ -78,32 +100,34 @@ private:
 template <simulation_algorithm A, bool UseShiftedVerlet>
 void basic_sync_simulator<A, UseShiftedVerlet>::tick(real dT)
 {
+  // Velocity verlet needs the previous acceleration, which is why the constructor computes it
+  using integrator = std::conditional_t<UseShiftedVerlet, leapfrog_integrator, velocity_verlet_integrator>;
+
   // Do phase 1 of the time integration
-  if constexpr (UseShiftedVerlet) {
-    for (std::size_t i = 0, n = body_positions_.size(); i != n; ++i)
-      integrate_leapfrog_phase1(body_positions_[i], body_velocities_[i], dT);
-  } else {
-    // needs previous acceleration!
-    for (std::size_t i = 0, n = body_positions_.size(); i != n; ++i)
-      integrate_velocity_verlet_phase1(body_positions_[i], body_velocities_[i], acceleration_[i], dT);
-  }
+  integrator::phase1(body_positions_, body_velocities_, acceleration_, dT);
 
   update_acceleration();
 
   // Do phase 2 of the time integration
-  if constexpr (UseShiftedVerlet) {
-    for (std::size_t i = 0, n = body_positions_.size(); i != n; ++i)
-      integrate_leapfrog_phase2(body_positions_[i], body_velocities_[i], acceleration_[i], dT);
-  } else {
-    for (std::size_t i = 0, n = body_positions_.size(); i != n; ++i)
-      integrate_velocity_verlet_phase2(body_velocities_[i], acceleration_[i], dT);
-  }
+  integrator::phase2(body_positions_, body_velocities_, acceleration_, dT);
 }
 
 template <simulation_algorithm A, bool UseShiftedVerlet>
 void basic_sync_simulator<A, UseShiftedVerlet>::update_acceleration()
 {
-  A().tick(body_positions_, body_masses_, softening_factor_, acceleration_);
+  algorithm_.tick(body_positions_, body_masses_, softening_factor_, acceleration_);
+}
+
+template <simulation_algorithm A, bool UseShiftedVerlet>
+real basic_sync_simulator<A, UseShiftedVerlet>::total_energy() const
+{
+  real energy = 0;
+  for (std::size_t i = 0, n = body_positions_.size(); i != n; ++i) {
+    energy += calculate_kinetic_energy(body_masses_[i], body_velocities_[i]);
+    for (std::size_t j = i + 1; j < n; ++j)
+      energy -= calculate_potential_energy(body_masses_[i], body_masses_[j], body_positions_[i], body_positions_[j]);
+  }
+  return energy;
 }
 
 // Simulation algorithm implementations:
@@ -111,18 +135,162 @@ void basic_sync_simulator<A, UseShiftedVerlet>::update_acceleration()
 struct naive_sync_simulator_impl
 {
   void tick(std::span<const triple> body_positions, std::span<const real> body_masses, real softening_factor,
-            std::span<triple> acceleration) const;
+            std::span<triple> acceleration);
+
+  // Compute the pairwise forces in float32 instead, see force_precision
+  void set_precision(force_precision precision) noexcept { kernel_.set_precision(precision); }
+  [[nodiscard]] force_precision get_precision() const noexcept { return kernel_.get_precision(); }
+  // Soften with Plummer spheres instead, see softening_kind
+  void set_softening_kind(softening_kind kind) noexcept { kernel_.set_softening_kind(kind); }
+  [[nodiscard]] softening_kind get_softening_kind() const noexcept { return kernel_.get_softening_kind(); }
+
+private:
+  direct_sum_kernel kernel_;
 };
 
 struct barnes_hut_sync_simulator_impl
 {
+  barnes_hut_sync_simulator_impl() = default;
+
+  // With |refit_options|, the octree's topology is kept between ticks and only refit, see barnes_hut_octree::refit()
+  explicit barnes_hut_sync_simulator_impl(const opening_criterion& criterion,
+                                          std::optional<octree_refit_options> refit_options = {});
+  explicit barnes_hut_sync_simulator_impl(const octree_refit_options& refit_options)
+    : refit_options_(refit_options)
+  {
+  }
+
+  void tick(std::span<const triple> body_positions, std::span<const real> body_masses, real softening_factor,
+            std::span<triple> acceleration);
+
+  // Can be changed between ticks, e.g. by a theta_controller
+  void set_opening_criterion(const opening_criterion& criterion) { octree_.set_opening_criterion(criterion); }
+  [[nodiscard]] const opening_criterion& get_opening_criterion() const noexcept
+  {
+    return octree_.get_opening_criterion();
+  }
+
+  void set_leaf_options(const octree_leaf_options& options) noexcept
+  {
+    octree_.set_leaf_options(options);
+    lazy_octree_.set_leaf_options(options);
+  }
+
+  // Soften with Plummer spheres instead, see softening_kind
+  void set_softening_kind(softening_kind kind) noexcept
+  {
+    octree_.set_softening_kind(kind);
+    lazy_octree_.set_softening_kind(kind);
+  }
+  [[nodiscard]] softening_kind get_softening_kind() const noexcept { return octree_.get_softening_kind(); }
+
+  // Walk 32-byte nodes with float32 centers of mass instead, see octree_node_format
+  void set_node_format(octree_node_format format) { octree_.set_node_format(format); }
+  [[nodiscard]] octree_node_format get_node_format() const noexcept { return octree_.get_node_format(); }
+
+  // Walk the tree once per group of nearby bodies instead of once per body, see
+  // barnes_hut_octree::recompute_group_accelerations()
+  void set_group_traversal(bool enabled) noexcept { group_traversal_ = enabled; }
+  [[nodiscard]] bool get_group_traversal() const noexcept { return group_traversal_; }
+
+  // Walk the tree with packets of adjacent bodies, one per SIMD lane, see
+  // barnes_hut_octree::recompute_chunk_accelerations(). Group traversal takes precedence.
+  void set_packet_traversal(bool enabled) noexcept { packet_traversal_ = enabled; }
+  [[nodiscard]] bool get_packet_traversal() const noexcept { return packet_traversal_; }
+
+  // Only build the parts of the tree the walks actually open, see lazy_octree.
+  // Takes precedence over refitting and group traversal.
+  void set_lazy_expansion(bool enabled) noexcept { lazy_expansion_ = enabled; }
+  [[nodiscard]] bool get_lazy_expansion() const noexcept { return lazy_expansion_; }
+
+private:
+  // Rebuilt (or refit) every tick, but its node pool is reused.
+  barnes_hut_octree octree_;
+  std::optional<octree_refit_options> refit_options_;
+  bool group_traversal_  = false;
+  bool packet_traversal_ = false;
+
+  lazy_octree lazy_octree_;
+  bool lazy_expansion_ = false;
+};
+
+struct fmm_sync_simulator_impl
+{
+  fmm_sync_simulator_impl() = default;
+  explicit fmm_sync_simulator_impl(const fmm_options& options)
+    : octree_(options)
+  {
+  }
+
+  void tick(std::span<const triple> body_positions, std::span<const real> body_masses, real softening_factor,
+            std::span<triple> acceleration);
+
+  void set_options(const fmm_options& options) { octree_.set_options(options); }
+  [[nodiscard]] const fmm_options& get_options() const noexcept { return octree_.get_options(); }
+
+  // Soften with Plummer spheres instead, see softening_kind
+  void set_softening_kind(softening_kind kind) noexcept { octree_.set_softening_kind(kind); }
+  [[nodiscard]] softening_kind get_softening_kind() const noexcept { return octree_.get_softening_kind(); }
+
+private:
+  // Rebuilt every tick, but its buffers are reused.
+  fmm_octree octree_;
+};
+
+struct kd_tree_sync_simulator_impl
+{
+  kd_tree_sync_simulator_impl() = default;
+  explicit kd_tree_sync_simulator_impl(const kd_tree_options& options, const opening_criterion& criterion = {});
+
+  void tick(std::span<const triple> body_positions, std::span<const real> body_masses, real softening_factor,
+            std::span<triple> acceleration);
+
+  void set_options(const kd_tree_options& options) noexcept { tree_.set_options(options); }
+  [[nodiscard]] const kd_tree_options& get_options() const noexcept { return tree_.get_options(); }
+  void set_opening_criterion(const opening_criterion& criterion) noexcept { tree_.set_opening_criterion(criterion); }
+  [[nodiscard]] const opening_criterion& get_opening_criterion() const noexcept
+  {
+    return tree_.get_opening_criterion();
+  }
+
+  // Soften with Plummer spheres instead, see softening_kind
+  void set_softening_kind(softening_kind kind) noexcept { tree_.set_softening_kind(kind); }
+  [[nodiscard]] softening_kind get_softening_kind() const noexcept { return tree_.get_softening_kind(); }
+
+private:
+  // Rebuilt every tick, but its buffers are reused.
+  kd_tree tree_;
+};
+
+struct treepm_sync_simulator_impl
+{
+  treepm_sync_simulator_impl() = default;
+  explicit treepm_sync_simulator_impl(const treepm_options& options)
+    : solver_(options)
+  {
+  }
+
   void tick(std::span<const triple> body_positions, std::span<const real> body_masses, real softening_factor,
-            std::span<triple> acceleration) const;
+            std::span<triple> acceleration);
+
+  void set_options(const treepm_options& options) { solver_.set_options(options); }
+  [[nodiscard]] const treepm_options& get_options() const noexcept { return solver_.get_options(); }
+
+  // Soften the short-range force with Plummer spheres instead, see softening_kind
+  void set_softening_kind(softening_kind kind) noexcept { solver_.set_softening_kind(kind); }
+  [[nodiscard]] softening_kind get_softening_kind() const noexcept { return solver_.get_softening_kind(); }
+
+private:
+  // Keeps its mesh and Green's function across ticks.
+  treepm_solver solver_;
 };
 
 // Easy-to-use simulator types:
 using naive_sync_simulator      = basic_sync_simulator<naive_sync_simulator_impl>;
 using barnes_hut_sync_simulator = basic_sync_simulator<barnes_hut_sync_simulator_impl>;
+using fmm_sync_simulator        = basic_sync_simulator<fmm_sync_simulator_impl>;
+using kd_tree_sync_simulator    = basic_sync_simulator<kd_tree_sync_simulator_impl>;
+using treepm_sync_simulator     = basic_sync_simulator<treepm_sync_simulator_impl>;
 
 /**
  * \brief Run a complete simulation with a fixed time step and a given duration
@@ -141,6 +309,40 @@ void run_simulation(basic_sync_simulator<A>& simulator, real time_step, real dur
   }
 }
 
+/**
+ * \brief Like run_simulation(), but adapt the Barnes-Hut theta as the simulation goes
+ * Every \c check_interval ticks, the relative energy change since the last check is fed to \c controller.
+ * \param simulator simulation state
+ * \param time_step Time between simulation ticks
+ * \param duration Total runtime of the simulation
+ * \param controller Picks theta from the energy error
+ * \param check_interval Number of ticks between energy checks. Each check takes O(n^2) time!
+ */
+inline void run_simulation(barnes_hut_sync_simulator& simulator, real time_step, real duration,
+                           theta_controller& controller, std::size_t check_interval = 100)
+{
+  assert(time_step <= duration);
+  assert(check_interval > 0);
+
+  opening_criterion criterion = simulator.algorithm().get_opening_criterion();
+  criterion.theta             = controller.theta();
+  simulator.algorithm().set_opening_criterion(criterion);
+
+  const real initial_energy = simulator.total_energy();
+  real previous_energy      = initial_energy;
+  std::size_t ticks         = 0;
+  for (real elapsed = time_step; elapsed < duration; elapsed += time_step) {
+    simulator.tick(time_step);
+    if (++ticks % check_interval != 0 || initial_energy == 0)
+      continue;
+
+    const real energy = simulator.total_energy();
+    criterion.theta   = controller.update(std::abs(energy - previous_energy) / std::abs(initial_energy));
+    simulator.algorithm().set_opening_criterion(criterion);
+    previous_energy = energy;
+  }
+}
+
 SOLARSIM_NS_END
 
 #endif
@@ -0,0 +1,197 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef SOLARSIM_TREEPM_HPP
+#define SOLARSIM_TREEPM_HPP
+
+#include "solarsim/detail/config.hpp"
+
+#if SOLARSIM_HAS_PRAGMA_ONCE
+#  pragma once
+#endif
+
+#include "solarsim/barnes_hut_octree.hpp"
+
+#include <complex>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+SOLARSIM_NS_BEGIN
+
+struct treepm_options
+{
+  // Cells per side of the mesh the bodies are assigned to. Has to be a power of two.
+  // The FFTs run on twice that (zero-padded), so the cost grows like 8 * mesh_size^3.
+  std::uint32_t mesh_size = 64;
+
+  // Force split scale r_s, in cells. Smaller values move work from the tree to the mesh, but the mesh force
+  // gets less accurate once r_s approaches the cell size.
+  real split_scale = 1.25;
+
+  // The tree ignores everything beyond cutoff_scale * r_s, where the short-range force is down to 2% of Newton's.
+  real cutoff_scale = 4.5;
+
+  // Opening criterion of the short-range tree walk
+  opening_criterion criterion;
+};
+
+/// TreePM: Newton's force split into a long-range part computed on a mesh, and a short-range part from a tree.
+///
+/// With the split of calculate_scaled_short_range_acceleration(), the long-range potential is that of all masses
+/// smoothed by a Gaussian of width r_s. It's computed with FFTs on a mesh around the bounding box of all bodies
+/// (particle mesh, PM): mass assignment with cloud-in-cell (CIC), convolution with the long-range Green's function,
+/// 4-point finite differences and CIC interpolation back to the bodies. The mesh is zero-padded to twice its size,
+/// so there are no periodic images. The short-range part falls off quickly beyond r_s, so the tree walk never
+/// opens nodes farther away than a few r_s - in dense datasets, that's a lot less than a full Barnes-Hut walk.
+///
+/// The phases have to be run in order, with all tasks of a phase finished before the next one starts:
+///
+///   prepare(...)                                                  [serial]
+///   transform_plane(x)          for x < mesh_size                 [parallel]
+///   convolve_column(y)          for y < 2 * mesh_size             [parallel]
+///   inverse_transform_plane(x)  for x < mesh_size                 [parallel]
+///   differentiate_plane(x)      for x < mesh_size                 [parallel]
+///   compute_acceleration(body)  for body < body_count()           [parallel]
+class treepm_solver
+{
+public:
+  // Bounds of the FFT length. The padded mesh of the Green's function alone takes 128 * mesh_size^3 bytes.
+  static constexpr std::uint32_t min_mesh_size = 16;
+  static constexpr std::uint32_t max_mesh_size = 512;
+
+  treepm_solver()
+    : treepm_solver(treepm_options())
+  {
+  }
+  explicit treepm_solver(const treepm_options& options);
+
+  // Recomputes the Green's function, so don't call this every tick.
+  void set_options(const treepm_options& options);
+  [[nodiscard]] const treepm_options& get_options() const noexcept { return options_; }
+
+  // Softening of the short-range force, takes effect immediately
+  void set_softening_kind(softening_kind kind) noexcept { tree_.set_softening_kind(kind); }
+  [[nodiscard]] softening_kind get_softening_kind() const noexcept { return tree_.get_softening_kind(); }
+
+  /**
+   * Set up the mesh around the bodies, assign their masses to it and build the short-range tree.
+   * The body spans need to stay valid until the last compute_acceleration().
+   * @param body_positions Positions of all bodies.
+   * @param body_masses Masses of all bodies.
+   */
+  void prepare(std::span<const triple> body_positions, std::span<const real> body_masses);
+
+  void transform_plane(std::size_t x);
+  void convolve_column(std::size_t y);
+  void inverse_transform_plane(std::size_t x);
+  void differentiate_plane(std::size_t x);
+
+  /**
+   * Sum up the long-range (mesh) and short-range (tree) acceleration of one body.
+   * @param body Index of the body in tree order (< body_count()).
+   * @param softening Softening factor of the short-range force. The long-range force doesn't need any.
+   * @param acceleration Acceleration of all bodies. Only |acceleration[body]| is replaced.
+   */
+  void compute_acceleration(std::size_t body, real softening, std::span<triple> acceleration) const;
+
+  /**
+   * Run all phases with the given parallel loop.
+   * @param for_each Callable as for_each(count, f), invoking f(i) for all i < count and returning when done.
+   */
+  template <typename ForEach>
+  void compute_accelerations(std::span<const triple> body_positions, std::span<const real> body_masses,
+                             real softening, std::span<triple> acceleration, ForEach&& for_each)
+  {
+    prepare(body_positions, body_masses);
+    for_each(mesh_size(), [this](std::size_t x) { transform_plane(x); });
+    for_each(padded_size(), [this](std::size_t y) { convolve_column(y); });
+    for_each(mesh_size(), [this](std::size_t x) { inverse_transform_plane(x); });
+    for_each(mesh_size(), [this](std::size_t x) { differentiate_plane(x); });
+    for_each(body_count(), [&](std::size_t body) { compute_acceleration(body, softening, acceleration); });
+  }
+
+  // Single-threaded convenience version
+  void compute_accelerations(std::span<const triple> body_positions, std::span<const real> body_masses,
+                             real softening, std::span<triple> acceleration);
+
+  // Bodies of the last prepare(). All of them are in the tree, massless ones included.
+  [[nodiscard]] std::size_t body_count() const noexcept { return tree_.body_order().size(); }
+
+  [[nodiscard]] std::size_t mesh_size() const noexcept { return options_.mesh_size; }
+  [[nodiscard]] std::size_t padded_size() const noexcept { return 2 * std::size_t(options_.mesh_size); }
+
+  // Edge length of a mesh cell, and the resulting split radius r_s. Valid after prepare().
+  [[nodiscard]] real cell_size() const noexcept { return cell_size_; }
+  [[nodiscard]] real split_radius() const noexcept { return options_.split_scale * cell_size_; }
+
+  [[nodiscard]] std::size_t allocated_bytes() const noexcept
+  {
+    return mesh_.capacity() * sizeof(std::complex<real>) + green_.capacity() * sizeof(real) +
+           forces_.capacity() * sizeof(triple) + twiddles_.capacity() * sizeof(std::complex<real>) +
+           bit_reversal_.capacity() * sizeof(std::uint32_t) + tree_.allocated_bytes();
+  }
+
+private:
+  using complex = std::complex<real>;
+
+  void compute_tables();
+  void compute_green();
+
+  // In-place FFT of |padded_size()| values. The inverse isn't normalized.
+  void transform(complex* line, bool inverse) const noexcept;
+  // Lines along x and y are copied into a buffer for their transforms, a few adjacent ones at once,
+  // so every cache line we touch is used completely. Line i of a block starts at i * padded_size().
+  static constexpr std::size_t lines_per_block = 4;
+  using line_block = std::vector<complex>;
+
+  // One per task, the phases run concurrently
+  [[nodiscard]] line_block make_line_block() const { return line_block(lines_per_block * padded_size()); }
+
+  // Copy |count| values |stride| apart of the lines starting at |first|, |first| + 1, ... into |lines|,
+  // and zero the rest of them
+  void load_lines(std::size_t first, std::size_t stride, std::size_t count, line_block& lines) const noexcept;
+  void store_lines(const line_block& lines, std::size_t first, std::size_t stride, std::size_t count) noexcept;
+
+  [[nodiscard]] std::size_t mesh_index(std::size_t x, std::size_t y, std::size_t z) const noexcept
+  {
+    return (x * padded_size() + y) * padded_size() + z;
+  }
+
+  treepm_options options_;
+
+  // Mass, then potential, on the padded mesh (z fastest). Only the octant x, y, z < mesh_size holds bodies,
+  // and the planes x >= mesh_size are always zero before the x transforms, so we don't store them.
+  std::vector<complex> mesh_;
+  // Spectrum of the long-range Green's function, incl. normalization and CIC deconvolution.
+  // It's even along every axis, so we only keep |k| <= mesh_size, i.e. (mesh_size + 1)^3 values.
+  std::vector<real> green_;
+  // Long-range acceleration at the mesh points
+  std::vector<triple> forces_;
+
+  std::vector<complex> twiddles_;
+  std::vector<std::uint32_t> bit_reversal_;
+
+  // Lower corner of the mesh, i.e. the position of mesh point (0, 0, 0)
+  triple origin_  = {};
+  real cell_size_ = 1;
+
+  std::span<const triple> body_positions_;
+  std::span<const real> body_masses_;
+  barnes_hut_octree tree_;
+};
+
+SOLARSIM_NS_END
+
+#endif
@@ -92,6 +92,29 @@ struct triple
   real v[3];
 };
 
+// A triple padded to 4 lanes and aligned to them: 4 doubles fill an AVX register, and a quad never straddles a cache
+// line. The 4th lane is either padding (0) or belongs with the point, e.g. the mass of a body or node.
+// The arithmetic operators work on all 4 lanes, see make_quad() / to_triple() for the conversions.
+struct alignas(4 * sizeof(real)) quad
+{
+  // subscription operators
+  [[nodiscard]] constexpr real& operator[](std::size_t i) noexcept { return v[i]; }
+  [[nodiscard]] constexpr const real& operator[](std::size_t i) const noexcept { return v[i]; }
+
+  // data() + size() for span<> etc. support
+  [[nodiscard]] constexpr std::size_t size() const noexcept { return 4; }
+  [[nodiscard]] constexpr real* data() noexcept { return v; }
+  [[nodiscard]] constexpr const real* data() const noexcept { return v; }
+
+  // The 4th lane
+  [[nodiscard]] constexpr real& w() noexcept { return v[3]; }
+  [[nodiscard]] constexpr real w() const noexcept { return v[3]; }
+
+  real v[4];
+};
+
+static_assert(sizeof(quad) == 4 * sizeof(real));
+
 // AABBs are very basic axis-aligned collision primitives
 struct axis_aligned_bounding_box
 {
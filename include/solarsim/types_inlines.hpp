@@ -109,6 +109,70 @@ constexpr triple& operator/=(triple& lhs, const triple& rhs)
   return lhs;
 }
 
+constexpr quad make_quad(const triple& xyz, real w = 0)
+{
+  return quad{xyz.v[0], xyz.v[1], xyz.v[2], w};
+}
+constexpr triple to_triple(const quad& xyzw)
+{
+  return triple{xyzw.v[0], xyzw.v[1], xyzw.v[2]};
+}
+
+// Plain loops over all lanes, which the compiler turns into vector instructions
+constexpr quad operator*(const quad& lhs, real rhs)
+{
+  quad result = {};
+  for (std::size_t i = 0; i != 4; ++i)
+    result.v[i] = lhs.v[i] * rhs;
+  return result;
+}
+
+constexpr quad operator+(const quad& lhs, const quad& rhs)
+{
+  quad result = {};
+  for (std::size_t i = 0; i != 4; ++i)
+    result.v[i] = lhs.v[i] + rhs.v[i];
+  return result;
+}
+constexpr quad operator-(const quad& lhs, const quad& rhs)
+{
+  quad result = {};
+  for (std::size_t i = 0; i != 4; ++i)
+    result.v[i] = lhs.v[i] - rhs.v[i];
+  return result;
+}
+constexpr quad operator*(const quad& lhs, const quad& rhs)
+{
+  quad result = {};
+  for (std::size_t i = 0; i != 4; ++i)
+    result.v[i] = lhs.v[i] * rhs.v[i];
+  return result;
+}
+
+constexpr quad operator-(const quad& lhs)
+{
+  return quad{-lhs.v[0], -lhs.v[1], -lhs.v[2], -lhs.v[3]};
+}
+
+constexpr quad& operator*=(quad& lhs, real rhs)
+{
+  for (std::size_t i = 0; i != 4; ++i)
+    lhs.v[i] *= rhs;
+  return lhs;
+}
+constexpr quad& operator+=(quad& lhs, const quad& rhs)
+{
+  for (std::size_t i = 0; i != 4; ++i)
+    lhs.v[i] += rhs.v[i];
+  return lhs;
+}
+constexpr quad& operator-=(quad& lhs, const quad& rhs)
+{
+  for (std::size_t i = 0; i != 4; ++i)
+    lhs.v[i] -= rhs.v[i];
+  return lhs;
+}
+
 constexpr axis_aligned_bounding_box axis_aligned_bounding_box::infinity()
 {
   // min() gives us smallest *normalized* value
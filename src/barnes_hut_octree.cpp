@@ -15,244 +15,1375 @@
 #include "solarsim/barnes_hut_octree.hpp"
 #include "solarsim/math.hpp"
 
+#include "simd_kernels.hpp"
+
 #include <algorithm>
 #include <span>
 #include <cassert>
+#include <cmath>
 
 SOLARSIM_NS_BEGIN
 
-barnes_hut_octree_node& barnes_hut_octree_node::get_child_for_position(const triple& pos) const
+std::size_t barnes_hut_octree_node::get_child_slot(const triple& pos) const noexcept
 {
   // Make really sure we're not called with a position outside this node's bounds!
-  constexpr real epsilon = 0.00001; // Use some hardcoded epsilon to account for inaccuracies.
+  // Use some epsilon to account for inaccuracies. Node bounds are accumulated halvings, so at
+  // parsec-scale coordinates they can be off by a few ULPs - far more than any absolute value.
+  const real magnitude = std::abs(position[0]) + std::abs(position[1]) + std::abs(position[2]) + length;
+  const real epsilon   = 0.00001 + 1e-12 * magnitude;
   assert(pos[0] >= position[0] - epsilon);
   assert(pos[1] >= position[1] - epsilon);
   assert(pos[2] >= position[2] - epsilon);
   assert(pos[0] <= position[0] + length + epsilon);
   assert(pos[1] <= position[1] + length + epsilon);
   assert(pos[2] <= position[2] + length + epsilon);
+  (void)epsilon;
+  (void)magnitude;
 
   const triple center        = position + length / 2;
   const std::size_t offset_x = 4 * static_cast<std::size_t>(pos[0] >= center[0]);
   const std::size_t offset_y = 2 * static_cast<std::size_t>(pos[1] >= center[1]);
   const std::size_t offset_z = 1 * static_cast<std::size_t>(pos[2] >= center[2]);
-  return *children[offset_x + offset_y + offset_z];
+  return offset_x + offset_y + offset_z;
 }
 
-void barnes_hut_octree_node::insert_body(const triple& body_position, real body_mass)
+triple barnes_hut_octree_node::get_child_position(std::size_t slot) const noexcept
 {
-  if (is_leaf()) {
-    if (has_contained_body) {
-      subdivide_node();
+  // This order is special
+  // 1) it alternates between +0 / +half on the Z-axis
+  // 2) these groups of two alternate between +0 / +half on the Y-axis
+  // 3) these groups of four alternate between +0 / +half on the X-axis
+  // see get_child_slot()
+  const real half_length = length / 2;
+  return position + triple{(slot & 4) ? half_length : 0, (slot & 2) ? half_length : 0, (slot & 1) ? half_length : 0};
+}
 
-      // We had a body in the node we just subdivided? place that first!
-      get_child_for_position(contained_body_position).insert_body(contained_body_position, contained_body_mass);
-      has_contained_body = false;
+namespace {
 
-      // Now place what we've been asked to place
-      get_child_for_position(body_position).insert_body(body_position, body_mass);
-    } else {
-      has_contained_body      = true;
-      contained_body_position = body_position;
-      contained_body_mass     = body_mass;
+barnes_hut_octree_node setup_root_node_with_bounds(const axis_aligned_bounding_box& aabb)
+{
+  debug_validate_finite(aabb.min);
+  debug_validate_finite(aabb.max);
+
+  // Find (position, length) that encompasses this AABB
+  // We don't really care about wasting space (i.e. making a larger bounding area than necessary)
+  const triple center = (aabb.min + aabb.max) * 0.5;
+  const triple d      = aabb.max - aabb.min;
+  const real length   = std::max({d[0], d[1], d[2]});
+  assert(std::isfinite(length));
+
+  return barnes_hut_octree_node{center - (length * 0.5), length};
+}
+
+// Of the xyz part of anything indexable like a triple
+template <typename Position>
+axis_aligned_bounding_box bounding_box_of(std::span<const Position> positions)
+{
+  axis_aligned_bounding_box aabb = axis_aligned_bounding_box::infinity();
+  for (const auto& position : positions) {
+    aabb.min[0] = std::min(aabb.min[0], position[0]);
+    aabb.min[1] = std::min(aabb.min[1], position[1]);
+    aabb.min[2] = std::min(aabb.min[2], position[2]);
+
+    aabb.max[0] = std::max(aabb.max[0], position[0]);
+    aabb.max[1] = std::max(aabb.max[1], position[1]);
+    aabb.max[2] = std::max(aabb.max[2], position[2]);
+  }
+  return aabb;
+}
+
+} // namespace
+
+// Not templates themselves, so vectors still convert to the spans
+axis_aligned_bounding_box build_bounding_box(std::span<const triple> positions)
+{
+  return bounding_box_of(positions);
+}
+
+axis_aligned_bounding_box build_bounding_box(std::span<const quad> positions)
+{
+  return bounding_box_of(positions);
+}
+
+partial_barnes_hut_octree::partial_barnes_hut_octree(const axis_aligned_bounding_box& bounds,
+                                                     std::span<const triple> body_positions,
+                                                     std::span<const real> body_masses)
+{
+  rebuild(bounds, body_positions, body_masses);
+}
+
+partial_barnes_hut_octree::partial_barnes_hut_octree(const axis_aligned_bounding_box& bounds)
+{
+  // real setup happens in child classes
+  reset(bounds);
+}
+
+void partial_barnes_hut_octree::rebuild(const axis_aligned_bounding_box& bounds,
+                                        std::span<const triple> body_positions, std::span<const real> body_masses,
+                                        std::uint32_t first_body_id)
+{
+  assert(body_positions.size() == body_masses.size());
+  reset(bounds);
+
+  // Rough upper bound for uniformly distributed bodies - avoids most of the regrowing on the first build.
+  nodes_.reserve(2 * body_positions.size());
+  body_positions_.reserve(body_positions.size());
+  body_masses_.reserve(body_positions.size());
+  body_ids_.reserve(body_positions.size());
+  next_body_.reserve(body_positions.size());
+  for (std::size_t i = 0, n = body_positions.size(); i < n; ++i)
+    insert_body(0, append_body(body_positions[i], body_masses[i], first_body_id + static_cast<std::uint32_t>(i)));
+}
+
+void partial_barnes_hut_octree::insert_body(const triple& body_position, real body_mass)
+{
+  assert(!nodes_.empty());
+  insert_body(0, append_body(body_position, body_mass, static_cast<std::uint32_t>(body_positions_.size())));
+}
+
+void partial_barnes_hut_octree::merge_from(const partial_barnes_hut_octree& other)
+{
+  assert(!nodes_.empty());
+  if (!other.nodes_.empty())
+    merge_from(0, other, 0);
+}
+
+void partial_barnes_hut_octree::reset(const axis_aligned_bounding_box& bounds)
+{
+  // clear() keeps our capacity around
+  nodes_.clear();
+  nodes_.push_back(setup_root_node_with_bounds(bounds));
+  body_positions_.clear();
+  body_masses_.clear();
+  body_ids_.clear();
+  next_body_.clear();
+  min_leaf_length_ = std::ldexp(nodes_[0].length, -static_cast<int>(leaf_options_.max_depth));
+}
+
+octree_node_index partial_barnes_hut_octree::allocate_node(const triple& position, real length)
+{
+  assert(nodes_.size() < invalid_octree_node_index);
+  const auto index = static_cast<octree_node_index>(nodes_.size());
+  nodes_.emplace_back(position, length);
+  return index;
+}
+
+octree_node_index partial_barnes_hut_octree::get_or_create_child(octree_node_index index, std::size_t slot)
+{
+  if (nodes_[index].has_child(slot))
+    return nodes_[index].children[slot];
+
+  // Careful: allocate_node() invalidates all references into |nodes_|
+  const barnes_hut_octree_node& parent = nodes_[index];
+  const octree_node_index child        = allocate_node(parent.get_child_position(slot), parent.length / 2);
+
+  barnes_hut_octree_node& node = nodes_[index];
+  node.children[slot]          = child;
+  node.child_mask              = static_cast<std::uint8_t>(node.child_mask | (1u << slot));
+  return child;
+}
+
+octree_node_index partial_barnes_hut_octree::copy_subtree(const partial_barnes_hut_octree& other,
+                                                          octree_node_index other_index)
+{
+  const barnes_hut_octree_node& source = other.nodes_[other_index];
+
+  const octree_node_index index = allocate_node(source.position, source.length);
+  nodes_[index]                 = source;
+  if (source.body_count != 0) {
+    nodes_[index].body_count = 0;
+    other.for_each_leaf_body(source, [&](std::uint32_t i) {
+      add_leaf_body(nodes_[index], append_body(other.body_positions_[i], other.body_masses_[i], other.body_ids_[i]));
+    });
+  }
+  for (std::size_t slot = 0; slot != 8; ++slot) {
+    if (source.has_child(slot)) {
+      const octree_node_index child = copy_subtree(other, source.children[slot]);
+      nodes_[index].children[slot]  = child;
     }
+  }
+  return index;
+}
+
+std::uint32_t partial_barnes_hut_octree::append_body(const triple& body_position, real body_mass,
+                                                     std::uint32_t body_id)
+{
+  assert(body_positions_.size() < std::numeric_limits<std::uint32_t>::max());
+  const auto body = static_cast<std::uint32_t>(body_positions_.size());
+  body_positions_.push_back(body_position);
+  body_masses_.push_back(body_mass);
+  body_ids_.push_back(body_id);
+  next_body_.push_back(body);
+  return body;
+}
+
+void partial_barnes_hut_octree::add_leaf_body(barnes_hut_octree_node& node, std::uint32_t body) noexcept
+{
+  next_body_[body] = node.first_body;
+  node.first_body  = body;
+  ++node.body_count;
+}
+
+void partial_barnes_hut_octree::remove_leaf_body(barnes_hut_octree_node& node, std::uint32_t body) noexcept
+{
+  assert(node.body_count != 0);
+  if (node.first_body == body) {
+    node.first_body = next_body_[body];
   } else {
-    get_child_for_position(body_position).insert_body(body_position, body_mass);
+    std::uint32_t previous = node.first_body;
+    while (next_body_[previous] != body)
+      previous = next_body_[previous];
+    next_body_[previous] = next_body_[body];
   }
-  total_mass += body_mass;
+  --node.body_count;
 }
 
-void barnes_hut_octree_node::merge_from(barnes_hut_octree_node&& other)
+void partial_barnes_hut_octree::insert_body(octree_node_index index, std::uint32_t body)
 {
-  assert(almost_equal_ulps(other.position, position));
-  assert(almost_equal_ulps(other.length, length));
+  const triple& body_position = body_positions_[body];
+  const real body_mass        = body_masses_[body];
 
-  if (!is_leaf()) {
-    // Simple case: We're both branches - just merge our children
-    if (!other.is_leaf()) {
-      real new_total_mass = 0;
-      for (int i = 0; i < 8; ++i) {
-        children[i]->merge_from(std::move(*other.children[i]));
-        new_total_mass += children[i]->total_mass;
-      }
-      total_mass = new_total_mass;
+  for (;;) {
+    nodes_[index].total_mass += body_mass;
+
+    if (!nodes_[index].is_leaf()) {
+      index = get_or_create_child(index, nodes_[index].get_child_slot(body_position));
+      continue;
+    }
+
+    // Room left, or too deep to split any further?
+    barnes_hut_octree_node& node = nodes_[index];
+    if (node.body_count < leaf_options_.max_bodies || node.length <= min_leaf_length_) {
+      add_leaf_body(node, body);
       return;
     }
 
-    // Still the easiest path - just get the correct child and insert there.
-    insert_body(other.contained_body_position, other.contained_body_mass);
-    return;
+    // Now place what we've been asked to place (we're no longer a leaf)
+    split_leaf(index);
+    index = get_or_create_child(index, nodes_[index].get_child_slot(body_position));
   }
+}
+
+void partial_barnes_hut_octree::split_leaf(octree_node_index index)
+{
+  assert(nodes_[index].length > min_leaf_length_);
+  barnes_hut_octree_node& node = nodes_[index];
+  std::uint32_t body           = node.first_body;
+  std::uint32_t count          = node.body_count;
+  node.body_count              = 0;
 
-  if (other.is_leaf()) {
-    insert_body(other.contained_body_position, other.contained_body_mass);
+  // At most |max_bodies| bodies end up in the same child, so this doesn't split any further.
+  for (; count != 0; --count) {
+    const std::uint32_t next = next_body_[body];
+    insert_body(get_or_create_child(index, nodes_[index].get_child_slot(body_positions_[body])), body);
+    body = next;
+  }
+}
+
+void partial_barnes_hut_octree::merge_from(octree_node_index index, const partial_barnes_hut_octree& other,
+                                           octree_node_index other_index)
+{
+  const barnes_hut_octree_node& other_node = other.nodes_[other_index];
+  assert(almost_equal_ulps(other_node.position, nodes_[index].position));
+  assert(almost_equal_ulps(other_node.length, nodes_[index].length));
+
+  if (other_node.is_leaf()) {
+    // Easiest path - just get the correct child and insert there.
+    other.for_each_leaf_body(other_node, [&](std::uint32_t i) {
+      insert_body(index, append_body(other.body_positions_[i], other.body_masses_[i], other.body_ids_[i]));
+    });
     return;
   }
 
-  children = std::move(other.children);
+  // We had bodies in the node we're about to turn into a branch? place them first!
+  if (nodes_[index].body_count != 0)
+    split_leaf(index);
 
-  // We had a body in the node we just subdivided? place that first!
-  get_child_for_position(contained_body_position).insert_body(contained_body_position, contained_body_mass);
-  has_contained_body = false;
+  // Now we're both branches (or we're empty) - merge our children
+  for (std::size_t slot = 0; slot != 8; ++slot) {
+    if (!other_node.has_child(slot))
+      continue;
 
-  total_mass += other.total_mass;
+    if (nodes_[index].has_child(slot)) {
+      merge_from(nodes_[index].children[slot], other, other_node.children[slot]);
+    } else {
+      const octree_node_index child = copy_subtree(other, other_node.children[slot]);
+      barnes_hut_octree_node& node  = nodes_[index];
+      node.children[slot]           = child;
+      node.child_mask               = static_cast<std::uint8_t>(node.child_mask | (1u << slot));
+    }
+  }
+  nodes_[index].total_mass += other_node.total_mass;
 }
 
-template <typename F>
-void barnes_hut_octree_node::recursively_apply_node_gravity(const triple& body_position, real softening,
-                                                            F&& apply_gravity) const
+void partial_barnes_hut_octree::finalize(octree_node_index index)
 {
-  constexpr real theta = 0.5;
+  const barnes_hut_octree_node& node = nodes_[index];
+  for (std::size_t slot = 0; slot != 8; ++slot) {
+    if (node.has_child(slot))
+      finalize(node.children[slot]);
+  }
+  update_moments(index);
+}
 
-  const real distance_to_center = ::solarsim::length(center_of_mass - body_position) + softening;
-  if (length / distance_to_center < theta) {
-    // It's far enough away that our approximation is sufficient.
-    apply_gravity(center_of_mass, total_mass);
+void partial_barnes_hut_octree::finalize_top(octree_node_index index, std::size_t depth)
+{
+  if (depth == 0)
     return;
+
+  const barnes_hut_octree_node& node = nodes_[index];
+  for (std::size_t slot = 0; slot != 8; ++slot) {
+    if (node.has_child(slot))
+      finalize_top(node.children[slot], depth - 1);
   }
+  update_moments(index);
+}
 
-  // Leaf nodes apply their body's force
-  if (is_leaf()) {
-    if (has_contained_body) {
-      apply_gravity(contained_body_position, contained_body_mass);
+void partial_barnes_hut_octree::update_moments(octree_node_index index)
+{
+  barnes_hut_octree_node& node = nodes_[index];
+  triple mass_centers_sum      = {};
+  real total_mass              = 0;
+  if (node.is_leaf()) {
+    for_each_leaf_body(node, [&](std::uint32_t i) {
+      mass_centers_sum += body_positions_[i] * body_masses_[i];
+      total_mass += body_masses_[i];
+    });
+  } else {
+    for (std::size_t slot = 0; slot != 8; ++slot) {
+      if (node.has_child(slot)) {
+        const barnes_hut_octree_node& child = nodes_[node.children[slot]];
+        mass_centers_sum += child.center_of_mass * child.total_mass;
+        total_mass += child.total_mass;
+      }
     }
+  }
+  node.total_mass = total_mass;
+  if (total_mass <= 0) {
+    // Leaves emptied by barnes_hut_octree::refit(), or nodes holding only massless bodies
+    node.center_of_mass = node.position + node.length / 2;
     return;
   }
 
-  // Otherwise, descend into our children
-  for (auto& child : children) {
-    if (!child->is_leaf() || child->has_contained_body)
-      child->recursively_apply_node_gravity(body_position, softening, std::forward<F>(apply_gravity));
+  node.center_of_mass = mass_centers_sum / total_mass;
+  debug_validate_finite(node.center_of_mass);
+}
+
+void partial_barnes_hut_octree::collect_nodes_at_depth(octree_node_index index, std::size_t depth,
+                                                       std::vector<octree_node_index>& nodes) const
+{
+  if (depth == 0) {
+    nodes.push_back(index);
+    return;
+  }
+
+  const barnes_hut_octree_node& node = nodes_[index];
+  for (std::size_t slot = 0; slot != 8; ++slot) {
+    if (node.has_child(slot))
+      collect_nodes_at_depth(node.children[slot], depth - 1, nodes);
+  }
+}
+
+barnes_hut_octree::barnes_hut_octree(const axis_aligned_bounding_box& bounds, std::span<const triple> body_positions,
+                                     std::span<const real> body_masses)
+{
+  rebuild(bounds, body_positions, body_masses);
+}
+
+barnes_hut_octree::barnes_hut_octree(const axis_aligned_bounding_box& bounds,
+                                     std::span<barnes_hut_octree> partial_trees)
+  : partial_barnes_hut_octree(bounds)
+{
+  if (!partial_trees.empty()) {
+    set_leaf_options(partial_trees.front().get_leaf_options());
+    reset(bounds);
+  }
+
+  // Merge all other trees into this one.
+  for (auto& tree : partial_trees) {
+    if (!tree.nodes_.empty())
+      merge_from(0, tree, 0);
+  }
+
+  finalize(0);
+  linearize();
+}
+
+barnes_hut_octree::barnes_hut_octree(std::span<const triple> body_positions, std::span<const real> body_masses)
+  : barnes_hut_octree(build_bounding_box(body_positions), body_positions, body_masses)
+{
+}
+
+void barnes_hut_octree::rebuild(const axis_aligned_bounding_box& bounds, std::span<const triple> body_positions,
+                                std::span<const real> body_masses)
+{
+  body_leaves_.clear();
+  partial_barnes_hut_octree::rebuild(bounds, body_positions, body_masses);
+  finalize(0);
+  linearize();
+}
+
+void barnes_hut_octree::rebuild(std::span<const triple> body_positions, std::span<const real> body_masses)
+{
+  rebuild(build_bounding_box(body_positions), body_positions, body_masses);
+}
+
+namespace {
+
+bool is_inside(const barnes_hut_octree_node& node, const triple& pos) noexcept
+{
+  // Upper bounds are inclusive, bodies sitting exactly on a face may stay where they are.
+  return pos[0] >= node.position[0] && pos[1] >= node.position[1] && pos[2] >= node.position[2] &&
+         pos[0] <= node.position[0] + node.length && pos[1] <= node.position[1] + node.length &&
+         pos[2] <= node.position[2] + node.length;
+}
+
+} // namespace
+
+bool barnes_hut_octree::refit(std::span<const triple> body_positions, std::span<const real> body_masses,
+                              const octree_refit_options& options)
+{
+  assert(body_positions.size() == body_masses.size());
+  const std::size_t n = body_positions.size();
+  if (n == 0) {
+    nodes_.clear();
+    body_positions_.clear();
+    body_masses_.clear();
+    body_ids_.clear();
+    next_body_.clear();
+    body_leaves_.clear();
+    linearize();
+    return true;
+  }
+
+  if (body_leaves_.size() != n) {
+    rebuild_for_refit(body_positions, body_masses, options);
+    return true;
+  }
+
+  // Bodies must not leave the root, and it shouldn't be much larger than necessary either.
+  const axis_aligned_bounding_box bounds = build_bounding_box(body_positions);
+  const triple extent                    = bounds.max - bounds.min;
+  const barnes_hut_octree_node& root     = nodes_[0];
+  if (!is_inside(root, bounds.min) || !is_inside(root, bounds.max) ||
+      std::max({extent[0], extent[1], extent[2]}) < options.min_bounds_fill * root.length) {
+    rebuild_for_refit(body_positions, body_masses, options);
+    return true;
+  }
+
+  // Take the bodies that left their leaf out of the tree. Their old leaves stay around, empty.
+  std::size_t moved = 0;
+  for (std::uint32_t i = 0; i != n; ++i) {
+    body_positions_[i] = body_positions[i];
+    body_masses_[i]    = body_masses[i];
+
+    barnes_hut_octree_node& leaf = nodes_[body_leaves_[i]];
+    if (!is_inside(leaf, body_positions[i])) {
+      remove_leaf_body(leaf, i);
+      body_leaves_[i] = invalid_octree_node_index;
+      ++moved;
+    }
   }
+
+  moved_since_rebuild_ += moved;
+  if (static_cast<real>(moved_since_rebuild_) > options.max_moved_fraction * static_cast<real>(n)) {
+    rebuild_for_refit(body_positions, body_masses, options);
+    return true;
+  }
+
+  if (moved != 0) {
+    for (std::uint32_t i = 0; i != n; ++i) {
+      if (body_leaves_[i] == invalid_octree_node_index)
+        insert_body(0, i);
+    }
+  }
+
+  // Recomputes all moments (insert_body()'s mass bookkeeping is overwritten) and finds the bodies' new leaves.
+  refit_node(0);
+  linearize();
+  return false;
+}
+
+void barnes_hut_octree::rebuild_for_refit(std::span<const triple> body_positions, std::span<const real> body_masses,
+                                          const octree_refit_options& options)
+{
+  axis_aligned_bounding_box bounds = build_bounding_box(body_positions);
+  const triple extent              = bounds.max - bounds.min;
+  const real margin                = std::max({extent[0], extent[1], extent[2]}) * options.bounds_margin;
+  bounds.min = bounds.min - margin;
+  bounds.max = bounds.max + margin;
+
+  // Insertion keeps the bodies in input order, so body i is body_positions_[i] from here on.
+  partial_barnes_hut_octree::rebuild(bounds, body_positions, body_masses);
+  body_leaves_.assign(body_positions.size(), invalid_octree_node_index);
+  moved_since_rebuild_ = 0;
+  refit_node(0);
+  linearize();
 }
 
-void barnes_hut_octree_node::finalize()
+void barnes_hut_octree::refit_node(octree_node_index index)
 {
-  if (is_leaf()) {
-    if (has_contained_body)
-      center_of_mass = contained_body_position * contained_body_mass;
+  const barnes_hut_octree_node& node = nodes_[index];
+  if (node.is_leaf()) {
+    for_each_leaf_body(node, [&](std::uint32_t i) { body_leaves_[i] = index; });
   } else {
-    triple mass_centers_sum = {};
-    for (auto& child : children) {
-      if (!child->is_leaf() || child->has_contained_body) {
-        child->finalize();
-        mass_centers_sum += child->center_of_mass * child->total_mass;
+    for (std::size_t slot = 0; slot != 8; ++slot) {
+      if (node.has_child(slot))
+        refit_node(node.children[slot]);
+    }
+  }
+  update_moments(index);
+}
+
+void barnes_hut_octree::linearize()
+{
+  compact_nodes_.clear();
+  wide_nodes_.clear();
+  linear_nodes_.clear();
+  linear_bodies_.clear();
+  linear_body_ids_.clear();
+  linear_quadrupoles_.clear();
+  linear_body_bounds_.clear();
+  groups_.clear();
+  if (nodes_.empty())
+    return;
+
+  linear_nodes_.reserve(nodes_.size());
+  if constexpr (octree_multipole_order >= 2)
+    linear_quadrupoles_.reserve(nodes_.size());
+  linear_bodies_.reserve(body_positions_.size());
+  linear_body_ids_.reserve(body_ids_.size());
+  linearize_node(0);
+  if (linear_bodies_.empty()) {
+    linear_nodes_.clear();
+    linear_quadrupoles_.clear();
+    return;
+  }
+  compute_body_bounds();
+  compute_groups();
+  if (node_format_ == octree_node_format::compact)
+    compact();
+  else if (node_format_ == octree_node_format::wide)
+    widen();
+}
+
+void barnes_hut_octree::linearize_node(octree_node_index index)
+{
+  const barnes_hut_octree_node& node = nodes_[index];
+  const auto linear_index            = static_cast<std::uint32_t>(linear_nodes_.size());
+  const auto first_body              = static_cast<std::uint32_t>(linear_bodies_.size());
+
+  // Opening test: size / distance < theta <=> distance^2 > (size / theta)^2
+  real size = node.length;
+  if (criterion_.type == opening_criterion::kind::bmax) {
+    // Distance to the farthest corner
+    triple farthest = {};
+    for (std::size_t axis = 0; axis != 3; ++axis) {
+      farthest[axis] = std::max(node.center_of_mass[axis] - node.position[axis],
+                                node.position[axis] + node.length - node.center_of_mass[axis]);
+    }
+    size = ::solarsim::length(farthest);
+  }
+  const real critical_radius = size / criterion_.theta;
+  linear_nodes_.push_back({make_quad(node.center_of_mass, gravitational_constant * node.total_mass),
+                           critical_radius * critical_radius, node.length * node.length});
+  if constexpr (octree_multipole_order >= 2)
+    linear_quadrupoles_.emplace_back();
+
+  if (node.is_leaf()) {
+    for_each_leaf_body(node, [this](std::uint32_t i) {
+      linear_bodies_.push_back(make_quad(body_positions_[i], gravitational_constant * body_masses_[i]));
+      linear_body_ids_.push_back(body_ids_[i]);
+    });
+  } else {
+    for (std::size_t slot = 0; slot != 8; ++slot) {
+      if (!node.has_child(slot))
+        continue;
+
+      // Massless subtrees stay, their bodies still need accelerations. Empty ones (see refit()) are dropped.
+      const std::size_t child_nodes  = linear_nodes_.size();
+      const std::size_t child_bodies = linear_bodies_.size();
+      linearize_node(node.children[slot]);
+      if (linear_bodies_.size() == child_bodies) {
+        linear_nodes_.resize(child_nodes);
+        if constexpr (octree_multipole_order >= 2)
+          linear_quadrupoles_.resize(child_nodes);
+      }
+    }
+  }
+
+  linear_octree_node& linear_node = linear_nodes_[linear_index];
+  linear_node.next                = static_cast<std::uint32_t>(linear_nodes_.size());
+  linear_node.first_body          = first_body;
+  linear_node.body_count          = static_cast<std::uint32_t>(linear_bodies_.size()) - first_body;
+
+  if constexpr (octree_multipole_order >= 2) {
+    // Our bodies' or children's moments (parallel axis theorem) - both are in place by now.
+    quadrupole_moment& quadrupole = linear_quadrupoles_[linear_index];
+    const triple center_of_mass   = to_triple(linear_node.mass_point);
+    if (linear_node.is_leaf(linear_index)) {
+      for (std::uint32_t i = first_body, end = first_body + linear_node.body_count; i != end; ++i)
+        add_point_quadrupole(to_triple(linear_bodies_[i]) - center_of_mass, linear_bodies_[i].w(), quadrupole);
+    } else {
+      for (std::uint32_t child = linear_index + 1; child != linear_node.next; child = linear_nodes_[child].next) {
+        const linear_octree_node& child_node      = linear_nodes_[child];
+        const quadrupole_moment& child_quadrupole = linear_quadrupoles_[child];
+        for (std::size_t i = 0; i != quadrupole.size(); ++i)
+          quadrupole[i] += child_quadrupole[i];
+        add_point_quadrupole(to_triple(child_node.mass_point) - center_of_mass, child_node.mass_point.w(),
+                             quadrupole);
       }
     }
-    center_of_mass = mass_centers_sum / total_mass;
-    debug_validate_finite(center_of_mass);
   }
 }
 
-void barnes_hut_octree_node::subdivide_node()
+void barnes_hut_octree::compact()
 {
-  assert(is_leaf());          // can't divide a non-leaf
-  assert(has_contained_body); // why else would subdivide?
+  compact_nodes_.reserve(linear_nodes_.size() + 1);
+  compact_lengths_squared_.clear();
+  compact_root_center_ = to_triple(linear_nodes_[0].mass_point);
+  if (!compact_node(0, 0, compact_root_center_)) {
+    compact_nodes_.clear();
+    return;
+  }
 
-  // This order is special
-  // 1) it alternates between +0 / +half on the Z-axis
-  // 2) these groups of two alternate between +0 / +half on the Y-axis
-  // 3) these groups of four alternate between +0 / +half on the X-axis
-  // see get_child_node()
-  const real half_length        = length / 2;
-  const triple child_offsets[8] = {
-      triple{          0,           0,           0},
-      triple{          0,           0, half_length},
+  // Sentinel, so the last leaf knows where its bodies end
+  compact_octree_node& sentinel = compact_nodes_.emplace_back();
+  sentinel.first_body           = static_cast<std::uint32_t>(linear_bodies_.size());
+}
+
+bool barnes_hut_octree::compact_node(std::uint32_t index, std::uint32_t depth, const triple& parent_center)
+{
+  if (depth >= max_compact_depth)
+    return false;
+
+  // Same order as |linear_nodes_|, so indices (and |next|) stay the same.
+  const linear_octree_node& node = linear_nodes_[index];
+  const triple offset            = to_triple(node.mass_point) - parent_center;
+  compact_octree_node& compact   = compact_nodes_.emplace_back();
+  compact.center_offset = {static_cast<float>(offset[0]), static_cast<float>(offset[1]), static_cast<float>(offset[2])};
+  compact.total_mass    = static_cast<float>(node.mass_point.w());
+  compact.critical_radius_squared = static_cast<float>(node.critical_radius_squared);
+  compact.depth                   = depth;
+  compact.next                    = node.next;
+  compact.first_body              = node.first_body;
+  if (compact_lengths_squared_.size() == depth)
+    compact_lengths_squared_.push_back(node.length_squared);
+
+  // What the walk will decode - our children's offsets are relative to this.
+  const triple center = parent_center + triple{compact.center_offset[0], compact.center_offset[1],
+                                               compact.center_offset[2]};
+  for (std::uint32_t child = index + 1; child != node.next; child = linear_nodes_[child].next) {
+    if (!compact_node(child, depth + 1, center))
+      return false;
+  }
+  return true;
+}
+
+void barnes_hut_octree::widen()
+{
+  // A wide node above the root, so the walk doesn't need to special-case it
+  wide_nodes_.emplace_back();
+  if (!widen_child(0, 0, 0, 0))
+    wide_nodes_.clear();
+}
+
+bool barnes_hut_octree::widen_child(std::uint32_t parent, std::uint32_t slot, std::uint32_t index, std::uint32_t depth)
+{
+  const linear_octree_node& node = linear_nodes_[index];
+  {
+    // Our recursion below reallocates |wide_nodes_|, so don't keep this reference around.
+    wide_octree_node& wide             = wide_nodes_[parent];
+    wide.x[slot]                       = node.mass_point[0];
+    wide.y[slot]                       = node.mass_point[1];
+    wide.z[slot]                       = node.mass_point[2];
+    wide.total_mass[slot]              = node.mass_point.w();
+    wide.critical_radius_squared[slot] = node.critical_radius_squared;
+    wide.length_squared[slot]          = node.length_squared;
+    wide.linear_index[slot]            = index;
+    wide.first_body[slot]              = node.first_body;
+    wide.body_count[slot]              = node.body_count;
+    wide.children[slot]                = wide_octree_node::no_children;
+    wide.child_count                   = slot + 1;
+  }
+  if (node.is_leaf(index))
+    return true;
+  if (depth >= max_compact_depth)
+    return false;
+
+  const auto wide_index              = static_cast<std::uint32_t>(wide_nodes_.size());
+  wide_nodes_[parent].children[slot] = wide_index;
+  wide_nodes_.emplace_back();
+
+  std::uint32_t child_slot = 0;
+  for (std::uint32_t child = index + 1; child != node.next; child = linear_nodes_[child].next) {
+    if (!widen_child(wide_index, child_slot++, child, depth + 1))
+      return false;
+  }
+  return true;
+}
+
+void barnes_hut_octree::compute_groups()
+{
+  const auto count = static_cast<std::uint32_t>(linear_nodes_.size());
+  for (std::uint32_t index = 0; index < count;) {
+    const linear_octree_node& node = linear_nodes_[index];
+    if (node.body_count > max_group_size) {
+      ++index;
+      continue;
+    }
+
+    // Small enough - this subtree's bodies are contiguous and make up one group.
+    const std::span<const quad> bodies(linear_bodies_.data() + node.first_body, node.body_count);
+    const axis_aligned_bounding_box bounds = build_bounding_box(bodies);
+    const triple center                    = (bounds.min + bounds.max) * 0.5;
+    groups_.push_back({center, ::solarsim::length(bounds.max - center), node.first_body, node.body_count});
+    index = node.next;
+  }
+}
+
+void barnes_hut_octree::compute_body_bounds()
+{
+  // Children come after their parents, so going backwards we always have them done already
+  linear_body_bounds_.resize(linear_nodes_.size());
+  for (auto index = static_cast<std::uint32_t>(linear_nodes_.size()); index-- != 0;) {
+    const linear_octree_node& node = linear_nodes_[index];
+    if (node.is_leaf(index)) {
+      linear_body_bounds_[index] =
+          build_bounding_box(std::span<const quad>(linear_bodies_.data() + node.first_body, node.body_count));
+      continue;
+    }
+
+    axis_aligned_bounding_box bounds = axis_aligned_bounding_box::infinity();
+    for (std::uint32_t child = index + 1; child != node.next; child = linear_nodes_[child].next) {
+      const axis_aligned_bounding_box& child_bounds = linear_body_bounds_[child];
+      for (std::size_t axis = 0; axis != 3; ++axis) {
+        bounds.min[axis] = std::min(bounds.min[axis], child_bounds.min[axis]);
+        bounds.max[axis] = std::max(bounds.max[axis], child_bounds.max[axis]);
+      }
+    }
+    linear_body_bounds_[index] = bounds;
+  }
+}
+
+template <typename F, typename M>
+void barnes_hut_octree::apply_node_gravity(const triple& center, real radius, real previous_acceleration,
+                                           F&& apply_gravity, M&& apply_multipoles) const
+{
+  // Separate loops for all kinds of tests, so the common one stays as simple as possible.
+  // is_far_enough(critical_radius_squared, length_squared, total_mass, distance_squared)
+  auto walk_linear = [&](auto&& get_distance_squared, auto&& is_far_enough) {
+    const linear_octree_node* nodes = linear_nodes_.data();
+    const auto count                = static_cast<std::uint32_t>(linear_nodes_.size());
+    for (std::uint32_t index = 0; index < count;) {
+      const linear_octree_node& node = nodes[index];
+
+      // We continue with either the next node (sequential, so the hardware prefetcher has it) or skip the subtree.
+      SOLARSIM_PREFETCH(nodes + node.next);
+
+      const triple center_of_mass = to_triple(node.mass_point);
+      if (is_far_enough(node.critical_radius_squared, node.length_squared, node.mass_point.w(),
+                        get_distance_squared(center_of_mass))) {
+        // It's far enough away that our approximation is sufficient.
+        apply_gravity(center_of_mass, node.mass_point.w());
+        if constexpr (octree_multipole_order >= 2)
+          apply_multipoles(index, center_of_mass);
+        index = node.next;
+      } else if (node.is_leaf(index)) {
+        // Leaf nodes apply their bodies' force
+        for (std::uint32_t i = node.first_body, end = node.first_body + node.body_count; i != end; ++i)
+          apply_gravity(to_triple(linear_bodies_[i]), linear_bodies_[i].w());
+        index = node.next;
+      } else {
+        // Otherwise, descend into our children
+        ++index;
+      }
+    }
+  };
+
+  // Same as walk_linear(), but with the centers of mass decoded on the way down
+  auto walk_compact = [&](auto&& get_distance_squared, auto&& is_far_enough) {
+    const compact_octree_node* nodes = compact_nodes_.data();
+    const auto count                 = static_cast<std::uint32_t>(compact_nodes_.size() - 1);
+
+    // Center of mass of the last node we descended into at each depth, i.e. our current ancestors
+    std::array<triple, max_compact_depth + 1> parent_centers;
+    parent_centers[0] = compact_root_center_;
+
+    for (std::uint32_t index = 0; index < count;) {
+      const compact_octree_node& node = nodes[index];
+      SOLARSIM_PREFETCH(nodes + node.next);
+
+      const triple center_of_mass =
+          parent_centers[node.depth] + triple{node.center_offset[0], node.center_offset[1], node.center_offset[2]};
+      const real total_mass = node.total_mass;
+      if (is_far_enough(node.critical_radius_squared, compact_lengths_squared_[node.depth], total_mass,
+                        get_distance_squared(center_of_mass))) {
+        apply_gravity(center_of_mass, total_mass);
+        if constexpr (octree_multipole_order >= 2)
+          apply_multipoles(index, center_of_mass);
+        index = node.next;
+      } else if (node.next == index + 1) {
+        for (std::uint32_t i = node.first_body, end = nodes[node.next].first_body; i != end; ++i)
+          apply_gravity(to_triple(linear_bodies_[i]), linear_bodies_[i].w());
+        index = node.next;
+      } else {
+        parent_centers[node.depth + 1] = center_of_mass;
+        ++index;
+      }
+    }
+  };
+
+  // Depth first with an explicit stack of wide nodes, testing all children of a node at once
+  auto walk_wide = [&](auto&& get_distance_squared, auto&& is_far_enough) {
+    constexpr std::size_t width   = wide_octree_node::width;
+    const wide_octree_node* nodes = wide_nodes_.data();
 
-      triple{          0, half_length,           0},
-      triple{          0, half_length, half_length},
+    // Every node we pop pushes at most |width| children, one of which is popped next.
+    std::array<std::uint32_t, (width - 1) * (max_compact_depth + 1) + 1> stack;
+    std::size_t stack_size = 0;
+    stack[stack_size++]    = 0;
 
-      triple{half_length,           0,           0},
-      triple{half_length,           0, half_length},
+    while (stack_size != 0) {
+      const wide_octree_node& node = nodes[stack[--stack_size]];
 
-      triple{half_length, half_length,           0},
-      triple{half_length, half_length, half_length},
+      // Fixed-size loop, so this ends up as vector code
+      bool far_enough[width];
+      for (std::size_t slot = 0; slot != width; ++slot) {
+        far_enough[slot] =
+            is_far_enough(node.critical_radius_squared[slot], node.length_squared[slot], node.total_mass[slot],
+                          get_distance_squared(triple{node.x[slot], node.y[slot], node.z[slot]}));
+      }
+
+      for (std::uint32_t slot = 0; slot != node.child_count; ++slot) {
+        if (far_enough[slot]) {
+          const triple center_of_mass = {node.x[slot], node.y[slot], node.z[slot]};
+          apply_gravity(center_of_mass, node.total_mass[slot]);
+          if constexpr (octree_multipole_order >= 2)
+            apply_multipoles(node.linear_index[slot], center_of_mass);
+        } else if (node.children[slot] == wide_octree_node::no_children) {
+          for (std::uint32_t i = node.first_body[slot], end = i + node.body_count[slot]; i != end; ++i)
+            apply_gravity(to_triple(linear_bodies_[i]), linear_bodies_[i].w());
+        } else {
+          SOLARSIM_PREFETCH(nodes + node.children[slot]);
+          stack[stack_size++] = node.children[slot];
+        }
+      }
+    }
   };
 
-  for (std::size_t index = 0; index != 8; ++index) {
-    children[index] = std::make_unique<barnes_hut_octree_node>(position + child_offsets[index], half_length);
+  auto walk = [&](auto&& get_distance_squared, auto&& is_far_enough) {
+    if (!compact_nodes_.empty())
+      walk_compact(get_distance_squared, is_far_enough);
+    else if (!wide_nodes_.empty())
+      walk_wide(get_distance_squared, is_far_enough);
+    else
+      walk_linear(get_distance_squared, is_far_enough);
+  };
+
+  auto walk_with_criterion = [&](auto&& get_distance_squared) {
+    if (criterion_.type == opening_criterion::kind::relative_acceleration && previous_acceleration > 0) {
+      // Accept: G * M * l^2 <= alpha * |a| * d^4
+      const real threshold = criterion_.alpha * previous_acceleration;
+      walk(get_distance_squared,
+           [threshold](real /*critical_radius_squared*/, real length_squared, real total_mass, real distance_squared) {
+             // The center of mass is somewhere inside the node, so 3 l^2 (the squared diagonal) keeps us from
+             // accepting nodes that contain the body.
+             return distance_squared > 3 * length_squared &&
+                    total_mass * length_squared <= threshold * distance_squared * distance_squared;
+           });
+    } else {
+      walk(get_distance_squared, [](real critical_radius_squared, real, real, real distance_squared) {
+        return distance_squared > critical_radius_squared;
+      });
+    }
+  };
+
+  if (radius > 0) {
+    // Distance to the closest point of the sphere. Centers of mass inside it are never accepted.
+    walk_with_criterion([&](const triple& center_of_mass) {
+      const real distance = ::solarsim::length(center_of_mass - center) - radius;
+      return distance > 0 ? distance * distance : real(0);
+    });
+  } else {
+    walk_with_criterion([&](const triple& center_of_mass) { return squared_length(center_of_mass - center); });
   }
 }
 
+void barnes_hut_octree::set_opening_criterion(const opening_criterion& criterion)
+{
+  assert(criterion.theta > 0);
+  criterion_ = criterion;
+  linearize();
+}
+
+void barnes_hut_octree::set_node_format(octree_node_format format)
+{
+  node_format_ = format;
+  compact_nodes_.clear();
+  wide_nodes_.clear();
+  if (linear_nodes_.empty())
+    return;
+  if (format == octree_node_format::compact)
+    compact();
+  else if (format == octree_node_format::wide)
+    widen();
+}
+
 namespace {
 
-barnes_hut_octree_node setup_root_node_with_bounds(const axis_aligned_bounding_box& aabb)
+// Point masses a single body's walk interacts with, evaluated a few SIMD widths at a time by the accumulate_list
+// kernel of active_simd_instruction_set(). Unlike octree_interaction_list, it lives on the stack.
+class body_interaction_buffer
 {
-  debug_validate_finite(aabb.min);
-  debug_validate_finite(aabb.max);
+public:
+  body_interaction_buffer(const triple& body_position, real softening, softening_kind kind, triple& acceleration)
+    : body_position_(body_position)
+    , softening_(softening)
+    , acceleration_(acceleration)
+    , accumulate_list_(
+          get_body_kernels(active_simd_instruction_set()).accumulate_list[kind == softening_kind::plummer ? 1 : 0])
+  {
+  }
 
-  // Find (position, length) that encompasses this AABB
-  // We don't really care about wasting space (i.e. making a larger bounding area than necessary)
-  const triple center = (aabb.min + aabb.max) * 0.5;
-  const triple d      = aabb.max - aabb.min;
-  const real length   = std::max({d[0], d[1], d[2]});
-  assert(std::isfinite(length));
+  void push_back(const triple& position, real scaled_mass)
+  {
+    x_[size_]    = position[0];
+    y_[size_]    = position[1];
+    z_[size_]    = position[2];
+    mass_[size_] = scaled_mass;
+    if (++size_ == capacity)
+      flush();
+  }
 
-  return barnes_hut_octree_node{center - (length * 0.5), length};
-}
+  // Evaluate what's left, padded like octree_interaction_list::pad()
+  void flush()
+  {
+    constexpr real far_away = 1e100;
+    if (size_ == 0)
+      return;
+    for (; size_ % soa_lane_count != 0; ++size_) {
+      x_[size_] = y_[size_] = z_[size_] = far_away;
+      mass_[size_]                      = 0;
+    }
+    accumulate_list_(body_position_, x_, y_, z_, mass_, size_, softening_, acceleration_);
+    size_ = 0;
+  }
+
+private:
+  static constexpr std::size_t capacity = 8 * soa_lane_count;
+
+  const triple& body_position_;
+  real softening_;
+  triple& acceleration_;
+  void (*accumulate_list_)(const triple& x_i, const real* x_j, const real* y_j, const real* z_j,
+                           const real* scaled_mass_j, std::size_t count, real softening, triple& acceleration);
+
+  alignas(64) real x_[capacity];
+  alignas(64) real y_[capacity];
+  alignas(64) real z_[capacity];
+  alignas(64) real mass_[capacity];
+  std::size_t size_ = 0;
+};
 
 } // namespace
 
-axis_aligned_bounding_box build_bounding_box(std::span<const triple> positions)
+void barnes_hut_octree::apply_forces_to(const triple& body_position, real softening, triple& acceleration) const
 {
-  axis_aligned_bounding_box aabb = axis_aligned_bounding_box::infinity();
-  for (const auto& position : positions) {
-    aabb.min[0] = std::min(aabb.min[0], position[0]);
-    aabb.min[1] = std::min(aabb.min[1], position[1]);
-    aabb.min[2] = std::min(aabb.min[2], position[2]);
+  body_interaction_buffer buffer(body_position, softening, softening_kind_, acceleration);
+  apply_node_gravity(
+      body_position, 0, 0, [&buffer](const triple& position, real mass) { buffer.push_back(position, mass); },
+      [&](std::uint32_t index, const triple& center_of_mass) {
+        calculate_scaled_quadrupole_acceleration(body_position, center_of_mass, linear_quadrupoles_[index],
+                                                 acceleration);
+      });
+  buffer.flush();
+  debug_validate_finite(acceleration);
+}
 
-    aabb.max[0] = std::max(aabb.max[0], position[0]);
-    aabb.max[1] = std::max(aabb.max[1], position[1]);
-    aabb.max[2] = std::max(aabb.max[2], position[2]);
+void barnes_hut_octree::recompute_acceleration(const triple& body_position, real softening, triple& acceleration) const
+{
+  const real previous_acceleration =
+      criterion_.type == opening_criterion::kind::relative_acceleration ? ::solarsim::length(acceleration) : 0;
+  acceleration = {};
+
+  body_interaction_buffer buffer(body_position, softening, softening_kind_, acceleration);
+  apply_node_gravity(
+      body_position, 0, previous_acceleration,
+      [&buffer](const triple& position, real mass) { buffer.push_back(position, mass); },
+      [&](std::uint32_t index, const triple& center_of_mass) {
+        calculate_scaled_quadrupole_acceleration(body_position, center_of_mass, linear_quadrupoles_[index],
+                                                 acceleration);
+      });
+  buffer.flush();
+  debug_validate_finite(acceleration);
+}
+
+std::size_t barnes_hut_octree::count_interactions(const triple& body_position) const
+{
+  std::size_t count = 0;
+  apply_node_gravity(
+      body_position, 0, 0, [&count](const triple&, real) { ++count; }, [](std::uint32_t, const triple&) {});
+  return count;
+}
+
+void barnes_hut_octree::apply_short_range_forces_to(const triple& body_position, real softening, real split_radius,
+                                                    real cutoff, triple& acceleration) const
+{
+  const real cutoff_squared       = cutoff * cutoff;
+  const linear_octree_node* nodes = linear_nodes_.data();
+  const auto count                = static_cast<std::uint32_t>(linear_nodes_.size());
+  for (std::uint32_t index = 0; index < count;) {
+    const linear_octree_node& node = nodes[index];
+    SOLARSIM_PREFETCH(nodes + node.next);
+
+    const triple center_of_mass = to_triple(node.mass_point);
+    const triple displacement   = center_of_mass - body_position;
+    const real distance_squared = squared_length(displacement);
+    if (distance_squared > node.critical_radius_squared) {
+      // Far enough for its monopole, if it's within the cutoff at all
+      if (distance_squared <= cutoff_squared) {
+        calculate_scaled_short_range_acceleration(body_position, center_of_mass, node.mass_point.w(), softening,
+                                                  softening_kind_, split_radius, acceleration);
+      }
+      index = node.next;
+      continue;
+    }
+
+    // The center of mass is inside the node, so its bodies are at most one side length away along every axis.
+    const real reach = cutoff + std::sqrt(node.length_squared);
+    if (std::max({std::abs(displacement[0]), std::abs(displacement[1]), std::abs(displacement[2])}) > reach) {
+      index = node.next;
+    } else if (node.is_leaf(index)) {
+      for (std::uint32_t i = node.first_body, end = node.first_body + node.body_count; i != end; ++i) {
+        const triple position = to_triple(linear_bodies_[i]);
+        if (squared_length(position - body_position) <= cutoff_squared) {
+          calculate_scaled_short_range_acceleration(body_position, position, linear_bodies_[i].w(), softening,
+                                                    softening_kind_, split_radius, acceleration);
+        }
+      }
+      index = node.next;
+    } else {
+      ++index;
+    }
   }
-  return aabb;
 }
 
-partial_barnes_hut_octree::partial_barnes_hut_octree(const axis_aligned_bounding_box& bounds,
-                                                     std::span<const triple> body_positions,
-                                                     std::span<const real> body_masses)
-  : root_(setup_root_node_with_bounds(bounds))
+void barnes_hut_octree::recompute_group_acceleration(std::size_t group_index, real softening,
+                                                     std::span<triple> acceleration,
+                                                     octree_interaction_list& list) const
 {
-  assert(body_positions.size() == body_masses.size());
-  for (std::size_t i = 0, n = body_positions.size(); i < n; ++i)
-    root_.insert_body(body_positions[i], body_masses[i]);
+  const octree_body_group& group = groups_[group_index];
+  const std::uint32_t end        = group.first_body + group.body_count;
+
+  // Relative criteria have to satisfy the group's weakest field
+  real previous_acceleration = 0;
+  if (criterion_.type == opening_criterion::kind::relative_acceleration) {
+    previous_acceleration = std::numeric_limits<real>::max();
+    for (std::uint32_t i = group.first_body; i != end; ++i)
+      previous_acceleration = std::min(previous_acceleration, ::solarsim::length(acceleration[linear_body_ids_[i]]));
+  }
+
+  list.clear();
+  apply_node_gravity(
+      group.center, group.radius, previous_acceleration,
+      [&list](const triple& position, real mass) { list.push_back(position, mass); },
+      [&list](std::uint32_t index, const triple& center_of_mass) { list.push_back_node(index, center_of_mass); });
+  list.pad();
+
+  for (std::uint32_t i = group.first_body; i != end; ++i) {
+    const triple position     = to_triple(linear_bodies_[i]);
+    triple& body_acceleration = acceleration[linear_body_ids_[i]];
+    body_acceleration         = {};
+    calculate_scaled_acceleration_soa(position, list.x.data(), list.y.data(), list.z.data(), list.mass.data(),
+                                      list.size(), softening, softening_kind_, body_acceleration);
+    for (std::size_t node = 0; node != list.nodes.size(); ++node) {
+      calculate_scaled_quadrupole_acceleration(position, list.node_centers[node],
+                                               linear_quadrupoles_[list.nodes[node]], body_acceleration);
+    }
+  }
 }
 
-partial_barnes_hut_octree::partial_barnes_hut_octree(const axis_aligned_bounding_box& bounds)
-  : root_(setup_root_node_with_bounds(bounds))
+void barnes_hut_octree::recompute_group_accelerations(real softening, std::span<triple> acceleration) const
 {
-  // real setup happens in child classes
+  octree_interaction_list list;
+  for (std::size_t group = 0; group != groups_.size(); ++group)
+    recompute_group_acceleration(group, softening, acceleration, list);
 }
 
-barnes_hut_octree::barnes_hut_octree(const axis_aligned_bounding_box& bounds, std::span<const triple> body_positions,
-                                     std::span<const real> body_masses)
-  : partial_barnes_hut_octree(bounds, body_positions, body_masses)
+void barnes_hut_octree::apply_forces_to(std::span<const triple> body_positions, real softening,
+                                        std::span<triple> acceleration) const
 {
-  root_.finalize();
+  assert(body_positions.size() == acceleration.size());
+  for (std::size_t first = 0, n = body_positions.size(); first < n; first += packet_size) {
+    const std::size_t count = std::min(packet_size, n - first);
+    apply_packet_forces(body_positions.subspan(first, count), {}, softening, softening_kind_,
+                        acceleration.subspan(first, count));
+  }
 }
 
-barnes_hut_octree::barnes_hut_octree(const axis_aligned_bounding_box& bounds,
-                                     std::span<barnes_hut_octree> partial_trees)
-  : partial_barnes_hut_octree(bounds)
+void barnes_hut_octree::apply_packet_forces(std::span<const triple> body_positions,
+                                            std::span<const real> previous_accelerations, real softening,
+                                            softening_kind kind, std::span<triple> acceleration) const
+{
+  assert(!body_positions.empty() && body_positions.size() <= packet_size);
+  assert(previous_accelerations.empty() || previous_accelerations.size() == body_positions.size());
+  if (linear_nodes_.empty())
+    return;
+
+  // Lane-wise copies of the bodies. Missing lanes repeat the last one, so they never open anything on their own.
+  real x[packet_size];
+  real y[packet_size];
+  real z[packet_size];
+  for (std::size_t lane = 0; lane != packet_size; ++lane) {
+    const triple& position = body_positions[std::min(lane, body_positions.size() - 1)];
+    x[lane]                = position[0];
+    y[lane]                = position[1];
+    z[lane]                = position[2];
+  }
+
+  real sum_x[packet_size] = {};
+  real sum_y[packet_size] = {};
+  real sum_z[packet_size] = {};
+  std::array<triple, packet_size> multipole_sum = {};
+
+  // Masked pairwise_gravity of |count| mass points for all lanes, |mask| being 0 or 1
+  const auto accumulate_packet =
+      get_body_kernels(active_simd_instruction_set()).accumulate_packet[kind == softening_kind::plummer ? 1 : 0];
+  auto accumulate = [&](const quad* mass_points, std::size_t count, const real* mask) {
+    accumulate_packet(x, y, z, mass_points, count, mask, softening, sum_x, sum_y, sum_z);
+  };
+
+  // Lanes that accepted a node sit out its subtree, i.e. until the walk reaches the node's |next|.
+  // is_far_enough(lane, node, distance_squared), see apply_node_gravity()
+  auto walk = [&](auto&& is_far_enough) {
+    std::uint32_t skip_until[packet_size] = {};
+    real accepts[packet_size];
+    real opens[packet_size];
+
+    const linear_octree_node* nodes = linear_nodes_.data();
+    const auto count                = static_cast<std::uint32_t>(linear_nodes_.size());
+    for (std::uint32_t index = 0; index < count;) {
+      const linear_octree_node& node = nodes[index];
+      SOLARSIM_PREFETCH(nodes + node.next);
+
+      real any_accepts = 0;
+      real any_opens   = 0;
+      for (std::size_t lane = 0; lane != packet_size; ++lane) {
+        const real active = index >= skip_until[lane] ? 1 : 0;
+        const real dx     = node.mass_point[0] - x[lane];
+        const real dy     = node.mass_point[1] - y[lane];
+        const real dz     = node.mass_point[2] - z[lane];
+        accepts[lane]     = active * (is_far_enough(lane, node, dx * dx + dy * dy + dz * dz) ? 1 : 0);
+        opens[lane]       = active - accepts[lane];
+        skip_until[lane]  = accepts[lane] != 0 ? node.next : skip_until[lane];
+        any_accepts += accepts[lane];
+        any_opens += opens[lane];
+      }
+
+      if (any_accepts != 0) {
+        accumulate(&node.mass_point, 1, accepts);
+        if constexpr (octree_multipole_order >= 2) {
+          for (std::size_t lane = 0; lane != packet_size; ++lane) {
+            if (accepts[lane] != 0) {
+              calculate_scaled_quadrupole_acceleration({x[lane], y[lane], z[lane]}, to_triple(node.mass_point),
+                                                       linear_quadrupoles_[index], multipole_sum[lane]);
+            }
+          }
+        }
+      }
+
+      if (any_opens == 0) {
+        index = node.next;
+      } else if (node.is_leaf(index)) {
+        accumulate(linear_bodies_.data() + node.first_body, node.body_count, opens);
+        index = node.next;
+      } else {
+        ++index;
+      }
+    }
+  };
+
+  if (criterion_.type == opening_criterion::kind::relative_acceleration && !previous_accelerations.empty()) {
+    // Per-lane version of apply_node_gravity()'s test. Lanes without a previous acceleration (threshold 0) stay
+    // geometric, like single-body walks do.
+    real thresholds[packet_size];
+    for (std::size_t lane = 0; lane != packet_size; ++lane)
+      thresholds[lane] = criterion_.alpha * previous_accelerations[std::min(lane, body_positions.size() - 1)];
+    walk([&thresholds](std::size_t lane, const linear_octree_node& node, real distance_squared) {
+      if (thresholds[lane] <= 0)
+        return distance_squared > node.critical_radius_squared;
+      return distance_squared > 3 * node.length_squared &&
+             node.mass_point.w() * node.length_squared <= thresholds[lane] * distance_squared * distance_squared;
+    });
+  } else {
+    walk([](std::size_t, const linear_octree_node& node, real distance_squared) {
+      return distance_squared > node.critical_radius_squared;
+    });
+  }
+
+  for (std::size_t lane = 0; lane != body_positions.size(); ++lane) {
+    acceleration[lane] += triple{sum_x[lane], sum_y[lane], sum_z[lane]} + multipole_sum[lane];
+    debug_validate_finite(acceleration[lane]);
+  }
+}
+
+void barnes_hut_octree::recompute_chunk_accelerations(std::size_t chunk, real softening,
+                                                      std::span<triple> acceleration) const
 {
-  // Destructively merge all other trees into this one.
-  for (auto& tree : partial_trees)
-    root_.merge_from(std::move(tree.root_));
+  const std::size_t first = chunk * packet_chunk_size;
+  assert(first < linear_bodies_.size());
+  const std::size_t count = std::min(packet_chunk_size, linear_bodies_.size() - first);
+
+  std::array<triple, packet_chunk_size> chunk_positions;
+  for (std::size_t i = 0; i != count; ++i)
+    chunk_positions[i] = to_triple(linear_bodies_[first + i]);
 
-  root_.finalize();
+  // What recompute_acceleration() would take from |acceleration| for relative criteria
+  std::array<real, packet_chunk_size> previous_accelerations;
+  const bool relative = criterion_.type == opening_criterion::kind::relative_acceleration;
+  if (relative) {
+    for (std::size_t i = 0; i != count; ++i)
+      previous_accelerations[i] = ::solarsim::length(acceleration[linear_body_ids_[first + i]]);
+  }
+
+  std::array<triple, packet_chunk_size> chunk_acceleration = {};
+  for (std::size_t packet = 0; packet < count; packet += packet_size) {
+    const std::size_t packet_count = std::min(packet_size, count - packet);
+    apply_packet_forces(std::span(chunk_positions).subspan(packet, packet_count),
+                        relative ? std::span<const real>(previous_accelerations).subspan(packet, packet_count)
+                                 : std::span<const real>(),
+                        softening, softening_kind_, std::span(chunk_acceleration).subspan(packet, packet_count));
+  }
+  for (std::size_t i = 0; i != count; ++i)
+    acceleration[linear_body_ids_[first + i]] = chunk_acceleration[i];
 }
 
-barnes_hut_octree::barnes_hut_octree(std::span<const triple> body_positions, std::span<const real> body_masses)
-  : barnes_hut_octree(build_bounding_box(body_positions), body_positions, body_masses)
+theta_controller::theta_controller(real target_energy_error, real min_theta, real max_theta, real initial_theta)
+  : target_energy_error_(target_energy_error)
+  , min_theta_(min_theta)
+  , max_theta_(max_theta)
+  , theta_(std::clamp(initial_theta, min_theta, max_theta))
 {
+  assert(target_energy_error > 0);
+  assert(0 < min_theta && min_theta <= max_theta);
 }
 
-void barnes_hut_octree::apply_forces_to(const triple& body_position, real softening, triple& acceleration) const
+real theta_controller::update(real energy_error) noexcept
 {
-  auto apply_gravity = [&](const triple& node_position, real node_mass) {
-    calculate_acceleration(body_position, node_position, node_mass, softening, acceleration);
-  };
-  root_.recursively_apply_node_gravity(body_position, softening, apply_gravity);
+  // error ~ theta^2 => theta_new = theta * sqrt(target / error). Limit the step, energy errors are noisy.
+  constexpr real max_decrease = 0.5;
+  constexpr real max_increase = 1.25;
+
+  const real factor = energy_error > 0 ? std::clamp(std::sqrt(target_energy_error_ / energy_error), max_decrease,
+                                                    max_increase)
+                                       : max_increase;
+  theta_ = std::clamp(theta_ * factor, min_theta_, max_theta_);
+  return theta_;
+}
+
+namespace {
+
+// Bounds of the squared distance between |point| and any point of |bounds|
+real min_distance_squared(const axis_aligned_bounding_box& bounds, const triple& point) noexcept
+{
+  real sum = 0;
+  for (std::size_t axis = 0; axis != 3; ++axis) {
+    const real distance = std::max({bounds.min[axis] - point[axis], point[axis] - bounds.max[axis], real(0)});
+    sum += distance * distance;
+  }
+  return sum;
+}
+
+real max_distance_squared(const axis_aligned_bounding_box& bounds, const triple& point) noexcept
+{
+  real sum = 0;
+  for (std::size_t axis = 0; axis != 3; ++axis) {
+    const real distance = std::max(point[axis] - bounds.min[axis], bounds.max[axis] - point[axis]);
+    sum += distance * distance;
+  }
+  return sum;
+}
+
+// Max-heap order, so the farthest of the current candidates is at the front
+bool is_closer(const octree_neighbor& a, const octree_neighbor& b) noexcept
+{
+  return a.distance_squared < b.distance_squared;
+}
+
+} // namespace
+
+void barnes_hut_octree::find_bodies_in_radius(const triple& center, real radius,
+                                              std::vector<std::uint32_t>& bodies) const
+{
+  const real radius_squared = radius * radius;
+  const auto count          = static_cast<std::uint32_t>(linear_nodes_.size());
+  for (std::uint32_t index = 0; index < count;) {
+    const linear_octree_node& node = linear_nodes_[index];
+    const axis_aligned_bounding_box& bounds = linear_body_bounds_[index];
+    if (min_distance_squared(bounds, center) > radius_squared) {
+      index = node.next;
+    } else if (max_distance_squared(bounds, center) <= radius_squared) {
+      // Entirely inside, and the bodies of a subtree are contiguous
+      bodies.insert(bodies.end(), linear_body_ids_.begin() + node.first_body,
+                    linear_body_ids_.begin() + node.first_body + node.body_count);
+      index = node.next;
+    } else if (node.is_leaf(index)) {
+      for (std::uint32_t i = node.first_body, end = node.first_body + node.body_count; i != end; ++i) {
+        if (squared_length(to_triple(linear_bodies_[i]) - center) <= radius_squared)
+          bodies.push_back(linear_body_ids_[i]);
+      }
+      index = node.next;
+    } else {
+      ++index;
+    }
+  }
+}
+
+void barnes_hut_octree::find_nearest_bodies(const triple& point, std::size_t k,
+                                            std::vector<octree_neighbor>& neighbors) const
+{
+  neighbors.clear();
+  if (k == 0 || linear_nodes_.empty())
+    return;
+
+  // |neighbors| is a max-heap of the best candidates so far while we search
+  neighbors.reserve(std::min(k, linear_body_ids_.size()));
+  find_nearest_bodies(0, point, k, neighbors);
+  std::sort_heap(neighbors.begin(), neighbors.end(), is_closer);
+}
+
+void barnes_hut_octree::find_nearest_bodies(std::uint32_t index, const triple& point, std::size_t k,
+                                            std::vector<octree_neighbor>& neighbors) const
+{
+  const linear_octree_node& node = linear_nodes_[index];
+  if (node.is_leaf(index)) {
+    for (std::uint32_t i = node.first_body, end = node.first_body + node.body_count; i != end; ++i) {
+      const octree_neighbor candidate = {linear_body_ids_[i], squared_length(to_triple(linear_bodies_[i]) - point)};
+      if (neighbors.size() < k) {
+        neighbors.push_back(candidate);
+        std::push_heap(neighbors.begin(), neighbors.end(), is_closer);
+      } else if (is_closer(candidate, neighbors.front())) {
+        std::pop_heap(neighbors.begin(), neighbors.end(), is_closer);
+        neighbors.back() = candidate;
+        std::push_heap(neighbors.begin(), neighbors.end(), is_closer);
+      }
+    }
+    return;
+  }
+
+  // Closest children first, so the heap fills up with good candidates early and we can skip more of the others
+  std::array<std::pair<real, std::uint32_t>, 8> children;
+  std::size_t child_count = 0;
+  for (std::uint32_t child = index + 1; child != node.next; child = linear_nodes_[child].next)
+    children[child_count++] = {min_distance_squared(linear_body_bounds_[child], point), child};
+  std::sort(children.begin(), children.begin() + static_cast<std::ptrdiff_t>(child_count));
+
+  for (std::size_t i = 0; i != child_count; ++i) {
+    if (neighbors.size() == k && children[i].first >= neighbors.front().distance_squared)
+      break;
+    find_nearest_bodies(children[i].second, point, k, neighbors);
+  }
 }
 
 SOLARSIM_NS_END
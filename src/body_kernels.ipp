@@ -0,0 +1,166 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// The body_kernels, included once by each of body_kernels*.cpp. Those are compiled for different instruction sets,
+// so everything in here has internal linkage, and the integrators of math_inlines.hpp are spelled out again
+// instead of being called (see simd_kernels.hpp). The arithmetic is the same, so are the results (up to FMA).
+
+#include "simd_kernels.hpp"
+
+#include "solarsim/math.hpp"
+
+#include <cmath>
+
+SOLARSIM_NS_BEGIN
+
+namespace {
+
+template <softening_kind Kind>
+void accumulate_list(const triple& x_i, const real* x_j, const real* y_j, const real* z_j, const real* scaled_mass_j,
+                     std::size_t count, real softening, triple& acceleration)
+{
+  const real softening_squared = softening * softening;
+
+  // One accumulator per lane. The fixed-size inner loops are what the compiler turns into vector code.
+  real sum_x[soa_lane_count] = {};
+  real sum_y[soa_lane_count] = {};
+  real sum_z[soa_lane_count] = {};
+  for (std::size_t j = 0; j != count; j += soa_lane_count) {
+    for (std::size_t lane = 0; lane != soa_lane_count; ++lane) {
+      const real dx               = x_j[j + lane] - x_i.v[0];
+      const real dy               = y_j[j + lane] - x_i.v[1];
+      const real dz               = z_j[j + lane] - x_i.v[2];
+      const real squared_distance = dx * dx + dy * dy + dz * dz;
+      // softened_inverse_distance(), spelled out like the integrators
+      real inverse;
+      if constexpr (Kind == softening_kind::plummer)
+        inverse = 1 / std::sqrt(squared_distance + softening_squared);
+      else
+        inverse = 1 / (std::sqrt(squared_distance) + softening);
+      const real factor = scaled_mass_j[j + lane] * inverse * (inverse * inverse);
+      sum_x[lane] += factor * dx;
+      sum_y[lane] += factor * dy;
+      sum_z[lane] += factor * dz;
+    }
+  }
+
+  real sum[3] = {};
+  for (std::size_t lane = 0; lane != soa_lane_count; ++lane) {
+    sum[0] += sum_x[lane];
+    sum[1] += sum_y[lane];
+    sum[2] += sum_z[lane];
+  }
+  for (std::size_t axis = 0; axis != 3; ++axis)
+    acceleration.v[axis] += sum[axis];
+}
+
+template <softening_kind Kind>
+void accumulate_packet(const real* x, const real* y, const real* z, const quad* mass_points, std::size_t count,
+                       const real* mask, real softening, real* sum_x, real* sum_y, real* sum_z)
+{
+  const real softening_squared = softening * softening;
+
+  // Local sums, the compiler can't know that they don't alias the inputs
+  real packet_x[soa_lane_count];
+  real packet_y[soa_lane_count];
+  real packet_z[soa_lane_count];
+  for (std::size_t lane = 0; lane != soa_lane_count; ++lane) {
+    packet_x[lane] = sum_x[lane];
+    packet_y[lane] = sum_y[lane];
+    packet_z[lane] = sum_z[lane];
+  }
+
+  for (std::size_t j = 0; j != count; ++j) {
+    const quad& point = mass_points[j];
+    for (std::size_t lane = 0; lane != soa_lane_count; ++lane) {
+      const real dx               = point.v[0] - x[lane];
+      const real dy               = point.v[1] - y[lane];
+      const real dz               = point.v[2] - z[lane];
+      const real squared_distance = dx * dx + dy * dy + dz * dz;
+      // Masked lanes might be at the point, keep them from dividing by zero. A select would be
+      // more obvious, but GCC doesn't vectorize that.
+      real inverse;
+      if constexpr (Kind == softening_kind::plummer)
+        inverse = 1 / std::sqrt(squared_distance + softening_squared + (1 - mask[lane]));
+      else
+        inverse = 1 / (std::sqrt(squared_distance) + softening + (1 - mask[lane]));
+      const real factor = mask[lane] * point.v[3] * inverse * (inverse * inverse);
+      packet_x[lane] += factor * dx;
+      packet_y[lane] += factor * dy;
+      packet_z[lane] += factor * dz;
+    }
+  }
+
+  for (std::size_t lane = 0; lane != soa_lane_count; ++lane) {
+    sum_x[lane] = packet_x[lane];
+    sum_y[lane] = packet_y[lane];
+    sum_z[lane] = packet_z[lane];
+  }
+}
+
+void leapfrog_phase1(triple* positions, const triple* velocities, std::size_t count, real dT)
+{
+  const real half_dT = 0.5 * dT;
+  for (std::size_t i = 0; i != count; ++i) {
+    for (std::size_t axis = 0; axis != 3; ++axis)
+      positions[i].v[axis] += velocities[i].v[axis] * half_dT;
+  }
+}
+
+void leapfrog_phase2(triple* positions, triple* velocities, const triple* accelerations, std::size_t count, real dT)
+{
+  const real half_dT = 0.5 * dT;
+  for (std::size_t i = 0; i != count; ++i) {
+    for (std::size_t axis = 0; axis != 3; ++axis) {
+      const real velocity   = velocities[i].v[axis] + accelerations[i].v[axis] * dT;
+      velocities[i].v[axis] = velocity;
+      positions[i].v[axis] += velocity * half_dT;
+    }
+  }
+}
+
+void velocity_verlet_phase1(triple* positions, triple* velocities, const triple* accelerations, std::size_t count,
+                            real dT)
+{
+  const real half_dT = 0.5 * dT;
+  for (std::size_t i = 0; i != count; ++i) {
+    for (std::size_t axis = 0; axis != 3; ++axis) {
+      const real velocity   = velocities[i].v[axis] + accelerations[i].v[axis] * half_dT;
+      velocities[i].v[axis] = velocity;
+      positions[i].v[axis] += velocity * dT;
+    }
+  }
+}
+
+void velocity_verlet_phase2(triple* velocities, const triple* accelerations, std::size_t count, real dT)
+{
+  const real half_dT = 0.5 * dT;
+  for (std::size_t i = 0; i != count; ++i) {
+    for (std::size_t axis = 0; axis != 3; ++axis)
+      velocities[i].v[axis] += accelerations[i].v[axis] * half_dT;
+  }
+}
+
+constexpr body_kernels kernels = {{accumulate_list<softening_kind::linear>, accumulate_list<softening_kind::plummer>},
+                                  {accumulate_packet<softening_kind::linear>,
+                                   accumulate_packet<softening_kind::plummer>},
+                                  leapfrog_phase1,
+                                  leapfrog_phase2,
+                                  velocity_verlet_phase1,
+                                  velocity_verlet_phase2};
+
+} // namespace
+
+SOLARSIM_NS_END
@@ -0,0 +1,23 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include "body_kernels.ipp"
+
+// Compiled with AVX2 and FMA enabled, see simd_kernels.hpp for what not to do here.
+
+SOLARSIM_NS_BEGIN
+
+const body_kernels body_kernels_avx2 = kernels;
+
+SOLARSIM_NS_END
@@ -0,0 +1,274 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include "solarsim/collisions.hpp"
+#include "solarsim/math.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <utility>
+
+SOLARSIM_NS_BEGIN
+
+namespace {
+
+real dot(const triple& a, const triple& b) noexcept
+{
+  return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+} // namespace
+
+bool spheres_touch(const triple& relative_position, const triple& relative_velocity, real radius_sum,
+                   real sweep_time) noexcept
+{
+  const real radius_sum_squared = radius_sum * radius_sum;
+  if (squared_length(relative_position) <= radius_sum_squared)
+    return true;
+
+  // Closest approach of the straight paths, clamped to the sweep
+  const real speed_squared = squared_length(relative_velocity);
+  if (sweep_time <= 0 || speed_squared == 0)
+    return false;
+  const real t = std::clamp(-dot(relative_position, relative_velocity) / speed_squared, -sweep_time, sweep_time);
+  return squared_length(relative_position + relative_velocity * t) <= radius_sum_squared;
+}
+
+void collision_merger::prepare(simulation_state& state, std::size_t num_tasks)
+{
+  const std::size_t n = state.body_positions.size();
+  assert(state.body_velocities.size() == n && state.body_masses.size() == n && state.body_radii.size() == n &&
+         state.acceleration.size() == n);
+  assert(n < std::numeric_limits<std::uint32_t>::max());
+
+  positions_     = state.body_positions;
+  velocities_    = state.body_velocities;
+  masses_        = state.body_masses;
+  radii_         = state.body_radii;
+  acceleration_  = state.acceleration;
+  num_tasks_     = std::clamp<std::size_t>(num_tasks, 1, std::max<std::size_t>(n / min_bodies_per_task, 1));
+  removed_count_ = 0;
+
+  max_radius_ = 0;
+  max_speed_  = 0;
+  for (std::size_t i = 0; i != n; ++i) {
+    max_radius_ = std::max(max_radius_, radii_[i]);
+    max_speed_  = std::max(max_speed_, squared_length(velocities_[i]));
+  }
+  max_speed_ = std::sqrt(max_speed_);
+
+  task_collisions_.resize(num_tasks_);
+  collisions_.clear();
+  // Filled by detect()
+  parents_.resize(n);
+  removed_.resize(n);
+}
+
+std::size_t collision_merger::task_begin(std::size_t task) const noexcept
+{
+  return positions_.size() * task / num_tasks_;
+}
+
+void collision_merger::detect(std::size_t task, const barnes_hut_octree& octree, real sweep_time)
+{
+  const std::size_t begin = task_begin(task);
+  const std::size_t end   = task_begin(task + 1);
+  std::iota(parents_.begin() + static_cast<std::ptrdiff_t>(begin), parents_.begin() + static_cast<std::ptrdiff_t>(end),
+            static_cast<std::uint32_t>(begin));
+  std::fill(removed_.begin() + static_cast<std::ptrdiff_t>(begin), removed_.begin() + static_cast<std::ptrdiff_t>(end),
+            std::uint8_t(0));
+
+  std::vector<body_collision>& found = task_collisions_[task];
+  found.clear();
+
+  // One query per body group, in tree order. Bodies of a group are close to each other, and so are their
+  // candidates - and consecutive groups are close as well.
+  const auto groups = octree.groups();
+  const auto order  = octree.body_order();
+  std::vector<std::uint32_t> candidates;
+  const std::size_t first_group = groups.size() * task / num_tasks_;
+  const std::size_t last_group  = groups.size() * (task + 1) / num_tasks_;
+  for (std::size_t g = first_group; g != last_group; ++g) {
+    const octree_body_group& group = groups[g];
+    const std::span<const std::uint32_t> bodies(order.data() + group.first_body, group.body_count);
+
+    // Nobody farther away than this can touch any of the group within the sweep
+    real reach = 0;
+    for (const std::uint32_t i : bodies)
+      reach = std::max(reach, radii_[i] + length(velocities_[i]) * sweep_time);
+    reach += group.radius + max_radius_ + max_speed_ * sweep_time;
+
+    candidates.clear();
+    octree.find_bodies_in_radius(group.center, reach, candidates);
+
+    // Both of a pair find each other, so only the lower index reports it
+    for (const std::uint32_t i : bodies) {
+      for (const std::uint32_t j : candidates) {
+        if (j > i && spheres_touch(positions_[j] - positions_[i], velocities_[j] - velocities_[i],
+                                   radii_[i] + radii_[j], sweep_time))
+          found.push_back({i, j});
+      }
+    }
+  }
+}
+
+std::uint32_t collision_merger::find_root(std::uint32_t body) noexcept
+{
+  while (parents_[body] != body) {
+    // Path halving
+    parents_[body] = parents_[parents_[body]];
+    body           = parents_[body];
+  }
+  return body;
+}
+
+void collision_merger::resolve()
+{
+  for (const auto& found : task_collisions_)
+    collisions_.insert(collisions_.end(), found.begin(), found.end());
+  std::sort(collisions_.begin(), collisions_.end(), [](const body_collision& a, const body_collision& b) {
+    return a.first != b.first ? a.first < b.first : a.second < b.second;
+  });
+
+  // Unite, keeping the lowest index as root
+  for (const body_collision& collision : collisions_) {
+    const std::uint32_t a = find_root(collision.first);
+    const std::uint32_t b = find_root(collision.second);
+    if (a != b)
+      parents_[std::max(a, b)] = std::min(a, b);
+  }
+
+  // All bodies involved, sorted by group. A group's root is its lowest index, so it comes first.
+  std::vector<std::pair<std::uint32_t, std::uint32_t>> members;
+  members.reserve(collisions_.size() * 2);
+  for (const body_collision& collision : collisions_) {
+    members.emplace_back(find_root(collision.first), collision.first);
+    members.emplace_back(find_root(collision.second), collision.second);
+  }
+  std::sort(members.begin(), members.end());
+  members.erase(std::unique(members.begin(), members.end()), members.end());
+
+  std::vector<std::uint32_t> removed;
+  for (auto first = members.begin(); first != members.end();) {
+    const std::uint32_t root = first->first;
+    const auto last          = std::find_if(first, members.end(), [root](const auto& member) {
+      return member.first != root;
+    });
+    assert(first->second == root);
+
+    // Mass weighted means conserve momentum. The mutual forces cancel out, so the same holds for the acceleration.
+    // Massless groups get plain means instead.
+    real mass   = 0;
+    real volume = 0;
+    for (auto it = first; it != last; ++it) {
+      mass += masses_[it->second];
+      volume += radii_[it->second] * radii_[it->second] * radii_[it->second];
+    }
+    const auto count = static_cast<real>(last - first);
+
+    triple position     = {};
+    triple velocity     = {};
+    triple acceleration = {};
+    for (auto it = first; it != last; ++it) {
+      const std::uint32_t body = it->second;
+      const real weight        = mass > 0 ? masses_[body] / mass : 1 / count;
+      position                 = position + positions_[body] * weight;
+      velocity                 = velocity + velocities_[body] * weight;
+      acceleration             = acceleration + acceleration_[body] * weight;
+      if (body != root) {
+        removed_[body] = 1;
+        removed.push_back(body);
+      }
+    }
+
+    positions_[root]    = position;
+    velocities_[root]   = velocity;
+    acceleration_[root] = acceleration;
+    masses_[root]       = mass;
+    radii_[root]        = std::cbrt(volume);
+    first               = last;
+  }
+
+  removed_count_ = removed.size();
+  if (removed_count_ == 0)
+    return;
+
+  // Survivors of a task go right after those of the tasks before it
+  std::sort(removed.begin(), removed.end());
+  task_offsets_.resize(num_tasks_ + 1);
+  for (std::size_t task = 0; task <= num_tasks_; ++task) {
+    const std::size_t begin   = task_begin(task);
+    const auto removed_before =
+        static_cast<std::size_t>(std::lower_bound(removed.begin(), removed.end(), begin) - removed.begin());
+    task_offsets_[task] = begin - removed_before;
+  }
+
+  const std::size_t n = positions_.size() - removed_count_;
+  compact_positions_.resize(n);
+  compact_velocities_.resize(n);
+  compact_masses_.resize(n);
+  compact_radii_.resize(n);
+  compact_acceleration_.resize(n);
+}
+
+void collision_merger::compact(std::size_t task)
+{
+  if (removed_count_ == 0)
+    return;
+
+  std::size_t target = task_offsets_[task];
+  for (std::size_t i = task_begin(task), end = task_begin(task + 1); i != end; ++i) {
+    if (removed_[i] != 0)
+      continue;
+    compact_positions_[target]    = positions_[i];
+    compact_velocities_[target]   = velocities_[i];
+    compact_masses_[target]       = masses_[i];
+    compact_radii_[target]        = radii_[i];
+    compact_acceleration_[target] = acceleration_[i];
+    ++target;
+  }
+  assert(target == task_offsets_[task + 1]);
+}
+
+void collision_merger::finish(simulation_state& state)
+{
+  assert(state.body_positions.data() == positions_.data());
+  positions_    = {};
+  velocities_   = {};
+  masses_       = {};
+  radii_        = {};
+  acceleration_ = {};
+  if (removed_count_ == 0)
+    return;
+
+  // Our buffers get the old arrays, to be reused by the next pass
+  state.body_positions.swap(compact_positions_);
+  state.body_velocities.swap(compact_velocities_);
+  state.body_masses.swap(compact_masses_);
+  state.body_radii.swap(compact_radii_);
+  state.acceleration.swap(compact_acceleration_);
+}
+
+void collision_merger::merge(simulation_state& state, const barnes_hut_octree& octree, real sweep_time)
+{
+  merge(state, octree, sweep_time, 1, [](std::size_t count, auto&& f) {
+    for (std::size_t i = 0; i != count; ++i)
+      f(i);
+  });
+}
+
+SOLARSIM_NS_END
@@ -0,0 +1,497 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include "solarsim/direct_sum.hpp"
+#include "solarsim/math.hpp"
+#include "simd_kernels.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+
+SOLARSIM_NS_BEGIN
+
+namespace {
+
+// The fixed-size inner loops are what the compiler turns into vector code, like calculate_scaled_acceleration_soa().
+// One cache line per array and step, which is direct_sum_kernel::lane_count or float_lane_count.
+// gm / distance^3 is computed as gm * (1 / distance) * (1 / distance)^2, which doesn't overflow floats for
+// distances way beyond the solar system.
+
+// 1 / softened distance, see softened_inverse_distance()
+template <bool Plummer, typename Real>
+Real inverse_distance(Real r2, Real softening) noexcept
+{
+  if constexpr (Plummer)
+    return 1 / std::sqrt(r2 + softening * softening);
+  else
+    return 1 / (std::sqrt(r2) + softening);
+}
+
+template <typename Real, bool Plummer>
+void accumulate_portable(const basic_soa_bodies<Real>& bodies, const direct_sum_tile& tile, Real softening,
+                         const basic_soa_accelerations<Real>& acceleration)
+{
+  constexpr std::size_t lanes = 64 / sizeof(Real);
+  for (std::size_t i = tile.i_begin; i != tile.i_end; ++i) {
+    const Real x_i = bodies.x[i];
+    const Real y_i = bodies.y[i];
+    const Real z_i = bodies.z[i];
+
+    Real sum_x[lanes] = {};
+    Real sum_y[lanes] = {};
+    Real sum_z[lanes] = {};
+    for (std::size_t j = tile.j_begin; j != tile.j_end; j += lanes) {
+      for (std::size_t lane = 0; lane != lanes; ++lane) {
+        const Real dx      = bodies.x[j + lane] - x_i;
+        const Real dy      = bodies.y[j + lane] - y_i;
+        const Real dz      = bodies.z[j + lane] - z_i;
+        const Real r2      = dx * dx + dy * dy + dz * dz;
+        const Real inverse = r2 > 0 ? inverse_distance<Plummer>(r2, softening) : 0;
+        const Real factor  = bodies.gm[j + lane] * inverse * (inverse * inverse);
+        sum_x[lane] += factor * dx;
+        sum_y[lane] += factor * dy;
+        sum_z[lane] += factor * dz;
+      }
+    }
+
+    for (std::size_t lane = 0; lane != lanes; ++lane) {
+      acceleration.x[i] += sum_x[lane];
+      acceleration.y[i] += sum_y[lane];
+      acceleration.z[i] += sum_z[lane];
+    }
+  }
+}
+
+template <typename Real, bool Plummer>
+void accumulate_pairs_portable(const basic_soa_bodies<Real>& bodies, const direct_sum_tile& tile, Real softening,
+                               const basic_soa_accelerations<Real>& acceleration)
+{
+  constexpr std::size_t lanes = 64 / sizeof(Real);
+  for (std::size_t i = tile.i_begin; i != tile.i_end; ++i) {
+    // Start at the block holding i + 1, the lanes up to i are masked out
+    const std::size_t j_first = std::max(tile.j_begin, (i + 1) / lanes * lanes);
+    if (j_first >= tile.j_end)
+      continue;
+
+    const Real x_i  = bodies.x[i];
+    const Real y_i  = bodies.y[i];
+    const Real z_i  = bodies.z[i];
+    const Real gm_i = bodies.gm[i];
+
+    Real sum_x[lanes] = {};
+    Real sum_y[lanes] = {};
+    Real sum_z[lanes] = {};
+    for (std::size_t j = j_first; j != tile.j_end; j += lanes) {
+      for (std::size_t lane = 0; lane != lanes; ++lane) {
+        const Real dx       = bodies.x[j + lane] - x_i;
+        const Real dy       = bodies.y[j + lane] - y_i;
+        const Real dz       = bodies.z[j + lane] - z_i;
+        const Real r2       = dx * dx + dy * dy + dz * dz;
+        const Real inverse  = r2 > 0 && j + lane > i ? inverse_distance<Plummer>(r2, softening) : 0;
+        const Real inverse2 = inverse * inverse;
+        const Real factor_i = bodies.gm[j + lane] * inverse * inverse2;
+        const Real factor_j = gm_i * inverse * inverse2;
+        sum_x[lane] += factor_i * dx;
+        sum_y[lane] += factor_i * dy;
+        sum_z[lane] += factor_i * dz;
+        acceleration.x[j + lane] -= factor_j * dx;
+        acceleration.y[j + lane] -= factor_j * dy;
+        acceleration.z[j + lane] -= factor_j * dz;
+      }
+    }
+
+    for (std::size_t lane = 0; lane != lanes; ++lane) {
+      acceleration.x[i] += sum_x[lane];
+      acceleration.y[i] += sum_y[lane];
+      acceleration.z[i] += sum_z[lane];
+    }
+  }
+}
+
+// Center of the bounding box of bodies [begin, end)
+triple tile_origin(const soa_bodies& bodies, std::size_t begin, std::size_t end) noexcept
+{
+  triple min = {bodies.x[begin], bodies.y[begin], bodies.z[begin]};
+  triple max = min;
+  for (std::size_t i = begin + 1; i < end; ++i) {
+    min = {std::min(min[0], bodies.x[i]), std::min(min[1], bodies.y[i]), std::min(min[2], bodies.z[i])};
+    max = {std::max(max[0], bodies.x[i]), std::max(max[1], bodies.y[i]), std::max(max[2], bodies.z[i])};
+  }
+  return {(min[0] + max[0]) / 2, (min[1] + max[1]) / 2, (min[2] + max[2]) / 2};
+}
+
+// A task's float arrays, see direct_sum_kernel::mixed_array()
+struct mixed_buffers
+{
+  [[nodiscard]] basic_soa_bodies<float> bodies() const noexcept { return {x, y, z, gm}; }
+
+  float* x  = nullptr;
+  float* y  = nullptr;
+  float* z  = nullptr;
+  float* gm = nullptr;
+  basic_soa_accelerations<float> sums;
+};
+
+// Scales to bring positions and masses into float range, whatever their units. Our accelerations come out
+// |acceleration| times too large.
+struct mixed_scales
+{
+  real length       = 1;
+  real mass         = 1;
+  real acceleration = 1;
+};
+
+mixed_scales make_mixed_scales(real length, real mass) noexcept
+{
+  return {length, mass, mass / (length * length)};
+}
+
+// Copy bodies [begin, end) relative to |origin| to |offset| in |buffers|, padded with massless bodies.
+// Clears their sums. Returns the padded end.
+std::size_t convert_tile(const soa_bodies& bodies, std::size_t begin, std::size_t end, const triple& origin,
+                         const mixed_scales& scales, const mixed_buffers& buffers, std::size_t offset) noexcept
+{
+  constexpr std::size_t lanes = direct_sum_kernel::float_lane_count;
+
+  const std::size_t count        = end - begin;
+  const std::size_t padded_count = (count + lanes - 1) / lanes * lanes;
+  for (std::size_t i = 0; i != count; ++i) {
+    buffers.x[offset + i]  = static_cast<float>((bodies.x[begin + i] - origin[0]) * scales.length);
+    buffers.y[offset + i]  = static_cast<float>((bodies.y[begin + i] - origin[1]) * scales.length);
+    buffers.z[offset + i]  = static_cast<float>((bodies.z[begin + i] - origin[2]) * scales.length);
+    buffers.gm[offset + i] = static_cast<float>(bodies.gm[begin + i] * scales.mass);
+  }
+  for (float* array : {buffers.x, buffers.y, buffers.z, buffers.gm})
+    std::fill(array + offset + count, array + offset + padded_count, 0.0f);
+  for (float* array : {buffers.sums.x, buffers.sums.y, buffers.sums.z})
+    std::fill(array + offset, array + offset + padded_count, 0.0f);
+  return offset + padded_count;
+}
+
+// Add the float sums at |offset| to bodies [begin, end), and reset them for the next tile pair
+void add_tile(const basic_soa_accelerations<float>& sums, std::size_t offset, std::size_t begin, std::size_t end,
+              const mixed_scales& scales, const soa_accelerations& acceleration) noexcept
+{
+  const real scale = 1 / scales.acceleration;
+  for (std::size_t i = begin; i != end; ++i) {
+    acceleration.x[i] += static_cast<real>(sums.x[offset + i - begin]) * scale;
+    acceleration.y[i] += static_cast<real>(sums.y[offset + i - begin]) * scale;
+    acceleration.z[i] += static_cast<real>(sums.z[offset + i - begin]) * scale;
+    sums.x[offset + i - begin] = 0.0f;
+    sums.y[offset + i - begin] = 0.0f;
+    sums.z[offset + i - begin] = 0.0f;
+  }
+}
+
+// Unit length is the largest extent of the bodies, unit mass the largest G * m
+mixed_scales compute_mixed_scales(const soa_bodies& bodies, std::size_t count) noexcept
+{
+  if (count == 0)
+    return {};
+
+  const triple center = tile_origin(bodies, 0, count);
+  real extent         = 0;
+  real mass           = 0;
+  for (std::size_t i = 0; i != count; ++i) {
+    extent = std::max({extent, std::abs(bodies.x[i] - center[0]), std::abs(bodies.y[i] - center[1]),
+                       std::abs(bodies.z[i] - center[2])});
+    mass   = std::max(mass, bodies.gm[i]);
+  }
+  return make_mixed_scales(extent > 0 ? 1 / extent : 1, mass > 0 ? 1 / mass : 1);
+}
+
+const direct_sum_kernels& get_kernels(simd_instruction_set instruction_set, bool plummer) noexcept
+{
+  const std::size_t index = plummer ? 1 : 0;
+  switch (instruction_set) {
+#if SOLARSIM_HAS_X86_KERNELS
+    case simd_instruction_set::avx2:
+      return direct_sum_kernels_avx2[index];
+    case simd_instruction_set::avx512:
+      return direct_sum_kernels_avx512[index];
+#endif
+    default:
+      return direct_sum_kernels_portable[index];
+  }
+}
+
+} // namespace
+
+const direct_sum_kernels direct_sum_kernels_portable[2] = {
+    {accumulate_portable<real, false>, accumulate_pairs_portable<real, false>, accumulate_portable<float, false>,
+     accumulate_pairs_portable<float, false>},
+    {accumulate_portable<real, true>, accumulate_pairs_portable<real, true>, accumulate_portable<float, true>,
+     accumulate_pairs_portable<float, true>},
+};
+
+std::string_view to_string(force_precision precision) noexcept
+{
+  return precision == force_precision::mixed ? "mixed" : "full";
+}
+
+direct_sum_kernel::direct_sum_kernel(simd_instruction_set instruction_set) noexcept
+  : instruction_set_(instruction_set)
+{
+}
+
+real* direct_sum_kernel::array(std::size_t index) noexcept
+{
+  return const_cast<real*>(std::as_const(*this).array(index));
+}
+
+const real* direct_sum_kernel::array(std::size_t index) const noexcept
+{
+  // |storage_| has room for the padding in front
+  constexpr std::uintptr_t alignment = 64;
+  const auto misalignment            = reinterpret_cast<std::uintptr_t>(storage_.data()) % alignment;
+  const std::size_t padding          = (alignment - misalignment) % alignment / sizeof(real);
+  return storage_.data() + padding + index * padded_count_;
+}
+
+float* direct_sum_kernel::mixed_array(std::size_t task, std::size_t index) noexcept
+{
+  constexpr std::uintptr_t alignment = 64;
+  const auto misalignment            = reinterpret_cast<std::uintptr_t>(mixed_storage_.data()) % alignment;
+  const std::size_t padding          = (alignment - misalignment) % alignment / sizeof(float);
+  return mixed_storage_.data() + padding + (task * mixed_array_count + index) * 2 * tile_size;
+}
+
+std::size_t direct_sum_kernel::task_begin(std::size_t task) const noexcept
+{
+  const std::size_t units = fused_ ? tile_pairs_.size() : tile_count();
+  return units * task / num_tasks_;
+}
+
+void direct_sum_kernel::load(std::span<const triple> body_positions, std::span<const real> body_masses)
+{
+  assert(body_positions.size() == body_masses.size());
+
+  body_count_   = body_positions.size();
+  padded_count_ = (body_count_ + lane_count - 1) / lane_count * lane_count;
+  // Room for one acceleration buffer, prepare() grows it as needed
+  storage_.resize(std::max(storage_.size(), (body_array_count + 3) * padded_count_ + 64 / sizeof(real)));
+
+  real* x  = array(0);
+  real* y  = array(1);
+  real* z  = array(2);
+  real* gm = array(3);
+  for (std::size_t i = 0; i != body_count_; ++i) {
+    x[i]  = body_positions[i][0];
+    y[i]  = body_positions[i][1];
+    z[i]  = body_positions[i][2];
+    gm[i] = gravitational_constant * body_masses[i];
+  }
+  std::fill(x + body_count_, x + padded_count_, real(0));
+  std::fill(y + body_count_, y + padded_count_, real(0));
+  std::fill(z + body_count_, z + padded_count_, real(0));
+  std::fill(gm + body_count_, gm + padded_count_, real(0));
+}
+
+void direct_sum_kernel::prepare(real softening, bool fused, std::size_t num_tasks)
+{
+  softening_ = softening;
+  fused_     = fused;
+  // Without softening both kinds are the same, and Plummer's is the cheaper kernel
+  plummer_ = softening_kind_ == softening_kind::plummer || softening == 0;
+
+  const auto tiles = static_cast<std::uint32_t>(tile_count());
+  tile_pairs_.clear();
+  if (fused) {
+    for (std::uint32_t i = 0; i != tiles; ++i) {
+      for (std::uint32_t j = i; j != tiles; ++j)
+        tile_pairs_.emplace_back(i, j);
+    }
+  }
+
+  const std::size_t units = fused ? tile_pairs_.size() : tiles;
+  num_tasks_              = std::clamp(num_tasks, std::size_t(1), std::max(units, std::size_t(1)));
+
+  // Growing |storage_| would move the bodies to a different alignment, so copy them over
+  const std::size_t num_buffers = fused ? num_tasks_ : 1;
+  const std::size_t size        = (body_array_count + 3 * num_buffers) * padded_count_ + 64 / sizeof(real);
+  if (size > storage_.capacity()) {
+    direct_sum_kernel grown(instruction_set_);
+    grown.body_count_   = body_count_;
+    grown.padded_count_ = padded_count_;
+    grown.storage_.resize(size);
+    std::copy(array(0), array(body_array_count), grown.array(0));
+    storage_.swap(grown.storage_);
+  }
+  storage_.resize(std::max(storage_.size(), size));
+
+  mixed_ = precision_ == force_precision::mixed;
+  if (mixed_) {
+    mixed_storage_.resize(num_tasks_ * mixed_array_count * 2 * tile_size + 64 / sizeof(float));
+    const mixed_scales scales = compute_mixed_scales({array(0), array(1), array(2), array(3)}, body_count_);
+    length_scale_             = scales.length;
+    mass_scale_               = scales.mass;
+  }
+}
+
+void direct_sum_kernel::accumulate(std::size_t task)
+{
+  assert(task < num_tasks_);
+  if (mixed_) {
+    accumulate_mixed(task);
+    return;
+  }
+
+  const soa_bodies bodies           = {array(0), array(1), array(2), array(3)};
+  const direct_sum_kernels& kernels = get_kernels(instruction_set_, plummer_);
+  const std::size_t begin           = task_begin(task);
+  const std::size_t end             = task_begin(task + 1);
+
+  if (fused_) {
+    // Our own buffer, since the pairs can touch bodies anywhere
+    const std::size_t buffer     = body_array_count + 3 * task;
+    const soa_accelerations sums = {array(buffer), array(buffer + 1), array(buffer + 2)};
+    std::fill(sums.x, sums.x + padded_count_, real(0));
+    std::fill(sums.y, sums.y + padded_count_, real(0));
+    std::fill(sums.z, sums.z + padded_count_, real(0));
+
+    for (std::size_t pair = begin; pair != end; ++pair) {
+      const auto [i, j]          = tile_pairs_[pair];
+      const direct_sum_tile tile = {i * tile_size, std::min((i + 1) * tile_size, body_count_), j * tile_size,
+                                    std::min((j + 1) * tile_size, padded_count_)};
+      kernels.accumulate_pairs(bodies, tile, softening_, sums);
+    }
+    return;
+  }
+
+  // Every tile of bodies i streams all tiles j while they're in L1. Rows of other tasks aren't touched.
+  const soa_accelerations sums = {array(body_array_count), array(body_array_count + 1),
+                                  array(body_array_count + 2)};
+  for (std::size_t i = begin; i != end; ++i) {
+    const std::size_t i_begin = i * tile_size;
+    const std::size_t i_end   = std::min(i_begin + tile_size, body_count_);
+    std::fill(sums.x + i_begin, sums.x + i_end, real(0));
+    std::fill(sums.y + i_begin, sums.y + i_end, real(0));
+    std::fill(sums.z + i_begin, sums.z + i_end, real(0));
+
+    for (std::size_t j_begin = 0; j_begin < padded_count_; j_begin += tile_size) {
+      const direct_sum_tile tile = {i_begin, i_end, j_begin, std::min(j_begin + tile_size, padded_count_)};
+      kernels.accumulate(bodies, tile, softening_, sums);
+    }
+  }
+}
+
+void direct_sum_kernel::accumulate_mixed(std::size_t task)
+{
+  const soa_bodies bodies           = {array(0), array(1), array(2), array(3)};
+  const direct_sum_kernels& kernels = get_kernels(instruction_set_, plummer_);
+  const mixed_scales scales         = make_mixed_scales(length_scale_, mass_scale_);
+  const auto softening              = static_cast<float>(softening_ * scales.length);
+  const std::size_t begin           = task_begin(task);
+  const std::size_t end             = task_begin(task + 1);
+
+  // The i tile goes to the front of the float arrays, the j tile behind it
+  const mixed_buffers buffers = {mixed_array(task, 0),
+                                 mixed_array(task, 1),
+                                 mixed_array(task, 2),
+                                 mixed_array(task, 3),
+                                 {mixed_array(task, 4), mixed_array(task, 5), mixed_array(task, 6)}};
+
+  if (fused_) {
+    const std::size_t buffer     = body_array_count + 3 * task;
+    const soa_accelerations sums = {array(buffer), array(buffer + 1), array(buffer + 2)};
+    std::fill(sums.x, sums.x + padded_count_, real(0));
+    std::fill(sums.y, sums.y + padded_count_, real(0));
+    std::fill(sums.z, sums.z + padded_count_, real(0));
+
+    for (std::size_t pair = begin; pair != end; ++pair) {
+      const auto [i, j]         = tile_pairs_[pair];
+      const std::size_t i_begin = i * tile_size;
+      const std::size_t i_end   = std::min(i_begin + tile_size, body_count_);
+      const triple origin       = tile_origin(bodies, i_begin, i_end);
+      const std::size_t i_count = i_end - i_begin;
+      if (i == j) {
+        const std::size_t padded_end = convert_tile(bodies, i_begin, i_end, origin, scales, buffers, 0);
+        kernels.accumulate_pairs_float(buffers.bodies(), {0, i_count, 0, padded_end}, softening, buffers.sums);
+        add_tile(buffers.sums, 0, i_begin, i_end, scales, sums);
+        continue;
+      }
+
+      const std::size_t j_begin = j * tile_size;
+      const std::size_t j_end   = std::min(j_begin + tile_size, body_count_);
+      convert_tile(bodies, i_begin, i_end, origin, scales, buffers, 0);
+      const std::size_t padded_end = convert_tile(bodies, j_begin, j_end, origin, scales, buffers, tile_size);
+      kernels.accumulate_pairs_float(buffers.bodies(), {0, i_count, tile_size, padded_end}, softening,
+                                     buffers.sums);
+      add_tile(buffers.sums, 0, i_begin, i_end, scales, sums);
+      add_tile(buffers.sums, tile_size, j_begin, j_end, scales, sums);
+    }
+    return;
+  }
+
+  // Bodies at the same position don't interact, so i's own copy in the j tile doesn't need any masking.
+  // The i tile stays in place for all j tiles, add_tile() hands back its sums zeroed.
+  const soa_accelerations sums = {array(body_array_count), array(body_array_count + 1),
+                                  array(body_array_count + 2)};
+  for (std::size_t i = begin; i != end; ++i) {
+    const std::size_t i_begin = i * tile_size;
+    const std::size_t i_end   = std::min(i_begin + tile_size, body_count_);
+    const triple origin       = tile_origin(bodies, i_begin, i_end);
+    std::fill(sums.x + i_begin, sums.x + i_end, real(0));
+    std::fill(sums.y + i_begin, sums.y + i_end, real(0));
+    std::fill(sums.z + i_begin, sums.z + i_end, real(0));
+    convert_tile(bodies, i_begin, i_end, origin, scales, buffers, 0);
+
+    for (std::size_t j_begin = 0; j_begin < body_count_; j_begin += tile_size) {
+      const std::size_t j_end      = std::min(j_begin + tile_size, body_count_);
+      const std::size_t padded_end = convert_tile(bodies, j_begin, j_end, origin, scales, buffers, tile_size);
+      kernels.accumulate_float(buffers.bodies(), {0, i_end - i_begin, tile_size, padded_end}, softening,
+                               buffers.sums);
+      add_tile(buffers.sums, 0, i_begin, i_end, scales, sums);
+    }
+  }
+}
+
+void direct_sum_kernel::reduce(std::size_t chunk, std::span<triple> acceleration) const
+{
+  assert(acceleration.size() == body_count_);
+
+  const std::size_t begin       = chunk * tile_size;
+  const std::size_t end         = std::min(begin + tile_size, body_count_);
+  const std::size_t num_buffers = fused_ ? num_tasks_ : 1;
+
+  const real* x = array(body_array_count);
+  const real* y = array(body_array_count + 1);
+  const real* z = array(body_array_count + 2);
+  for (std::size_t i = begin; i != end; ++i)
+    acceleration[i] = {x[i], y[i], z[i]};
+
+  for (std::size_t buffer = 1; buffer != num_buffers; ++buffer) {
+    x = array(body_array_count + 3 * buffer);
+    y = array(body_array_count + 3 * buffer + 1);
+    z = array(body_array_count + 3 * buffer + 2);
+    for (std::size_t i = begin; i != end; ++i) {
+      acceleration[i][0] += x[i];
+      acceleration[i][1] += y[i];
+      acceleration[i][2] += z[i];
+    }
+  }
+}
+
+void direct_sum_kernel::compute_accelerations(real softening, bool fused, std::span<triple> acceleration)
+{
+  compute_accelerations(softening, fused, acceleration, 1, [](std::size_t count, auto&& f) {
+    for (std::size_t i = 0; i != count; ++i)
+      f(i);
+  });
+}
+
+SOLARSIM_NS_END
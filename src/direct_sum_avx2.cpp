@@ -0,0 +1,263 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include "simd_kernels.hpp"
+
+#include <immintrin.h>
+
+// Compiled with AVX2 and FMA enabled, see simd_kernels.hpp for what not to do here.
+
+SOLARSIM_NS_BEGIN
+
+namespace {
+
+constexpr std::size_t lanes       = 4;
+constexpr std::size_t float_lanes = 8;
+
+double reduce_add(__m256d v) noexcept
+{
+  const __m128d sum = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+  return _mm_cvtsd_f64(_mm_add_sd(sum, _mm_unpackhi_pd(sum, sum)));
+}
+
+float reduce_add(__m256 v) noexcept
+{
+  __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+  sum        = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+  return _mm_cvtss_f32(_mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1)));
+}
+
+// rsqrt / rcp are good to 12 bits, one Newton-Raphson step makes that float precision
+__m256 reciprocal_sqrt(__m256 x) noexcept
+{
+  const __m256 half_x = _mm256_mul_ps(x, _mm256_set1_ps(0.5f));
+  const __m256 y      = _mm256_rsqrt_ps(x);
+  return _mm256_mul_ps(y, _mm256_fnmadd_ps(half_x, _mm256_mul_ps(y, y), _mm256_set1_ps(1.5f)));
+}
+
+__m256 reciprocal(__m256 x) noexcept
+{
+  const __m256 y = _mm256_rcp_ps(x);
+  return _mm256_fmadd_ps(y, _mm256_fnmadd_ps(x, y, _mm256_set1_ps(1)), y);
+}
+
+// 1 / softened distance, see softened_inverse_distance(). Garbage for r2 == 0, the callers mask those lanes.
+// There's no double precision estimate before AVX-512, and refining the exponent trick's one to full precision
+// takes four Newton-Raphson steps, which is slower than sqrt and div.
+template <bool Plummer>
+__m256d inverse_distance(__m256d r2, __m256d epsilon, __m256d epsilon2) noexcept
+{
+  if constexpr (Plummer)
+    return _mm256_div_pd(_mm256_set1_pd(1), _mm256_sqrt_pd(_mm256_add_pd(r2, epsilon2)));
+  else
+    return _mm256_div_pd(_mm256_set1_pd(1), _mm256_add_pd(_mm256_sqrt_pd(r2), epsilon));
+}
+
+template <bool Plummer>
+__m256 inverse_distance(__m256 r2, __m256 epsilon, __m256 epsilon2) noexcept
+{
+  if constexpr (Plummer)
+    return reciprocal_sqrt(_mm256_add_ps(r2, epsilon2));
+  else
+    return reciprocal(_mm256_fmadd_ps(r2, reciprocal_sqrt(r2), epsilon));
+}
+
+template <bool Plummer>
+void accumulate_avx2(const soa_bodies& bodies, const direct_sum_tile& tile, real softening,
+                     const soa_accelerations& acceleration)
+{
+  const __m256d zero     = _mm256_setzero_pd();
+  const __m256d epsilon  = _mm256_set1_pd(softening);
+  const __m256d epsilon2 = _mm256_set1_pd(softening * softening);
+  for (std::size_t i = tile.i_begin; i != tile.i_end; ++i) {
+    const __m256d x_i = _mm256_set1_pd(bodies.x[i]);
+    const __m256d y_i = _mm256_set1_pd(bodies.y[i]);
+    const __m256d z_i = _mm256_set1_pd(bodies.z[i]);
+
+    __m256d sum_x = zero;
+    __m256d sum_y = zero;
+    __m256d sum_z = zero;
+    for (std::size_t j = tile.j_begin; j != tile.j_end; j += lanes) {
+      const __m256d dx = _mm256_sub_pd(_mm256_load_pd(bodies.x + j), x_i);
+      const __m256d dy = _mm256_sub_pd(_mm256_load_pd(bodies.y + j), y_i);
+      const __m256d dz = _mm256_sub_pd(_mm256_load_pd(bodies.z + j), z_i);
+      const __m256d r2 = _mm256_fmadd_pd(dz, dz, _mm256_fmadd_pd(dy, dy, _mm256_mul_pd(dx, dx)));
+      // Zero for coincident bodies (including i itself)
+      const __m256d mask    = _mm256_cmp_pd(r2, zero, _CMP_GT_OQ);
+      const __m256d inverse = _mm256_and_pd(mask, inverse_distance<Plummer>(r2, epsilon, epsilon2));
+      const __m256d factor  = _mm256_mul_pd(_mm256_mul_pd(_mm256_load_pd(bodies.gm + j), inverse),
+                                            _mm256_mul_pd(inverse, inverse));
+      sum_x                 = _mm256_fmadd_pd(factor, dx, sum_x);
+      sum_y                 = _mm256_fmadd_pd(factor, dy, sum_y);
+      sum_z                 = _mm256_fmadd_pd(factor, dz, sum_z);
+    }
+
+    acceleration.x[i] += reduce_add(sum_x);
+    acceleration.y[i] += reduce_add(sum_y);
+    acceleration.z[i] += reduce_add(sum_z);
+  }
+}
+
+template <bool Plummer>
+void accumulate_pairs_avx2(const soa_bodies& bodies, const direct_sum_tile& tile, real softening,
+                           const soa_accelerations& acceleration)
+{
+  const __m256d zero       = _mm256_setzero_pd();
+  const __m256d epsilon    = _mm256_set1_pd(softening);
+  const __m256d epsilon2   = _mm256_set1_pd(softening * softening);
+  const __m256d lane_index = _mm256_set_pd(3, 2, 1, 0);
+  for (std::size_t i = tile.i_begin; i != tile.i_end; ++i) {
+    // Start at the block holding i + 1, the lanes up to i are masked out
+    const std::size_t j_block = (i + 1) / lanes * lanes;
+    const std::size_t j_first = j_block > tile.j_begin ? j_block : tile.j_begin;
+    if (j_first >= tile.j_end)
+      continue;
+
+    const __m256d x_i  = _mm256_set1_pd(bodies.x[i]);
+    const __m256d y_i  = _mm256_set1_pd(bodies.y[i]);
+    const __m256d z_i  = _mm256_set1_pd(bodies.z[i]);
+    const __m256d gm_i = _mm256_set1_pd(bodies.gm[i]);
+
+    __m256d sum_x = zero;
+    __m256d sum_y = zero;
+    __m256d sum_z = zero;
+    for (std::size_t j = j_first; j != tile.j_end; j += lanes) {
+      const __m256d dx = _mm256_sub_pd(_mm256_load_pd(bodies.x + j), x_i);
+      const __m256d dy = _mm256_sub_pd(_mm256_load_pd(bodies.y + j), y_i);
+      const __m256d dz = _mm256_sub_pd(_mm256_load_pd(bodies.z + j), z_i);
+      const __m256d r2 = _mm256_fmadd_pd(dz, dz, _mm256_fmadd_pd(dy, dy, _mm256_mul_pd(dx, dx)));
+
+      __m256d mask = _mm256_cmp_pd(r2, zero, _CMP_GT_OQ);
+      if (j <= i) {
+        // Only the lanes past i. Compared relative to the block, global indices aren't exact in float.
+        const __m256d offset_i = _mm256_set1_pd(static_cast<double>(i - j));
+        mask                   = _mm256_and_pd(mask, _mm256_cmp_pd(lane_index, offset_i, _CMP_GT_OQ));
+      }
+      const __m256d inverse  = _mm256_and_pd(mask, inverse_distance<Plummer>(r2, epsilon, epsilon2));
+      const __m256d inverse3 = _mm256_mul_pd(inverse, _mm256_mul_pd(inverse, inverse));
+      const __m256d factor_i = _mm256_mul_pd(_mm256_load_pd(bodies.gm + j), inverse3);
+      const __m256d factor_j = _mm256_mul_pd(gm_i, inverse3);
+      sum_x                  = _mm256_fmadd_pd(factor_i, dx, sum_x);
+      sum_y                  = _mm256_fmadd_pd(factor_i, dy, sum_y);
+      sum_z                  = _mm256_fmadd_pd(factor_i, dz, sum_z);
+      _mm256_store_pd(acceleration.x + j, _mm256_fnmadd_pd(factor_j, dx, _mm256_load_pd(acceleration.x + j)));
+      _mm256_store_pd(acceleration.y + j, _mm256_fnmadd_pd(factor_j, dy, _mm256_load_pd(acceleration.y + j)));
+      _mm256_store_pd(acceleration.z + j, _mm256_fnmadd_pd(factor_j, dz, _mm256_load_pd(acceleration.z + j)));
+    }
+
+    acceleration.x[i] += reduce_add(sum_x);
+    acceleration.y[i] += reduce_add(sum_y);
+    acceleration.z[i] += reduce_add(sum_z);
+  }
+}
+
+template <bool Plummer>
+void accumulate_float_avx2(const basic_soa_bodies<float>& bodies, const direct_sum_tile& tile, float softening,
+                           const basic_soa_accelerations<float>& acceleration)
+{
+  const __m256 zero     = _mm256_setzero_ps();
+  const __m256 epsilon  = _mm256_set1_ps(softening);
+  const __m256 epsilon2 = _mm256_set1_ps(softening * softening);
+  for (std::size_t i = tile.i_begin; i != tile.i_end; ++i) {
+    const __m256 x_i = _mm256_set1_ps(bodies.x[i]);
+    const __m256 y_i = _mm256_set1_ps(bodies.y[i]);
+    const __m256 z_i = _mm256_set1_ps(bodies.z[i]);
+
+    __m256 sum_x = zero;
+    __m256 sum_y = zero;
+    __m256 sum_z = zero;
+    for (std::size_t j = tile.j_begin; j != tile.j_end; j += float_lanes) {
+      const __m256 dx = _mm256_sub_ps(_mm256_load_ps(bodies.x + j), x_i);
+      const __m256 dy = _mm256_sub_ps(_mm256_load_ps(bodies.y + j), y_i);
+      const __m256 dz = _mm256_sub_ps(_mm256_load_ps(bodies.z + j), z_i);
+      const __m256 r2 = _mm256_fmadd_ps(dz, dz, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dx, dx)));
+      // gm / distance^3 without overflowing, see accumulate_portable()
+      const __m256 mask     = _mm256_cmp_ps(r2, zero, _CMP_GT_OQ);
+      const __m256 inverse  = _mm256_and_ps(mask, inverse_distance<Plummer>(r2, epsilon, epsilon2));
+      const __m256 inverse2 = _mm256_mul_ps(inverse, inverse);
+      const __m256 factor   = _mm256_mul_ps(_mm256_mul_ps(_mm256_load_ps(bodies.gm + j), inverse), inverse2);
+      sum_x                 = _mm256_fmadd_ps(factor, dx, sum_x);
+      sum_y                 = _mm256_fmadd_ps(factor, dy, sum_y);
+      sum_z                 = _mm256_fmadd_ps(factor, dz, sum_z);
+    }
+
+    acceleration.x[i] += reduce_add(sum_x);
+    acceleration.y[i] += reduce_add(sum_y);
+    acceleration.z[i] += reduce_add(sum_z);
+  }
+}
+
+template <bool Plummer>
+void accumulate_pairs_float_avx2(const basic_soa_bodies<float>& bodies, const direct_sum_tile& tile,
+                                 float softening, const basic_soa_accelerations<float>& acceleration)
+{
+  const __m256 zero       = _mm256_setzero_ps();
+  const __m256 epsilon    = _mm256_set1_ps(softening);
+  const __m256 epsilon2   = _mm256_set1_ps(softening * softening);
+  const __m256 lane_index = _mm256_set_ps(7, 6, 5, 4, 3, 2, 1, 0);
+  for (std::size_t i = tile.i_begin; i != tile.i_end; ++i) {
+    // Start at the block holding i + 1, the lanes up to i are masked out
+    const std::size_t j_block = (i + 1) / float_lanes * float_lanes;
+    const std::size_t j_first = j_block > tile.j_begin ? j_block : tile.j_begin;
+    if (j_first >= tile.j_end)
+      continue;
+
+    const __m256 x_i  = _mm256_set1_ps(bodies.x[i]);
+    const __m256 y_i  = _mm256_set1_ps(bodies.y[i]);
+    const __m256 z_i  = _mm256_set1_ps(bodies.z[i]);
+    const __m256 gm_i = _mm256_set1_ps(bodies.gm[i]);
+
+    __m256 sum_x = zero;
+    __m256 sum_y = zero;
+    __m256 sum_z = zero;
+    for (std::size_t j = j_first; j != tile.j_end; j += float_lanes) {
+      const __m256 dx = _mm256_sub_ps(_mm256_load_ps(bodies.x + j), x_i);
+      const __m256 dy = _mm256_sub_ps(_mm256_load_ps(bodies.y + j), y_i);
+      const __m256 dz = _mm256_sub_ps(_mm256_load_ps(bodies.z + j), z_i);
+      const __m256 r2 = _mm256_fmadd_ps(dz, dz, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dx, dx)));
+
+      __m256 mask = _mm256_cmp_ps(r2, zero, _CMP_GT_OQ);
+      if (j <= i) {
+        // Only the lanes past i, see accumulate_pairs_avx2()
+        const __m256 offset_i = _mm256_set1_ps(static_cast<float>(i - j));
+        mask                  = _mm256_and_ps(mask, _mm256_cmp_ps(lane_index, offset_i, _CMP_GT_OQ));
+      }
+      const __m256 inverse  = _mm256_and_ps(mask, inverse_distance<Plummer>(r2, epsilon, epsilon2));
+      const __m256 inverse2 = _mm256_mul_ps(inverse, inverse);
+      const __m256 factor_i = _mm256_mul_ps(_mm256_mul_ps(_mm256_load_ps(bodies.gm + j), inverse), inverse2);
+      const __m256 factor_j = _mm256_mul_ps(_mm256_mul_ps(gm_i, inverse), inverse2);
+      sum_x                 = _mm256_fmadd_ps(factor_i, dx, sum_x);
+      sum_y                 = _mm256_fmadd_ps(factor_i, dy, sum_y);
+      sum_z                 = _mm256_fmadd_ps(factor_i, dz, sum_z);
+      _mm256_store_ps(acceleration.x + j, _mm256_fnmadd_ps(factor_j, dx, _mm256_load_ps(acceleration.x + j)));
+      _mm256_store_ps(acceleration.y + j, _mm256_fnmadd_ps(factor_j, dy, _mm256_load_ps(acceleration.y + j)));
+      _mm256_store_ps(acceleration.z + j, _mm256_fnmadd_ps(factor_j, dz, _mm256_load_ps(acceleration.z + j)));
+    }
+
+    acceleration.x[i] += reduce_add(sum_x);
+    acceleration.y[i] += reduce_add(sum_y);
+    acceleration.z[i] += reduce_add(sum_z);
+  }
+}
+
+} // namespace
+
+const direct_sum_kernels direct_sum_kernels_avx2[2] = {
+    {accumulate_avx2<false>, accumulate_pairs_avx2<false>, accumulate_float_avx2<false>,
+     accumulate_pairs_float_avx2<false>},
+    {accumulate_avx2<true>, accumulate_pairs_avx2<true>, accumulate_float_avx2<true>,
+     accumulate_pairs_float_avx2<true>},
+};
+
+SOLARSIM_NS_END
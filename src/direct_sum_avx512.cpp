@@ -0,0 +1,293 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include "simd_kernels.hpp"
+
+#include <immintrin.h>
+
+// Compiled with AVX-512F enabled, see simd_kernels.hpp for what not to do here.
+
+SOLARSIM_NS_BEGIN
+
+namespace {
+
+constexpr std::size_t lanes       = 8;
+constexpr std::size_t float_lanes = 16;
+
+// GCC's unmasked forms of rsqrt14, rcp14 and the 256-bit extracts pass an uninitialized merge source to their
+// builtins, which -Wmaybe-uninitialized reports wherever they get inlined. Their zero-masked forms with every lane
+// selected compile to the same instructions.
+constexpr __mmask8 all_lanes        = 0xFF;
+constexpr __mmask16 all_float_lanes = 0xFFFF;
+
+// Lower (0) or upper (1) 256 bits of |v|
+template <int Half>
+__m256d extract_half(__m512d v) noexcept
+{
+  return _mm512_maskz_extractf64x4_pd(0xF, v, Half);
+}
+
+double reduce_add(__m512d v) noexcept
+{
+  const __m256d half = _mm256_add_pd(extract_half<0>(v), extract_half<1>(v));
+  const __m128d sum  = _mm_add_pd(_mm256_castpd256_pd128(half), _mm256_extractf128_pd(half, 1));
+  return _mm_cvtsd_f64(_mm_add_sd(sum, _mm_unpackhi_pd(sum, sum)));
+}
+
+float reduce_add(__m512 v) noexcept
+{
+  // The float extract needs AVX-512DQ, the double one moves the same bits.
+  const __m512d bits = _mm512_castps_pd(v);
+  const __m256 half  = _mm256_add_ps(_mm256_castpd_ps(extract_half<0>(bits)), _mm256_castpd_ps(extract_half<1>(bits)));
+  __m128 sum         = _mm_add_ps(_mm256_castps256_ps128(half), _mm256_extractf128_ps(half, 1));
+  sum                = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+  return _mm_cvtss_f32(_mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1)));
+}
+
+// rsqrt14 / rcp14 are good to 14 bits, and every Newton-Raphson step doubles that:
+//   1 / sqrt(x): y' = y * (3/2 - x/2 * y^2)
+//   1 / x:       y' = y + y * (1 - x * y)
+// Two steps make for full double precision, one for float. Either is a lot cheaper than sqrt and div.
+
+__m512d reciprocal_sqrt(__m512d x) noexcept
+{
+  const __m512d half_x       = _mm512_mul_pd(x, _mm512_set1_pd(0.5));
+  const __m512d three_halves = _mm512_set1_pd(1.5);
+  __m512d y                  = _mm512_maskz_rsqrt14_pd(all_lanes, x);
+  y = _mm512_mul_pd(y, _mm512_fnmadd_pd(half_x, _mm512_mul_pd(y, y), three_halves));
+  y = _mm512_mul_pd(y, _mm512_fnmadd_pd(half_x, _mm512_mul_pd(y, y), three_halves));
+  return y;
+}
+
+__m512d reciprocal(__m512d x) noexcept
+{
+  const __m512d one = _mm512_set1_pd(1);
+  __m512d y         = _mm512_maskz_rcp14_pd(all_lanes, x);
+  y                 = _mm512_fmadd_pd(y, _mm512_fnmadd_pd(x, y, one), y);
+  y                 = _mm512_fmadd_pd(y, _mm512_fnmadd_pd(x, y, one), y);
+  return y;
+}
+
+__m512 reciprocal_sqrt(__m512 x) noexcept
+{
+  const __m512 half_x = _mm512_mul_ps(x, _mm512_set1_ps(0.5f));
+  const __m512 y      = _mm512_maskz_rsqrt14_ps(all_float_lanes, x);
+  return _mm512_mul_ps(y, _mm512_fnmadd_ps(half_x, _mm512_mul_ps(y, y), _mm512_set1_ps(1.5f)));
+}
+
+__m512 reciprocal(__m512 x) noexcept
+{
+  const __m512 y = _mm512_maskz_rcp14_ps(all_float_lanes, x);
+  return _mm512_fmadd_ps(y, _mm512_fnmadd_ps(x, y, _mm512_set1_ps(1)), y);
+}
+
+// 1 / softened distance, see softened_inverse_distance(). Garbage for r2 == 0, the callers mask those lanes.
+template <bool Plummer>
+__m512d inverse_distance(__m512d r2, __m512d epsilon, __m512d epsilon2) noexcept
+{
+  if constexpr (Plummer)
+    return reciprocal_sqrt(_mm512_add_pd(r2, epsilon2));
+  else
+    return reciprocal(_mm512_fmadd_pd(r2, reciprocal_sqrt(r2), epsilon));
+}
+
+template <bool Plummer>
+__m512 inverse_distance(__m512 r2, __m512 epsilon, __m512 epsilon2) noexcept
+{
+  if constexpr (Plummer)
+    return reciprocal_sqrt(_mm512_add_ps(r2, epsilon2));
+  else
+    return reciprocal(_mm512_fmadd_ps(r2, reciprocal_sqrt(r2), epsilon));
+}
+
+template <bool Plummer>
+void accumulate_avx512(const soa_bodies& bodies, const direct_sum_tile& tile, real softening,
+                       const soa_accelerations& acceleration)
+{
+  const __m512d zero     = _mm512_setzero_pd();
+  const __m512d epsilon  = _mm512_set1_pd(softening);
+  const __m512d epsilon2 = _mm512_set1_pd(softening * softening);
+  for (std::size_t i = tile.i_begin; i != tile.i_end; ++i) {
+    const __m512d x_i = _mm512_set1_pd(bodies.x[i]);
+    const __m512d y_i = _mm512_set1_pd(bodies.y[i]);
+    const __m512d z_i = _mm512_set1_pd(bodies.z[i]);
+
+    __m512d sum_x = zero;
+    __m512d sum_y = zero;
+    __m512d sum_z = zero;
+    for (std::size_t j = tile.j_begin; j != tile.j_end; j += lanes) {
+      const __m512d dx = _mm512_sub_pd(_mm512_load_pd(bodies.x + j), x_i);
+      const __m512d dy = _mm512_sub_pd(_mm512_load_pd(bodies.y + j), y_i);
+      const __m512d dz = _mm512_sub_pd(_mm512_load_pd(bodies.z + j), z_i);
+      const __m512d r2 = _mm512_fmadd_pd(dz, dz, _mm512_fmadd_pd(dy, dy, _mm512_mul_pd(dx, dx)));
+      // Zero for coincident bodies (including i itself)
+      const __mmask8 mask   = _mm512_cmp_pd_mask(r2, zero, _CMP_GT_OQ);
+      const __m512d inverse = _mm512_mask_blend_pd(mask, zero, inverse_distance<Plummer>(r2, epsilon, epsilon2));
+      const __m512d factor  = _mm512_mul_pd(_mm512_mul_pd(_mm512_load_pd(bodies.gm + j), inverse),
+                                            _mm512_mul_pd(inverse, inverse));
+      sum_x                 = _mm512_fmadd_pd(factor, dx, sum_x);
+      sum_y                 = _mm512_fmadd_pd(factor, dy, sum_y);
+      sum_z                 = _mm512_fmadd_pd(factor, dz, sum_z);
+    }
+
+    acceleration.x[i] += reduce_add(sum_x);
+    acceleration.y[i] += reduce_add(sum_y);
+    acceleration.z[i] += reduce_add(sum_z);
+  }
+}
+
+template <bool Plummer>
+void accumulate_pairs_avx512(const soa_bodies& bodies, const direct_sum_tile& tile, real softening,
+                             const soa_accelerations& acceleration)
+{
+  const __m512d zero     = _mm512_setzero_pd();
+  const __m512d epsilon  = _mm512_set1_pd(softening);
+  const __m512d epsilon2 = _mm512_set1_pd(softening * softening);
+  for (std::size_t i = tile.i_begin; i != tile.i_end; ++i) {
+    // Start at the block holding i + 1, the lanes up to i are masked out
+    const std::size_t j_block = (i + 1) / lanes * lanes;
+    const std::size_t j_first = j_block > tile.j_begin ? j_block : tile.j_begin;
+    if (j_first >= tile.j_end)
+      continue;
+
+    const __m512d x_i  = _mm512_set1_pd(bodies.x[i]);
+    const __m512d y_i  = _mm512_set1_pd(bodies.y[i]);
+    const __m512d z_i  = _mm512_set1_pd(bodies.z[i]);
+    const __m512d gm_i = _mm512_set1_pd(bodies.gm[i]);
+
+    __m512d sum_x = zero;
+    __m512d sum_y = zero;
+    __m512d sum_z = zero;
+    for (std::size_t j = j_first; j != tile.j_end; j += lanes) {
+      const __m512d dx = _mm512_sub_pd(_mm512_load_pd(bodies.x + j), x_i);
+      const __m512d dy = _mm512_sub_pd(_mm512_load_pd(bodies.y + j), y_i);
+      const __m512d dz = _mm512_sub_pd(_mm512_load_pd(bodies.z + j), z_i);
+      const __m512d r2 = _mm512_fmadd_pd(dz, dz, _mm512_fmadd_pd(dy, dy, _mm512_mul_pd(dx, dx)));
+
+      __mmask8 mask = _mm512_cmp_pd_mask(r2, zero, _CMP_GT_OQ);
+      if (j <= i)
+        mask &= static_cast<__mmask8>(0xFF << (i + 1 - j));
+      const __m512d inverse  = _mm512_mask_blend_pd(mask, zero, inverse_distance<Plummer>(r2, epsilon, epsilon2));
+      const __m512d inverse3 = _mm512_mul_pd(inverse, _mm512_mul_pd(inverse, inverse));
+      const __m512d factor_i = _mm512_mul_pd(_mm512_load_pd(bodies.gm + j), inverse3);
+      const __m512d factor_j = _mm512_mul_pd(gm_i, inverse3);
+      sum_x                  = _mm512_fmadd_pd(factor_i, dx, sum_x);
+      sum_y                  = _mm512_fmadd_pd(factor_i, dy, sum_y);
+      sum_z                  = _mm512_fmadd_pd(factor_i, dz, sum_z);
+      _mm512_store_pd(acceleration.x + j, _mm512_fnmadd_pd(factor_j, dx, _mm512_load_pd(acceleration.x + j)));
+      _mm512_store_pd(acceleration.y + j, _mm512_fnmadd_pd(factor_j, dy, _mm512_load_pd(acceleration.y + j)));
+      _mm512_store_pd(acceleration.z + j, _mm512_fnmadd_pd(factor_j, dz, _mm512_load_pd(acceleration.z + j)));
+    }
+
+    acceleration.x[i] += reduce_add(sum_x);
+    acceleration.y[i] += reduce_add(sum_y);
+    acceleration.z[i] += reduce_add(sum_z);
+  }
+}
+
+template <bool Plummer>
+void accumulate_float_avx512(const basic_soa_bodies<float>& bodies, const direct_sum_tile& tile, float softening,
+                             const basic_soa_accelerations<float>& acceleration)
+{
+  const __m512 zero     = _mm512_setzero_ps();
+  const __m512 epsilon  = _mm512_set1_ps(softening);
+  const __m512 epsilon2 = _mm512_set1_ps(softening * softening);
+  for (std::size_t i = tile.i_begin; i != tile.i_end; ++i) {
+    const __m512 x_i = _mm512_set1_ps(bodies.x[i]);
+    const __m512 y_i = _mm512_set1_ps(bodies.y[i]);
+    const __m512 z_i = _mm512_set1_ps(bodies.z[i]);
+
+    __m512 sum_x = zero;
+    __m512 sum_y = zero;
+    __m512 sum_z = zero;
+    for (std::size_t j = tile.j_begin; j != tile.j_end; j += float_lanes) {
+      const __m512 dx = _mm512_sub_ps(_mm512_load_ps(bodies.x + j), x_i);
+      const __m512 dy = _mm512_sub_ps(_mm512_load_ps(bodies.y + j), y_i);
+      const __m512 dz = _mm512_sub_ps(_mm512_load_ps(bodies.z + j), z_i);
+      const __m512 r2 = _mm512_fmadd_ps(dz, dz, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dx, dx)));
+      // gm / distance^3 without overflowing, see accumulate_portable()
+      const __mmask16 mask  = _mm512_cmp_ps_mask(r2, zero, _CMP_GT_OQ);
+      const __m512 inverse  = _mm512_mask_blend_ps(mask, zero, inverse_distance<Plummer>(r2, epsilon, epsilon2));
+      const __m512 inverse2 = _mm512_mul_ps(inverse, inverse);
+      const __m512 factor   = _mm512_mul_ps(_mm512_mul_ps(_mm512_load_ps(bodies.gm + j), inverse), inverse2);
+      sum_x                 = _mm512_fmadd_ps(factor, dx, sum_x);
+      sum_y                 = _mm512_fmadd_ps(factor, dy, sum_y);
+      sum_z                 = _mm512_fmadd_ps(factor, dz, sum_z);
+    }
+
+    acceleration.x[i] += reduce_add(sum_x);
+    acceleration.y[i] += reduce_add(sum_y);
+    acceleration.z[i] += reduce_add(sum_z);
+  }
+}
+
+template <bool Plummer>
+void accumulate_pairs_float_avx512(const basic_soa_bodies<float>& bodies, const direct_sum_tile& tile,
+                                   float softening, const basic_soa_accelerations<float>& acceleration)
+{
+  const __m512 zero     = _mm512_setzero_ps();
+  const __m512 epsilon  = _mm512_set1_ps(softening);
+  const __m512 epsilon2 = _mm512_set1_ps(softening * softening);
+  for (std::size_t i = tile.i_begin; i != tile.i_end; ++i) {
+    // Start at the block holding i + 1, the lanes up to i are masked out
+    const std::size_t j_block = (i + 1) / float_lanes * float_lanes;
+    const std::size_t j_first = j_block > tile.j_begin ? j_block : tile.j_begin;
+    if (j_first >= tile.j_end)
+      continue;
+
+    const __m512 x_i  = _mm512_set1_ps(bodies.x[i]);
+    const __m512 y_i  = _mm512_set1_ps(bodies.y[i]);
+    const __m512 z_i  = _mm512_set1_ps(bodies.z[i]);
+    const __m512 gm_i = _mm512_set1_ps(bodies.gm[i]);
+
+    __m512 sum_x = zero;
+    __m512 sum_y = zero;
+    __m512 sum_z = zero;
+    for (std::size_t j = j_first; j != tile.j_end; j += float_lanes) {
+      const __m512 dx = _mm512_sub_ps(_mm512_load_ps(bodies.x + j), x_i);
+      const __m512 dy = _mm512_sub_ps(_mm512_load_ps(bodies.y + j), y_i);
+      const __m512 dz = _mm512_sub_ps(_mm512_load_ps(bodies.z + j), z_i);
+      const __m512 r2 = _mm512_fmadd_ps(dz, dz, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dx, dx)));
+
+      __mmask16 mask = _mm512_cmp_ps_mask(r2, zero, _CMP_GT_OQ);
+      if (j <= i)
+        mask &= static_cast<__mmask16>(0xFFFF << (i + 1 - j));
+      const __m512 inverse  = _mm512_mask_blend_ps(mask, zero, inverse_distance<Plummer>(r2, epsilon, epsilon2));
+      const __m512 inverse2 = _mm512_mul_ps(inverse, inverse);
+      const __m512 factor_i = _mm512_mul_ps(_mm512_mul_ps(_mm512_load_ps(bodies.gm + j), inverse), inverse2);
+      const __m512 factor_j = _mm512_mul_ps(_mm512_mul_ps(gm_i, inverse), inverse2);
+      sum_x                 = _mm512_fmadd_ps(factor_i, dx, sum_x);
+      sum_y                 = _mm512_fmadd_ps(factor_i, dy, sum_y);
+      sum_z                 = _mm512_fmadd_ps(factor_i, dz, sum_z);
+      _mm512_store_ps(acceleration.x + j, _mm512_fnmadd_ps(factor_j, dx, _mm512_load_ps(acceleration.x + j)));
+      _mm512_store_ps(acceleration.y + j, _mm512_fnmadd_ps(factor_j, dy, _mm512_load_ps(acceleration.y + j)));
+      _mm512_store_ps(acceleration.z + j, _mm512_fnmadd_ps(factor_j, dz, _mm512_load_ps(acceleration.z + j)));
+    }
+
+    acceleration.x[i] += reduce_add(sum_x);
+    acceleration.y[i] += reduce_add(sum_y);
+    acceleration.z[i] += reduce_add(sum_z);
+  }
+}
+
+} // namespace
+
+const direct_sum_kernels direct_sum_kernels_avx512[2] = {
+    {accumulate_avx512<false>, accumulate_pairs_avx512<false>, accumulate_float_avx512<false>,
+     accumulate_pairs_float_avx512<false>},
+    {accumulate_avx512<true>, accumulate_pairs_avx512<true>, accumulate_float_avx512<true>,
+     accumulate_pairs_float_avx512<true>},
+};
+
+SOLARSIM_NS_END
@@ -0,0 +1,392 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include "solarsim/fmm_octree.hpp"
+#include "solarsim/math.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+SOLARSIM_NS_BEGIN
+
+// Notation: cell A has its expansion center z_A and bodies b with positions x_b and masses m_b (times G, which
+// cell_body_masses_ has folded in already).
+// For a multi-index n = (n_x, n_y, n_z): |n| = n_x + n_y + n_z, n! = n_x! n_y! n_z!, y^n = y_x^n_x y_y^n_y y_z^n_z
+// and D_n = d^|n| / (dx^n_x dy^n_y dz^n_z).
+//
+//   Multipoles:  M_n = \sum_b m_b (x_b - z_A)^n / n!
+//   M2L:         L_k(B) = \sum_n (-1)^|n| M_n(A) D_{n+k} 1/|r|, with r = z_B - z_A and |n| + |k| <= order
+//   Potential:   phi(z_B + y) = -\sum_k L_k(B) y^k / k!
+//
+// Since D_m 1/|-r| = (-1)^|m| D_m 1/|r|, both directions of a cell pair use the same derivatives:
+//
+//   L_k(A) = (-1)^|k| \sum_n M_n(B) D_{n+k} 1/|r|
+
+fmm_octree::fmm_octree(const fmm_options& options)
+{
+  set_options(options);
+}
+
+void fmm_octree::set_options(const fmm_options& options)
+{
+  assert(options.order <= max_order);
+  assert(options.theta > 0 && options.theta < 1);
+  options_ = options;
+  set_leaf_options(options.leaf_options);
+  terms_.clear();
+}
+
+std::uint32_t fmm_octree::term_index(std::uint32_t x, std::uint32_t y, std::uint32_t z) const noexcept
+{
+  // Within a degree, terms are sorted by descending n_x, then descending n_y.
+  const std::uint32_t degree = x + y + z;
+  return degree_offsets_[degree] + (degree - x) * (degree - x + 1) / 2 + (degree - x - y);
+}
+
+void fmm_octree::compute_tables()
+{
+  const std::uint32_t order = options_.order;
+
+  terms_.clear();
+  degree_offsets_.clear();
+  for (std::uint32_t degree = 0; degree <= order; ++degree) {
+    degree_offsets_.push_back(static_cast<std::uint32_t>(terms_.size()));
+    for (std::uint32_t x = degree + 1; x-- != 0;) {
+      for (std::uint32_t y = degree - x + 1; y-- != 0;) {
+        term t;
+        t.n      = {x, y, degree - x - y};
+        t.degree = degree;
+        terms_.push_back(t);
+      }
+    }
+  }
+  degree_offsets_.push_back(static_cast<std::uint32_t>(terms_.size()));
+
+  constexpr auto invalid = std::numeric_limits<std::uint32_t>::max();
+  for (std::size_t i = 0; i != terms_.size(); ++i) {
+    term& t = terms_[i];
+    assert(term_index(t.n[0], t.n[1], t.n[2]) == i);
+    for (std::uint32_t axis = 0; axis != 3; ++axis) {
+      std::array<std::uint32_t, 3> n = t.n;
+      const auto m                   = static_cast<real>(t.n[axis]);
+      const auto degree              = static_cast<real>(t.degree);
+
+      ++n[axis];
+      t.plus_one[axis] = t.degree < order ? term_index(n[0], n[1], n[2]) : invalid;
+      if (t.n[axis] >= 1) {
+        n[axis] -= 2;
+        t.minus_one[axis]        = term_index(n[0], n[1], n[2]);
+        t.minus_one_weight[axis] = -(2 * degree - 1) * m / degree;
+        t.lower                  = t.minus_one[axis];
+        t.lower_axis             = axis;
+      }
+      if (t.n[axis] >= 2) {
+        --n[axis];
+        t.minus_two[axis]        = term_index(n[0], n[1], n[2]);
+        t.minus_two_weight[axis] = -(degree - 1) * m * (m - 1) / degree;
+      }
+    }
+  }
+
+  // Grouped by b, so M2L can sum up each local coefficient in a register
+  term_pairs_.clear();
+  term_pair_offsets_.clear();
+  for (std::uint32_t b = 0; b != terms_.size(); ++b) {
+    term_pair_offsets_.push_back(static_cast<std::uint32_t>(term_pairs_.size()));
+    for (std::uint32_t a = 0; a != terms_.size() && terms_[a].degree + terms_[b].degree <= order; ++a) {
+      const term& ta = terms_[a];
+      const term& tb = terms_[b];
+      term_pairs_.push_back({a, b, term_index(ta.n[0] + tb.n[0], ta.n[1] + tb.n[1], ta.n[2] + tb.n[2])});
+    }
+  }
+  term_pair_offsets_.push_back(static_cast<std::uint32_t>(term_pairs_.size()));
+}
+
+void fmm_octree::compute_monomials(const triple& y, real* monomials) const noexcept
+{
+  monomials[0] = 1;
+  for (std::size_t i = 1, n = terms_.size(); i != n; ++i) {
+    const term& t = terms_[i];
+    monomials[i]  = monomials[t.lower] * y[t.lower_axis] / static_cast<real>(t.n[t.lower_axis]);
+  }
+}
+
+void fmm_octree::compute_derivatives(const triple& r, real* derivatives) const noexcept
+{
+  // Derivatives of 1/|r| satisfy (from Laplace's equation and their homogeneity):
+  //   |m| r^2 D_m + (2|m| - 1) \sum_i m_i r_i D_{m-e_i} + (|m| - 1) \sum_i m_i (m_i - 1) D_{m-2e_i} = 0
+  const real inverse_squared_distance = 1 / squared_length(r);
+  derivatives[0]                      = std::sqrt(inverse_squared_distance);
+  for (std::size_t i = 1, n = terms_.size(); i != n; ++i) {
+    const term& t = terms_[i];
+    real sum      = 0;
+    for (std::size_t axis = 0; axis != 3; ++axis) {
+      sum += t.minus_one_weight[axis] * r[axis] * derivatives[t.minus_one[axis]] +
+             t.minus_two_weight[axis] * derivatives[t.minus_two[axis]];
+    }
+    derivatives[i] = sum * inverse_squared_distance;
+  }
+}
+
+void fmm_octree::rebuild(std::span<const triple> body_positions, std::span<const real> body_masses)
+{
+  if (terms_.empty())
+    compute_tables();
+
+  partial_barnes_hut_octree::rebuild(build_bounding_box(body_positions), body_positions, body_masses);
+
+  cells_.clear();
+  cell_body_positions_.clear();
+  cell_body_masses_.clear();
+  cell_body_ids_.clear();
+  body_cells_.clear();
+  if (body_positions_.empty())
+    return;
+
+  finalize(0);
+  cells_.reserve(nodes_.size());
+  cell_body_positions_.reserve(body_positions_.size());
+  cell_body_masses_.reserve(body_masses_.size());
+  cell_body_ids_.reserve(body_ids_.size());
+  body_cells_.reserve(body_ids_.size());
+  linearize_node(0, 0);
+  compute_multipoles();
+}
+
+void fmm_octree::linearize_node(octree_node_index index, std::uint32_t parent)
+{
+  const barnes_hut_octree_node& node = nodes_[index];
+  const auto cell_index              = static_cast<std::uint32_t>(cells_.size());
+  const auto first_body              = static_cast<std::uint32_t>(cell_body_positions_.size());
+
+  cell c;
+  c.center = node.center_of_mass;
+  c.parent = parent;
+  cells_.push_back(c);
+
+  if (node.is_leaf()) {
+    for_each_leaf_body(node, [&](std::uint32_t i) {
+      cell_body_positions_.push_back(body_positions_[i]);
+      cell_body_masses_.push_back(gravitational_constant * body_masses_[i]);
+      cell_body_ids_.push_back(body_ids_[i]);
+      body_cells_.push_back(cell_index);
+    });
+  } else {
+    for (std::size_t slot = 0; slot != 8; ++slot) {
+      if (node.has_child(slot))
+        linearize_node(node.children[slot], cell_index);
+    }
+  }
+
+  cell& linear_cell      = cells_[cell_index];
+  linear_cell.next       = static_cast<std::uint32_t>(cells_.size());
+  linear_cell.first_body = first_body;
+  linear_cell.body_count = static_cast<std::uint32_t>(cell_body_positions_.size()) - first_body;
+}
+
+void fmm_octree::compute_multipoles()
+{
+  const std::size_t num_terms = terms_.size();
+  multipoles_.assign(cells_.size() * num_terms, 0);
+
+  // Children come after their parent, so going backwards gets us all children first.
+  std::array<real, max_terms> monomials;
+  for (std::size_t index = cells_.size(); index-- != 0;) {
+    cell& c            = cells_[index];
+    real* multipole    = multipoles_.data() + index * num_terms;
+    const auto index32 = static_cast<std::uint32_t>(index);
+
+    if (c.is_leaf(index32)) {
+      // P2M
+      for (std::uint32_t i = c.first_body, end = c.first_body + c.body_count; i != end; ++i) {
+        const triple offset = cell_body_positions_[i] - c.center;
+        compute_monomials(offset, monomials.data());
+        for (std::size_t t = 0; t != num_terms; ++t)
+          multipole[t] += cell_body_masses_[i] * monomials[t];
+        c.radius = std::max(c.radius, length(offset));
+      }
+      continue;
+    }
+
+    // M2M: (x_b - z_P)^n / n! = \sum_{a+b=n} (x_b - z_C)^a / a! (z_C - z_P)^b / b!
+    for (std::uint32_t child = index32 + 1; child != c.next; child = cells_[child].next) {
+      const triple offset         = cells_[child].center - c.center;
+      const real* child_multipole = multipoles_.data() + child * num_terms;
+      compute_monomials(offset, monomials.data());
+      for (const term_pair& pair : term_pairs_)
+        multipole[pair.sum] += child_multipole[pair.a] * monomials[pair.b];
+      c.radius = std::max(c.radius, length(offset) + cells_[child].radius);
+    }
+  }
+}
+
+void fmm_octree::interact(real softening)
+{
+  statistics_ = {};
+  locals_.assign(multipoles_.size(), 0);
+  near_field_.assign(cell_body_positions_.size(), {});
+  if (cells_.empty())
+    return;
+
+  interact_self(0, softening);
+  compute_locals();
+}
+
+void fmm_octree::interact_self(std::uint32_t a, real softening)
+{
+  const cell& c = cells_[a];
+  if (c.is_leaf(a)) {
+    with_pairwise_gravity(softening_kind_, softening, [&](const auto& gravity) {
+      for (std::uint32_t i = c.first_body, end = c.first_body + c.body_count; i != end; ++i) {
+        for (std::uint32_t j = i + 1; j != end; ++j) {
+          gravity(cell_body_positions_[i], cell_body_positions_[j], cell_body_masses_[i], cell_body_masses_[j],
+                  near_field_[i], near_field_[j]);
+        }
+      }
+    });
+    statistics_.body_interactions += std::size_t(c.body_count) * (c.body_count - 1) / 2;
+    return;
+  }
+
+  for (std::uint32_t child = a + 1; child != c.next; child = cells_[child].next) {
+    interact_self(child, softening);
+    for (std::uint32_t other = cells_[child].next; other != c.next; other = cells_[other].next)
+      interact_cells(child, other, softening);
+  }
+}
+
+void fmm_octree::interact_cells(std::uint32_t a, std::uint32_t b, real softening)
+{
+  const cell& cell_a = cells_[a];
+  const cell& cell_b = cells_[b];
+
+  // Well separated?
+  const real radii = cell_a.radius + cell_b.radius;
+  if (radii * radii < options_.theta * options_.theta * squared_length(cell_b.center - cell_a.center)) {
+    interact_multipoles(a, b);
+    return;
+  }
+
+  const bool leaf_a = cell_a.is_leaf(a);
+  const bool leaf_b = cell_b.is_leaf(b);
+  if (leaf_a && leaf_b) {
+    interact_bodies(a, b, softening);
+    return;
+  }
+
+  // Split the larger cell
+  if (!leaf_a && (leaf_b || cell_a.radius >= cell_b.radius)) {
+    for (std::uint32_t child = a + 1; child != cell_a.next; child = cells_[child].next)
+      interact_cells(child, b, softening);
+  } else {
+    for (std::uint32_t child = b + 1; child != cell_b.next; child = cells_[child].next)
+      interact_cells(a, child, softening);
+  }
+}
+
+void fmm_octree::interact_multipoles(std::uint32_t a, std::uint32_t b)
+{
+  const std::size_t num_terms = terms_.size();
+
+  std::array<real, max_terms> derivatives;
+  compute_derivatives(cells_[b].center - cells_[a].center, derivatives.data());
+
+  const real* multipole_a = multipoles_.data() + a * num_terms;
+  const real* multipole_b = multipoles_.data() + b * num_terms;
+  std::array<real, max_terms> signed_multipole_a;
+  for (std::size_t t = 0; t != num_terms; ++t)
+    signed_multipole_a[t] = (terms_[t].degree & 1) ? -multipole_a[t] : multipole_a[t];
+
+  real* local_a = locals_.data() + a * num_terms;
+  real* local_b = locals_.data() + b * num_terms;
+  for (std::size_t k = 0; k != num_terms; ++k) {
+    real sum_a = 0;
+    real sum_b = 0;
+    for (std::uint32_t i = term_pair_offsets_[k], end = term_pair_offsets_[k + 1]; i != end; ++i) {
+      const term_pair& pair = term_pairs_[i];
+      const real derivative = derivatives[pair.sum];
+      sum_a += multipole_b[pair.a] * derivative;
+      sum_b += signed_multipole_a[pair.a] * derivative;
+    }
+    local_a[k] += (terms_[k].degree & 1) ? -sum_a : sum_a;
+    local_b[k] += sum_b;
+  }
+  ++statistics_.cell_interactions;
+}
+
+void fmm_octree::interact_bodies(std::uint32_t a, std::uint32_t b, real softening)
+{
+  const cell& cell_a = cells_[a];
+  const cell& cell_b = cells_[b];
+  with_pairwise_gravity(softening_kind_, softening, [&](const auto& gravity) {
+    for (std::uint32_t i = cell_a.first_body, end_a = cell_a.first_body + cell_a.body_count; i != end_a; ++i) {
+      for (std::uint32_t j = cell_b.first_body, end_b = cell_b.first_body + cell_b.body_count; j != end_b; ++j) {
+        gravity(cell_body_positions_[i], cell_body_positions_[j], cell_body_masses_[i], cell_body_masses_[j],
+                near_field_[i], near_field_[j]);
+      }
+    }
+  });
+  statistics_.body_interactions += std::size_t(cell_a.body_count) * cell_b.body_count;
+}
+
+void fmm_octree::compute_locals()
+{
+  const std::size_t num_terms = terms_.size();
+
+  // L2L: parents come before their children.
+  std::array<real, max_terms> monomials;
+  for (std::size_t index = 1; index != cells_.size(); ++index) {
+    const cell& c            = cells_[index];
+    const real* parent_local = locals_.data() + c.parent * num_terms;
+    real* local              = locals_.data() + index * num_terms;
+    compute_monomials(c.center - cells_[c.parent].center, monomials.data());
+    for (const term_pair& pair : term_pairs_)
+      local[pair.a] += parent_local[pair.sum] * monomials[pair.b];
+  }
+}
+
+void fmm_octree::evaluate(std::size_t body, std::span<triple> acceleration) const
+{
+  const std::size_t num_terms = terms_.size();
+  const std::uint32_t index   = body_cells_[body];
+  const real* local           = locals_.data() + index * num_terms;
+
+  // L2P: a = -grad phi = \sum_k L_{k+e_i} y^k / k!
+  std::array<real, max_terms> monomials;
+  compute_monomials(cell_body_positions_[body] - cells_[index].center, monomials.data());
+
+  triple far_field = {};
+  for (std::size_t t = 0, end = degree_offsets_[options_.order]; t != end; ++t) {
+    const term& k = terms_[t];
+    for (std::size_t axis = 0; axis != 3; ++axis)
+      far_field[axis] += local[k.plus_one[axis]] * monomials[t];
+  }
+
+  triple& result = acceleration[cell_body_ids_[body]];
+  result         = near_field_[body] + far_field;
+  debug_validate_finite(result);
+}
+
+void fmm_octree::compute_accelerations(std::span<const triple> body_positions, std::span<const real> body_masses,
+                                       real softening, std::span<triple> acceleration)
+{
+  rebuild(body_positions, body_masses);
+  interact(softening);
+  for (std::size_t body = 0, n = body_count(); body != n; ++body)
+    evaluate(body, acceleration);
+}
+
+SOLARSIM_NS_END
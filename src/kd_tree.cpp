@@ -0,0 +1,258 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include "solarsim/kd_tree.hpp"
+#include "solarsim/math.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+
+SOLARSIM_NS_BEGIN
+
+namespace {
+
+real surface_area(const triple& lower, const triple& upper)
+{
+  const triple size = upper - lower;
+  return 2 * (size[0] * size[1] + size[1] * size[2] + size[2] * size[0]);
+}
+
+} // namespace
+
+void kd_tree::rebuild(std::span<const triple> body_positions, std::span<const real> body_masses)
+{
+  assert(body_positions.size() == body_masses.size());
+  nodes_.clear();
+  depth_ = 0;
+
+  const auto n = static_cast<std::uint32_t>(body_positions.size());
+  bodies_.resize(n);
+  for (std::uint32_t i = 0; i != n; ++i)
+    bodies_[i] = {body_positions[i], gravitational_constant * body_masses[i]};
+  if (n == 0)
+    return;
+
+  if (options_.split_rule == kd_split_rule::surface_area) {
+    bins_.resize(3 * std::size_t(options_.sah_bins));
+    upper_costs_.resize(options_.sah_bins);
+  }
+  build_node(0, n, 1);
+}
+
+void kd_tree::build_node(std::uint32_t first, std::uint32_t count, std::size_t depth)
+{
+  depth_ = std::max(depth_, depth);
+
+  // Bounding box and moments of our bodies
+  triple lower        = bodies_[first].position;
+  triple upper        = lower;
+  triple weighted_sum = {};
+  real total_mass     = 0;
+  for (std::uint32_t i = first, end = first + count; i != end; ++i) {
+    const triple& position = bodies_[i].position;
+    const real mass        = bodies_[i].scaled_mass;
+    weighted_sum += position * mass;
+    total_mass += mass;
+    for (std::size_t axis = 0; axis != 3; ++axis) {
+      lower[axis] = std::min(lower[axis], position[axis]);
+      upper[axis] = std::max(upper[axis], position[axis]);
+    }
+  }
+  const triple center_of_mass = total_mass > 0 ? weighted_sum / total_mass : (lower + upper) / 2;
+
+  // Opening test: size / distance < theta <=> distance^2 > (size / theta)^2
+  const triple extent = upper - lower;
+  const real length   = std::max({extent[0], extent[1], extent[2]});
+  real size           = length;
+  if (criterion_.type == opening_criterion::kind::bmax) {
+    // Distance to the farthest corner
+    triple farthest = {};
+    for (std::size_t axis = 0; axis != 3; ++axis)
+      farthest[axis] = std::max(center_of_mass[axis] - lower[axis], upper[axis] - center_of_mass[axis]);
+    size = ::solarsim::length(farthest);
+  }
+  const real critical_radius = size / criterion_.theta;
+
+  const auto index             = static_cast<std::uint32_t>(nodes_.size());
+  linear_octree_node& node     = nodes_.emplace_back();
+  node.mass_point              = make_quad(center_of_mass, total_mass);
+  node.critical_radius_squared = critical_radius * critical_radius;
+  node.length_squared          = length * length;
+  node.first_body              = first;
+  node.body_count              = count;
+
+  // Bodies at the very same position can't be split
+  if (count > options_.max_leaf_bodies && length > 0) {
+    const std::uint32_t lower_count =
+        options_.split_rule == kd_split_rule::surface_area && depth < max_surface_area_depth
+            ? split_surface_area(first, count, lower, upper)
+            : split_median(first, count, lower, upper);
+    build_node(first, lower_count, depth + 1);
+    build_node(first + lower_count, count - lower_count, depth + 1);
+  }
+
+  nodes_[index].next = static_cast<std::uint32_t>(nodes_.size());
+}
+
+std::uint32_t kd_tree::split_median(std::uint32_t first, std::uint32_t count, const triple& lower,
+                                    const triple& upper)
+{
+  const triple extent = upper - lower;
+  const std::size_t axis =
+      extent[0] >= extent[1] ? (extent[0] >= extent[2] ? 0 : 2) : (extent[1] >= extent[2] ? 1 : 2);
+
+  const std::uint32_t half = count / 2;
+  const auto begin         = bodies_.begin() + first;
+  std::nth_element(begin, begin + half, begin + count,
+                   [axis](const body& a, const body& b) { return a.position[axis] < b.position[axis]; });
+  return half;
+}
+
+std::uint32_t kd_tree::split_surface_area(std::uint32_t first, std::uint32_t count, const triple& lower,
+                                          const triple& upper)
+{
+  const std::size_t bin_count = options_.sah_bins;
+  assert(bin_count >= 2);
+  const triple extent = upper - lower;
+  auto bin_of         = [&](const triple& position, std::size_t axis) {
+    const auto bin = static_cast<std::size_t>((position[axis] - lower[axis]) / extent[axis] * real(bin_count));
+    return std::min(bin, bin_count - 1);
+  };
+
+  // Count the bodies of each slab and their bounding boxes
+  std::fill(bins_.begin(), bins_.end(), sah_bin{0, upper, lower});
+  for (std::uint32_t i = first, end = first + count; i != end; ++i) {
+    const triple& position = bodies_[i].position;
+    for (std::size_t axis = 0; axis != 3; ++axis) {
+      if (extent[axis] <= 0)
+        continue;
+      sah_bin& bin = bins_[axis * bin_count + bin_of(position, axis)];
+      ++bin.count;
+      for (std::size_t k = 0; k != 3; ++k) {
+        bin.lower[k] = std::min(bin.lower[k], position[k]);
+        bin.upper[k] = std::max(bin.upper[k], position[k]);
+      }
+    }
+  }
+
+  // Sweep from the right to get the cost of every upper half, then from the left for the lower ones.
+  // Costs are relative to the node's own surface area, which is the same for all candidates.
+  real best_cost         = std::numeric_limits<real>::max();
+  std::size_t best_axis  = 0;
+  std::size_t best_split = 0; // The lower half has the bins below it
+  for (std::size_t axis = 0; axis != 3; ++axis) {
+    if (extent[axis] <= 0)
+      continue;
+    const sah_bin* bins = bins_.data() + axis * bin_count;
+
+    // Bounds start out inverted, so the first bin's replace them
+    sah_bin running{0, upper, lower};
+    for (std::size_t split = bin_count - 1; split != 0; --split) {
+      running.count += bins[split].count;
+      for (std::size_t k = 0; k != 3; ++k) {
+        running.lower[k] = std::min(running.lower[k], bins[split].lower[k]);
+        running.upper[k] = std::max(running.upper[k], bins[split].upper[k]);
+      }
+      upper_costs_[split] = running.count > 0 ? surface_area(running.lower, running.upper) * running.count : 0;
+    }
+
+    running = {0, upper, lower};
+    for (std::size_t split = 1; split != bin_count; ++split) {
+      running.count += bins[split - 1].count;
+      for (std::size_t k = 0; k != 3; ++k) {
+        running.lower[k] = std::min(running.lower[k], bins[split - 1].lower[k]);
+        running.upper[k] = std::max(running.upper[k], bins[split - 1].upper[k]);
+      }
+      if (running.count == 0 || running.count == count)
+        continue;
+      const real cost = surface_area(running.lower, running.upper) * running.count + upper_costs_[split];
+      if (cost < best_cost) {
+        best_cost  = cost;
+        best_axis  = axis;
+        best_split = split;
+      }
+    }
+  }
+
+  // All bodies in a single slab of every axis, e.g. one tight cluster with a single outlier
+  if (best_split == 0)
+    return split_median(first, count, lower, upper);
+
+  const auto begin  = bodies_.begin() + first;
+  const auto middle = std::partition(begin, begin + count,
+                                     [&](const body& b) { return bin_of(b.position, best_axis) < best_split; });
+  return static_cast<std::uint32_t>(middle - begin);
+}
+
+template <typename F, typename G>
+void kd_tree::apply_node_gravity(const triple& body_position, F&& is_far_enough, const G& gravity,
+                                 triple& acceleration) const
+{
+  const linear_octree_node* nodes = nodes_.data();
+  const auto count                = static_cast<std::uint32_t>(nodes_.size());
+  for (std::uint32_t index = 0; index < count;) {
+    const linear_octree_node& node = nodes[index];
+    SOLARSIM_PREFETCH(nodes + node.next);
+
+    const triple center_of_mass = to_triple(node.mass_point);
+    if (is_far_enough(node, squared_length(center_of_mass - body_position))) {
+      gravity(body_position, center_of_mass, node.mass_point.w(), acceleration);
+      index = node.next;
+    } else if (node.is_leaf(index)) {
+      for (std::uint32_t i = node.first_body, end = node.first_body + node.body_count; i != end; ++i)
+        gravity(body_position, bodies_[i].position, bodies_[i].scaled_mass, acceleration);
+      index = node.next;
+    } else {
+      ++index;
+    }
+  }
+}
+
+void kd_tree::apply_forces_to(const triple& body_position, real softening, triple& acceleration) const
+{
+  with_pairwise_gravity(softening_kind_, softening, [&](const auto& gravity) {
+    apply_node_gravity(
+        body_position,
+        [](const linear_octree_node& node, real distance_squared) {
+          return distance_squared > node.critical_radius_squared;
+        },
+        gravity, acceleration);
+  });
+}
+
+void kd_tree::recompute_acceleration(const triple& body_position, real softening, triple& acceleration) const
+{
+  const real previous_acceleration =
+      criterion_.type == opening_criterion::kind::relative_acceleration ? ::solarsim::length(acceleration) : 0;
+  acceleration = {};
+  if (previous_acceleration <= 0) {
+    apply_forces_to(body_position, softening, acceleration);
+    return;
+  }
+
+  // Accept: G * M * l^2 <= alpha * |a| * d^4, see barnes_hut_octree
+  const real threshold = criterion_.alpha * previous_acceleration;
+  with_pairwise_gravity(softening_kind_, softening, [&](const auto& gravity) {
+    apply_node_gravity(
+        body_position,
+        [threshold](const linear_octree_node& node, real distance_squared) {
+          return distance_squared > 3 * node.length_squared &&
+                 node.mass_point.w() * node.length_squared <= threshold * distance_squared * distance_squared;
+        },
+        gravity, acceleration);
+  });
+}
+
+SOLARSIM_NS_END
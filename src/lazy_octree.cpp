@@ -0,0 +1,293 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include "solarsim/lazy_octree.hpp"
+#include "solarsim/math.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+
+SOLARSIM_NS_BEGIN
+
+lazy_octree_node_pool::lazy_octree_node_pool(lazy_octree_node_pool&& other) noexcept
+  : chunks_(std::move(other.chunks_))
+  , current_chunk_(other.current_chunk_)
+  , current_used_(other.current_used_)
+  , size_(other.size_)
+{
+  other.reset();
+}
+
+lazy_octree_node_pool& lazy_octree_node_pool::operator=(lazy_octree_node_pool&& other) noexcept
+{
+  chunks_        = std::move(other.chunks_);
+  current_chunk_ = other.current_chunk_;
+  current_used_  = other.current_used_;
+  size_          = other.size_;
+  other.reset();
+  return *this;
+}
+
+lazy_octree_node* lazy_octree_node_pool::allocate(std::size_t count)
+{
+  assert(count <= 8);
+  std::lock_guard lock(mutex_);
+  if (chunks_.empty() || current_used_ + count > chunk_size) {
+    if (!chunks_.empty())
+      ++current_chunk_;
+    if (current_chunk_ == chunks_.size())
+      chunks_.push_back(std::make_unique<lazy_octree_node[]>(chunk_size));
+    current_used_ = 0;
+  }
+
+  lazy_octree_node* nodes = chunks_[current_chunk_].get() + current_used_;
+  current_used_ += count;
+  size_ += count;
+  return nodes;
+}
+
+void lazy_octree_node_pool::reset() noexcept
+{
+  current_chunk_ = 0;
+  current_used_  = 0;
+  size_          = 0;
+}
+
+std::size_t lazy_octree_node_pool::size() const noexcept
+{
+  std::lock_guard lock(mutex_);
+  return size_;
+}
+
+lazy_octree::lazy_octree(std::span<const triple> body_positions, std::span<const real> body_masses)
+{
+  rebuild(body_positions, body_masses);
+}
+
+void lazy_octree::rebuild(std::span<const triple> body_positions, std::span<const real> body_masses)
+{
+  assert(body_positions.size() == body_masses.size());
+  body_positions_.assign(body_positions.begin(), body_positions.end());
+  body_masses_.resize(body_masses.size());
+  for (std::size_t i = 0; i != body_masses.size(); ++i)
+    body_masses_[i] = gravitational_constant * body_masses[i];
+  scratch_positions_.resize(body_positions.size());
+  scratch_masses_.resize(body_masses.size());
+
+  pool_.reset();
+  root_ = nullptr;
+  if (body_positions.empty())
+    return;
+
+  root_ = pool_.allocate(1);
+  initialize_node(*root_, 0, static_cast<std::uint32_t>(body_positions.size()), 0);
+}
+
+void lazy_octree::set_opening_criterion(const opening_criterion& criterion)
+{
+  assert(criterion.theta > 0);
+  criterion_ = criterion;
+}
+
+void lazy_octree::initialize_node(lazy_octree_node& node, std::uint32_t first_body, std::uint32_t body_count,
+                                  std::uint32_t depth)
+{
+  const std::span<const triple> positions(body_positions_.data() + first_body, body_count);
+  const axis_aligned_bounding_box bounds = build_bounding_box(positions);
+  const triple extent                    = bounds.max - bounds.min;
+
+  triple mass_centers_sum = {};
+  real total_mass         = 0;
+  for (std::uint32_t i = first_body, end = first_body + body_count; i != end; ++i) {
+    mass_centers_sum += body_positions_[i] * body_masses_[i];
+    total_mass += body_masses_[i];
+  }
+
+  node.position       = bounds.min;
+  node.length         = std::max({extent[0], extent[1], extent[2]});
+  node.total_mass     = total_mass;
+  node.center_of_mass = total_mass > 0 ? mass_centers_sum / total_mass : bounds.min + extent * 0.5;
+  node.first_body     = first_body;
+  node.body_count     = body_count;
+  node.depth          = depth;
+  node.children       = nullptr;
+  node.child_count    = 0;
+
+  // Distance to the farthest corner
+  triple farthest = {};
+  for (std::size_t axis = 0; axis != 3; ++axis) {
+    farthest[axis] = std::max(node.center_of_mass[axis] - node.position[axis],
+                              node.position[axis] + node.length - node.center_of_mass[axis]);
+  }
+  node.bmax = length(farthest);
+
+  // Identical bodies can't be split, no matter how deep we go.
+  const bool is_leaf = body_count <= leaf_options_.max_bodies || depth >= leaf_options_.max_depth || node.length <= 0;
+  node.state.store(is_leaf ? lazy_octree_node::leaf : lazy_octree_node::unexpanded, std::memory_order_relaxed);
+}
+
+void lazy_octree::open(lazy_octree_node& node)
+{
+  auto state = node.state.load(std::memory_order_acquire);
+  if (state == lazy_octree_node::expanded)
+    return;
+
+  if (state == lazy_octree_node::unexpanded &&
+      node.state.compare_exchange_strong(state, lazy_octree_node::expanding, std::memory_order_acquire)) {
+    expand(node);
+    node.state.store(lazy_octree_node::expanded, std::memory_order_release);
+    node.state.notify_all();
+    return;
+  }
+
+  // Someone else got there first
+  while (state != lazy_octree_node::expanded) {
+    node.state.wait(state, std::memory_order_acquire);
+    state = node.state.load(std::memory_order_acquire);
+  }
+}
+
+void lazy_octree::expand(lazy_octree_node& node)
+{
+  // Split at the cube's center. The cube is tight, so its longest axis always separates at least two bodies.
+  const triple center       = node.position + node.length / 2;
+  const std::uint32_t first = node.first_body;
+  const std::uint32_t end   = first + node.body_count;
+
+  auto get_slot = [&center](const triple& position) {
+    return (position[0] >= center[0] ? 4u : 0u) | (position[1] >= center[1] ? 2u : 0u) |
+           (position[2] >= center[2] ? 1u : 0u);
+  };
+
+  std::array<std::uint32_t, 8> counts = {};
+  for (std::uint32_t i = first; i != end; ++i)
+    ++counts[get_slot(body_positions_[i])];
+
+  std::array<std::uint32_t, 8> offsets = {};
+  std::uint32_t child_count            = 0;
+  for (std::uint32_t slot = 0, offset = first; slot != 8; ++slot) {
+    offsets[slot] = offset;
+    offset += counts[slot];
+    child_count += counts[slot] != 0 ? 1u : 0u;
+  }
+
+  // Counting sort through our part of the scratch buffers
+  std::array<std::uint32_t, 8> write = offsets;
+  for (std::uint32_t i = first; i != end; ++i) {
+    const std::uint32_t target = write[get_slot(body_positions_[i])]++;
+    scratch_positions_[target] = body_positions_[i];
+    scratch_masses_[target]    = body_masses_[i];
+  }
+  std::copy(scratch_positions_.begin() + first, scratch_positions_.begin() + end, body_positions_.begin() + first);
+  std::copy(scratch_masses_.begin() + first, scratch_masses_.begin() + end, body_masses_.begin() + first);
+
+  lazy_octree_node* children = pool_.allocate(child_count);
+  lazy_octree_node* child    = children;
+  for (std::uint32_t slot = 0; slot != 8; ++slot) {
+    if (counts[slot] != 0)
+      initialize_node(*child++, offsets[slot], counts[slot], node.depth + 1);
+  }
+  node.children    = children;
+  node.child_count = child_count;
+}
+
+void lazy_octree::expand_all()
+{
+  if (root_)
+    expand_all(*root_);
+}
+
+void lazy_octree::expand_all(lazy_octree_node& node)
+{
+  if (node.state.load(std::memory_order_relaxed) == lazy_octree_node::leaf)
+    return;
+
+  open(node);
+  for (std::uint32_t i = 0; i != node.child_count; ++i)
+    expand_all(node.children[i]);
+}
+
+template <typename F, typename G>
+void lazy_octree::apply_node_gravity(lazy_octree_node& node, const triple& body_position, F&& is_far_enough,
+                                     const G& gravity, triple& acceleration)
+{
+  if (is_far_enough(node, squared_length(node.center_of_mass - body_position))) {
+    // It's far enough away that our approximation is sufficient.
+    gravity(body_position, node.center_of_mass, node.total_mass, acceleration);
+  } else if (node.state.load(std::memory_order_relaxed) == lazy_octree_node::leaf) {
+    // Leaf nodes apply their bodies' force. Leaves are never expanded, so their bodies stay where they are.
+    for (std::uint32_t i = node.first_body, end = node.first_body + node.body_count; i != end; ++i)
+      gravity(body_position, body_positions_[i], body_masses_[i], acceleration);
+  } else {
+    // Otherwise, descend into our children
+    open(node);
+    for (std::uint32_t i = 0; i != node.child_count; ++i)
+      apply_node_gravity(node.children[i], body_position, is_far_enough, gravity, acceleration);
+  }
+}
+
+void lazy_octree::apply_forces_to(const triple& body_position, real softening, triple& acceleration)
+{
+  if (!root_)
+    return;
+
+  // Opening test: size / distance < theta <=> distance^2 * theta^2 > size^2
+  const real theta_squared = criterion_.theta * criterion_.theta;
+  with_pairwise_gravity(softening_kind_, softening, [&](const auto& gravity) {
+    if (criterion_.type == opening_criterion::kind::bmax) {
+      apply_node_gravity(
+          *root_, body_position,
+          [theta_squared](const lazy_octree_node& node, real distance_squared) {
+            return distance_squared * theta_squared > node.bmax * node.bmax;
+          },
+          gravity, acceleration);
+    } else {
+      apply_node_gravity(
+          *root_, body_position,
+          [theta_squared](const lazy_octree_node& node, real distance_squared) {
+            return distance_squared * theta_squared > node.length * node.length;
+          },
+          gravity, acceleration);
+    }
+  });
+}
+
+void lazy_octree::recompute_acceleration(const triple& body_position, real softening, triple& acceleration)
+{
+  const real previous_acceleration = length(acceleration);
+  acceleration                     = {};
+  if (criterion_.type != opening_criterion::kind::relative_acceleration || previous_acceleration <= 0) {
+    apply_forces_to(body_position, softening, acceleration);
+    return;
+  }
+
+  if (!root_)
+    return;
+
+  // Accept: G * M * l^2 <= alpha * |a| * d^4, see barnes_hut_octree
+  const real threshold = criterion_.alpha * previous_acceleration;
+  with_pairwise_gravity(softening_kind_, softening, [&](const auto& gravity) {
+    apply_node_gravity(
+        *root_, body_position,
+        [threshold](const lazy_octree_node& node, real distance_squared) {
+          const real length_squared = node.length * node.length;
+          return distance_squared > 3 * length_squared &&
+                 node.total_mass * length_squared <= threshold * distance_squared * distance_squared;
+        },
+        gravity, acceleration);
+  });
+}
+
+SOLARSIM_NS_END
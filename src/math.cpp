@@ -15,7 +15,10 @@
 #include "solarsim/math.hpp"
 #include "solarsim/body_definition.hpp"
 
+#include "simd_kernels.hpp"
+
 #include <cassert>
+#include <numbers>
 
 SOLARSIM_NS_BEGIN
 
@@ -27,104 +30,161 @@ SOLARSIM_NS_BEGIN
 void calculate_acceleration(const triple& x_i, const triple& x_j, real unadjusted_mass, real softening,
                             triple& acceleration)
 {
-  const triple displacement = x_j - x_i;
-
-  const real distance = length(displacement) + softening;
-  const real divisor  = distance * distance * distance;
-
-  unadjusted_mass *= gravitational_constant;
-
-  acceleration[0] += unadjusted_mass * displacement[0] / divisor;
-  acceleration[1] += unadjusted_mass * displacement[1] / divisor;
-  acceleration[2] += unadjusted_mass * displacement[2] / divisor;
-  debug_validate_finite(acceleration);
+  pairwise_gravity<>{softening}(x_i, x_j, unadjusted_mass * gravitational_constant, acceleration);
 }
 
 // calculate acceleration pairwise for (i, j) and (j, i)
 // This allows us to cut down on the more expensive calculations (e.g. sqrt)
 void calculate_acceleration(const triple& x_i, const triple& x_j, real unadjusted_mass_i, real unadjusted_mass_j,
                             real softening, triple& acceleration_i, triple& acceleration_j)
+{
+  pairwise_gravity<>{softening}(x_i, x_j, unadjusted_mass_i * gravitational_constant,
+                                unadjusted_mass_j * gravitational_constant, acceleration_i, acceleration_j);
+}
+
+void calculate_scaled_acceleration(const triple& x_i, const triple& x_j, real scaled_mass, real softening,
+                                   softening_kind kind, triple& acceleration)
+{
+  if (kind == softening_kind::plummer)
+    pairwise_gravity<softening_kind::plummer>{softening}(x_i, x_j, scaled_mass, acceleration);
+  else
+    pairwise_gravity<softening_kind::linear>{softening}(x_i, x_j, scaled_mass, acceleration);
+}
+
+void calculate_scaled_acceleration(const triple& x_i, const triple& x_j, real scaled_mass_i, real scaled_mass_j,
+                                   real softening, softening_kind kind, triple& acceleration_i,
+                                   triple& acceleration_j)
+{
+  if (kind == softening_kind::plummer) {
+    pairwise_gravity<softening_kind::plummer>{softening}(x_i, x_j, scaled_mass_i, scaled_mass_j, acceleration_i,
+                                                         acceleration_j);
+  } else {
+    pairwise_gravity<softening_kind::linear>{softening}(x_i, x_j, scaled_mass_i, scaled_mass_j, acceleration_i,
+                                                        acceleration_j);
+  }
+}
+
+void calculate_scaled_short_range_acceleration(const triple& x_i, const triple& x_j, real scaled_mass,
+                                               real softening, softening_kind kind, real split_radius,
+                                               triple& acceleration)
 {
   const triple displacement = x_j - x_i;
 
-  const real distance = length(displacement) + softening;
-  const real divisor  = distance * distance * distance;
+  const real squared_distance = squared_length(displacement);
+  const real r                = std::sqrt(squared_distance);
+  const real inverse          = softened_inverse_distance(squared_distance, softening, kind);
+
+  // erfc(u) = t * P(t) * exp(-u^2) with t = 1 / (1 + p * u) (Abramowitz & Stegun 7.1.26, |error| < 1.5e-7),
+  // so both terms share the exponential.
+  const real u        = r / (2 * split_radius);
+  const real gaussian = std::exp(-u * u);
+  const real t        = 1 / (1 + real(0.3275911) * u);
+  const real erfc_u =
+      t * (real(0.254829592) +
+           t * (real(-0.284496736) + t * (real(1.421413741) + t * (real(-1.453152027) + t * real(1.061405429))))) *
+      gaussian;
+  const real factor = erfc_u + 2 * u * std::numbers::inv_sqrtpi_v<real> * gaussian;
+
+  const real scale = scaled_mass * factor * inverse * (inverse * inverse);
+
+  acceleration[0] += scale * displacement[0];
+  acceleration[1] += scale * displacement[1];
+  acceleration[2] += scale * displacement[2];
+  debug_validate_finite(acceleration);
+}
 
-  unadjusted_mass_j *= gravitational_constant;
-  unadjusted_mass_i *= gravitational_constant;
+void calculate_scaled_acceleration_soa(const triple& x_i, const real* x_j, const real* y_j, const real* z_j,
+                                       const real* scaled_mass_j, std::size_t count, real softening,
+                                       softening_kind kind, triple& acceleration)
+{
+  assert(count % soa_lane_count == 0);
 
-  acceleration_i[0] += unadjusted_mass_j * displacement[0] / divisor;
-  acceleration_i[1] += unadjusted_mass_j * displacement[1] / divisor;
-  acceleration_i[2] += unadjusted_mass_j * displacement[2] / divisor;
-  debug_validate_finite(acceleration_i);
+  const std::size_t index = kind == softening_kind::plummer ? 1 : 0;
+  get_body_kernels(active_simd_instruction_set())
+      .accumulate_list[index](x_i, x_j, y_j, z_j, scaled_mass_j, count, softening, acceleration);
+  debug_validate_finite(acceleration);
+}
 
-  acceleration_j[0] -= unadjusted_mass_i * displacement[0] / divisor;
-  acceleration_j[1] -= unadjusted_mass_i * displacement[1] / divisor;
-  acceleration_j[2] -= unadjusted_mass_i * displacement[2] / divisor;
-  debug_validate_finite(acceleration_j);
+void add_point_quadrupole(const triple& offset, real mass, quadrupole_moment& quadrupole)
+{
+  const real squared_distance = squared_length(offset);
+  quadrupole[0] += mass * (3 * offset[0] * offset[0] - squared_distance);
+  quadrupole[1] += mass * 3 * offset[0] * offset[1];
+  quadrupole[2] += mass * 3 * offset[0] * offset[2];
+  quadrupole[3] += mass * (3 * offset[1] * offset[1] - squared_distance);
+  quadrupole[4] += mass * 3 * offset[1] * offset[2];
+  quadrupole[5] += mass * (3 * offset[2] * offset[2] - squared_distance);
 }
 
-// Velocity verlet
+// With d = x_c - x_i and r = |d|, the quadrupole potential -1 / 2 * d^T Q d / r^5 (G is part of Q) yields
 //
-// This is supposed to be used in two phases, between which the |acceleration|
-// is re-calculated based on the new body positions.
-//
-// Steps:
-//   calculate acceleration(...) [or re-use from previous time step]
-//   integrate_velocity_verlet_phase1(...)
-//   calculate acceleration(...)
-//   integrate_velocity_verlet_phase2(...)
+//   a_i = 5 / 2 * (d^T Q d) * d / r^7 - Q d / r^5
+void calculate_scaled_quadrupole_acceleration(const triple& x_i, const triple& center_of_mass,
+                                              const quadrupole_moment& quadrupole, triple& acceleration)
+{
+  const triple d = center_of_mass - x_i;
+
+  const triple qd = {quadrupole[0] * d[0] + quadrupole[1] * d[1] + quadrupole[2] * d[2],
+                     quadrupole[1] * d[0] + quadrupole[3] * d[1] + quadrupole[4] * d[2],
+                     quadrupole[2] * d[0] + quadrupole[4] * d[1] + quadrupole[5] * d[2]};
+  const real dqd  = d[0] * qd[0] + d[1] * qd[1] + d[2] * qd[2];
+
+  const real squared_distance = squared_length(d);
+  const real inverse_r2       = 1 / squared_distance;
+  const real inverse_r5       = inverse_r2 * inverse_r2 / std::sqrt(squared_distance);
+
+  acceleration += (d * (2.5 * dqd * inverse_r2) - qd) * inverse_r5;
+  debug_validate_finite(acceleration);
+}
 
 void integrate_velocity_verlet_phase1(triple& position, triple& velocity, const triple& acceleration, real dT)
 {
-  // v_{i+1/2} = v_i + 0.5 \times a[i] \times \Delta t
-  velocity[0] += acceleration[0] * 0.5 * dT;
-  velocity[1] += acceleration[1] * 0.5 * dT;
-  velocity[2] += acceleration[2] * 0.5 * dT;
-
-  // x_{i+1} = x_i + v_{i+1/2} \times \Delta t
-  position[0] += velocity[0] * dT;
-  position[1] += velocity[1] * dT;
-  position[2] += velocity[2] * dT;
+  velocity_verlet_integrator::phase1(position, velocity, acceleration, dT);
 }
 
 void integrate_velocity_verlet_phase2(triple& velocity, const triple& acceleration, real dT)
 {
-  // v_{i+1} = v_{i+1/2} + 0.5 \times a_{i+1} \times \Delta t
-  velocity[0] += acceleration[0] * 0.5 * dT;
-  velocity[1] += acceleration[1] * 0.5 * dT;
-  velocity[2] += acceleration[2] * 0.5 * dT;
+  velocity_verlet_integrator::phase2({}, velocity, acceleration, dT);
 }
 
-// Leapfrog
-//
-// This is the velocity verlet with a time shift of one half of a step.
-// Has the benefit of not needing a preserved acceleration vector!
-//
-// Steps:
-//   integrate_leapfrog_phase1(...)
-//   calculate acceleration(...)
-//   integrate_leapfrog_phase2(...)
-
 void integrate_leapfrog_phase1(triple& position, const triple& velocity, real dT)
 {
-  // x_{i+1/2} = x_i + 0.5 \times v_{i} \times \Delta t
-  position[0] += velocity[0] * 0.5 * dT;
-  position[1] += velocity[1] * 0.5 * dT;
-  position[2] += velocity[2] * 0.5 * dT;
+  leapfrog_integrator::phase1(position, velocity, {}, dT);
 }
 
 void integrate_leapfrog_phase2(triple& position, triple& velocity, const triple& acceleration, real dT)
 {
-  // v_{i+1} = v_i + a_{i+1/2} \times \Delta t
-  velocity[0] += acceleration[0] * dT;
-  velocity[1] += acceleration[1] * dT;
-  velocity[2] += acceleration[2] * dT;
+  leapfrog_integrator::phase2(position, velocity, acceleration, dT);
+}
+
+void integrate_velocity_verlet_phase1(std::span<triple> positions, std::span<triple> velocities,
+                                      std::span<const triple> accelerations, real dT)
+{
+  assert(velocities.size() == positions.size() && accelerations.size() == positions.size());
+  get_body_kernels(active_simd_instruction_set())
+      .velocity_verlet_phase1(positions.data(), velocities.data(), accelerations.data(), positions.size(), dT);
+}
 
-  // x_{i+1} = x_{i+1/2} + 0.5 \times v_{i+1} \times \Delta t
-  position[0] += velocity[0] * 0.5 * dT;
-  position[1] += velocity[1] * 0.5 * dT;
-  position[2] += velocity[2] * 0.5 * dT;
+void integrate_velocity_verlet_phase2(std::span<triple> velocities, std::span<const triple> accelerations, real dT)
+{
+  assert(accelerations.size() == velocities.size());
+  get_body_kernels(active_simd_instruction_set())
+      .velocity_verlet_phase2(velocities.data(), accelerations.data(), velocities.size(), dT);
+}
+
+void integrate_leapfrog_phase1(std::span<triple> positions, std::span<const triple> velocities, real dT)
+{
+  assert(velocities.size() == positions.size());
+  get_body_kernels(active_simd_instruction_set())
+      .leapfrog_phase1(positions.data(), velocities.data(), positions.size(), dT);
+}
+
+void integrate_leapfrog_phase2(std::span<triple> positions, std::span<triple> velocities,
+                               std::span<const triple> accelerations, real dT)
+{
+  assert(velocities.size() == positions.size() && accelerations.size() == positions.size());
+  get_body_kernels(active_simd_instruction_set())
+      .leapfrog_phase2(positions.data(), velocities.data(), accelerations.data(), positions.size(), dT);
 }
 
 // System energy
@@ -0,0 +1,99 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include "solarsim/merged_octree_builder.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+SOLARSIM_NS_BEGIN
+
+void merged_octree_builder::prepare(const axis_aligned_bounding_box& bounds, std::span<const triple> body_positions,
+                                    std::span<const real> body_masses, std::size_t num_tasks)
+{
+  assert(body_positions.size() == body_masses.size());
+
+  const std::size_t n = body_positions.size();
+  bounds_             = bounds;
+  input_positions_    = body_positions;
+  input_masses_       = body_masses;
+  // Don't bother with tiny partial trees
+  const std::size_t max_useful_tasks = std::clamp<std::size_t>(n / min_bodies_per_task, 1, max_num_tasks);
+  num_tasks_                         = std::clamp<std::size_t>(num_tasks, 1, max_useful_tasks);
+
+  // Keep the partial trees around, their node pools are reused
+  partial_trees_.resize(max_num_tasks);
+  for (auto& tree : partial_trees_)
+    tree.set_leaf_options(leaf_options_);
+  subtree_roots_.clear();
+}
+
+void merged_octree_builder::build_partial(std::size_t task)
+{
+  if (task >= num_tasks_)
+    return;
+
+  const std::size_t n     = input_positions_.size();
+  const std::size_t begin = n * task / num_tasks_;
+  const std::size_t end   = n * (task + 1) / num_tasks_;
+  partial_trees_[task].rebuild(bounds_, input_positions_.subspan(begin, end - begin),
+                               input_masses_.subspan(begin, end - begin), static_cast<std::uint32_t>(begin));
+}
+
+void merged_octree_builder::merge(std::size_t round, std::size_t index)
+{
+  // Round r merges tree (i * 2^(r+1) + 2^r) into tree (i * 2^(r+1)), so tree 0 ends up with everything.
+  const std::size_t stride = std::size_t(2) << round;
+  const std::size_t target = index * stride;
+  const std::size_t source = target + stride / 2;
+  if (source < num_tasks_)
+    partial_trees_[target].merge_from(partial_trees_[source]);
+}
+
+void merged_octree_builder::prepare_finalize()
+{
+  std::swap(static_cast<partial_barnes_hut_octree&>(octree_), partial_trees_[0]);
+  octree_.collect_nodes_at_depth(0, finalize_depth, subtree_roots_);
+}
+
+void merged_octree_builder::finalize_subtree(std::size_t index)
+{
+  if (index < subtree_roots_.size())
+    octree_.finalize(subtree_roots_[index]);
+}
+
+void merged_octree_builder::finalize_top()
+{
+  octree_.finalize_top(0, finalize_depth);
+}
+
+barnes_hut_octree merged_octree_builder::release()
+{
+  octree_.criterion_ = criterion_;
+  octree_.linearize();
+  input_positions_ = {};
+  input_masses_    = {};
+  return std::move(octree_);
+}
+
+barnes_hut_octree merged_octree_builder::build(std::span<const triple> body_positions,
+                                               std::span<const real> body_masses)
+{
+  return build(build_bounding_box(body_positions), body_positions, body_masses, [](std::size_t count, auto&& f) {
+    for (std::size_t i = 0; i != count; ++i)
+      f(i);
+  });
+}
+
+SOLARSIM_NS_END
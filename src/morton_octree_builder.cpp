@@ -0,0 +1,408 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include "solarsim/morton_octree_builder.hpp"
+#include "solarsim/math.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+
+SOLARSIM_NS_BEGIN
+
+namespace {
+
+// Spread the lower 21 bits of |v| so that there are two zero bits between each of them.
+// see: https://fgiesen.wordpress.com/2009/12/13/decoding-morton-codes/
+constexpr std::uint64_t spread_bits(std::uint64_t v) noexcept
+{
+  v &= 0x1fffff;
+  v = (v | v << 32) & 0x1f00000000ffff;
+  v = (v | v << 16) & 0x1f0000ff0000ff;
+  v = (v | v << 8) & 0x100f00f00f00f00f;
+  v = (v | v << 4) & 0x10c30c30c30c30c3;
+  v = (v | v << 2) & 0x1249249249249249;
+  return v;
+}
+
+constexpr std::uint64_t compact_bits(std::uint64_t v) noexcept
+{
+  v &= 0x1249249249249249;
+  v = (v ^ (v >> 2)) & 0x10c30c30c30c30c3;
+  v = (v ^ (v >> 4)) & 0x100f00f00f00f00f;
+  v = (v ^ (v >> 8)) & 0x1f0000ff0000ff;
+  v = (v ^ (v >> 16)) & 0x1f00000000ffff;
+  v = (v ^ (v >> 32)) & 0x1fffff;
+  return v;
+}
+
+constexpr std::size_t cell_shift = 3 * (morton_octree_builder::max_levels - morton_octree_builder::cell_levels);
+
+// Sort (key, index) pairs by key. Used for the (independent) top-level cells.
+// The scratch spans need the same size as |keys|.
+void sort_cell(std::span<std::uint64_t> keys, std::span<std::uint32_t> indices, std::span<std::uint64_t> keys_tmp,
+               std::span<std::uint32_t> indices_tmp)
+{
+  const std::size_t n = keys.size();
+  if (n < 64) {
+    // Insertion sort is hard to beat for these.
+    for (std::size_t i = 1; i < n; ++i) {
+      const std::uint64_t key   = keys[i];
+      const std::uint32_t index = indices[i];
+      std::size_t j             = i;
+      for (; j > 0 && keys[j - 1] > key; --j) {
+        keys[j]    = keys[j - 1];
+        indices[j] = indices[j - 1];
+      }
+      keys[j]    = key;
+      indices[j] = index;
+    }
+    return;
+  }
+
+  // LSD radix sort over the bits below the cell prefix (which all our keys share)
+  constexpr std::size_t radix_bits = 8;
+  constexpr std::size_t radix_size = std::size_t(1) << radix_bits;
+
+  std::span<std::uint64_t> src_keys    = keys;
+  std::span<std::uint32_t> src_indices = indices;
+  std::span<std::uint64_t> dst_keys    = keys_tmp;
+  std::span<std::uint32_t> dst_indices = indices_tmp;
+
+  for (std::size_t shift = 0; shift < cell_shift; shift += radix_bits) {
+    std::uint32_t offsets[radix_size] = {};
+    for (const std::uint64_t key : src_keys)
+      ++offsets[(key >> shift) & (radix_size - 1)];
+
+    // All keys share this digit? Nothing to do for this pass.
+    if (offsets[(src_keys[0] >> shift) & (radix_size - 1)] == n)
+      continue;
+
+    std::uint32_t sum = 0;
+    for (auto& offset : offsets) {
+      const std::uint32_t count = offset;
+      offset                    = sum;
+      sum += count;
+    }
+
+    for (std::size_t i = 0; i != n; ++i) {
+      const std::uint32_t target = offsets[(src_keys[i] >> shift) & (radix_size - 1)]++;
+      dst_keys[target]           = src_keys[i];
+      dst_indices[target]        = src_indices[i];
+    }
+    std::swap(src_keys, dst_keys);
+    std::swap(src_indices, dst_indices);
+  }
+
+  if (src_keys.data() != keys.data()) {
+    std::copy(src_keys.begin(), src_keys.end(), keys.begin());
+    std::copy(src_indices.begin(), src_indices.end(), indices.begin());
+  }
+}
+
+} // namespace
+
+std::uint64_t encode_morton_key(std::uint32_t x, std::uint32_t y, std::uint32_t z) noexcept
+{
+  return spread_bits(x) << 2 | spread_bits(y) << 1 | spread_bits(z);
+}
+
+void morton_octree_builder::prepare(const axis_aligned_bounding_box& bounds, std::span<const triple> body_positions,
+                                    std::span<const real> body_masses, std::size_t num_tasks)
+{
+  assert(body_positions.size() == body_masses.size());
+  assert(body_positions.size() < std::numeric_limits<std::uint32_t>::max());
+
+  const std::size_t n = body_positions.size();
+  input_positions_    = body_positions;
+  input_masses_       = body_masses;
+  num_tasks_          = std::clamp<std::size_t>(num_tasks, 1, std::max<std::size_t>(n / min_bodies_per_task, 1));
+
+  octree_.set_leaf_options(leaf_options_);
+  octree_.reset(bounds);
+  octree_.body_positions_.resize(n);
+  octree_.body_masses_.resize(n);
+  octree_.body_ids_.resize(n);
+  octree_.next_body_.resize(n);
+
+  keys_.resize(n);
+  sorted_keys_.resize(n);
+  sorted_indices_.resize(n);
+  scratch_keys_.resize(n);
+  scratch_indices_.resize(n);
+  cell_histograms_.assign(num_tasks_ * num_cells, 0);
+  cell_offsets_.resize(num_cells + 1);
+  cell_nodes_.resize(num_cells);
+  cell_node_offsets_.resize(num_cells);
+}
+
+std::size_t morton_octree_builder::task_begin(std::size_t task) const noexcept
+{
+  return input_positions_.size() * task / num_tasks_;
+}
+
+void morton_octree_builder::compute_keys(std::size_t task)
+{
+  const barnes_hut_octree_node& root = octree_.nodes_[0];
+
+  // Quantize positions into a 2^21 grid over our root cell
+  constexpr real grid_size = static_cast<real>(std::uint32_t(1) << max_levels);
+  constexpr real grid_max  = grid_size - 1;
+  const real scale         = root.length > 0 ? grid_size / root.length : 0;
+
+  auto quantize = [grid_max](real v) {
+    return static_cast<std::uint32_t>(std::clamp(v, real(0), grid_max));
+  };
+
+  std::uint32_t* histogram = cell_histograms_.data() + task * num_cells;
+  for (std::size_t i = task_begin(task), end = task_begin(task + 1); i != end; ++i) {
+    const triple grid_position = (input_positions_[i] - root.position) * scale;
+    const std::uint64_t key =
+        encode_morton_key(quantize(grid_position[0]), quantize(grid_position[1]), quantize(grid_position[2]));
+    keys_[i] = key;
+    ++histogram[key >> cell_shift];
+  }
+}
+
+void morton_octree_builder::scan_cells()
+{
+  // Turn the histograms into write offsets. Cells first, then tasks - so the scatter is stable.
+  std::uint32_t sum = 0;
+  for (std::size_t cell = 0; cell != num_cells; ++cell) {
+    cell_offsets_[cell] = sum;
+    for (std::size_t task = 0; task != num_tasks_; ++task) {
+      std::uint32_t& offset     = cell_histograms_[task * num_cells + cell];
+      const std::uint32_t count = offset;
+      offset                    = sum;
+      sum += count;
+    }
+  }
+  cell_offsets_[num_cells] = sum;
+}
+
+void morton_octree_builder::scatter_keys(std::size_t task)
+{
+  std::uint32_t* offsets = cell_histograms_.data() + task * num_cells;
+  for (std::size_t i = task_begin(task), end = task_begin(task + 1); i != end; ++i) {
+    const std::uint32_t target = offsets[keys_[i] >> cell_shift]++;
+    sorted_keys_[target]       = keys_[i];
+    sorted_indices_[target]    = static_cast<std::uint32_t>(i);
+  }
+}
+
+void morton_octree_builder::build_cell(std::size_t cell)
+{
+  auto& nodes = cell_nodes_[cell];
+  nodes.clear();
+
+  const std::uint32_t begin = cell_offsets_[cell];
+  const std::uint32_t end   = cell_offsets_[cell + 1];
+  if (begin == end)
+    return;
+
+  // Cells don't overlap, so each one can use its own range of the scratch buffers.
+  sort_cell(std::span(sorted_keys_).subspan(begin, end - begin),
+            std::span(sorted_indices_).subspan(begin, end - begin),
+            std::span(scratch_keys_).subspan(begin, end - begin),
+            std::span(scratch_indices_).subspan(begin, end - begin));
+
+  // Our tree gets its own copy of the bodies, in Morton order
+  for (std::uint32_t i = begin; i != end; ++i) {
+    octree_.body_positions_[i] = input_positions_[sorted_indices_[i]];
+    octree_.body_masses_[i]    = input_masses_[sorted_indices_[i]];
+    octree_.body_ids_[i]       = sorted_indices_[i];
+    octree_.next_body_[i]      = i + 1;
+  }
+
+  // Part of a leaf above the top-level cells? link_node() takes care of that.
+  for (std::size_t level = 0; level != cell_levels; ++level) {
+    if (is_region_leaf(level, cell >> (3 * (cell_levels - level))))
+      return;
+  }
+
+  build_node(nodes, begin, end, cell_levels, cell);
+}
+
+octree_node_index morton_octree_builder::build_node(std::vector<barnes_hut_octree_node>& nodes, std::uint32_t begin,
+                                                    std::uint32_t end, std::size_t level, std::uint64_t prefix)
+{
+  const barnes_hut_octree_node& root = octree_.nodes_[0];
+  const real length                  = root.length / static_cast<real>(std::uint64_t(1) << level);
+  const triple grid_position         = {static_cast<real>(compact_bits(prefix >> 2)),
+                                        static_cast<real>(compact_bits(prefix >> 1)),
+                                        static_cast<real>(compact_bits(prefix))};
+
+  const auto index = static_cast<octree_node_index>(nodes.size());
+  nodes.emplace_back(root.position + grid_position * length, length);
+
+  triple mass_centers_sum = {};
+  real total_mass         = 0;
+  // Everything below max_levels has the same key - no point in splitting any further.
+  const std::size_t max_level = std::clamp<std::size_t>(leaf_options_.max_depth, cell_levels, max_levels);
+  if (end - begin <= leaf_options_.max_bodies || level == max_level) {
+    // Leaf bodies are contiguous in Morton order, see build_cell()
+    nodes[index].first_body = begin;
+    nodes[index].body_count = end - begin;
+    for (std::uint32_t i = begin; i != end; ++i) {
+      mass_centers_sum += octree_.body_positions_[i] * octree_.body_masses_[i];
+      total_mass += octree_.body_masses_[i];
+    }
+  } else {
+    // Our range is sorted, so each child's range follows the previous one.
+    const std::size_t shift   = 3 * (max_levels - level - 1);
+    std::uint32_t child_begin = begin;
+    for (std::size_t slot = 0; slot != 8 && child_begin != end; ++slot) {
+      const auto child_end = static_cast<std::uint32_t>(
+          std::partition_point(sorted_keys_.begin() + child_begin, sorted_keys_.begin() + end,
+                               [&](std::uint64_t key) { return ((key >> shift) & 7) <= slot; }) -
+          sorted_keys_.begin());
+      if (child_end != child_begin) {
+        const octree_node_index child = build_node(nodes, child_begin, child_end, level + 1, prefix << 3 | slot);
+        nodes[index].children[slot]   = child;
+        nodes[index].child_mask       = static_cast<std::uint8_t>(nodes[index].child_mask | (1u << slot));
+        mass_centers_sum += nodes[child].center_of_mass * nodes[child].total_mass;
+        total_mass += nodes[child].total_mass;
+      }
+      child_begin = child_end;
+    }
+  }
+
+  // Massless bodies (test particles) have no center of mass, take the node's center like update_moments() does.
+  nodes[index].total_mass     = total_mass;
+  nodes[index].center_of_mass = total_mass > 0 ? mass_centers_sum / total_mass : nodes[index].position + length / 2;
+  debug_validate_finite(nodes[index].center_of_mass);
+  return index;
+}
+
+std::uint32_t morton_octree_builder::region_begin(std::size_t level, std::uint64_t prefix) const noexcept
+{
+  return cell_offsets_[prefix << (3 * (cell_levels - level))];
+}
+
+bool morton_octree_builder::is_region_empty(std::size_t level, std::uint64_t prefix) const noexcept
+{
+  return region_begin(level, prefix) == region_begin(level, prefix + 1);
+}
+
+bool morton_octree_builder::is_region_leaf(std::size_t level, std::uint64_t prefix) const noexcept
+{
+  return region_begin(level, prefix + 1) - region_begin(level, prefix) <= octree_.leaf_options_.max_bodies;
+}
+
+void morton_octree_builder::link_cells()
+{
+  if (is_region_empty(0, 0))
+    return; // no bodies - the root stays an empty leaf
+
+  // Our tree starts with the (few) nodes above the top-level cells, followed by all cell subtrees.
+  // Regions below a leaf don't get a node.
+  std::size_t num_top_nodes = 0;
+  for (std::size_t level = 0; level != cell_levels; ++level) {
+    for (std::uint64_t prefix = 0, n = std::uint64_t(1) << (3 * level); prefix != n; ++prefix)
+      num_top_nodes += !is_region_empty(level, prefix) && (level == 0 || !is_region_leaf(level - 1, prefix >> 3));
+  }
+
+  std::size_t offset = num_top_nodes;
+  for (std::size_t cell = 0; cell != num_cells; ++cell) {
+    cell_node_offsets_[cell] = static_cast<octree_node_index>(offset);
+    offset += cell_nodes_[cell].size();
+  }
+  assert(offset < invalid_octree_node_index);
+
+  link_node(0, 0, 0);
+  assert(octree_.nodes_.size() == num_top_nodes);
+  octree_.nodes_.resize(offset);
+}
+
+void morton_octree_builder::link_node(octree_node_index index, std::size_t level, std::uint64_t prefix)
+{
+  if (is_region_leaf(level, prefix)) {
+    // Few enough bodies for a single leaf - build_cell() didn't build any nodes below us.
+    barnes_hut_octree_node& node = octree_.nodes_[index];
+    node.first_body              = region_begin(level, prefix);
+    node.body_count              = region_begin(level, prefix + 1) - node.first_body;
+    octree_.update_moments(index);
+    return;
+  }
+
+  triple mass_centers_sum = {};
+  real total_mass         = 0;
+  for (std::size_t slot = 0; slot != 8; ++slot) {
+    const std::uint64_t child_prefix = prefix << 3 | slot;
+    if (is_region_empty(level + 1, child_prefix))
+      continue;
+
+    octree_node_index child = 0;
+    if (level + 1 == cell_levels) {
+      // The cell's moments are already known, we'll copy its nodes over in emit_cell()
+      child                                   = cell_node_offsets_[child_prefix];
+      const barnes_hut_octree_node& cell_root = cell_nodes_[child_prefix][0];
+      mass_centers_sum += cell_root.center_of_mass * cell_root.total_mass;
+      total_mass += cell_root.total_mass;
+    } else {
+      const barnes_hut_octree_node& node = octree_.nodes_[index];
+      child = octree_.allocate_node(node.get_child_position(slot), node.length / 2);
+      link_node(child, level + 1, child_prefix);
+      mass_centers_sum += octree_.nodes_[child].center_of_mass * octree_.nodes_[child].total_mass;
+      total_mass += octree_.nodes_[child].total_mass;
+    }
+
+    barnes_hut_octree_node& node = octree_.nodes_[index];
+    node.children[slot]          = child;
+    node.child_mask              = static_cast<std::uint8_t>(node.child_mask | (1u << slot));
+  }
+
+  barnes_hut_octree_node& node = octree_.nodes_[index];
+  node.total_mass              = total_mass;
+  node.center_of_mass          = total_mass > 0 ? mass_centers_sum / total_mass : node.position + node.length / 2;
+  debug_validate_finite(node.center_of_mass);
+}
+
+void morton_octree_builder::emit_cell(std::size_t cell)
+{
+  const auto& nodes = cell_nodes_[cell];
+  if (nodes.empty())
+    return;
+
+  const octree_node_index offset = cell_node_offsets_[cell];
+  std::copy(nodes.begin(), nodes.end(), octree_.nodes_.begin() + offset);
+  for (std::size_t i = 0, n = nodes.size(); i != n; ++i) {
+    barnes_hut_octree_node& node = octree_.nodes_[offset + i];
+    for (std::size_t slot = 0; slot != 8; ++slot) {
+      if (node.has_child(slot))
+        node.children[slot] += offset;
+    }
+  }
+}
+
+barnes_hut_octree morton_octree_builder::release()
+{
+  octree_.criterion_ = criterion_;
+  octree_.linearize();
+  input_positions_ = {};
+  input_masses_    = {};
+  return std::move(octree_);
+}
+
+barnes_hut_octree morton_octree_builder::build(std::span<const triple> body_positions,
+                                               std::span<const real> body_masses)
+{
+  return build(build_bounding_box(body_positions), body_positions, body_masses, 1,
+               [](std::size_t count, auto&& f) {
+                 for (std::size_t i = 0; i != count; ++i)
+                   f(i);
+               });
+}
+
+SOLARSIM_NS_END
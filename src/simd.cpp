@@ -0,0 +1,188 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include "solarsim/simd.hpp"
+#include "solarsim/log.hpp"
+
+#include "simd_kernels.hpp"
+
+#include <atomic>
+#include <cstdlib>
+
+#if SOLARSIM_HAS_X86_KERNELS
+#  if defined(_MSC_VER)
+#    include <immintrin.h>
+#    include <intrin.h>
+#  else
+#    include <cpuid.h>
+#  endif
+#endif
+
+SOLARSIM_NS_BEGIN
+
+namespace {
+
+#if SOLARSIM_HAS_X86_KERNELS
+struct cpuid_registers
+{
+  std::uint32_t eax = 0;
+  std::uint32_t ebx = 0;
+  std::uint32_t ecx = 0;
+  std::uint32_t edx = 0;
+};
+
+cpuid_registers cpuid(std::uint32_t leaf, std::uint32_t subleaf) noexcept
+{
+  cpuid_registers registers;
+#  if defined(_MSC_VER)
+  int values[4] = {};
+  __cpuidex(values, static_cast<int>(leaf), static_cast<int>(subleaf));
+  registers = {static_cast<std::uint32_t>(values[0]), static_cast<std::uint32_t>(values[1]),
+               static_cast<std::uint32_t>(values[2]), static_cast<std::uint32_t>(values[3])};
+#  else
+  __cpuid_count(leaf, subleaf, registers.eax, registers.ebx, registers.ecx, registers.edx);
+#  endif
+  return registers;
+}
+
+// XCR0, i.e. the register states the OS saves on context switches. Only valid if cpuid reports OSXSAVE.
+std::uint64_t read_xcr0() noexcept
+{
+#  if defined(_MSC_VER)
+  return _xgetbv(0);
+#  else
+  std::uint32_t eax = 0;
+  std::uint32_t edx = 0;
+  __asm__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+  return (static_cast<std::uint64_t>(edx) << 32) | eax;
+#  endif
+}
+
+bool has_bit(std::uint32_t value, unsigned bit) noexcept
+{
+  return ((value >> bit) & 1) != 0;
+}
+#endif
+
+// Keeps the fallback in one place: the best instruction set at or below |requested| the CPU supports
+simd_instruction_set clamp_to_supported(simd_instruction_set requested) noexcept
+{
+  const simd_instruction_set supported = detect_simd_instruction_set();
+  return static_cast<std::uint8_t>(requested) <= static_cast<std::uint8_t>(supported) ? requested : supported;
+}
+
+// Not a valid simd_instruction_set, marks active_instruction_set as not yet picked
+constexpr auto unset_instruction_set = static_cast<simd_instruction_set>(0xff);
+
+std::atomic<simd_instruction_set> active_instruction_set = unset_instruction_set;
+
+} // namespace
+
+std::string_view to_string(simd_instruction_set instruction_set) noexcept
+{
+  switch (instruction_set) {
+    case simd_instruction_set::avx2:
+      return "avx2";
+    case simd_instruction_set::avx512:
+      return "avx512";
+    default:
+      return "portable";
+  }
+}
+
+std::optional<simd_instruction_set> parse_simd_instruction_set(std::string_view name) noexcept
+{
+  for (const auto instruction_set :
+       {simd_instruction_set::portable, simd_instruction_set::avx2, simd_instruction_set::avx512}) {
+    if (name == to_string(instruction_set))
+      return instruction_set;
+  }
+  return std::nullopt;
+}
+
+simd_instruction_set detect_simd_instruction_set() noexcept
+{
+#if SOLARSIM_HAS_X86_KERNELS
+  // The result doesn't change, and cpuid can be slow in VMs
+  static const simd_instruction_set detected = [] {
+    if (cpuid(0, 0).eax < 7)
+      return simd_instruction_set::portable;
+
+    const cpuid_registers features          = cpuid(1, 0);
+    const cpuid_registers extended_features = cpuid(7, 0);
+    if (!has_bit(features.ecx, 27) || !has_bit(features.ecx, 28)) // OSXSAVE, AVX
+      return simd_instruction_set::portable;
+
+    // SSE and AVX state for the ymm registers, plus opmask and upper zmm state for AVX-512
+    const std::uint64_t xcr0 = read_xcr0();
+    if ((xcr0 & 0x06) != 0x06)
+      return simd_instruction_set::portable;
+    if (has_bit(extended_features.ebx, 16) && (xcr0 & 0xe6) == 0xe6) // AVX512F
+      return simd_instruction_set::avx512;
+    if (has_bit(extended_features.ebx, 5) && has_bit(features.ecx, 12)) // AVX2, FMA
+      return simd_instruction_set::avx2;
+    return simd_instruction_set::portable;
+  }();
+  return detected;
+#else
+  return simd_instruction_set::portable;
+#endif
+}
+
+simd_instruction_set active_simd_instruction_set()
+{
+  simd_instruction_set active = active_instruction_set.load(std::memory_order_acquire);
+  if (active != unset_instruction_set)
+    return active;
+
+  simd_instruction_set picked = detect_simd_instruction_set();
+  if (const char* name = std::getenv("SOLARSIM_SIMD")) {
+    if (const auto requested = parse_simd_instruction_set(name))
+      picked = clamp_to_supported(*requested);
+    else
+      SOLARSIM_LOG_WARNING("Ignoring unknown instruction set SOLARSIM_SIMD={}", name);
+  }
+
+  // Someone else might have been faster, in which case we go with their choice
+  if (!active_instruction_set.compare_exchange_strong(active, picked, std::memory_order_acq_rel))
+    return active;
+
+  SOLARSIM_LOG_INFO("Using {} kernels (CPU supports {})", to_string(picked),
+                    to_string(detect_simd_instruction_set()));
+  return picked;
+}
+
+void set_active_simd_instruction_set(simd_instruction_set instruction_set)
+{
+  const simd_instruction_set picked = clamp_to_supported(instruction_set);
+  active_instruction_set.store(picked, std::memory_order_release);
+  SOLARSIM_LOG_INFO("Using {} kernels (requested {}, CPU supports {})", to_string(picked),
+                    to_string(instruction_set), to_string(detect_simd_instruction_set()));
+}
+
+const body_kernels& get_body_kernels(simd_instruction_set instruction_set) noexcept
+{
+  switch (instruction_set) {
+#if SOLARSIM_HAS_X86_KERNELS
+    case simd_instruction_set::avx2:
+      return body_kernels_avx2;
+    case simd_instruction_set::avx512:
+      return body_kernels_avx512;
+#endif
+    default:
+      return body_kernels_portable;
+  }
+}
+
+SOLARSIM_NS_END
@@ -0,0 +1,125 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef SOLARSIM_SIMDKERNELS_HPP
+#define SOLARSIM_SIMDKERNELS_HPP
+
+#include "solarsim/detail/config.hpp"
+
+#if SOLARSIM_HAS_PRAGMA_ONCE
+#  pragma once
+#endif
+
+#include "solarsim/simd.hpp"
+#include "solarsim/types.hpp"
+
+#include <cstddef>
+
+// Kernels built once per instruction set, each in its own translation unit compiled for it (see CMakeLists.txt).
+// Those translation units must not use any inline functions shared with the rest of the library, or the linker
+// might pick their copy for everyone.
+
+SOLARSIM_NS_BEGIN
+
+// Bodies of a direct_sum_kernel. All arrays are aligned to 64 bytes and padded to a multiple of
+// direct_sum_kernel::lane_count (float_lane_count for floats) with massless bodies.
+template <typename Real>
+struct basic_soa_bodies
+{
+  const Real* x  = nullptr;
+  const Real* y  = nullptr;
+  const Real* z  = nullptr;
+  const Real* gm = nullptr;
+};
+
+template <typename Real>
+struct basic_soa_accelerations
+{
+  Real* x = nullptr;
+  Real* y = nullptr;
+  Real* z = nullptr;
+};
+
+using soa_bodies        = basic_soa_bodies<real>;
+using soa_accelerations = basic_soa_accelerations<real>;
+
+// Bodies [i_begin, i_end) interacting with bodies [j_begin, j_end).
+// |j_begin| and |j_end| have to be multiples of the lane count.
+struct direct_sum_tile
+{
+  std::size_t i_begin = 0;
+  std::size_t i_end   = 0;
+  std::size_t j_begin = 0;
+  std::size_t j_end   = 0;
+};
+
+struct direct_sum_kernels
+{
+  // Add the acceleration of the bodies i caused by all bodies j. Bodies at the same position are skipped.
+  void (*accumulate)(const soa_bodies& bodies, const direct_sum_tile& tile, real softening,
+                     const soa_accelerations& acceleration);
+  // The same for all pairs with i < j, also adding the opposite acceleration to the bodies j
+  void (*accumulate_pairs)(const soa_bodies& bodies, const direct_sum_tile& tile, real softening,
+                           const soa_accelerations& acceleration);
+
+  // float32 versions of the above, for force_precision::mixed
+  void (*accumulate_float)(const basic_soa_bodies<float>& bodies, const direct_sum_tile& tile, float softening,
+                           const basic_soa_accelerations<float>& acceleration);
+  void (*accumulate_pairs_float)(const basic_soa_bodies<float>& bodies, const direct_sum_tile& tile,
+                                 float softening, const basic_soa_accelerations<float>& acceleration);
+};
+
+// One set of kernels per softening_kind: linear, Plummer
+extern const direct_sum_kernels direct_sum_kernels_portable[2];
+#if SOLARSIM_HAS_X86_KERNELS
+extern const direct_sum_kernels direct_sum_kernels_avx2[2];
+extern const direct_sum_kernels direct_sum_kernels_avx512[2];
+#endif
+
+// Per-body loops, built from body_kernels.ipp for every instruction set. Unlike the direct-sum kernels, these are
+// plain C++ that the compiler vectorizes with whatever it's allowed to use. Masses are G * m, like pairwise_gravity's.
+struct body_kernels
+{
+  // calculate_scaled_acceleration_soa(), i.e. a barnes_hut_octree interaction list of leaf bodies and far-away
+  // nodes. One per softening_kind: linear, Plummer
+  void (*accumulate_list[2])(const triple& x_i, const real* x_j, const real* y_j, const real* z_j,
+                             const real* scaled_mass_j, std::size_t count, real softening, triple& acceleration);
+
+  // barnes_hut_octree's packet walk: |count| mass points (xyz and G * m) acting on soa_lane_count bodies at once,
+  // added to the per-lane sums. Lanes with a |mask| of 0 sit them out. One per softening_kind: linear, Plummer
+  void (*accumulate_packet[2])(const real* x, const real* y, const real* z, const quad* mass_points,
+                               std::size_t count, const real* mask, real softening, real* sum_x, real* sum_y,
+                               real* sum_z);
+
+  // leapfrog_integrator and velocity_verlet_integrator for |count| bodies
+  void (*leapfrog_phase1)(triple* positions, const triple* velocities, std::size_t count, real dT);
+  void (*leapfrog_phase2)(triple* positions, triple* velocities, const triple* accelerations, std::size_t count,
+                          real dT);
+  void (*velocity_verlet_phase1)(triple* positions, triple* velocities, const triple* accelerations,
+                                 std::size_t count, real dT);
+  void (*velocity_verlet_phase2)(triple* velocities, const triple* accelerations, std::size_t count, real dT);
+};
+
+extern const body_kernels body_kernels_portable;
+#if SOLARSIM_HAS_X86_KERNELS
+extern const body_kernels body_kernels_avx2;
+extern const body_kernels body_kernels_avx512;
+#endif
+
+// The kernels for |instruction_set|, which the CPU has to support
+const body_kernels& get_body_kernels(simd_instruction_set instruction_set) noexcept;
+
+SOLARSIM_NS_END
+
+#endif
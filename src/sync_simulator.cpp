@@ -20,41 +20,81 @@
 SOLARSIM_NS_BEGIN
 
 void naive_sync_simulator_impl::tick(std::span<const triple> body_positions, std::span<const real> body_masses,
-                                     real softening_factor, std::span<triple> acceleration) const
+                                     real softening_factor, std::span<triple> acceleration)
 {
   // TODO: Add a template argument for this?
+  // Fused computes (i, j) & (j, i) at the same time, otherwise every body sums up all others on its own.
   constexpr bool use_fused_acceleration_calculation = true;
 
-  std::fill(acceleration.begin(), acceleration.end(), triple{});
+  kernel_.load(body_positions, body_masses);
+  kernel_.compute_accelerations(softening_factor, use_fused_acceleration_calculation, acceleration);
+}
 
-  for (std::size_t i = 0, n = body_positions.size(); i != n; ++i) {
-    // Obtain a_i by summing all pairwise acceleration values (i \ne j)
-    if constexpr (use_fused_acceleration_calculation) {
-      // do it for (i, j) & (j, i) at the same time
-      for (std::size_t j = i + 1; j < n; ++j) {
-        calculate_acceleration(body_positions[i], body_positions[j], body_masses[i], body_masses[j], softening_factor,
-                               acceleration[i], acceleration[j]);
-      }
-    } else {
-      // very naive version, calculate it per body
-      for (std::size_t j = 0; j != n; ++j) {
-        if (i != j) {
-          calculate_acceleration(body_positions[i], body_positions[j], body_masses[j], softening_factor,
-                                 acceleration[i]);
-        }
-      }
-    }
-  }
+barnes_hut_sync_simulator_impl::barnes_hut_sync_simulator_impl(const opening_criterion& criterion,
+                                                               std::optional<octree_refit_options> refit_options)
+  : refit_options_(refit_options)
+{
+  octree_.set_opening_criterion(criterion);
 }
 
 void barnes_hut_sync_simulator_impl::tick(std::span<const triple> body_positions, std::span<const real> body_masses,
-                                          real softening_factor, std::span<triple> acceleration) const
+                                          real softening_factor, std::span<triple> acceleration)
 {
-  std::fill(acceleration.begin(), acceleration.end(), triple{});
-  barnes_hut_octree octree(body_positions, body_masses);
+  if (lazy_expansion_) {
+    lazy_octree_.set_opening_criterion(octree_.get_opening_criterion());
+    lazy_octree_.rebuild(body_positions, body_masses);
+    for (std::size_t i = 0, n = body_positions.size(); i != n; ++i)
+      lazy_octree_.recompute_acceleration(body_positions[i], softening_factor, acceleration[i]);
+    return;
+  }
+
+  if (refit_options_)
+    octree_.refit(body_positions, body_masses, *refit_options_);
+  else
+    octree_.rebuild(body_positions, body_masses);
+
+  // |acceleration| still holds the previous tick's values, which relative opening criteria need
+  if (group_traversal_) {
+    octree_.recompute_group_accelerations(softening_factor, acceleration);
+    return;
+  }
+
+  if (packet_traversal_) {
+    for (std::size_t chunk = 0, n = octree_.chunk_count(); chunk != n; ++chunk)
+      octree_.recompute_chunk_accelerations(chunk, softening_factor, acceleration);
+    return;
+  }
+
   for (std::size_t i = 0, n = body_positions.size(); i != n; ++i) {
-    octree.apply_forces_to(body_positions[i], softening_factor, acceleration[i]);
+    octree_.recompute_acceleration(body_positions[i], softening_factor, acceleration[i]);
   }
 }
 
+void fmm_sync_simulator_impl::tick(std::span<const triple> body_positions, std::span<const real> body_masses,
+                                   real softening_factor, std::span<triple> acceleration)
+{
+  octree_.compute_accelerations(body_positions, body_masses, softening_factor, acceleration);
+}
+
+kd_tree_sync_simulator_impl::kd_tree_sync_simulator_impl(const kd_tree_options& options,
+                                                         const opening_criterion& criterion)
+  : tree_(options)
+{
+  tree_.set_opening_criterion(criterion);
+}
+
+void kd_tree_sync_simulator_impl::tick(std::span<const triple> body_positions, std::span<const real> body_masses,
+                                       real softening_factor, std::span<triple> acceleration)
+{
+  tree_.rebuild(body_positions, body_masses);
+  for (std::size_t i = 0, n = body_positions.size(); i != n; ++i)
+    tree_.recompute_acceleration(body_positions[i], softening_factor, acceleration[i]);
+}
+
+void treepm_sync_simulator_impl::tick(std::span<const triple> body_positions, std::span<const real> body_masses,
+                                      real softening_factor, std::span<triple> acceleration)
+{
+  solver_.compute_accelerations(body_positions, body_masses, softening_factor, acceleration);
+}
+
 SOLARSIM_NS_END
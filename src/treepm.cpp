@@ -0,0 +1,378 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include "solarsim/treepm.hpp"
+#include "solarsim/math.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cassert>
+#include <cmath>
+#include <numbers>
+
+SOLARSIM_NS_BEGIN
+
+namespace {
+
+using complex = std::complex<real>;
+
+// std::complex's operator* has to care about NaNs and infinities, we don't.
+inline complex multiply(const complex& a, const complex& b) noexcept
+{
+  return {a.real() * b.real() - a.imag() * b.imag(), a.real() * b.imag() + a.imag() * b.real()};
+}
+
+// Fourier transform of the cloud-in-cell window along one axis, squared (assignment and interpolation)
+real cic_window(std::size_t k, std::size_t padded_size)
+{
+  if (k == 0)
+    return 1;
+  const real x    = std::numbers::pi_v<real> * real(k) / real(padded_size);
+  const real sinc = std::sin(x) / x;
+  return sinc * sinc * sinc * sinc;
+}
+
+// Cloud-in-cell weights of a position in cell units: the lower of the two cells on each axis, and the weights of the
+// upper ones.
+struct cic_stencil
+{
+  std::array<std::size_t, 3> cell;
+  triple fraction;
+};
+
+cic_stencil make_cic_stencil(const triple& position, const triple& origin, real cell_size, std::size_t mesh_size)
+{
+  cic_stencil stencil;
+  for (std::size_t axis = 0; axis != 3; ++axis) {
+    const real u = (position[axis] - origin[axis]) / cell_size;
+    // Bodies are at least 3 cells away from the mesh's edges, this only guards against rounding.
+    const real lower      = std::clamp(std::floor(u), real(0), real(mesh_size - 2));
+    stencil.cell[axis]     = static_cast<std::size_t>(lower);
+    stencil.fraction[axis] = std::clamp(u - lower, real(0), real(1));
+  }
+  return stencil;
+}
+
+} // namespace
+
+treepm_solver::treepm_solver(const treepm_options& options)
+{
+  set_options(options);
+}
+
+void treepm_solver::set_options(const treepm_options& options)
+{
+  assert(std::has_single_bit(options.mesh_size));
+  assert(options.mesh_size >= min_mesh_size && options.mesh_size <= max_mesh_size);
+  assert(options.split_scale > 0 && options.cutoff_scale > 0);
+  options_ = options;
+  tree_.set_opening_criterion(options.criterion);
+  compute_tables();
+  compute_green();
+}
+
+void treepm_solver::compute_tables()
+{
+  const std::size_t m = padded_size();
+
+  twiddles_.resize(m / 2);
+  for (std::size_t k = 0; k != m / 2; ++k)
+    twiddles_[k] = std::polar(real(1), -2 * std::numbers::pi_v<real> * real(k) / real(m));
+
+  const int bits = std::countr_zero(m);
+  bit_reversal_.resize(m);
+  for (std::size_t i = 0; i != m; ++i) {
+    std::uint32_t reversed = 0;
+    for (int bit = 0; bit != bits; ++bit)
+      reversed |= std::uint32_t((i >> bit) & 1) << (bits - 1 - bit);
+    bit_reversal_[i] = reversed;
+  }
+}
+
+// The long-range potential of a unit mass, in cells, is -erf(r / 2 r_s) / r. With the distances wrapped around the
+// padded mesh, a cyclic convolution with it is the same as a linear one over the octant with the bodies.
+void treepm_solver::compute_green()
+{
+  const std::size_t n = mesh_size();
+  const std::size_t m = padded_size();
+  const real s        = options_.split_scale;
+
+  // The mesh isn't big enough for all of it, so we need a temporary one here.
+  std::vector<complex> green(m * m * m);
+  for (std::size_t x = 0; x != m; ++x) {
+    const real dx = real(std::min(x, m - x));
+    for (std::size_t y = 0; y != m; ++y) {
+      const real dy = real(std::min(y, m - y));
+      for (std::size_t z = 0; z != m; ++z) {
+        const real dz = real(std::min(z, m - z));
+        const real r  = std::sqrt(dx * dx + dy * dy + dz * dz);
+        green[(x * m + y) * m + z] =
+            r > 0 ? -std::erf(r / (2 * s)) / r : -1 / (s * std::sqrt(std::numbers::pi_v<real>));
+      }
+    }
+  }
+
+  std::vector<complex> line(m);
+  for (std::size_t i = 0; i != m * m; ++i)
+    transform(green.data() + i * m, false);
+  for (std::size_t stride : {m, m * m}) {
+    for (std::size_t i = 0; i != m * m; ++i) {
+      // Lines along y (stride m) start at (x, 0, z), lines along x (stride m^2) at (0, y, z).
+      const std::size_t first = stride == m ? (i / m) * m * m + i % m : i;
+      for (std::size_t j = 0; j != m; ++j)
+        line[j] = green[first + j * stride];
+      transform(line.data(), false);
+      for (std::size_t j = 0; j != m; ++j)
+        green[first + j * stride] = line[j];
+    }
+  }
+
+  // Fold the normalization of the inverse transform and the CIC deconvolution into the spectrum
+  const real normalization = real(m) * real(m) * real(m);
+  green_.resize((n + 1) * (n + 1) * (n + 1));
+  for (std::size_t x = 0; x <= n; ++x) {
+    for (std::size_t y = 0; y <= n; ++y) {
+      for (std::size_t z = 0; z <= n; ++z) {
+        const real window = cic_window(x, m) * cic_window(y, m) * cic_window(z, m);
+        green_[(x * (n + 1) + y) * (n + 1) + z] = green[(x * m + y) * m + z].real() / (normalization * window);
+      }
+    }
+  }
+
+  mesh_.assign(n * m * m, complex());
+  forces_.assign(n * n * n, triple());
+}
+
+void treepm_solver::transform(complex* line, bool inverse) const noexcept
+{
+  const std::size_t m = padded_size();
+  for (std::size_t i = 0; i != m; ++i) {
+    const std::size_t j = bit_reversal_[i];
+    if (i < j)
+      std::swap(line[i], line[j]);
+  }
+
+  for (std::size_t half = 1; half < m; half *= 2) {
+    const std::size_t step = m / (2 * half);
+    for (std::size_t start = 0; start != m; start += 2 * half) {
+      for (std::size_t k = 0; k != half; ++k) {
+        const complex twiddle = inverse ? std::conj(twiddles_[k * step]) : twiddles_[k * step];
+        const complex u       = line[start + k];
+        const complex v       = multiply(line[start + k + half], twiddle);
+        line[start + k]        = u + v;
+        line[start + k + half] = u - v;
+      }
+    }
+  }
+}
+
+void treepm_solver::load_lines(std::size_t first, std::size_t stride, std::size_t count,
+                               line_block& lines) const noexcept
+{
+  const std::size_t m = padded_size();
+  for (std::size_t i = 0; i != count; ++i) {
+    for (std::size_t line = 0; line != lines_per_block; ++line)
+      lines[line * m + i] = mesh_[first + i * stride + line];
+  }
+  for (std::size_t line = 0; line != lines_per_block; ++line) {
+    const auto begin = lines.begin() + static_cast<std::ptrdiff_t>(line * m);
+    std::fill(begin + static_cast<std::ptrdiff_t>(count), begin + static_cast<std::ptrdiff_t>(m), complex());
+  }
+}
+
+void treepm_solver::store_lines(const line_block& lines, std::size_t first, std::size_t stride,
+                                std::size_t count) noexcept
+{
+  const std::size_t m = padded_size();
+  for (std::size_t i = 0; i != count; ++i) {
+    for (std::size_t line = 0; line != lines_per_block; ++line)
+      mesh_[first + i * stride + line] = lines[line * m + i];
+  }
+}
+
+void treepm_solver::prepare(std::span<const triple> body_positions, std::span<const real> body_masses)
+{
+  assert(body_positions.size() == body_masses.size());
+  body_positions_ = body_positions;
+  body_masses_    = body_masses;
+  if (body_positions.empty()) {
+    tree_.rebuild({}, body_positions, body_masses);
+    return;
+  }
+
+  const std::size_t n = mesh_size();
+  const std::size_t m = padded_size();
+
+  // Cubic cells, with the bodies 3 cells away from the edges: the CIC stencil covers one more cell,
+  // and the finite differences two more.
+  const axis_aligned_bounding_box bounds = build_bounding_box(body_positions);
+  const triple extent                    = bounds.max - bounds.min;
+  const real max_extent                  = std::max({extent[0], extent[1], extent[2]});
+  cell_size_                             = max_extent > 0 ? max_extent / real(n - 8) : real(1);
+  origin_ = bounds.min - triple{cell_size_, cell_size_, cell_size_} * 3;
+
+  // Planes x >= n are never stored, but all z of the lines y < n are read by transform_plane().
+  for (std::size_t x = 0; x != n; ++x)
+    std::fill_n(mesh_.begin() + static_cast<std::ptrdiff_t>(mesh_index(x, 0, 0)), n * m, complex());
+
+  for (std::size_t i = 0, count = body_positions.size(); i != count; ++i) {
+    const cic_stencil stencil = make_cic_stencil(body_positions[i], origin_, cell_size_, n);
+    for (std::size_t corner = 0; corner != 8; ++corner) {
+      real weight = body_masses[i];
+      std::array<std::size_t, 3> cell;
+      for (std::size_t axis = 0; axis != 3; ++axis) {
+        const bool upper = (corner >> axis) & 1;
+        cell[axis]       = stencil.cell[axis] + upper;
+        weight *= upper ? stencil.fraction[axis] : 1 - stencil.fraction[axis];
+      }
+      mesh_[mesh_index(cell[0], cell[1], cell[2])] += weight;
+    }
+  }
+
+  tree_.rebuild(bounds, body_positions, body_masses);
+}
+
+void treepm_solver::transform_plane(std::size_t x)
+{
+  const std::size_t n = mesh_size();
+  const std::size_t m = padded_size();
+
+  for (std::size_t y = 0; y != n; ++y)
+    transform(mesh_.data() + mesh_index(x, y, 0), false);
+
+  line_block lines = make_line_block();
+  for (std::size_t z = 0; z != m; z += lines_per_block) {
+    load_lines(mesh_index(x, 0, z), m, n, lines);
+    for (std::size_t line = 0; line != lines_per_block; ++line)
+      transform(lines.data() + line * m, false);
+    store_lines(lines, mesh_index(x, 0, z), m, m);
+  }
+}
+
+void treepm_solver::convolve_column(std::size_t y)
+{
+  const std::size_t n   = mesh_size();
+  const std::size_t m   = padded_size();
+  const std::size_t k_y = std::min(y, m - y);
+
+  line_block lines = make_line_block();
+  for (std::size_t z = 0; z != m; z += lines_per_block) {
+    load_lines(mesh_index(0, y, z), m * m, n, lines);
+    for (std::size_t line = 0; line != lines_per_block; ++line) {
+      complex* values = lines.data() + line * m;
+      transform(values, false);
+
+      const std::size_t k_z = std::min(z + line, m - z - line);
+      const real* green     = green_.data() + (k_y * (n + 1) + k_z);
+      for (std::size_t x = 0; x != m; ++x)
+        values[x] *= green[std::min(x, m - x) * (n + 1) * (n + 1)];
+
+      transform(values, true);
+    }
+    // The potential outside of the octant with the bodies is of no use to us.
+    store_lines(lines, mesh_index(0, y, z), m * m, n);
+  }
+}
+
+void treepm_solver::inverse_transform_plane(std::size_t x)
+{
+  const std::size_t n = mesh_size();
+  const std::size_t m = padded_size();
+
+  line_block lines = make_line_block();
+  for (std::size_t z = 0; z != m; z += lines_per_block) {
+    load_lines(mesh_index(x, 0, z), m, m, lines);
+    for (std::size_t line = 0; line != lines_per_block; ++line)
+      transform(lines.data() + line * m, true);
+    store_lines(lines, mesh_index(x, 0, z), m, n);
+  }
+
+  for (std::size_t y = 0; y != n; ++y)
+    transform(mesh_.data() + mesh_index(x, y, 0), true);
+}
+
+// Fourth-order central differences, a = -G / h^2 * grad(phi) with phi in cells.
+// The outermost two cells are never interpolated from, so we don't need any boundary handling.
+void treepm_solver::differentiate_plane(std::size_t x)
+{
+  const std::size_t n = mesh_size();
+  const real scale    = -gravitational_constant / (cell_size_ * cell_size_ * 12);
+
+  auto potential = [this](std::size_t i, std::size_t j, std::size_t k) { return mesh_[mesh_index(i, j, k)].real(); };
+  auto gradient  = [](real minus_two, real minus_one, real plus_one, real plus_two) {
+    return 8 * (plus_one - minus_one) - (plus_two - minus_two);
+  };
+
+  triple* forces = forces_.data() + x * n * n;
+  if (x < 2 || x + 2 >= n) {
+    std::fill_n(forces, n * n, triple());
+    return;
+  }
+
+  for (std::size_t y = 0; y != n; ++y) {
+    for (std::size_t z = 0; z != n; ++z) {
+      triple& force = forces[y * n + z];
+      if (y < 2 || y + 2 >= n || z < 2 || z + 2 >= n) {
+        force = {};
+        continue;
+      }
+
+      force[0] = scale * gradient(potential(x - 2, y, z), potential(x - 1, y, z), potential(x + 1, y, z),
+                                  potential(x + 2, y, z));
+      force[1] = scale * gradient(potential(x, y - 2, z), potential(x, y - 1, z), potential(x, y + 1, z),
+                                  potential(x, y + 2, z));
+      force[2] = scale * gradient(potential(x, y, z - 2), potential(x, y, z - 1), potential(x, y, z + 1),
+                                  potential(x, y, z + 2));
+    }
+  }
+}
+
+void treepm_solver::compute_acceleration(std::size_t body, real softening, std::span<triple> acceleration) const
+{
+  // Consecutive bodies in tree order walk the same part of the tree, which is a lot more cache friendly.
+  assert(body < body_count());
+  body = tree_.body_order()[body];
+
+  const std::size_t n       = mesh_size();
+  const triple& position    = body_positions_[body];
+  const cic_stencil stencil = make_cic_stencil(position, origin_, cell_size_, n);
+
+  triple result = {};
+  for (std::size_t corner = 0; corner != 8; ++corner) {
+    real weight      = 1;
+    std::size_t cell = 0;
+    for (std::size_t axis = 0; axis != 3; ++axis) {
+      const bool upper = (corner >> axis) & 1;
+      cell             = cell * n + stencil.cell[axis] + upper;
+      weight *= upper ? stencil.fraction[axis] : 1 - stencil.fraction[axis];
+    }
+    result = result + forces_[cell] * weight;
+  }
+
+  const real split_radius = this->split_radius();
+  tree_.apply_short_range_forces_to(position, softening, split_radius, options_.cutoff_scale * split_radius, result);
+  acceleration[body] = result;
+}
+
+void treepm_solver::compute_accelerations(std::span<const triple> body_positions, std::span<const real> body_masses,
+                                          real softening, std::span<triple> acceleration)
+{
+  compute_accelerations(body_positions, body_masses, softening, acceleration, [](std::size_t count, auto&& f) {
+    for (std::size_t i = 0; i != count; ++i)
+      f(i);
+  });
+}
+
+SOLARSIM_NS_END
@@ -0,0 +1,603 @@
+#include "solarsim/barnes_hut_octree.hpp"
+#include "solarsim/math.hpp"
+#include "solarsim/merged_octree_builder.hpp"
+#include "solarsim/morton_octree_builder.hpp"
+#include "solarsim/sync_simulator.hpp"
+#include "test_bodies.hpp"
+
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_floating_point.hpp>
+
+#include <algorithm>
+#include <random>
+#include <thread>
+#include <vector>
+
+SOLARSIM_NS_BEGIN
+
+TEST_CASE("barnes_hut_matches_naive", "barnes_hut_octree")
+{
+  const random_bodies bodies(1000);
+  std::vector<triple> expected(bodies.positions.size());
+  std::vector<triple> actual(bodies.positions.size());
+
+  naive_sync_simulator_impl().tick(bodies.positions, bodies.masses, .05, expected);
+  barnes_hut_sync_simulator_impl().tick(bodies.positions, bodies.masses, .05, actual);
+  REQUIRE(max_relative_error(expected, actual) < 0.1);
+}
+
+TEST_CASE("opening_criteria", "barnes_hut_octree")
+{
+  const random_bodies bodies(1000);
+  std::vector<triple> expected(bodies.positions.size());
+  naive_sync_simulator_impl().tick(bodies.positions, bodies.masses, .05, expected);
+
+  auto error_with = [&](const opening_criterion& criterion) {
+    barnes_hut_octree octree(bodies.positions, bodies.masses);
+    octree.set_opening_criterion(criterion);
+
+    // Start with the exact result as the previous tick's acceleration
+    std::vector<triple> actual(expected);
+    for (std::size_t i = 0; i != bodies.positions.size(); ++i)
+      octree.recompute_acceleration(bodies.positions[i], .05, actual[i]);
+    return max_relative_error(expected, actual);
+  };
+
+  const real coarse = error_with({opening_criterion::kind::geometric, 1.0});
+  const real fine   = error_with({opening_criterion::kind::geometric, 0.2});
+  REQUIRE(fine < coarse);
+  REQUIRE(fine < 0.01);
+
+  REQUIRE(error_with({opening_criterion::kind::bmax, 0.5}) < 0.1);
+  REQUIRE(error_with({opening_criterion::kind::relative_acceleration, 0.5, 0.001}) < 0.1);
+}
+
+TEST_CASE("group_traversal_matches_naive", "barnes_hut_octree")
+{
+  const random_bodies bodies(1000);
+  std::vector<triple> expected(bodies.positions.size());
+  std::vector<triple> actual(bodies.positions.size());
+  naive_sync_simulator_impl().tick(bodies.positions, bodies.masses, .05, expected);
+
+  barnes_hut_sync_simulator_impl simulator;
+  simulator.set_group_traversal(true);
+  simulator.tick(bodies.positions, bodies.masses, .05, actual);
+  REQUIRE(max_relative_error(expected, actual) < 0.1);
+
+  // Morton builds reorder the bodies, results still have to end up at their input index
+  barnes_hut_octree octree = morton_octree_builder().build(bodies.positions, bodies.masses);
+  REQUIRE(octree.group_count() > 0);
+  std::fill(actual.begin(), actual.end(), triple{});
+  octree.recompute_group_accelerations(.05, actual);
+  REQUIRE(max_relative_error(expected, actual) < 0.1);
+}
+
+TEST_CASE("plummer_softening_matches_naive", "barnes_hut_octree")
+{
+  // Softening on the order of the distances between bodies, so both kinds are far apart
+  const random_bodies bodies(1000);
+  const real softening = 5.0;
+  std::vector<triple> expected(bodies.positions.size());
+  std::vector<triple> actual(bodies.positions.size());
+
+  naive_sync_simulator_impl naive;
+  naive.set_softening_kind(softening_kind::plummer);
+  naive.tick(bodies.positions, bodies.masses, softening, expected);
+  naive_sync_simulator_impl().tick(bodies.positions, bodies.masses, softening, actual);
+  REQUIRE(max_relative_error(expected, actual) > 0.2);
+
+  for (const int traversal : {0, 1, 2, 3}) {
+    INFO("traversal " << traversal);
+    barnes_hut_sync_simulator_impl simulator({opening_criterion::kind::geometric, 0.2});
+    simulator.set_softening_kind(softening_kind::plummer);
+    simulator.set_group_traversal(traversal == 1);
+    simulator.set_packet_traversal(traversal == 2);
+    simulator.set_lazy_expansion(traversal == 3);
+    std::fill(actual.begin(), actual.end(), triple{});
+    simulator.tick(bodies.positions, bodies.masses, softening, actual);
+    REQUIRE(max_relative_error(expected, actual) < 0.02);
+  }
+}
+
+TEST_CASE("group_traversal_massless_bodies", "barnes_hut_octree")
+{
+  random_bodies bodies(1000);
+  bodies.make_massless(3);
+  for (std::size_t i = 0; i != bodies.positions.size(); ++i) {
+    if (bodies.positions[i][0] > 50)
+      bodies.masses[i] = 0;
+  }
+  std::vector<triple> expected(bodies.positions.size());
+  naive_sync_simulator_impl().tick(bodies.positions, bodies.masses, .05, expected);
+
+  // Every acceleration has to be replaced, none may keep the previous tick's value
+  std::vector<triple> actual(bodies.positions.size(), triple{1e30, 1e30, 1e30});
+  barnes_hut_sync_simulator_impl simulator;
+  simulator.set_group_traversal(true);
+  simulator.tick(bodies.positions, bodies.masses, .05, actual);
+  REQUIRE(max_relative_error(expected, actual) < 0.1);
+
+  actual = expected;
+  opening_criterion criterion;
+  criterion.type = opening_criterion::kind::relative_acceleration;
+  simulator.set_opening_criterion(criterion);
+  simulator.tick(bodies.positions, bodies.masses, .05, actual);
+  REQUIRE(max_relative_error(expected, actual) < 0.1);
+}
+
+TEST_CASE("packet_traversal_matches_single_bodies", "barnes_hut_octree")
+{
+  // Not a multiple of the packet size, so the last packet has unused lanes
+  const random_bodies bodies(1003);
+  const barnes_hut_octree octree(bodies.positions, bodies.masses);
+
+  std::vector<triple> expected(bodies.positions.size());
+  for (std::size_t i = 0; i != bodies.positions.size(); ++i)
+    octree.apply_forces_to(bodies.positions[i], .05, expected[i]);
+
+  // Same opening decisions for every body, only the order of the sums differs. Both walks go through the kernels
+  // of the active instruction set.
+  const simd_instruction_set previous = active_simd_instruction_set();
+  std::vector<triple> actual(bodies.positions.size());
+  for (const simd_instruction_set instruction_set : supported_instruction_sets()) {
+    set_active_simd_instruction_set(instruction_set);
+    INFO(to_string(instruction_set));
+    std::fill(actual.begin(), actual.end(), triple{});
+    octree.apply_forces_to(bodies.positions, .05, actual);
+    REQUIRE(max_relative_error(expected, actual) < 1e-12);
+    for (std::size_t i = 0; i != bodies.positions.size(); ++i) {
+      actual[i] = {};
+      octree.apply_forces_to(bodies.positions[i], .05, actual[i]);
+    }
+    REQUIRE(max_relative_error(expected, actual) < 1e-12);
+  }
+  set_active_simd_instruction_set(previous);
+
+  barnes_hut_sync_simulator_impl simulator;
+  simulator.set_packet_traversal(true);
+  std::fill(actual.begin(), actual.end(), triple{1.0, 1.0, 1.0});
+  simulator.tick(bodies.positions, bodies.masses, .05, actual);
+  REQUIRE(max_relative_error(expected, actual) < 1e-12);
+}
+
+TEST_CASE("quadrupole_acceleration", "barnes_hut_octree")
+{
+  // Two bodies at +-s on the x-axis, seen from far away on the same axis
+  const real s = 1.0;
+  const real r = 20.0;
+  triple exact = {};
+  calculate_acceleration({r, 0, 0}, {s, 0, 0}, 1.0, 0.0, exact);
+  calculate_acceleration({r, 0, 0}, {-s, 0, 0}, 1.0, 0.0, exact);
+
+  quadrupole_moment quadrupole = {};
+  add_point_quadrupole({s, 0, 0}, gravitational_constant, quadrupole);
+  add_point_quadrupole({-s, 0, 0}, gravitational_constant, quadrupole);
+
+  triple approximated = {};
+  calculate_acceleration({r, 0, 0}, {0, 0, 0}, 2.0, 0.0, approximated);
+  const real monopole_error = std::abs(approximated[0] - exact[0]);
+  calculate_scaled_quadrupole_acceleration({r, 0, 0}, {0, 0, 0}, quadrupole, approximated);
+  REQUIRE(std::abs(approximated[0] - exact[0]) < monopole_error / 50);
+  REQUIRE(approximated[1] == 0);
+}
+
+TEST_CASE("multipole_order", "barnes_hut_octree")
+{
+  const random_bodies bodies(1000);
+  std::vector<triple> expected(bodies.positions.size());
+  naive_sync_simulator_impl().tick(bodies.positions, bodies.masses, .05, expected);
+
+  barnes_hut_octree octree(bodies.positions, bodies.masses);
+  octree.set_opening_criterion({opening_criterion::kind::geometric, 0.7});
+  std::vector<triple> actual(bodies.positions.size());
+  for (std::size_t i = 0; i != bodies.positions.size(); ++i)
+    octree.apply_forces_to(bodies.positions[i], .05, actual[i]);
+
+  // Quadrupoles more than halve the error at the same theta
+  const real max_error = octree_multipole_order >= 2 ? 0.008 : 0.02;
+  REQUIRE(mean_relative_error(expected, actual) < max_error);
+
+  // Grouped walks need to apply them just the same
+  std::vector<triple> grouped(bodies.positions.size());
+  octree.recompute_group_accelerations(.05, grouped);
+  REQUIRE(mean_relative_error(expected, grouped) < max_error);
+}
+
+TEST_CASE("theta_controller", "barnes_hut_octree")
+{
+  theta_controller controller(1e-6, 0.2, 1.0, 0.5);
+  REQUIRE(controller.update(4e-6) < 0.5); // too inaccurate
+  const real theta = controller.theta();
+  REQUIRE(controller.update(1e-8) > theta); // cheaper is fine
+
+  for (int i = 0; i != 100; ++i)
+    controller.update(1.0);
+  REQUIRE(controller.theta() == 0.2);
+}
+
+TEST_CASE("leaf_buckets", "barnes_hut_octree")
+{
+  const random_bodies bodies(1000);
+  std::vector<triple> expected(bodies.positions.size());
+  naive_sync_simulator_impl().tick(bodies.positions, bodies.masses, .05, expected);
+
+  barnes_hut_octree single;
+  single.set_leaf_options({1});
+  single.rebuild(bodies.positions, bodies.masses);
+  const barnes_hut_octree bucketed(bodies.positions, bodies.masses);
+  REQUIRE(bucketed.node_count() * 2 < single.node_count());
+
+  std::vector<triple> actual(bodies.positions.size());
+  for (std::size_t i = 0; i != bodies.positions.size(); ++i)
+    bucketed.apply_forces_to(bodies.positions[i], .05, actual[i]);
+  REQUIRE(max_relative_error(expected, actual) < 0.1);
+}
+
+TEST_CASE("leaf_max_depth", "barnes_hut_octree")
+{
+  random_bodies bodies(100);
+  for (std::size_t i = 1; i != 20; ++i)
+    bodies.positions[i] = bodies.positions[0];
+
+  // The duplicates stay in a single leaf at the maximum depth instead of subdividing forever.
+  barnes_hut_octree octree;
+  octree.set_leaf_options({4, 10});
+  octree.rebuild(bodies.positions, bodies.masses);
+  REQUIRE(octree.node_count() < 100);
+
+  triple acceleration = {};
+  octree.apply_forces_to(bodies.positions[0], .05, acceleration);
+  REQUIRE(std::isfinite(acceleration[0]));
+}
+
+TEST_CASE("compact_nodes", "barnes_hut_octree")
+{
+  // A tight cluster far from the origin: deep nodes, tiny offsets, large absolute coordinates
+  random_bodies bodies(1000);
+  std::mt19937 rng(2);
+  std::normal_distribution<real> cluster_dist(0.0, 1e-4);
+  for (std::size_t i = 0; i != 500; ++i)
+    bodies.positions[i] = triple{90.0, -40.0, 70.0} + triple{cluster_dist(rng), cluster_dist(rng), cluster_dist(rng)};
+
+  std::vector<triple> expected(bodies.positions.size());
+  naive_sync_simulator_impl().tick(bodies.positions, bodies.masses, 1e-5, expected);
+
+  barnes_hut_octree octree(bodies.positions, bodies.masses);
+  auto compute = [&] {
+    std::vector<triple> actual(bodies.positions.size());
+    for (std::size_t i = 0; i != bodies.positions.size(); ++i)
+      octree.apply_forces_to(bodies.positions[i], 1e-5, actual[i]);
+    return actual;
+  };
+
+  const std::vector<triple> linear = compute();
+  const std::size_t linear_bytes   = octree.allocated_bytes();
+  octree.set_node_format(octree_node_format::compact);
+  REQUIRE(octree.allocated_bytes() > linear_bytes);
+  const std::vector<triple> compact = compute();
+
+  REQUIRE(max_relative_error(linear, compact) < 1e-5);
+  REQUIRE(mean_relative_error(expected, compact) < 0.01);
+
+  // Survives rebuilds, and switching back gives exactly the old results
+  octree.rebuild(bodies.positions, bodies.masses);
+  REQUIRE(max_relative_error(compact, compute()) == 0);
+  octree.set_node_format(octree_node_format::linear);
+  REQUIRE(max_relative_error(linear, compute()) == 0);
+}
+
+TEST_CASE("wide_nodes", "barnes_hut_octree")
+{
+  const random_bodies bodies(1000);
+  barnes_hut_octree octree(bodies.positions, bodies.masses);
+  auto compute = [&] {
+    std::vector<triple> actual(bodies.positions.size());
+    for (std::size_t i = 0; i != bodies.positions.size(); ++i)
+      octree.apply_forces_to(bodies.positions[i], .05, actual[i]);
+    return actual;
+  };
+  auto compute_grouped = [&] {
+    std::vector<triple> actual(bodies.positions.size());
+    octree.recompute_group_accelerations(.05, actual);
+    return actual;
+  };
+
+  const std::vector<triple> linear         = compute();
+  const std::vector<triple> linear_grouped = compute_grouped();
+  const std::size_t linear_interactions    = octree.count_interactions(bodies.positions[0]);
+
+  // Same opening decisions, only the order of the sums differs
+  octree.set_node_format(octree_node_format::wide);
+  REQUIRE(max_relative_error(linear, compute()) < 1e-12);
+  REQUIRE(max_relative_error(linear_grouped, compute_grouped()) < 1e-12);
+  REQUIRE(octree.count_interactions(bodies.positions[0]) == linear_interactions);
+
+  octree.rebuild(bodies.positions, bodies.masses);
+  REQUIRE(max_relative_error(linear, compute()) < 1e-12);
+}
+
+TEST_CASE("rebuild_reuses_node_pool", "barnes_hut_octree")
+{
+  const random_bodies bodies(1000);
+  barnes_hut_octree octree(bodies.positions, bodies.masses);
+  const auto node_count      = octree.node_count();
+  const auto allocated_bytes = octree.allocated_bytes();
+
+  octree.rebuild(bodies.positions, bodies.masses);
+  REQUIRE(octree.node_count() == node_count);
+  REQUIRE(octree.allocated_bytes() == allocated_bytes);
+}
+
+TEST_CASE("refit_follows_moving_bodies", "barnes_hut_octree")
+{
+  random_bodies bodies(1000);
+  std::vector<triple> expected(bodies.positions.size());
+  std::vector<triple> actual(bodies.positions.size());
+
+  barnes_hut_octree octree;
+  REQUIRE(octree.refit(bodies.positions, bodies.masses)); // first call builds the tree
+
+  // Small steps only move a few bodies across cell boundaries
+  std::mt19937 rng(2);
+  std::uniform_real_distribution<real> step_dist(-0.05, 0.05);
+  for (int tick = 0; tick != 5; ++tick) {
+    for (auto& position : bodies.positions)
+      position += triple{step_dist(rng), step_dist(rng), step_dist(rng)};
+    REQUIRE_FALSE(octree.refit(bodies.positions, bodies.masses));
+
+    naive_sync_simulator_impl().tick(bodies.positions, bodies.masses, .05, expected);
+    std::fill(actual.begin(), actual.end(), triple{});
+    for (std::size_t i = 0; i != bodies.positions.size(); ++i)
+      octree.apply_forces_to(bodies.positions[i], .05, actual[i]);
+    REQUIRE(max_relative_error(expected, actual) < 0.1);
+  }
+
+  // Leaving the root forces a rebuild
+  bodies.positions[0] = {1000.0, 0.0, 0.0};
+  REQUIRE(octree.refit(bodies.positions, bodies.masses));
+
+  // So do large-scale moves
+  for (auto& position : bodies.positions)
+    position = triple{position[1], position[2], position[0]};
+  REQUIRE(octree.refit(bodies.positions, bodies.masses));
+}
+
+TEST_CASE("merge_partial_trees", "barnes_hut_octree")
+{
+  const random_bodies bodies(1000);
+  const auto bounds = build_bounding_box(bodies.positions);
+
+  std::vector<barnes_hut_octree> partial_trees;
+  const std::span<const triple> positions = bodies.positions;
+  const std::span<const real> masses      = bodies.masses;
+  for (std::size_t offset = 0; offset < positions.size(); offset += 250)
+    partial_trees.emplace_back(bounds, positions.subspan(offset, 250), masses.subspan(offset, 250));
+
+  const barnes_hut_octree merged(bounds, partial_trees);
+  const barnes_hut_octree whole(bounds, positions, masses);
+  for (const auto& position : positions) {
+    triple expected = {};
+    triple actual   = {};
+    whole.apply_forces_to(position, .05, expected);
+    merged.apply_forces_to(position, .05, actual);
+    REQUIRE_THAT(actual[0], Catch::Matchers::WithinRel(expected[0], 1e-9));
+    REQUIRE_THAT(actual[1], Catch::Matchers::WithinRel(expected[1], 1e-9));
+    REQUIRE_THAT(actual[2], Catch::Matchers::WithinRel(expected[2], 1e-9));
+  }
+}
+
+TEST_CASE("packet_traversal_massless_bodies", "barnes_hut_octree")
+{
+  random_bodies bodies(1003);
+  bodies.make_massless(3);
+  for (std::size_t i = 0; i != bodies.positions.size(); ++i) {
+    if (bodies.positions[i][0] > 50)
+      bodies.masses[i] = 0;
+  }
+  std::vector<triple> expected(bodies.positions.size());
+  naive_sync_simulator_impl().tick(bodies.positions, bodies.masses, .05, expected);
+
+  // Every acceleration has to be replaced, none may keep the previous tick's value
+  barnes_hut_octree octree(bodies.positions, bodies.masses);
+  std::vector<triple> actual(bodies.positions.size(), triple{1e30, 1e30, 1e30});
+  for (std::size_t chunk = 0; chunk != octree.chunk_count(); ++chunk)
+    octree.recompute_chunk_accelerations(chunk, .05, actual);
+  REQUIRE(max_relative_error(expected, actual) < 0.1);
+
+  // Relative criteria open the same nodes as the walks of single bodies
+  opening_criterion criterion;
+  criterion.type = opening_criterion::kind::relative_acceleration;
+  octree.set_opening_criterion(criterion);
+  std::vector<triple> single = expected;
+  for (std::size_t i = 0; i != bodies.positions.size(); ++i)
+    octree.recompute_acceleration(bodies.positions[i], .05, single[i]);
+  actual = expected;
+  for (std::size_t chunk = 0; chunk != octree.chunk_count(); ++chunk)
+    octree.recompute_chunk_accelerations(chunk, .05, actual);
+  REQUIRE(max_relative_error(single, actual) < 1e-12);
+  REQUIRE(max_relative_error(expected, actual) < 0.1);
+}
+
+TEST_CASE("morton_build_matches_insertion", "barnes_hut_octree")
+{
+  const random_bodies bodies(1000);
+  const barnes_hut_octree inserted(bodies.positions, bodies.masses);
+  const barnes_hut_octree sorted = morton_octree_builder().build(bodies.positions, bodies.masses);
+
+  for (const auto& position : bodies.positions) {
+    triple expected = {};
+    triple actual   = {};
+    inserted.apply_forces_to(position, .05, expected);
+    sorted.apply_forces_to(position, .05, actual);
+    REQUIRE_THAT(actual[0], Catch::Matchers::WithinRel(expected[0], 1e-9));
+    REQUIRE_THAT(actual[1], Catch::Matchers::WithinRel(expected[1], 1e-9));
+    REQUIRE_THAT(actual[2], Catch::Matchers::WithinRel(expected[2], 1e-9));
+  }
+}
+
+TEST_CASE("morton_build_massless_bodies", "barnes_hut_octree")
+{
+  // Massless bodies mixed in, and a region with whole massless subtrees
+  random_bodies bodies(1000);
+  bodies.make_massless(3);
+  for (std::size_t i = 0; i != bodies.positions.size(); ++i) {
+    if (bodies.positions[i][0] > 50)
+      bodies.masses[i] = 0;
+  }
+  const barnes_hut_octree inserted(bodies.positions, bodies.masses);
+  const barnes_hut_octree sorted = morton_octree_builder().build(bodies.positions, bodies.masses);
+
+  for (const auto& position : bodies.positions) {
+    triple expected = {};
+    triple actual   = {};
+    inserted.apply_forces_to(position, .05, expected);
+    sorted.apply_forces_to(position, .05, actual);
+    REQUIRE_THAT(actual[0], Catch::Matchers::WithinRel(expected[0], 1e-9));
+    REQUIRE_THAT(actual[1], Catch::Matchers::WithinRel(expected[1], 1e-9));
+    REQUIRE_THAT(actual[2], Catch::Matchers::WithinRel(expected[2], 1e-9));
+  }
+}
+
+TEST_CASE("merged_build_matches_insertion", "barnes_hut_octree")
+{
+  // Enough bodies for all partial trees to be used
+  const random_bodies bodies(merged_octree_builder::max_num_tasks * merged_octree_builder::min_bodies_per_task);
+  const barnes_hut_octree inserted(bodies.positions, bodies.masses);
+
+  merged_octree_builder builder;
+  for (int pass = 0; pass != 2; ++pass) {
+    const barnes_hut_octree merged = builder.build(bodies.positions, bodies.masses);
+    REQUIRE(merged.node_count() == inserted.node_count());
+
+    for (std::size_t i = 0; i < bodies.positions.size(); i += 97) {
+      triple expected = {};
+      triple actual   = {};
+      inserted.apply_forces_to(bodies.positions[i], .05, expected);
+      merged.apply_forces_to(bodies.positions[i], .05, actual);
+      REQUIRE_THAT(actual[0], Catch::Matchers::WithinRel(expected[0], 1e-9));
+      REQUIRE_THAT(actual[1], Catch::Matchers::WithinRel(expected[1], 1e-9));
+      REQUIRE_THAT(actual[2], Catch::Matchers::WithinRel(expected[2], 1e-9));
+    }
+  }
+}
+
+TEST_CASE("morton_build_duplicate_bodies", "barnes_hut_octree")
+{
+  random_bodies bodies(100);
+  bodies.positions[1] = bodies.positions[0];
+
+  // These end up in one leaf at the maximum depth.
+  const barnes_hut_octree octree = morton_octree_builder().build(bodies.positions, bodies.masses);
+  triple acceleration            = {};
+  octree.apply_forces_to(bodies.positions[2], .05, acceleration);
+  REQUIRE(std::isfinite(acceleration[0]));
+}
+
+TEST_CASE("massless_bodies_stay_in_tree", "barnes_hut_octree")
+{
+  random_bodies bodies(merged_octree_builder::max_num_tasks * merged_octree_builder::min_bodies_per_task);
+  bodies.make_massless(3);
+  for (std::size_t i = 0; i != bodies.positions.size(); ++i) {
+    if (bodies.positions[i][0] > 50)
+      bodies.masses[i] = 0;
+  }
+
+  const barnes_hut_octree inserted(bodies.positions, bodies.masses);
+  const barnes_hut_octree sorted = morton_octree_builder().build(bodies.positions, bodies.masses);
+  const barnes_hut_octree merged = merged_octree_builder().build(bodies.positions, bodies.masses);
+  for (const barnes_hut_octree* octree : {&inserted, &sorted, &merged}) {
+    std::vector<std::uint32_t> order(octree->body_order().begin(), octree->body_order().end());
+    std::sort(order.begin(), order.end());
+    REQUIRE(order.size() == bodies.positions.size());
+    for (std::uint32_t i = 0; i != order.size(); ++i)
+      REQUIRE(order[i] == i);
+
+    std::vector<std::uint32_t> found;
+    octree->find_bodies_in_radius(bodies.positions[0], 0, found);
+    REQUIRE(std::find(found.begin(), found.end(), 0u) != found.end());
+  }
+
+  // Test particles only: nothing pulls, but everybody is still there
+  std::fill(bodies.masses.begin(), bodies.masses.end(), 0);
+  const barnes_hut_octree empty(bodies.positions, bodies.masses);
+  REQUIRE(empty.body_order().size() == bodies.positions.size());
+  triple acceleration = {};
+  empty.apply_forces_to(bodies.positions[0], .05, acceleration);
+  REQUIRE(squared_length(acceleration) == 0);
+}
+
+TEST_CASE("radius_query_matches_brute_force", "barnes_hut_octree")
+{
+  const random_bodies bodies(5000);
+  const barnes_hut_octree octree(bodies.positions, bodies.masses);
+  const random_bodies queries(50, 2);
+
+  std::vector<std::uint32_t> found;
+  for (const real radius : {0.0, 5.0, 20.0, 400.0}) {
+    for (const triple& center : queries.positions) {
+      found.clear();
+      octree.find_bodies_in_radius(center, radius, found);
+      std::sort(found.begin(), found.end());
+
+      std::vector<std::uint32_t> expected;
+      for (std::uint32_t i = 0; i != bodies.positions.size(); ++i) {
+        if (squared_length(bodies.positions[i] - center) <= radius * radius)
+          expected.push_back(i);
+      }
+      REQUIRE(found == expected);
+    }
+  }
+
+  // Bodies are found at their own position
+  found.clear();
+  octree.find_bodies_in_radius(bodies.positions[42], 0.0, found);
+  REQUIRE(found == std::vector<std::uint32_t>{42});
+}
+
+TEST_CASE("nearest_query_matches_brute_force", "barnes_hut_octree")
+{
+  const random_bodies bodies(5000);
+  const barnes_hut_octree octree(bodies.positions, bodies.masses);
+  const random_bodies queries(50, 2);
+
+  // Run the queries from a few threads at once, like the workers of a bulk would
+  std::vector<std::thread> threads;
+  std::vector<int> mismatches(4);
+  for (std::size_t t = 0; t != mismatches.size(); ++t) {
+    threads.emplace_back([&, t] {
+      std::vector<octree_neighbor> neighbors;
+      for (std::size_t q = t; q < queries.positions.size(); q += mismatches.size()) {
+        const triple& point = queries.positions[q];
+        for (const std::size_t k : {std::size_t{1}, std::size_t{8}, std::size_t{33}}) {
+          octree.find_nearest_bodies(point, k, neighbors);
+
+          std::vector<real> expected(bodies.positions.size());
+          for (std::size_t i = 0; i != expected.size(); ++i)
+            expected[i] = squared_length(bodies.positions[i] - point);
+          std::sort(expected.begin(), expected.end());
+
+          if (neighbors.size() != k)
+            ++mismatches[t];
+          for (std::size_t i = 0; i != neighbors.size(); ++i) {
+            if (neighbors[i].distance_squared != expected[i] ||
+                squared_length(bodies.positions[neighbors[i].body] - point) != expected[i])
+              ++mismatches[t];
+          }
+        }
+      }
+    });
+  }
+  for (auto& thread : threads)
+    thread.join();
+  REQUIRE(mismatches == std::vector<int>(mismatches.size(), 0));
+
+  // Asking for more than there are
+  std::vector<octree_neighbor> neighbors;
+  const barnes_hut_octree small(std::span(bodies.positions).first(10), std::span(bodies.masses).first(10));
+  small.find_nearest_bodies({}, 20, neighbors);
+  REQUIRE(neighbors.size() == 10);
+  small.find_nearest_bodies({}, 0, neighbors);
+  REQUIRE(neighbors.empty());
+}
+
+SOLARSIM_NS_END
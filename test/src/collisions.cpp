@@ -0,0 +1,172 @@
+#include "solarsim/collisions.hpp"
+#include "solarsim/math.hpp"
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+SOLARSIM_NS_BEGIN
+
+namespace {
+
+simulation_state random_state(std::size_t n, std::uint32_t seed = 1)
+{
+  simulation_state state;
+  state.body_positions.resize(n);
+  state.body_velocities.resize(n);
+  state.body_masses.resize(n);
+  state.body_radii.resize(n);
+  state.acceleration.resize(n);
+  state.softening_factor = 0.01;
+
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<real> position_dist(-100.0, 100.0);
+  std::uniform_real_distribution<real> velocity_dist(-1.0, 1.0);
+  std::uniform_real_distribution<real> mass_dist(0.1, 1.0);
+  for (std::size_t i = 0; i != n; ++i) {
+    state.body_positions[i]  = {position_dist(rng), position_dist(rng), position_dist(rng)};
+    state.body_velocities[i] = {velocity_dist(rng), velocity_dist(rng), velocity_dist(rng)};
+    state.acceleration[i]    = {velocity_dist(rng), velocity_dist(rng), velocity_dist(rng)};
+    state.body_masses[i]     = mass_dist(rng);
+    state.body_radii[i]      = mass_dist(rng);
+  }
+  return state;
+}
+
+struct totals
+{
+  explicit totals(const simulation_state& state)
+  {
+    for (std::size_t i = 0; i != state.body_positions.size(); ++i) {
+      const real m = state.body_masses[i];
+      mass += m;
+      volume += state.body_radii[i] * state.body_radii[i] * state.body_radii[i];
+      center   = center + state.body_positions[i] * m;
+      momentum = momentum + state.body_velocities[i] * m;
+      force    = force + state.acceleration[i] * m;
+    }
+  }
+
+  real mass       = 0;
+  real volume     = 0;
+  triple center   = {};
+  triple momentum = {};
+  triple force    = {};
+};
+
+} // namespace
+
+TEST_CASE("spheres_touch", "collisions")
+{
+  // Overlapping right now
+  CHECK(spheres_touch({1.5, 0, 0}, {}, 2.0, 0.0));
+  CHECK_FALSE(spheres_touch({2.5, 0, 0}, {}, 2.0, 1.0));
+
+  // Passing through each other between two steps
+  CHECK(spheres_touch({10, 0, 0}, {-20, 0, 0}, 1.0, 1.0));
+  CHECK(spheres_touch({-10, 0, 0}, {-20, 0, 0}, 1.0, 1.0));
+  CHECK_FALSE(spheres_touch({10, 0, 0}, {-20, 0, 0}, 1.0, 0.0));
+  // Too slow to meet within the sweep
+  CHECK_FALSE(spheres_touch({10, 0, 0}, {-5, 0, 0}, 1.0, 1.0));
+  // Closest approach misses
+  CHECK_FALSE(spheres_touch({10, 3, 0}, {-20, 0, 0}, 2.0, 1.0));
+}
+
+TEST_CASE("collision_merger_matches_brute_force", "collisions")
+{
+  for (const real sweep_time : {0.0, 1.0}) {
+    simulation_state state          = random_state(5000);
+    const simulation_state original = state;
+    const totals before(state);
+
+    std::vector<body_collision> expected;
+    for (std::uint32_t i = 0; i != state.body_positions.size(); ++i) {
+      for (std::uint32_t j = i + 1; j != state.body_positions.size(); ++j) {
+        if (spheres_touch(state.body_positions[j] - state.body_positions[i],
+                          state.body_velocities[j] - state.body_velocities[i],
+                          state.body_radii[i] + state.body_radii[j], sweep_time))
+          expected.push_back({i, j});
+      }
+    }
+    REQUIRE(!expected.empty());
+
+    barnes_hut_octree octree;
+    octree.rebuild(state.body_positions, state.body_masses);
+    collision_merger merger;
+    merger.merge(state, octree, sweep_time, 4, [](std::size_t count, auto&& f) {
+      for (std::size_t i = count; i-- != 0;)
+        f(i);
+    });
+    CHECK(merger.num_tasks() == 4);
+
+    const auto collisions = merger.collisions();
+    REQUIRE(collisions.size() == expected.size());
+    for (std::size_t i = 0; i != expected.size(); ++i) {
+      CHECK(collisions[i].first == expected[i].first);
+      CHECK(collisions[i].second == expected[i].second);
+    }
+
+    // Each body merged away takes one collision at least
+    REQUIRE(merger.removed_count() > 0);
+    REQUIRE(merger.removed_count() <= expected.size());
+    REQUIRE(state.body_positions.size() == original.body_positions.size() - merger.removed_count());
+    REQUIRE(state.body_velocities.size() == state.body_positions.size());
+    REQUIRE(state.body_masses.size() == state.body_positions.size());
+    REQUIRE(state.body_radii.size() == state.body_positions.size());
+    REQUIRE(state.acceleration.size() == state.body_positions.size());
+
+    const totals after(state);
+    CHECK(std::abs(after.mass - before.mass) < 1e-9 * before.mass);
+    CHECK(std::abs(after.volume - before.volume) < 1e-9 * before.volume);
+    CHECK(length(after.center - before.center) < 1e-9 * before.mass);
+    CHECK(length(after.momentum - before.momentum) < 1e-9 * before.mass);
+    CHECK(length(after.force - before.force) < 1e-9 * before.mass);
+
+    // Bodies not involved in any collision are copied as they are, in order
+    std::vector<bool> involved(original.body_positions.size());
+    for (const body_collision& collision : expected)
+      involved[collision.first] = involved[collision.second] = true;
+    std::size_t next = 0;
+    for (std::size_t i = 0; i != original.body_positions.size(); ++i) {
+      if (involved[i])
+        continue;
+      while (next != state.body_positions.size() && state.body_masses[next] != original.body_masses[i])
+        ++next;
+      REQUIRE(next != state.body_positions.size());
+      CHECK(length(state.body_positions[next] - original.body_positions[i]) == 0);
+      ++next;
+    }
+  }
+}
+
+TEST_CASE("collision_merger_merges_chains", "collisions")
+{
+  // 0 touches 1, 1 touches 2, 3 stays alone: one group of three, with the lowest index surviving
+  simulation_state state;
+  state.body_positions   = {{0, 0, 0}, {1.5, 0, 0}, {3, 0, 0}, {10, 0, 0}};
+  state.body_velocities  = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}, {0, 0, 0}};
+  state.body_masses      = {1, 2, 1, 1};
+  state.body_radii       = {1, 1, 1, 1};
+  state.acceleration     = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
+  state.softening_factor = 0;
+
+  barnes_hut_octree octree;
+  octree.rebuild(state.body_positions, state.body_masses);
+  collision_merger merger;
+  merger.merge(state, octree, 0.0);
+
+  REQUIRE(merger.collisions().size() == 2);
+  CHECK(merger.removed_count() == 2);
+  REQUIRE(state.body_positions.size() == 2);
+  CHECK(state.body_masses[0] == 4);
+  CHECK(state.body_masses[1] == 1);
+  CHECK(length(state.body_positions[0] - triple{1.5, 0, 0}) < 1e-12);
+  CHECK(length(state.body_velocities[0] - triple{0.25, 0.5, 0.25}) < 1e-12);
+  CHECK(std::abs(state.body_radii[0] - std::cbrt(3.0)) < 1e-12);
+  CHECK(length(state.body_positions[1] - triple{10, 0, 0}) < 1e-12);
+}
+
+SOLARSIM_NS_END
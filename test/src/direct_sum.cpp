@@ -0,0 +1,169 @@
+#include "solarsim/direct_sum.hpp"
+#include "solarsim/math.hpp"
+#include "test_bodies.hpp"
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+SOLARSIM_NS_BEGIN
+
+TEST_CASE("direct_sum_matches_scalar", "direct_sum")
+{
+  // Not a multiple of the lane count, and more than a tile
+  random_bodies bodies(1203);
+  const std::size_t n = bodies.positions.size();
+
+  std::vector<triple> expected(n);
+  for (std::size_t i = 0; i != n; ++i) {
+    for (std::size_t j = 0; j != n; ++j) {
+      if (i != j)
+        calculate_acceleration(bodies.positions[i], bodies.positions[j], bodies.masses[j], .05, expected[i]);
+    }
+  }
+
+  std::vector<triple> actual(n);
+  for (const simd_instruction_set instruction_set : supported_instruction_sets()) {
+    for (const bool fused : {false, true}) {
+      direct_sum_kernel kernel(instruction_set);
+      kernel.load(bodies.positions, bodies.masses);
+      kernel.compute_accelerations(.05, fused, actual);
+      for (std::size_t i = 0; i != n; ++i) {
+        INFO(to_string(instruction_set) << (fused ? " fused" : "") << " body " << i);
+        REQUIRE(length(actual[i] - expected[i]) < 1e-12 * length(expected[i]));
+      }
+    }
+  }
+}
+
+TEST_CASE("direct_sum_plummer_softening", "direct_sum")
+{
+  random_bodies bodies(1203);
+  const std::size_t n = bodies.positions.size();
+
+  std::vector<triple> expected(n);
+  for (std::size_t i = 0; i != n; ++i) {
+    for (std::size_t j = 0; j != n; ++j) {
+      if (i != j)
+        calculate_scaled_acceleration(bodies.positions[i], bodies.positions[j],
+                                      gravitational_constant * bodies.masses[j], .05, softening_kind::plummer,
+                                      expected[i]);
+    }
+  }
+
+  std::vector<triple> actual(n);
+  for (const simd_instruction_set instruction_set : supported_instruction_sets()) {
+    for (const force_precision precision : {force_precision::full, force_precision::mixed}) {
+      for (const bool fused : {false, true}) {
+        direct_sum_kernel kernel(instruction_set);
+        kernel.set_softening_kind(softening_kind::plummer);
+        kernel.set_precision(precision);
+        kernel.load(bodies.positions, bodies.masses);
+        kernel.compute_accelerations(.05, fused, actual);
+
+        real error = 0;
+        for (std::size_t i = 0; i != n; ++i)
+          error = std::max(error, length(actual[i] - expected[i]) / length(expected[i]));
+        INFO(to_string(instruction_set) << " " << to_string(precision) << (fused ? " fused" : ""));
+        REQUIRE(error < (precision == force_precision::full ? 1e-12 : 1e-4));
+      }
+    }
+  }
+}
+
+TEST_CASE("direct_sum_tasks_match_serial", "direct_sum")
+{
+  random_bodies bodies(2100);
+  const std::size_t n = bodies.positions.size();
+
+  // Tasks are run backwards, so nothing depends on their order
+  auto backwards = [](std::size_t count, auto&& f) {
+    for (std::size_t i = count; i-- != 0;)
+      f(i);
+  };
+
+  std::vector<triple> expected(n);
+  std::vector<triple> actual(n);
+  for (const bool fused : {false, true}) {
+    direct_sum_kernel kernel;
+    kernel.load(bodies.positions, bodies.masses);
+    kernel.compute_accelerations(.05, fused, expected);
+
+    // The kernel is reused, so its buffers grow between runs
+    for (const std::size_t num_tasks : {std::size_t{2}, std::size_t{3}, std::size_t{7}, std::size_t{100}}) {
+      kernel.compute_accelerations(.05, fused, actual, num_tasks, backwards);
+      REQUIRE(kernel.num_tasks() == std::min<std::size_t>(num_tasks, fused ? 15 : 5));
+      for (std::size_t i = 0; i != n; ++i) {
+        INFO((fused ? "fused " : "") << num_tasks << " tasks, body " << i);
+        REQUIRE(length(actual[i] - expected[i]) < 1e-12 * length(expected[i]));
+      }
+    }
+  }
+}
+
+TEST_CASE("direct_sum_mixed_precision", "direct_sum")
+{
+  // Far from the origin, where plain float positions would be off by more than the distances between bodies.
+  // Scaled up, the accelerations would underflow in float without rescaling.
+  for (const real scale : {1.0, 1e13}) {
+    random_bodies bodies(1203);
+    const std::size_t n = bodies.positions.size();
+    for (triple& position : bodies.positions)
+      position = (position * 1e-3 + triple{1e5, -1e5, 1e5}) * scale;
+
+    std::vector<triple> expected(n);
+    direct_sum_kernel reference;
+    reference.load(bodies.positions, bodies.masses);
+    reference.compute_accelerations(0, false, expected);
+
+    std::vector<triple> actual(n);
+    for (const simd_instruction_set instruction_set : supported_instruction_sets()) {
+      for (const bool fused : {false, true}) {
+        direct_sum_kernel kernel(instruction_set);
+        kernel.set_precision(force_precision::mixed);
+        kernel.load(bodies.positions, bodies.masses);
+        kernel.compute_accelerations(0, fused, actual, 3, [](std::size_t count, auto&& f) {
+          for (std::size_t i = 0; i != count; ++i)
+            f(i);
+        });
+
+        real error = 0;
+        for (std::size_t i = 0; i != n; ++i)
+          error += length(actual[i] - expected[i]) / length(expected[i]);
+        INFO(to_string(instruction_set) << (fused ? " fused" : "") << " scale " << scale);
+        REQUIRE(error / static_cast<real>(n) < 1e-5);
+      }
+    }
+  }
+}
+
+TEST_CASE("direct_sum_skips_coincident_bodies", "direct_sum")
+{
+  // Without softening, calculate_acceleration() would divide by zero here
+  const std::vector<triple> positions = {{0, 0, 0}, {1, 0, 0}, {1, 0, 0}, {0, 2, 0}};
+  const std::vector<real> masses      = {1, 2, 3, 4};
+
+  std::vector<triple> actual(positions.size());
+  for (const simd_instruction_set instruction_set : supported_instruction_sets()) {
+    for (const bool fused : {false, true}) {
+      direct_sum_kernel kernel(instruction_set);
+      kernel.load(positions, masses);
+      kernel.compute_accelerations(0, fused, actual);
+
+      // Body 0 is pulled by 1 and 2 along x, by 3 along y
+      INFO(to_string(instruction_set) << (fused ? " fused" : ""));
+      REQUIRE(std::abs(actual[0][0] - gravitational_constant * 5) < 1e-12 * gravitational_constant);
+      REQUIRE(std::abs(actual[0][1] - gravitational_constant * 4 / 4) < 1e-12 * gravitational_constant);
+      for (const triple& a : actual) {
+        REQUIRE(std::isfinite(a[0]));
+        REQUIRE(std::isfinite(a[1]));
+        REQUIRE(std::isfinite(a[2]));
+      }
+    }
+  }
+}
+
+SOLARSIM_NS_END
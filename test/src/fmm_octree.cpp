@@ -0,0 +1,74 @@
+#include "solarsim/fmm_octree.hpp"
+#include "solarsim/math.hpp"
+#include "solarsim/sync_simulator.hpp"
+#include "test_bodies.hpp"
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <vector>
+
+SOLARSIM_NS_BEGIN
+
+TEST_CASE("fmm_matches_naive", "fmm_octree")
+{
+  const random_bodies bodies(2000);
+  std::vector<triple> expected(bodies.positions.size());
+  std::vector<triple> actual(bodies.positions.size());
+
+  naive_sync_simulator_impl().tick(bodies.positions, bodies.masses, .05, expected);
+  fmm_sync_simulator_impl().tick(bodies.positions, bodies.masses, .05, actual);
+  REQUIRE(mean_relative_error(expected, actual) < 0.005);
+}
+
+TEST_CASE("fmm_single_leaf_is_exact", "fmm_octree")
+{
+  // Everything fits into the root, so there's nothing but direct sums.
+  const random_bodies bodies(20);
+  std::vector<triple> expected(bodies.positions.size());
+  std::vector<triple> actual(bodies.positions.size());
+
+  naive_sync_simulator_impl().tick(bodies.positions, bodies.masses, .05, expected);
+  fmm_octree octree;
+  octree.compute_accelerations(bodies.positions, bodies.masses, .05, actual);
+  REQUIRE(octree.cell_count() == 1);
+  REQUIRE(octree.statistics().cell_interactions == 0);
+  REQUIRE(mean_relative_error(expected, actual) < 1e-12);
+
+  naive_sync_simulator_impl naive;
+  naive.set_softening_kind(softening_kind::plummer);
+  naive.tick(bodies.positions, bodies.masses, .05, expected);
+  octree.set_softening_kind(softening_kind::plummer);
+  octree.compute_accelerations(bodies.positions, bodies.masses, .05, actual);
+  REQUIRE(mean_relative_error(expected, actual) < 1e-12);
+}
+
+TEST_CASE("fmm_order", "fmm_octree")
+{
+  // The far field isn't softened, so leave out softening to see the expansion's error only.
+  const random_bodies bodies(2000, 5);
+  std::vector<triple> expected(bodies.positions.size());
+  naive_sync_simulator_impl().tick(bodies.positions, bodies.masses, 0, expected);
+
+  auto error_with = [&](std::uint32_t order) {
+    fmm_options options;
+    options.order = order;
+    fmm_octree octree(options);
+
+    std::vector<triple> actual(bodies.positions.size());
+    octree.compute_accelerations(bodies.positions, bodies.masses, 0, actual);
+    REQUIRE(octree.statistics().cell_interactions > 0);
+    return mean_relative_error(expected, actual);
+  };
+
+  // Higher orders converge towards the exact result
+  real previous_error = error_with(0);
+  for (std::uint32_t order = 1; order <= 8; ++order) {
+    const real error = error_with(order);
+    INFO("order " << order << ": " << error);
+    REQUIRE(error < previous_error);
+    previous_error = error;
+  }
+  REQUIRE(previous_error < 5e-4);
+}
+
+SOLARSIM_NS_END
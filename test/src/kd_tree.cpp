@@ -0,0 +1,66 @@
+#include "solarsim/kd_tree.hpp"
+#include "solarsim/math.hpp"
+#include "solarsim/sync_simulator.hpp"
+#include "test_bodies.hpp"
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <cmath>
+#include <vector>
+
+SOLARSIM_NS_BEGIN
+
+TEST_CASE("kd_tree_matches_naive", "kd_tree")
+{
+  random_bodies bodies(2000);
+  std::vector<triple> expected(bodies.positions.size());
+  std::vector<triple> actual(bodies.positions.size());
+
+  for (const bool clustered : {false, true}) {
+    if (clustered)
+      bodies.cluster(10, 1e-3);
+    naive_sync_simulator_impl().tick(bodies.positions, bodies.masses, 1e-5, expected);
+
+    for (const kd_split_rule rule : {kd_split_rule::median, kd_split_rule::surface_area}) {
+      kd_tree_sync_simulator_impl simulator({rule});
+      simulator.tick(bodies.positions, bodies.masses, 1e-5, actual);
+      REQUIRE(mean_relative_error(expected, actual) < 0.01);
+    }
+  }
+}
+
+TEST_CASE("kd_tree_stays_balanced", "kd_tree")
+{
+  // Clusters six orders of magnitude smaller than the whole set, which would take an octree ~20 extra levels
+  random_bodies bodies(4096);
+  bodies.cluster(4, 1e-4);
+
+  kd_tree tree;
+  tree.rebuild(bodies.positions, bodies.masses);
+  // 4096 / 8 = 512 leaves in a complete binary tree of 10 levels
+  REQUIRE(tree.depth() == 10);
+  REQUIRE(tree.node_count() == 1023);
+
+  tree.set_options({kd_split_rule::surface_area});
+  tree.rebuild(bodies.positions, bodies.masses);
+  REQUIRE(tree.depth() < 20);
+}
+
+TEST_CASE("kd_tree_duplicate_bodies", "kd_tree")
+{
+  random_bodies bodies(100);
+  for (auto& position : bodies.positions)
+    position = {1.0, 2.0, 3.0};
+
+  // Nothing to split - everything ends up in the root
+  kd_tree tree;
+  tree.rebuild(bodies.positions, bodies.masses);
+  REQUIRE(tree.node_count() == 1);
+
+  triple acceleration = {};
+  tree.apply_forces_to({0.0, 0.0, 0.0}, .05, acceleration);
+  REQUIRE(std::isfinite(acceleration[0]));
+  REQUIRE(acceleration[2] > 0);
+}
+
+SOLARSIM_NS_END
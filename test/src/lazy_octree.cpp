@@ -0,0 +1,87 @@
+#include "solarsim/lazy_octree.hpp"
+#include "solarsim/math.hpp"
+#include "solarsim/sync_simulator.hpp"
+#include "test_bodies.hpp"
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <thread>
+#include <vector>
+
+SOLARSIM_NS_BEGIN
+
+TEST_CASE("lazy_matches_naive", "lazy_octree")
+{
+  const random_bodies bodies(1000);
+  std::vector<triple> expected(bodies.positions.size());
+  std::vector<triple> actual(bodies.positions.size());
+
+  naive_sync_simulator_impl().tick(bodies.positions, bodies.masses, .05, expected);
+  barnes_hut_sync_simulator_impl simulator;
+  simulator.set_lazy_expansion(true);
+  simulator.tick(bodies.positions, bodies.masses, .05, actual);
+  REQUIRE(max_relative_error(expected, actual) < 0.1);
+}
+
+TEST_CASE("lazy_expands_opened_nodes_only", "lazy_octree")
+{
+  // Two clusters far apart: walks for the first one accept the second one's root right away.
+  random_bodies bodies(1000);
+  const random_bodies far_bodies(1000, 2, {1e6, 0, 0});
+  bodies.positions.insert(bodies.positions.end(), far_bodies.positions.begin(), far_bodies.positions.end());
+  bodies.masses.insert(bodies.masses.end(), far_bodies.masses.begin(), far_bodies.masses.end());
+
+  lazy_octree octree(bodies.positions, bodies.masses);
+  REQUIRE(octree.node_count() == 1);
+
+  std::vector<triple> acceleration(bodies.positions.size());
+  for (std::size_t i = 0; i != 1000; ++i)
+    octree.apply_forces_to(bodies.positions[i], .05, acceleration[i]);
+  const std::size_t opened_count = octree.node_count();
+
+  octree.expand_all();
+  REQUIRE(opened_count < octree.node_count() * 2 / 3);
+
+  // Walks for the other half are the same, whether the tree was expanded by them or not.
+  lazy_octree lazy(bodies.positions, bodies.masses);
+  for (std::size_t i = 1000; i != bodies.positions.size(); ++i) {
+    triple expected = {};
+    triple actual   = {};
+    octree.apply_forces_to(bodies.positions[i], .05, expected);
+    lazy.apply_forces_to(bodies.positions[i], .05, actual);
+    REQUIRE(squared_length(expected - actual) == 0);
+  }
+}
+
+TEST_CASE("lazy_concurrent_walks", "lazy_octree")
+{
+  const random_bodies bodies(5000);
+  const std::size_t n = bodies.positions.size();
+
+  std::vector<triple> expected(n);
+  lazy_octree reference(bodies.positions, bodies.masses);
+  for (std::size_t i = 0; i != n; ++i)
+    reference.apply_forces_to(bodies.positions[i], .05, expected[i]);
+
+  // Every thread walks for all bodies, so they keep running into each other's expansions.
+  constexpr std::size_t num_threads = 4;
+  lazy_octree octree(bodies.positions, bodies.masses);
+  std::vector<std::vector<triple>> actual(num_threads, std::vector<triple>(n));
+  {
+    std::vector<std::jthread> threads;
+    for (std::size_t t = 0; t != num_threads; ++t) {
+      threads.emplace_back([&, t] {
+        for (std::size_t j = 0; j != n; ++j) {
+          const std::size_t i = (j + t * n / num_threads) % n;
+          octree.apply_forces_to(bodies.positions[i], .05, actual[t][i]);
+        }
+      });
+    }
+  }
+
+  REQUIRE(octree.node_count() == reference.node_count());
+  for (std::size_t t = 0; t != num_threads; ++t)
+    REQUIRE(max_relative_error(expected, actual[t]) == 0);
+}
+
+SOLARSIM_NS_END
@@ -0,0 +1,148 @@
+#include "solarsim/math.hpp"
+#include "solarsim/simd.hpp"
+#include "test_bodies.hpp"
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <random>
+#include <vector>
+
+SOLARSIM_NS_BEGIN
+
+namespace {
+
+std::vector<triple> random_triples(std::size_t n, real extent, std::uint32_t seed)
+{
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<real> dist(-extent, extent);
+  std::vector<triple> values(n);
+  for (triple& value : values)
+    value = {dist(rng), dist(rng), dist(rng)};
+  return values;
+}
+
+bool close_to(const triple& actual, const triple& expected)
+{
+  return length(actual - expected) <= 1e-12 * length(expected);
+}
+
+} // namespace
+
+TEST_CASE("simd_instruction_set_names", "simd")
+{
+  for (const auto instruction_set :
+       {simd_instruction_set::portable, simd_instruction_set::avx2, simd_instruction_set::avx512})
+    REQUIRE(parse_simd_instruction_set(to_string(instruction_set)) == instruction_set);
+  REQUIRE(!parse_simd_instruction_set("sse9").has_value());
+}
+
+TEST_CASE("simd_active_instruction_set_falls_back", "simd")
+{
+  const simd_instruction_set previous = active_simd_instruction_set();
+
+  set_active_simd_instruction_set(simd_instruction_set::avx512);
+  REQUIRE(active_simd_instruction_set() == detect_simd_instruction_set());
+  set_active_simd_instruction_set(simd_instruction_set::portable);
+  REQUIRE(active_simd_instruction_set() == simd_instruction_set::portable);
+
+  set_active_simd_instruction_set(previous);
+}
+
+TEST_CASE("quad_matches_triple", "simd")
+{
+  const triple a = {1.5, -2.0, 4.0};
+  const triple b = {-0.5, 3.0, 2.5};
+  const quad qa  = make_quad(a);
+  const quad qb  = make_quad(b, 7.0);
+
+  REQUIRE(alignof(quad) == 4 * sizeof(real));
+  REQUIRE(qb.w() == 7.0);
+  REQUIRE(almost_equal_ulps(to_triple(qa + qb), a + b));
+  REQUIRE(almost_equal_ulps(to_triple(qa - qb), a - b));
+  REQUIRE(almost_equal_ulps(to_triple(qa * qb), a * b));
+  REQUIRE(almost_equal_ulps(to_triple(qa * 3.0), a * 3.0));
+  REQUIRE(almost_equal_ulps(to_triple(-qa), -a));
+  REQUIRE(squared_length(qb) == squared_length(b));
+
+  // The mass in the 4th lane must neither leak into the force nor get modified by it
+  triple expected = {};
+  pairwise_gravity<>{.05}(a, b, 7.0, expected);
+  quad actual = make_quad({}, -1.0);
+  pairwise_gravity<>{.05}(qa, qb, actual);
+  REQUIRE(almost_equal_ulps(to_triple(actual), expected));
+  REQUIRE(actual.w() == -1.0);
+}
+
+TEST_CASE("simd_body_kernels_match_scalar", "simd")
+{
+  const simd_instruction_set previous = active_simd_instruction_set();
+
+  const std::size_t n                     = 203;
+  const real dT                           = 60;
+  const std::vector<triple> positions     = random_triples(n, 100.0, 1);
+  const std::vector<triple> velocities    = random_triples(n, 1e-3, 2);
+  const std::vector<triple> accelerations = random_triples(n, 1e-6, 3);
+
+  // Interaction list, padded like barnes_hut_octree's
+  const std::size_t list_size = (n + soa_lane_count - 1) / soa_lane_count * soa_lane_count;
+  std::vector<real> x(list_size, 1e10), y(list_size, 1e10), z(list_size, 1e10), masses(list_size, 0.0);
+  for (std::size_t j = 0; j != n; ++j) {
+    x[j]      = positions[j][0];
+    y[j]      = positions[j][1];
+    z[j]      = positions[j][2];
+    masses[j] = gravitational_constant * (0.1 + 1e-3 * static_cast<real>(j));
+  }
+
+  const triple x_i = {1.5, -2.5, 3.5};
+  triple expected_accelerations[2];
+  for (const softening_kind kind : {softening_kind::linear, softening_kind::plummer}) {
+    triple& expected = expected_accelerations[kind == softening_kind::plummer ? 1 : 0];
+    expected         = {};
+    for (std::size_t j = 0; j != n; ++j)
+      calculate_scaled_acceleration(x_i, positions[j], masses[j], .05, kind, expected);
+  }
+
+  for (const simd_instruction_set instruction_set : supported_instruction_sets()) {
+    set_active_simd_instruction_set(instruction_set);
+    INFO(to_string(instruction_set));
+
+    for (const softening_kind kind : {softening_kind::linear, softening_kind::plummer}) {
+      triple acceleration = {};
+      calculate_scaled_acceleration_soa(x_i, x.data(), y.data(), z.data(), masses.data(), list_size, .05, kind,
+                                        acceleration);
+      REQUIRE(close_to(acceleration, expected_accelerations[kind == softening_kind::plummer ? 1 : 0]));
+    }
+
+    for (const bool leapfrog : {false, true}) {
+      std::vector<triple> expected_positions = positions, actual_positions = positions;
+      std::vector<triple> expected_velocities = velocities, actual_velocities = velocities;
+
+      for (std::size_t i = 0; i != n; ++i) {
+        if (leapfrog) {
+          integrate_leapfrog_phase1(expected_positions[i], expected_velocities[i], dT);
+          integrate_leapfrog_phase2(expected_positions[i], expected_velocities[i], accelerations[i], dT);
+        } else {
+          integrate_velocity_verlet_phase1(expected_positions[i], expected_velocities[i], accelerations[i], dT);
+          integrate_velocity_verlet_phase2(expected_velocities[i], accelerations[i], dT);
+        }
+      }
+      if (leapfrog) {
+        integrate_leapfrog_phase1(actual_positions, actual_velocities, dT);
+        integrate_leapfrog_phase2(actual_positions, actual_velocities, accelerations, dT);
+      } else {
+        integrate_velocity_verlet_phase1(actual_positions, actual_velocities, accelerations, dT);
+        integrate_velocity_verlet_phase2(actual_velocities, accelerations, dT);
+      }
+
+      for (std::size_t i = 0; i != n; ++i) {
+        INFO((leapfrog ? "leapfrog" : "velocity verlet") << " body " << i);
+        REQUIRE(close_to(actual_positions[i], expected_positions[i]));
+        REQUIRE(close_to(actual_velocities[i], expected_velocities[i]));
+      }
+    }
+  }
+
+  set_active_simd_instruction_set(previous);
+}
+
+SOLARSIM_NS_END
@@ -0,0 +1,89 @@
+#ifndef SOLARSIM_TEST_BODIES_HPP
+#define SOLARSIM_TEST_BODIES_HPP
+
+#include "solarsim/detail/config.hpp"
+
+#if SOLARSIM_HAS_PRAGMA_ONCE
+#  pragma once
+#endif
+
+#include "solarsim/math.hpp"
+#include "solarsim/simd.hpp"
+#include "solarsim/types.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <span>
+#include <vector>
+
+SOLARSIM_NS_BEGIN
+
+// Fixtures shared by the solver tests
+
+struct random_bodies
+{
+  // Uniform positions in a cube of edge 200 around center, masses in [0.1, 1]
+  explicit random_bodies(std::size_t n, std::uint32_t seed = 1, const triple& center = {})
+    : positions(n)
+    , masses(n)
+  {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<real> position_dist(-100.0, 100.0);
+    std::uniform_real_distribution<real> mass_dist(0.1, 1.0);
+    for (std::size_t i = 0; i != n; ++i) {
+      positions[i] = center + triple{position_dist(rng), position_dist(rng), position_dist(rng)};
+      masses[i]    = mass_dist(rng);
+    }
+  }
+
+  // A few tight clusters, like moons around their planets
+  void cluster(std::size_t clusters, real sigma, std::uint32_t seed = 2)
+  {
+    std::mt19937 rng(seed);
+    std::normal_distribution<real> offset_dist(0.0, sigma);
+    for (std::size_t i = 0; i != positions.size(); ++i)
+      positions[i] = positions[i % clusters] + triple{offset_dist(rng), offset_dist(rng), offset_dist(rng)};
+  }
+
+  // Test particles: every stride-th body feels gravity but exerts none
+  void make_massless(std::size_t stride)
+  {
+    for (std::size_t i = 0; i < masses.size(); i += stride)
+      masses[i] = 0;
+  }
+
+  std::vector<triple> positions;
+  std::vector<real> masses;
+};
+
+inline real max_relative_error(std::span<const triple> expected, std::span<const triple> actual)
+{
+  real max_error = 0;
+  for (std::size_t i = 0, n = expected.size(); i != n; ++i)
+    max_error = std::max(max_error, length(expected[i] - actual[i]) / length(expected[i]));
+  return max_error;
+}
+
+inline real mean_relative_error(std::span<const triple> expected, std::span<const triple> actual)
+{
+  real sum = 0;
+  for (std::size_t i = 0, n = expected.size(); i != n; ++i)
+    sum += length(expected[i] - actual[i]) / length(expected[i]);
+  return sum / static_cast<real>(expected.size());
+}
+
+// Instruction sets this CPU can run, for tests that compare every kernel variant
+inline std::vector<simd_instruction_set> supported_instruction_sets()
+{
+  std::vector<simd_instruction_set> supported = {simd_instruction_set::portable};
+  if (detect_simd_instruction_set() >= simd_instruction_set::avx2)
+    supported.push_back(simd_instruction_set::avx2);
+  if (detect_simd_instruction_set() >= simd_instruction_set::avx512)
+    supported.push_back(simd_instruction_set::avx512);
+  return supported;
+}
+
+SOLARSIM_NS_END
+
+#endif
@@ -0,0 +1,96 @@
+#include "solarsim/math.hpp"
+#include "solarsim/sync_simulator.hpp"
+#include "solarsim/treepm.hpp"
+#include "test_bodies.hpp"
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+SOLARSIM_NS_BEGIN
+
+TEST_CASE("short_range_split", "treepm")
+{
+  const triple origin = {};
+  const real split    = 2.0;
+
+  // Close by, it's all Newton. Beyond a few r_s, there's nothing left.
+  triple newton             = {};
+  triple split_acceleration = {};
+  calculate_acceleration(origin, {0.01, 0.0, 0.0}, 1.0, 0.0, newton);
+  calculate_scaled_short_range_acceleration(origin, {0.01, 0.0, 0.0}, gravitational_constant, 0.0,
+                                            softening_kind::linear, split, split_acceleration);
+  REQUIRE(std::abs(split_acceleration[0] / newton[0] - 1) < 1e-5);
+
+  newton = split_acceleration = {};
+  calculate_acceleration(origin, {10 * split, 0.0, 0.0}, 1.0, 0.0, newton);
+  calculate_scaled_short_range_acceleration(origin, {10 * split, 0.0, 0.0}, gravitational_constant, 0.0,
+                                            softening_kind::linear, split, split_acceleration);
+  REQUIRE(split_acceleration[0] / newton[0] < 1e-9);
+}
+
+TEST_CASE("treepm_mesh_force", "treepm")
+{
+  // Farther apart than the cutoff, so this is the mesh alone
+  const std::vector<triple> positions = {{0.0, 0.0, 0.0}, {3.0, 4.0, 12.0}};
+  const std::vector<real> masses      = {1.0, 2.0};
+  std::vector<triple> expected(2);
+  std::vector<triple> actual(2);
+
+  naive_sync_simulator_impl().tick(positions, masses, 1e-5, expected);
+  treepm_options options;
+  options.mesh_size = 32;
+  treepm_solver solver(options);
+  solver.compute_accelerations(positions, masses, 1e-5, actual);
+  REQUIRE(solver.get_options().cutoff_scale * solver.split_radius() < 13);
+  REQUIRE(mean_relative_error(expected, actual) < 0.01);
+}
+
+TEST_CASE("treepm_matches_naive", "treepm")
+{
+  random_bodies bodies(4000);
+  std::vector<triple> expected(bodies.positions.size());
+  std::vector<triple> actual(bodies.positions.size());
+
+  naive_sync_simulator_impl().tick(bodies.positions, bodies.masses, 1e-5, expected);
+  for (const std::uint32_t mesh_size : {32u, 64u}) {
+    treepm_options options;
+    options.mesh_size = mesh_size;
+    treepm_sync_simulator_impl simulator(options);
+    simulator.tick(bodies.positions, bodies.masses, 1e-5, actual);
+    REQUIRE(mean_relative_error(expected, actual) < 0.01);
+  }
+}
+
+TEST_CASE("treepm_massless_bodies", "treepm")
+{
+  random_bodies bodies(4000);
+  bodies.make_massless(3);
+  for (std::size_t i = 0; i != bodies.positions.size(); ++i) {
+    if (bodies.positions[i][0] > 50)
+      bodies.masses[i] = 0;
+  }
+  std::vector<triple> expected(bodies.positions.size());
+  naive_sync_simulator_impl().tick(bodies.positions, bodies.masses, 1e-5, expected);
+
+  // Every acceleration has to be written, test particles included
+  treepm_options options;
+  options.mesh_size = 32;
+  treepm_solver solver(options);
+  std::vector<triple> actual(bodies.positions.size(), triple{1e30, 1e30, 1e30});
+  solver.compute_accelerations(bodies.positions, bodies.masses, 1e-5, actual);
+  REQUIRE(solver.body_count() == bodies.positions.size());
+  REQUIRE(mean_relative_error(expected, actual) < 0.01);
+
+  std::fill(bodies.masses.begin(), bodies.masses.end(), 0);
+  solver.compute_accelerations(bodies.positions, bodies.masses, 1e-5, actual);
+  for (const triple& acceleration : actual)
+    REQUIRE(squared_length(acceleration) == 0);
+
+  solver.compute_accelerations({}, {}, 1e-5, {});
+  REQUIRE(solver.body_count() == 0);
+}
+
+SOLARSIM_NS_END
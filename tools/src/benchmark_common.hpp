@@ -18,6 +18,7 @@
 
 #include <solarsim/simulation_state.hpp>
 #include <solarsim/body_definition_csv.hpp>
+#include <solarsim/simd.hpp>
 
 // Enable optional spirit debugging
 // #define BOOST_SPIRIT_DEBUG
@@ -28,6 +29,7 @@
 #include <boost/math/special_functions/lambert_w.hpp>
 
 #include <cmath>
+#include <random>
 
 SOLARSIM_NS_BEGIN
 
@@ -39,11 +41,22 @@ enum class Scaling
   Strong
 };
 
+enum class TreeBuild
+{
+  // One body after another, see barnes_hut_octree
+  Insertion,
+  // Parallel & bottom-up, see morton_octree_builder
+  Morton,
+  // Partial trees built in parallel, then merged, see merged_octree_builder
+  Merged
+};
+
 //
 // Benchmark parameters
 //
 
 bool parse_threads(const char* flagname, const std::string& value);
+bool parse_simd(const char* flagname, const std::string& value);
 
 DEFINE_double(time_step, 60 * 60, "Time between simulation steps (in s)");
 DEFINE_double(duration, (60 * 60) * 15, "Total duration of the simulation (in s)");
@@ -51,6 +64,8 @@ DEFINE_string(dataset, "dataset/scenario1_state_vectors.csv", "Path to the input
 DEFINE_string(threads, "1,2,4,8,16", "Number of threads to test");
 DEFINE_validator(threads, &parse_threads);
 static std::vector<int> FLAGS_threads_v; // FLAGS_threads is just a string!
+DEFINE_string(simd, "", "Instruction set of the kernels (portable, avx2, avx512), detected if empty");
+DEFINE_validator(simd, &parse_simd);
 
 inline bool parse_threads(const char* /*flagname*/, const std::string& value)
 {
@@ -58,6 +73,16 @@ inline bool parse_threads(const char* /*flagname*/, const std::string& value)
   return phrase_parse(iter, value.end(), -(boost::spirit::x3::int_ % ','), boost::spirit::x3::space, FLAGS_threads_v);
 }
 
+inline bool parse_simd(const char* /*flagname*/, const std::string& value)
+{
+  if (value.empty())
+    return true;
+  const auto instruction_set = parse_simd_instruction_set(value);
+  if (instruction_set)
+    set_active_simd_instruction_set(*instruction_set);
+  return instruction_set.has_value();
+}
+
 // Helper type to own our simulation dataset
 template <typename DatasetPolicy>
 struct benchmark_simulator_data
@@ -90,6 +115,55 @@ struct benchmark_simulator_data
   simulation_state state;
 };
 
+// Generated problem of |n| bodies uniformly distributed in a cube.
+// Mostly useful for scaling the tree benchmarks way past our real datasets.
+inline simulation_state generate_problem(std::size_t n, std::uint32_t seed = 42)
+{
+  std::mt19937_64 rng(seed);
+  std::uniform_real_distribution<real> position_dist(-parsec_in_km, parsec_in_km);
+  std::uniform_real_distribution<real> mass_dist(1e-6, 1.0);
+
+  simulation_state state;
+  state.body_positions.resize(n);
+  state.body_velocities.resize(n);
+  state.body_masses.resize(n);
+  state.acceleration.resize(n);
+  state.softening_factor = .05;
+
+  for (std::size_t i = 0; i != n; ++i) {
+    state.body_positions[i] = {position_dist(rng), position_dist(rng), position_dist(rng)};
+    state.body_masses[i]    = mass_dist(rng);
+  }
+  return state;
+}
+
+// Generated problem of |n| bodies in |clusters| tight Gaussian clusters, spread over the same cube as
+// generate_problem(). Much like galaxies, and the worst case for trees with fixed subdivisions.
+inline simulation_state generate_clustered_problem(std::size_t n, std::size_t clusters = 32, std::uint32_t seed = 42)
+{
+  std::mt19937_64 rng(seed);
+  std::uniform_real_distribution<real> center_dist(-parsec_in_km, parsec_in_km);
+  std::normal_distribution<real> offset_dist(0, 1e-3 * parsec_in_km);
+  std::uniform_real_distribution<real> mass_dist(1e-6, 1.0);
+
+  std::vector<triple> centers(clusters);
+  for (auto& center : centers)
+    center = {center_dist(rng), center_dist(rng), center_dist(rng)};
+
+  simulation_state state;
+  state.body_positions.resize(n);
+  state.body_velocities.resize(n);
+  state.body_masses.resize(n);
+  state.acceleration.resize(n);
+  state.softening_factor = .05;
+
+  for (std::size_t i = 0; i != n; ++i) {
+    state.body_positions[i] = centers[i % clusters] + triple{offset_dist(rng), offset_dist(rng), offset_dist(rng)};
+    state.body_masses[i]    = mass_dist(rng);
+  }
+  return state;
+}
+
 static const simulation_state& get_problem()
 {
   // <static const> gives us "free" on-demand thread safe init for our static dataset
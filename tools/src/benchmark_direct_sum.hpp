@@ -0,0 +1,206 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include "benchmark_common.hpp"
+#include "benchmark_octree.hpp"
+
+#include <solarsim/direct_sum.hpp>
+#include <solarsim/math.hpp>
+
+#include <benchmark/benchmark.h>
+
+SOLARSIM_NS_BEGIN
+
+//
+// All-pairs kernels (backend-independent, single-threaded), items are pairwise interactions
+//
+
+inline void set_direct_sum_counters(benchmark::State& state, std::size_t n, bool fused)
+{
+  // Per-body kernels compute every pair twice
+  const auto pairs = static_cast<std::int64_t>(fused ? n * (n - 1) / 2 : n * (n - 1));
+  state.SetItemsProcessed(state.iterations() * pairs);
+}
+
+// The scalar loops naive_sync_simulator_impl had before direct_sum_kernel
+template <bool Fused>
+static void BM_DirectSum_Scalar(benchmark::State& state)
+{
+  const auto data = generate_problem(static_cast<std::size_t>(state.range(0)));
+  const auto n    = data.body_positions.size();
+  std::vector<triple> acceleration(n);
+
+  for (auto _ : state) {
+    std::fill(acceleration.begin(), acceleration.end(), triple{});
+    for (std::size_t i = 0; i != n; ++i) {
+      if constexpr (Fused) {
+        for (std::size_t j = i + 1; j < n; ++j) {
+          calculate_acceleration(data.body_positions[i], data.body_positions[j], data.body_masses[i],
+                                 data.body_masses[j], data.softening_factor, acceleration[i], acceleration[j]);
+        }
+      } else {
+        for (std::size_t j = 0; j != n; ++j) {
+          if (i != j) {
+            calculate_acceleration(data.body_positions[i], data.body_positions[j], data.body_masses[j],
+                                   data.softening_factor, acceleration[i]);
+          }
+        }
+      }
+    }
+    benchmark::DoNotOptimize(acceleration.data());
+  }
+  set_direct_sum_counters(state, n, Fused);
+}
+BENCHMARK(BM_DirectSum_Scalar<false>)->RangeMultiplier(4)->Range(256, 16384)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_DirectSum_Scalar<true>)->RangeMultiplier(4)->Range(256, 16384)->Unit(benchmark::kMillisecond);
+
+// BM_DirectSum_Scalar<false> on padded vectors: positions with G * m in the 4th lane, so each body is one load
+static void BM_DirectSum_Scalar_Padded(benchmark::State& state)
+{
+  const auto data = generate_problem(static_cast<std::size_t>(state.range(0)));
+  const auto n    = data.body_positions.size();
+  std::vector<quad> mass_points(n);
+  for (std::size_t i = 0; i != n; ++i)
+    mass_points[i] = make_quad(data.body_positions[i], gravitational_constant * data.body_masses[i]);
+  std::vector<quad> acceleration(n);
+
+  const pairwise_gravity<> gravity{data.softening_factor};
+  for (auto _ : state) {
+    std::fill(acceleration.begin(), acceleration.end(), quad{});
+    for (std::size_t i = 0; i != n; ++i) {
+      for (std::size_t j = 0; j != n; ++j) {
+        if (i != j)
+          gravity(mass_points[i], mass_points[j], acceleration[i]);
+      }
+    }
+    benchmark::DoNotOptimize(acceleration.data());
+  }
+  set_direct_sum_counters(state, n, false);
+}
+BENCHMARK(BM_DirectSum_Scalar_Padded)->RangeMultiplier(4)->Range(256, 16384)->Unit(benchmark::kMillisecond);
+
+template <simd_instruction_set InstructionSet, bool Fused>
+static void BM_DirectSum(benchmark::State& state)
+{
+  if (detect_simd_instruction_set() < InstructionSet) {
+    state.SkipWithError("instruction set not supported");
+    return;
+  }
+
+  const auto data = generate_problem(static_cast<std::size_t>(state.range(0)));
+  const auto n    = data.body_positions.size();
+  std::vector<triple> acceleration(n);
+  direct_sum_kernel kernel(InstructionSet);
+
+  for (auto _ : state) {
+    kernel.load(data.body_positions, data.body_masses);
+    kernel.compute_accelerations(data.softening_factor, Fused, acceleration);
+    benchmark::DoNotOptimize(acceleration.data());
+  }
+  set_direct_sum_counters(state, n, Fused);
+}
+BENCHMARK(BM_DirectSum<simd_instruction_set::portable, false>)
+    ->RangeMultiplier(4)
+    ->Range(256, 16384)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_DirectSum<simd_instruction_set::portable, true>)
+    ->RangeMultiplier(4)
+    ->Range(256, 16384)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_DirectSum<simd_instruction_set::avx2, false>)
+    ->RangeMultiplier(4)
+    ->Range(256, 16384)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_DirectSum<simd_instruction_set::avx2, true>)
+    ->RangeMultiplier(4)
+    ->Range(256, 16384)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_DirectSum<simd_instruction_set::avx512, false>)
+    ->RangeMultiplier(4)
+    ->Range(256, 16384)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_DirectSum<simd_instruction_set::avx512, true>)
+    ->RangeMultiplier(4)
+    ->Range(256, 16384)
+    ->Unit(benchmark::kMillisecond);
+
+// Plummer softening leaves a single reciprocal square root per pair, compare with BM_DirectSum<..., true>
+template <simd_instruction_set InstructionSet>
+static void BM_DirectSum_Plummer(benchmark::State& state)
+{
+  if (detect_simd_instruction_set() < InstructionSet) {
+    state.SkipWithError("instruction set not supported");
+    return;
+  }
+
+  const auto data = generate_problem(static_cast<std::size_t>(state.range(0)));
+  const auto n    = data.body_positions.size();
+  std::vector<triple> acceleration(n);
+  direct_sum_kernel kernel(InstructionSet);
+  kernel.set_softening_kind(softening_kind::plummer);
+
+  for (auto _ : state) {
+    kernel.load(data.body_positions, data.body_masses);
+    kernel.compute_accelerations(data.softening_factor, true, acceleration);
+    benchmark::DoNotOptimize(acceleration.data());
+  }
+  set_direct_sum_counters(state, n, true);
+}
+BENCHMARK(BM_DirectSum_Plummer<simd_instruction_set::portable>)
+    ->RangeMultiplier(4)
+    ->Range(256, 16384)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_DirectSum_Plummer<simd_instruction_set::avx2>)
+    ->RangeMultiplier(4)
+    ->Range(256, 16384)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_DirectSum_Plummer<simd_instruction_set::avx512>)
+    ->RangeMultiplier(4)
+    ->Range(256, 16384)
+    ->Unit(benchmark::kMillisecond);
+
+// Accuracy versus speed: float32 pairwise forces against doubles throughout, with the best instruction set
+template <force_precision Precision, bool Fused>
+static void BM_DirectSum_Precision(benchmark::State& state)
+{
+  const auto data = generate_problem(static_cast<std::size_t>(state.range(0)));
+  const auto n    = data.body_positions.size();
+  std::vector<triple> acceleration(n);
+  direct_sum_kernel kernel;
+  kernel.set_precision(Precision);
+
+  for (auto _ : state) {
+    kernel.load(data.body_positions, data.body_masses);
+    kernel.compute_accelerations(data.softening_factor, Fused, acceleration);
+    benchmark::DoNotOptimize(acceleration.data());
+  }
+  set_direct_sum_counters(state, n, Fused);
+  state.counters["mean_relative_error"] = sample_relative_error(data, acceleration);
+}
+BENCHMARK(BM_DirectSum_Precision<force_precision::full, true>)
+    ->RangeMultiplier(4)
+    ->Range(1024, 16384)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_DirectSum_Precision<force_precision::mixed, true>)
+    ->RangeMultiplier(4)
+    ->Range(1024, 16384)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_DirectSum_Precision<force_precision::mixed, false>)
+    ->RangeMultiplier(4)
+    ->Range(1024, 16384)
+    ->Unit(benchmark::kMillisecond);
+
+SOLARSIM_NS_END
@@ -0,0 +1,79 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include "benchmark_common.hpp"
+#include "benchmark_octree.hpp"
+
+#include <solarsim/barnes_hut_octree.hpp>
+#include <solarsim/fmm_octree.hpp>
+
+#include <benchmark/benchmark.h>
+
+SOLARSIM_NS_BEGIN
+
+//
+// FMM vs. Barnes-Hut (backend-independent, single-threaded)
+//
+// Both include the tree build, so the times are what a tick costs. Compare them at equal mean_relative_error.
+//
+
+// range(1) is theta in percent
+static void BM_BH_Tick(benchmark::State& state)
+{
+  const auto data = generate_problem(static_cast<std::size_t>(state.range(0)));
+  const auto n    = data.body_positions.size();
+
+  barnes_hut_octree octree;
+  octree.set_opening_criterion({opening_criterion::kind::geometric, static_cast<real>(state.range(1)) / 100});
+  std::vector<triple> acceleration(n);
+
+  for (auto _ : state) {
+    octree.rebuild(data.body_positions, data.body_masses);
+    for (std::size_t i = 0; i != n; ++i)
+      octree.recompute_acceleration(data.body_positions[i], data.softening_factor, acceleration[i]);
+    benchmark::DoNotOptimize(acceleration.data());
+  }
+  state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(n));
+  state.counters["mean_relative_error"] = sample_relative_error(data, acceleration);
+}
+BENCHMARK(BM_BH_Tick)->ArgsProduct({{1000, 10000, 100000, 1000000}, {50, 70}})->Unit(benchmark::kMillisecond);
+
+// range(1) is the expansion order, range(2) theta in percent
+static void BM_FMM_Tick(benchmark::State& state)
+{
+  const auto data = generate_problem(static_cast<std::size_t>(state.range(0)));
+  const auto n    = data.body_positions.size();
+
+  fmm_octree octree({static_cast<std::uint32_t>(state.range(1)), static_cast<real>(state.range(2)) / 100});
+  std::vector<triple> acceleration(n);
+
+  for (auto _ : state) {
+    octree.compute_accelerations(data.body_positions, data.body_masses, data.softening_factor, acceleration);
+    benchmark::DoNotOptimize(acceleration.data());
+  }
+  const auto n_r = static_cast<double>(n);
+  state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(n));
+  state.counters["bytes_per_body"]      = static_cast<double>(octree.allocated_bytes()) / n_r;
+  state.counters["cells_per_body"]      = static_cast<double>(octree.cell_count()) / n_r;
+  state.counters["m2l_per_body"]        = static_cast<double>(octree.statistics().cell_interactions) / n_r;
+  state.counters["p2p_per_body"]        = static_cast<double>(octree.statistics().body_interactions) / n_r;
+  state.counters["mean_relative_error"] = sample_relative_error(data, acceleration);
+}
+BENCHMARK(BM_FMM_Tick)
+    ->ArgsProduct({{1000, 10000, 100000, 1000000}, {2, 4, 6}, {70}})
+    ->Unit(benchmark::kMillisecond);
+
+SOLARSIM_NS_END
@@ -0,0 +1,119 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include "benchmark_common.hpp"
+
+#include <solarsim/math.hpp>
+#include <solarsim/simd.hpp>
+
+#include <benchmark/benchmark.h>
+
+#include <type_traits>
+
+SOLARSIM_NS_BEGIN
+
+//
+// Per-body time integration (backend-independent, single-threaded), items are bodies
+//
+
+// Both phases of one tick with the accelerations left as they are. |Inline| runs the loops over the policy objects
+// of math_inlines.hpp, which the compiler can vectorize, the rest calls the out-of-line functions of math.cpp for
+// every body, like all loops did before.
+template <typename Integrator, bool Inline>
+static void BM_Integrate(benchmark::State& state)
+{
+  auto data    = generate_problem(static_cast<std::size_t>(state.range(0)));
+  const auto n = data.body_positions.size();
+  for (std::size_t i = 0; i != n; ++i)
+    data.acceleration[i] = data.body_positions[i] * -1e-20;
+
+  triple* positions           = data.body_positions.data();
+  triple* velocities          = data.body_velocities.data();
+  const triple* accelerations = data.acceleration.data();
+  constexpr real dT           = 1e-3;
+  constexpr bool leapfrog     = std::is_same_v<Integrator, leapfrog_integrator>;
+
+  for (auto _ : state) {
+    if constexpr (Inline) {
+      for (std::size_t i = 0; i != n; ++i)
+        Integrator::phase1(positions[i], velocities[i], accelerations[i], dT);
+      for (std::size_t i = 0; i != n; ++i)
+        Integrator::phase2(positions[i], velocities[i], accelerations[i], dT);
+    } else if constexpr (leapfrog) {
+      for (std::size_t i = 0; i != n; ++i)
+        integrate_leapfrog_phase1(positions[i], velocities[i], dT);
+      for (std::size_t i = 0; i != n; ++i)
+        integrate_leapfrog_phase2(positions[i], velocities[i], accelerations[i], dT);
+    } else {
+      for (std::size_t i = 0; i != n; ++i)
+        integrate_velocity_verlet_phase1(positions[i], velocities[i], accelerations[i], dT);
+      for (std::size_t i = 0; i != n; ++i)
+        integrate_velocity_verlet_phase2(velocities[i], accelerations[i], dT);
+    }
+    benchmark::DoNotOptimize(positions);
+    benchmark::DoNotOptimize(velocities);
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(n));
+}
+BENCHMARK(BM_Integrate<leapfrog_integrator, false>)->RangeMultiplier(8)->Range(4096, 1 << 21);
+BENCHMARK(BM_Integrate<leapfrog_integrator, true>)->RangeMultiplier(8)->Range(4096, 1 << 21);
+BENCHMARK(BM_Integrate<velocity_verlet_integrator, false>)->RangeMultiplier(8)->Range(4096, 1 << 21);
+BENCHMARK(BM_Integrate<velocity_verlet_integrator, true>)->RangeMultiplier(8)->Range(4096, 1 << 21);
+
+// The same through the span overloads, i.e. the kernels built for |InstructionSet|
+template <typename Integrator, simd_instruction_set InstructionSet>
+static void BM_IntegrateDispatched(benchmark::State& state)
+{
+  if (detect_simd_instruction_set() < InstructionSet) {
+    state.SkipWithError("instruction set not supported");
+    return;
+  }
+
+  auto data = generate_problem(static_cast<std::size_t>(state.range(0)));
+  for (std::size_t i = 0, n = data.body_positions.size(); i != n; ++i)
+    data.acceleration[i] = data.body_positions[i] * -1e-20;
+
+  const simd_instruction_set previous = active_simd_instruction_set();
+  set_active_simd_instruction_set(InstructionSet);
+  for (auto _ : state) {
+    Integrator::phase1(data.body_positions, data.body_velocities, data.acceleration, 1e-3);
+    Integrator::phase2(data.body_positions, data.body_velocities, data.acceleration, 1e-3);
+    benchmark::ClobberMemory();
+  }
+  set_active_simd_instruction_set(previous);
+  state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(data.body_positions.size()));
+}
+BENCHMARK(BM_IntegrateDispatched<leapfrog_integrator, simd_instruction_set::portable>)
+    ->RangeMultiplier(8)
+    ->Range(4096, 1 << 21);
+BENCHMARK(BM_IntegrateDispatched<leapfrog_integrator, simd_instruction_set::avx2>)
+    ->RangeMultiplier(8)
+    ->Range(4096, 1 << 21);
+BENCHMARK(BM_IntegrateDispatched<leapfrog_integrator, simd_instruction_set::avx512>)
+    ->RangeMultiplier(8)
+    ->Range(4096, 1 << 21);
+BENCHMARK(BM_IntegrateDispatched<velocity_verlet_integrator, simd_instruction_set::portable>)
+    ->RangeMultiplier(8)
+    ->Range(4096, 1 << 21);
+BENCHMARK(BM_IntegrateDispatched<velocity_verlet_integrator, simd_instruction_set::avx2>)
+    ->RangeMultiplier(8)
+    ->Range(4096, 1 << 21);
+BENCHMARK(BM_IntegrateDispatched<velocity_verlet_integrator, simd_instruction_set::avx512>)
+    ->RangeMultiplier(8)
+    ->Range(4096, 1 << 21);
+
+SOLARSIM_NS_END
@@ -0,0 +1,136 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include "benchmark_common.hpp"
+#include "benchmark_octree.hpp"
+
+#include <solarsim/barnes_hut_octree.hpp>
+#include <solarsim/kd_tree.hpp>
+
+#include <benchmark/benchmark.h>
+
+SOLARSIM_NS_BEGIN
+
+//
+// kd-tree vs. octree on uniform and clustered inputs (backend-independent, single-threaded)
+//
+
+enum class tree_engine
+{
+  octree,
+  kd_median,
+  kd_surface_area,
+};
+
+// Run |f| with a freshly set up tree of |Engine|
+template <tree_engine Engine, typename F>
+void with_tree(F&& f)
+{
+  if constexpr (Engine == tree_engine::octree) {
+    barnes_hut_octree octree;
+    f(octree);
+  } else {
+    kd_tree tree({Engine == tree_engine::kd_median ? kd_split_rule::median : kd_split_rule::surface_area});
+    f(tree);
+  }
+}
+
+template <tree_engine Engine, bool Clustered>
+static void BM_Tree_Build(benchmark::State& state)
+{
+  const auto n    = static_cast<std::size_t>(state.range(0));
+  const auto data = Clustered ? generate_clustered_problem(n) : generate_problem(n);
+
+  with_tree<Engine>([&](auto& tree) {
+    for (auto _ : state) {
+      tree.rebuild(data.body_positions, data.body_masses);
+      benchmark::ClobberMemory();
+    }
+    state.counters["bytes_per_body"] = static_cast<double>(tree.allocated_bytes()) / static_cast<double>(n);
+    state.counters["nodes_per_body"] = static_cast<double>(tree.node_count()) / static_cast<double>(n);
+  });
+  state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(n));
+}
+
+template <tree_engine Engine, bool Clustered>
+static void BM_Tree_Forces(benchmark::State& state)
+{
+  const auto n    = static_cast<std::size_t>(state.range(0));
+  const auto data = Clustered ? generate_clustered_problem(n) : generate_problem(n);
+  std::vector<triple> acceleration(n);
+
+  with_tree<Engine>([&](auto& tree) {
+    tree.rebuild(data.body_positions, data.body_masses);
+    for (auto _ : state) {
+      for (std::size_t i = 0; i != n; ++i)
+        tree.recompute_acceleration(data.body_positions[i], data.softening_factor, acceleration[i]);
+      benchmark::DoNotOptimize(acceleration.data());
+    }
+  });
+  state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(n));
+  state.counters["mean_relative_error"] = sample_relative_error(data, acceleration);
+}
+
+BENCHMARK(BM_Tree_Build<tree_engine::octree, false>)
+    ->RangeMultiplier(10)
+    ->Range(10000, 1000000)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Tree_Build<tree_engine::octree, true>)
+    ->RangeMultiplier(10)
+    ->Range(10000, 1000000)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Tree_Build<tree_engine::kd_median, false>)
+    ->RangeMultiplier(10)
+    ->Range(10000, 1000000)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Tree_Build<tree_engine::kd_median, true>)
+    ->RangeMultiplier(10)
+    ->Range(10000, 1000000)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Tree_Build<tree_engine::kd_surface_area, false>)
+    ->RangeMultiplier(10)
+    ->Range(10000, 1000000)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Tree_Build<tree_engine::kd_surface_area, true>)
+    ->RangeMultiplier(10)
+    ->Range(10000, 1000000)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Tree_Forces<tree_engine::octree, false>)
+    ->RangeMultiplier(10)
+    ->Range(10000, 100000)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Tree_Forces<tree_engine::octree, true>)
+    ->RangeMultiplier(10)
+    ->Range(10000, 100000)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Tree_Forces<tree_engine::kd_median, false>)
+    ->RangeMultiplier(10)
+    ->Range(10000, 100000)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Tree_Forces<tree_engine::kd_median, true>)
+    ->RangeMultiplier(10)
+    ->Range(10000, 100000)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Tree_Forces<tree_engine::kd_surface_area, false>)
+    ->RangeMultiplier(10)
+    ->Range(10000, 100000)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Tree_Forces<tree_engine::kd_surface_area, true>)
+    ->RangeMultiplier(10)
+    ->Range(10000, 100000)
+    ->Unit(benchmark::kMillisecond);
+
+SOLARSIM_NS_END
@@ -1,4 +1,10 @@
 #include "benchmark_common.hpp"
+#include "benchmark_direct_sum.hpp"
+#include "benchmark_octree.hpp"
+#include "benchmark_fmm.hpp"
+#include "benchmark_integration.hpp"
+#include "benchmark_kd_tree.hpp"
+#include "benchmark_treepm.hpp"
 #include "solarsim/sync_simulator.hpp"
 #include "solarsim/hpx/async_simulator.hpp"
 #include "solarsim/hpx/async_simulator_sender.hpp"
@@ -44,7 +50,20 @@ static void BM_BH_ST(benchmark::State& state)
 }
 BENCHMARK(BM_BH_ST);
 
-template <Scaling S>
+static void BM_FMM_ST(benchmark::State& state)
+{
+  auto data = get_problem();
+  auto impl = [&]() {
+    fmm_sync_simulator simulator(data.body_positions, data.body_velocities, data.body_masses, .05);
+    run_simulation(simulator, FLAGS_time_step, FLAGS_duration);
+  };
+  for (auto _ : state) {
+    hpx::async(hpx::launch::sync, hpx::annotated_function(impl, "BM_FMM_ST"));
+  }
+}
+BENCHMARK(BM_FMM_ST);
+
+template <Scaling S, TreeBuild B = TreeBuild::Insertion>
 static void BM_BH_MT_HPXSenders(benchmark::State& state)
 {
   using namespace solarsim::impl_hpx;
@@ -55,6 +74,15 @@ static void BM_BH_MT_HPXSenders(benchmark::State& state)
   auto sched = hpx::parallel::execution::with_processing_units_count(
       hpx::execution::experimental::thread_pool_scheduler{}, state.range(0));
 
+  auto tick_barnes_hut = [&] {
+    if constexpr (B == TreeBuild::Morton)
+      return async_tick_barnes_hut_morton(sched);
+    else if constexpr (B == TreeBuild::Merged)
+      return async_tick_barnes_hut_merged(sched);
+    else
+      return async_tick_barnes_hut(sched);
+  };
+
   auto data = get_problem();
   auto impl = [&]() {
     for (real elapsed = FLAGS_time_step; elapsed < duration; elapsed += FLAGS_time_step) {
@@ -65,7 +93,7 @@ static void BM_BH_MT_HPXSenders(benchmark::State& state)
 
       auto snd = ex::transfer_just(sched, solarsim::simulation_state_view(data)) |
                  async_tick_simulation_phase1(solarsim::get_dataset_size(data), FLAGS_time_step) |
-                 async_tick_barnes_hut(sched) |
+                 tick_barnes_hut() |
                  async_tick_simulation_phase2(solarsim::get_dataset_size(data), FLAGS_time_step);
 
       tt::sync_wait(std::move(snd)); // wait on this thread to finish
@@ -76,7 +104,7 @@ static void BM_BH_MT_HPXSenders(benchmark::State& state)
   }
 }
 
-template <Scaling S>
+template <Scaling S, TreeBuild B = TreeBuild::Insertion>
 static void BM_BH_MT_HPXFutures(benchmark::State& state)
 {
   using namespace solarsim::impl_hpx;
@@ -100,7 +128,12 @@ static void BM_BH_MT_HPXFutures(benchmark::State& state)
       })();
       auto future2    = future1.then(hpx::annotated_function(
           [=](hpx::future<void>) {
-            return tick_barnes_hut(our_policy, view);
+            if constexpr (B == TreeBuild::Morton)
+              return tick_barnes_hut_morton(our_policy, view);
+            else if constexpr (B == TreeBuild::Merged)
+              return tick_barnes_hut_merged(our_policy, view);
+            else
+              return tick_barnes_hut(our_policy, view);
           },
           "tick_barnes_hut"));
       auto future3    = future2.then(hpx::annotated_function(
@@ -116,21 +149,126 @@ static void BM_BH_MT_HPXFutures(benchmark::State& state)
   }
 }
 
+// Same chain as BM_BH_MT_HPXSenders, with the FMM in place of Barnes-Hut
+template <Scaling S>
+static void BM_FMM_MT_HPXSenders(benchmark::State& state)
+{
+  using namespace solarsim::impl_hpx;
+
+  // The FMM is O(n), so equal work per thread just needs |threads| times the ticks.
+  const real duration = S == Scaling::Weak ? FLAGS_duration * static_cast<real>(state.range(0)) : FLAGS_duration;
+
+  auto sched = hpx::parallel::execution::with_processing_units_count(
+      hpx::execution::experimental::thread_pool_scheduler{}, state.range(0));
+
+  auto data = get_problem();
+  auto impl = [&]() {
+    for (real elapsed = FLAGS_time_step; elapsed < duration; elapsed += FLAGS_time_step) {
+      auto snd = ex::transfer_just(sched, solarsim::simulation_state_view(data)) |
+                 async_tick_simulation_phase1(solarsim::get_dataset_size(data), FLAGS_time_step) |
+                 async_tick_fmm(sched) |
+                 async_tick_simulation_phase2(solarsim::get_dataset_size(data), FLAGS_time_step);
+
+      tt::sync_wait(std::move(snd)); // wait on this thread to finish
+    }
+  };
+  for (auto _ : state) {
+    hpx::async(hpx::launch::sync, hpx::annotated_function(impl, "BM_FMM_MT_HPXSenders"));
+  }
+}
+
+// Same chain as BM_BH_MT_HPXSenders, with tiled direct summation in place of Barnes-Hut
+template <Scaling S>
+static void BM_Naive_MT_HPXSenders(benchmark::State& state)
+{
+  using namespace solarsim::impl_hpx;
+
+  // Every tick is the same O(n^2) work, so equal work per thread just needs |threads| times the ticks.
+  const real duration = S == Scaling::Weak ? FLAGS_duration * static_cast<real>(state.range(0)) : FLAGS_duration;
+
+  auto sched = hpx::parallel::execution::with_processing_units_count(
+      hpx::execution::experimental::thread_pool_scheduler{}, state.range(0));
+
+  auto data = get_problem();
+  auto impl = [&]() {
+    for (real elapsed = FLAGS_time_step; elapsed < duration; elapsed += FLAGS_time_step) {
+      auto snd = ex::transfer_just(sched, solarsim::simulation_state_view(data)) |
+                 async_tick_simulation_phase1(solarsim::get_dataset_size(data), FLAGS_time_step) |
+                 async_tick_naive_tiled(sched, static_cast<std::size_t>(state.range(0))) |
+                 async_tick_simulation_phase2(solarsim::get_dataset_size(data), FLAGS_time_step);
+
+      tt::sync_wait(std::move(snd)); // wait on this thread to finish
+    }
+  };
+  for (auto _ : state) {
+    hpx::async(hpx::launch::sync, hpx::annotated_function(impl, "BM_Naive_MT_HPXSenders"));
+  }
+}
+
+// Barnes-Hut with collision merging. Bodies merge as the simulation goes on, so the state is owned rather than a
+// view, and every tick integrates the bodies left after the previous one.
+static void BM_BH_Collisions_MT_HPXSenders(benchmark::State& state)
+{
+  using namespace solarsim::impl_hpx;
+
+  auto sched = hpx::parallel::execution::with_processing_units_count(
+      hpx::execution::experimental::thread_pool_scheduler{}, state.range(0));
+
+  // Spheres of 1/1000 of the average volume per body, see BM_Octree_Collisions
+  simulation_state initial = generate_problem(solarsim::get_dataset_size(get_problem()));
+  const auto n             = initial.body_positions.size();
+  initial.body_radii.assign(n, query_radius(n, 1) * std::cbrt(real(1e-3)));
+
+  std::size_t bodies_left = n;
+  auto impl               = [&]() {
+    simulation_state data = initial;
+    for (real elapsed = FLAGS_time_step; elapsed < FLAGS_duration; elapsed += FLAGS_time_step) {
+      // The phases take the count before the merge, phase 2 skips the bodies merged in between.
+      const auto num_bodies = solarsim::get_dataset_size(data);
+
+      auto snd = ex::transfer_just(sched, std::move(data)) |
+                 async_tick_simulation_phase1(num_bodies, FLAGS_time_step) |
+                 async_tick_barnes_hut_collisions(sched, FLAGS_time_step) |
+                 async_tick_simulation_phase2(num_bodies, FLAGS_time_step);
+
+      std::tie(data) = tt::sync_wait(std::move(snd)).value(); // NOLINT(bugprone-unchecked-optional-access)
+    }
+    bodies_left = data.body_positions.size();
+  };
+  for (auto _ : state) {
+    hpx::async(hpx::launch::sync, hpx::annotated_function(impl, "BM_BH_Collisions_MT_HPXSenders"));
+  }
+  state.counters["bodies_left"] = static_cast<double>(bodies_left);
+}
+
 int hpx_main(int argc, char** argv)
 {
   gflags::ParseCommandLineFlags(&argc, &argv, true);
   if (benchmark::ReportUnrecognizedArguments(argc, argv))
     return 1;
 
-#define SOLARSIM_BENCHMARK(function_name) register_solarsim_benchmark(#function_name, &function_name)
+#define SOLARSIM_BENCHMARK(...) register_solarsim_benchmark(#__VA_ARGS__, &__VA_ARGS__)
 
   // strong scaling first
   SOLARSIM_BENCHMARK(BM_BH_MT_HPXFutures<Scaling::Strong>);
   SOLARSIM_BENCHMARK(BM_BH_MT_HPXSenders<Scaling::Strong>);
+  SOLARSIM_BENCHMARK(BM_BH_MT_HPXFutures<Scaling::Strong, TreeBuild::Morton>);
+  SOLARSIM_BENCHMARK(BM_BH_MT_HPXSenders<Scaling::Strong, TreeBuild::Morton>);
+  SOLARSIM_BENCHMARK(BM_BH_MT_HPXFutures<Scaling::Strong, TreeBuild::Merged>);
+  SOLARSIM_BENCHMARK(BM_BH_MT_HPXSenders<Scaling::Strong, TreeBuild::Merged>);
+  SOLARSIM_BENCHMARK(BM_FMM_MT_HPXSenders<Scaling::Strong>);
+  SOLARSIM_BENCHMARK(BM_Naive_MT_HPXSenders<Scaling::Strong>);
+  SOLARSIM_BENCHMARK(BM_BH_Collisions_MT_HPXSenders);
 
   // then weak scaling
   SOLARSIM_BENCHMARK(BM_BH_MT_HPXFutures<Scaling::Weak>);
   SOLARSIM_BENCHMARK(BM_BH_MT_HPXSenders<Scaling::Weak>);
+  SOLARSIM_BENCHMARK(BM_BH_MT_HPXFutures<Scaling::Weak, TreeBuild::Morton>);
+  SOLARSIM_BENCHMARK(BM_BH_MT_HPXSenders<Scaling::Weak, TreeBuild::Morton>);
+  SOLARSIM_BENCHMARK(BM_BH_MT_HPXFutures<Scaling::Weak, TreeBuild::Merged>);
+  SOLARSIM_BENCHMARK(BM_BH_MT_HPXSenders<Scaling::Weak, TreeBuild::Merged>);
+  SOLARSIM_BENCHMARK(BM_FMM_MT_HPXSenders<Scaling::Weak>);
+  SOLARSIM_BENCHMARK(BM_Naive_MT_HPXSenders<Scaling::Weak>);
 
 #undef SOLARSIM_BENCHMARK
 
@@ -1,4 +1,10 @@
 #include "benchmark_common.hpp"
+#include "benchmark_direct_sum.hpp"
+#include "benchmark_octree.hpp"
+#include "benchmark_fmm.hpp"
+#include "benchmark_integration.hpp"
+#include "benchmark_kd_tree.hpp"
+#include "benchmark_treepm.hpp"
 #include "solarsim/sync_simulator.hpp"
 #include "solarsim/stdexec/async_simulator_sender.hpp"
 
@@ -35,7 +41,17 @@ static void BM_BH_ST(benchmark::State& state)
 }
 BENCHMARK(BM_BH_ST);
 
-template <Scaling S>
+static void BM_FMM_ST(benchmark::State& state)
+{
+  auto data = solarsim::get_problem();
+  for (auto _ : state) {
+    solarsim::fmm_sync_simulator simulator(data.body_positions, data.body_velocities, data.body_masses, .05);
+    run_simulation(simulator, FLAGS_time_step, FLAGS_duration);
+  }
+}
+BENCHMARK(BM_FMM_ST);
+
+template <Scaling S, TreeBuild B = TreeBuild::Insertion>
 static void BM_BH_MT_STDSenders(benchmark::State& state)
 {
   using namespace solarsim::impl_std;
@@ -47,6 +63,15 @@ static void BM_BH_MT_STDSenders(benchmark::State& state)
   exec::static_thread_pool pool(state.range(0));
   ex::scheduler auto sched = pool.get_scheduler();
 
+  auto tick_barnes_hut = [&] {
+    if constexpr (B == TreeBuild::Morton)
+      return async_tick_barnes_hut_morton(sched);
+    else if constexpr (B == TreeBuild::Merged)
+      return async_tick_barnes_hut_merged(sched);
+    else
+      return async_tick_barnes_hut(sched);
+  };
+
   auto data = solarsim::get_problem();
   for (auto _ : state) {
     for (solarsim::real elapsed = FLAGS_time_step; elapsed < duration; elapsed += FLAGS_time_step) {
@@ -57,7 +82,7 @@ static void BM_BH_MT_STDSenders(benchmark::State& state)
 
       auto snd = ex::transfer_just(sched, solarsim::simulation_state_view(data)) |                 //
                  async_tick_simulation_phase1(solarsim::get_dataset_size(data), FLAGS_time_step) | //
-                 async_tick_barnes_hut(sched) |                                                    //
+                 tick_barnes_hut() |                                                               //
                  async_tick_simulation_phase2(solarsim::get_dataset_size(data), FLAGS_time_step);
 
       tt::sync_wait(std::move(snd)); // wait on this thread to finish
@@ -67,6 +92,95 @@ static void BM_BH_MT_STDSenders(benchmark::State& state)
   pool.request_stop();
 }
 
+// Same chain as BM_BH_MT_STDSenders, with the FMM in place of Barnes-Hut
+template <Scaling S>
+static void BM_FMM_MT_STDSenders(benchmark::State& state)
+{
+  using namespace solarsim::impl_std;
+
+  // The FMM is O(n), so equal work per thread just needs |threads| times the ticks.
+  const real duration = S == Scaling::Weak ? FLAGS_duration * static_cast<real>(state.range(0)) : FLAGS_duration;
+
+  exec::static_thread_pool pool(state.range(0));
+  ex::scheduler auto sched = pool.get_scheduler();
+
+  auto data = solarsim::get_problem();
+  for (auto _ : state) {
+    for (solarsim::real elapsed = FLAGS_time_step; elapsed < duration; elapsed += FLAGS_time_step) {
+      auto snd = ex::transfer_just(sched, solarsim::simulation_state_view(data)) |                 //
+                 async_tick_simulation_phase1(solarsim::get_dataset_size(data), FLAGS_time_step) | //
+                 async_tick_fmm(sched) |                                                           //
+                 async_tick_simulation_phase2(solarsim::get_dataset_size(data), FLAGS_time_step);
+
+      tt::sync_wait(std::move(snd)); // wait on this thread to finish
+    }
+  }
+
+  pool.request_stop();
+}
+
+// Same chain as BM_BH_MT_STDSenders, with tiled direct summation in place of Barnes-Hut
+template <Scaling S>
+static void BM_Naive_MT_STDSenders(benchmark::State& state)
+{
+  using namespace solarsim::impl_std;
+
+  // Every tick is the same O(n^2) work, so equal work per thread just needs |threads| times the ticks.
+  const real duration = S == Scaling::Weak ? FLAGS_duration * static_cast<real>(state.range(0)) : FLAGS_duration;
+
+  exec::static_thread_pool pool(state.range(0));
+  ex::scheduler auto sched = pool.get_scheduler();
+
+  auto data = solarsim::get_problem();
+  for (auto _ : state) {
+    for (solarsim::real elapsed = FLAGS_time_step; elapsed < duration; elapsed += FLAGS_time_step) {
+      auto snd = ex::transfer_just(sched, solarsim::simulation_state_view(data)) |                 //
+                 async_tick_simulation_phase1(solarsim::get_dataset_size(data), FLAGS_time_step) | //
+                 async_tick_naive_tiled(sched, static_cast<std::size_t>(state.range(0))) |         //
+                 async_tick_simulation_phase2(solarsim::get_dataset_size(data), FLAGS_time_step);
+
+      tt::sync_wait(std::move(snd)); // wait on this thread to finish
+    }
+  }
+
+  pool.request_stop();
+}
+
+// Barnes-Hut with collision merging. Bodies merge as the simulation goes on, so the state is owned rather than a
+// view, and every tick integrates the bodies left after the previous one.
+static void BM_BH_Collisions_MT_STDSenders(benchmark::State& state)
+{
+  using namespace solarsim::impl_std;
+
+  exec::static_thread_pool pool(state.range(0));
+  ex::scheduler auto sched = pool.get_scheduler();
+
+  // Spheres of 1/1000 of the average volume per body, see BM_Octree_Collisions
+  simulation_state initial = generate_problem(solarsim::get_dataset_size(solarsim::get_problem()));
+  const auto n             = initial.body_positions.size();
+  initial.body_radii.assign(n, query_radius(n, 1) * std::cbrt(real(1e-3)));
+
+  std::size_t bodies_left = n;
+  for (auto _ : state) {
+    simulation_state data = initial;
+    for (solarsim::real elapsed = FLAGS_time_step; elapsed < FLAGS_duration; elapsed += FLAGS_time_step) {
+      // The phases take the count before the merge, phase 2 skips the bodies merged in between.
+      const auto num_bodies = solarsim::get_dataset_size(data);
+
+      auto snd = ex::transfer_just(sched, std::move(data)) |                 //
+                 async_tick_simulation_phase1(num_bodies, FLAGS_time_step) | //
+                 async_tick_barnes_hut_collisions(sched, FLAGS_time_step) |  //
+                 async_tick_simulation_phase2(num_bodies, FLAGS_time_step);
+
+      std::tie(data) = tt::sync_wait(std::move(snd)).value(); // NOLINT(bugprone-unchecked-optional-access)
+    }
+    bodies_left = data.body_positions.size();
+  }
+  state.counters["bodies_left"] = static_cast<double>(bodies_left);
+
+  pool.request_stop();
+}
+
 extern "C" int main(int argc, char* argv[])
 {
   benchmark::Initialize(&argc, argv, []() {
@@ -79,13 +193,22 @@ extern "C" int main(int argc, char* argv[])
   if (benchmark::ReportUnrecognizedArguments(argc, argv))
     return 1;
 
-#define SOLARSIM_BENCHMARK(function_name) register_solarsim_benchmark(#function_name, &function_name)
+#define SOLARSIM_BENCHMARK(...) register_solarsim_benchmark(#__VA_ARGS__, &__VA_ARGS__)
 
   // strong scaling first
   SOLARSIM_BENCHMARK(BM_BH_MT_STDSenders<Scaling::Strong>);
+  SOLARSIM_BENCHMARK(BM_BH_MT_STDSenders<Scaling::Strong, TreeBuild::Morton>);
+  SOLARSIM_BENCHMARK(BM_BH_MT_STDSenders<Scaling::Strong, TreeBuild::Merged>);
+  SOLARSIM_BENCHMARK(BM_FMM_MT_STDSenders<Scaling::Strong>);
+  SOLARSIM_BENCHMARK(BM_Naive_MT_STDSenders<Scaling::Strong>);
+  SOLARSIM_BENCHMARK(BM_BH_Collisions_MT_STDSenders);
 
   // then weak scaling
   SOLARSIM_BENCHMARK(BM_BH_MT_STDSenders<Scaling::Weak>);
+  SOLARSIM_BENCHMARK(BM_BH_MT_STDSenders<Scaling::Weak, TreeBuild::Morton>);
+  SOLARSIM_BENCHMARK(BM_BH_MT_STDSenders<Scaling::Weak, TreeBuild::Merged>);
+  SOLARSIM_BENCHMARK(BM_FMM_MT_STDSenders<Scaling::Weak>);
+  SOLARSIM_BENCHMARK(BM_Naive_MT_STDSenders<Scaling::Weak>);
 
 #undef SOLARSIM_BENCHMARK
 
@@ -0,0 +1,499 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include "benchmark_common.hpp"
+
+#include <solarsim/barnes_hut_octree.hpp>
+#include <solarsim/collisions.hpp>
+#include <solarsim/lazy_octree.hpp>
+#include <solarsim/merged_octree_builder.hpp>
+#include <solarsim/morton_octree_builder.hpp>
+
+#include <benchmark/benchmark.h>
+
+#include <numbers>
+
+SOLARSIM_NS_BEGIN
+
+//
+// Tree construction benchmarks (backend-independent, single-threaded)
+//
+
+inline void set_octree_counters(benchmark::State& state, const barnes_hut_octree& octree, std::size_t n)
+{
+  const auto n_r                   = static_cast<double>(n);
+  state.counters["bytes_per_body"] = static_cast<double>(octree.allocated_bytes()) / n_r;
+  state.counters["nodes_per_body"] = static_cast<double>(octree.node_count()) / n_r;
+  state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(n));
+}
+
+// A fresh tree each iteration - this is what every tick used to pay.
+static void BM_Octree_Build(benchmark::State& state)
+{
+  const auto data = generate_problem(static_cast<std::size_t>(state.range(0)));
+  for (auto _ : state) {
+    barnes_hut_octree octree(data.body_positions, data.body_masses);
+    benchmark::DoNotOptimize(octree);
+  }
+  set_octree_counters(state, barnes_hut_octree(data.body_positions, data.body_masses), data.body_positions.size());
+}
+BENCHMARK(BM_Octree_Build)->RangeMultiplier(10)->Range(1000, 1000000)->Unit(benchmark::kMillisecond);
+
+// Rebuilding into the same node pool - what barnes_hut_sync_simulator_impl does now.
+static void BM_Octree_Rebuild(benchmark::State& state)
+{
+  const auto data = generate_problem(static_cast<std::size_t>(state.range(0)));
+  barnes_hut_octree octree(data.body_positions, data.body_masses);
+  for (auto _ : state) {
+    octree.rebuild(data.body_positions, data.body_masses);
+    benchmark::DoNotOptimize(octree);
+  }
+  set_octree_counters(state, octree, data.body_positions.size());
+}
+BENCHMARK(BM_Octree_Rebuild)->RangeMultiplier(10)->Range(1000, 1000000)->Unit(benchmark::kMillisecond);
+
+// Refitting a persistent tree to slightly moved bodies. Alternates between two position sets,
+// so every iteration moves all bodies (and some of them across cell boundaries).
+static void BM_Octree_Refit(benchmark::State& state)
+{
+  const auto data = generate_problem(static_cast<std::size_t>(state.range(0)));
+
+  std::mt19937_64 rng(7);
+  std::uniform_real_distribution<real> step_dist(-1e-4 * parsec_in_km, 1e-4 * parsec_in_km);
+  std::vector<triple> moved_positions(data.body_positions);
+  for (auto& position : moved_positions)
+    position += triple{step_dist(rng), step_dist(rng), step_dist(rng)};
+
+  barnes_hut_octree octree;
+  octree.refit(data.body_positions, data.body_masses);
+
+  std::int64_t rebuilds = 0;
+  bool moved            = false;
+  for (auto _ : state) {
+    moved = !moved;
+    rebuilds += octree.refit(moved ? std::span<const triple>(moved_positions) : data.body_positions,
+                             data.body_masses);
+    benchmark::DoNotOptimize(octree);
+  }
+  set_octree_counters(state, octree, data.body_positions.size());
+  state.counters["rebuilds"] = static_cast<double>(rebuilds);
+}
+BENCHMARK(BM_Octree_Refit)->RangeMultiplier(10)->Range(1000, 1000000)->Unit(benchmark::kMillisecond);
+
+// Morton-sorted bottom-up build, run serially here. See the MT benchmarks for the parallel version.
+static void BM_Octree_Build_Morton(benchmark::State& state)
+{
+  const auto data = generate_problem(static_cast<std::size_t>(state.range(0)));
+  morton_octree_builder builder;
+  for (auto _ : state) {
+    auto octree = builder.build(data.body_positions, data.body_masses);
+    benchmark::DoNotOptimize(octree);
+  }
+  set_octree_counters(state, builder.build(data.body_positions, data.body_masses), data.body_positions.size());
+}
+BENCHMARK(BM_Octree_Build_Morton)->RangeMultiplier(10)->Range(1000, 1000000)->Unit(benchmark::kMillisecond);
+
+// Partial trees merged into one, run serially here. This shows the overhead of merging over a plain build.
+static void BM_Octree_Build_Merged(benchmark::State& state)
+{
+  const auto data = generate_problem(static_cast<std::size_t>(state.range(0)));
+  merged_octree_builder builder;
+  for (auto _ : state) {
+    auto octree = builder.build(data.body_positions, data.body_masses);
+    benchmark::DoNotOptimize(octree);
+  }
+  set_octree_counters(state, builder.build(data.body_positions, data.body_masses), data.body_positions.size());
+}
+BENCHMARK(BM_Octree_Build_Merged)->RangeMultiplier(10)->Range(1000, 1000000)->Unit(benchmark::kMillisecond);
+
+//
+// Force calculation benchmarks: speed vs. accuracy of the opening criteria
+//
+
+// Mean relative error of the first |samples| bodies' acceleration compared to direct summation
+inline double sample_relative_error(const simulation_state& data, std::span<const triple> acceleration,
+                                    std::size_t samples = 100)
+{
+  double sum = 0;
+  samples    = std::min(samples, data.body_positions.size());
+  for (std::size_t i = 0; i != samples; ++i) {
+    triple expected = {};
+    for (std::size_t j = 0, n = data.body_positions.size(); j != n; ++j) {
+      if (i != j)
+        calculate_acceleration(data.body_positions[i], data.body_positions[j], data.body_masses[j],
+                               data.softening_factor, expected);
+    }
+    sum += length(acceleration[i] - expected) / length(expected);
+  }
+  return sum / static_cast<double>(samples);
+}
+
+// range(1) is theta in percent, or alpha in 1/10000 for opening_criterion::kind::relative_acceleration
+template <opening_criterion::kind K>
+static void BM_Octree_Forces(benchmark::State& state)
+{
+  const auto data = generate_problem(static_cast<std::size_t>(state.range(0)));
+  const auto n    = data.body_positions.size();
+
+  opening_criterion criterion{K};
+  if constexpr (K == opening_criterion::kind::relative_acceleration)
+    criterion.alpha = static_cast<real>(state.range(1)) / 10000;
+  else
+    criterion.theta = static_cast<real>(state.range(1)) / 100;
+
+  barnes_hut_octree octree(data.body_positions, data.body_masses);
+  std::vector<triple> acceleration(n);
+
+  // Relative criteria need the previous tick's acceleration, so start with a default tick.
+  for (std::size_t i = 0; i != n; ++i)
+    octree.apply_forces_to(data.body_positions[i], data.softening_factor, acceleration[i]);
+  octree.set_opening_criterion(criterion);
+
+  for (auto _ : state) {
+    for (std::size_t i = 0; i != n; ++i)
+      octree.recompute_acceleration(data.body_positions[i], data.softening_factor, acceleration[i]);
+    benchmark::DoNotOptimize(acceleration.data());
+  }
+  state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(n));
+  state.counters["mean_relative_error"] = sample_relative_error(data, acceleration);
+}
+BENCHMARK(BM_Octree_Forces<opening_criterion::kind::geometric>)
+    ->ArgsProduct({{10000, 100000}, {30, 50, 70, 100}})
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Octree_Forces<opening_criterion::kind::bmax>)
+    ->ArgsProduct({{10000, 100000}, {30, 50, 70, 100}})
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Octree_Forces<opening_criterion::kind::relative_acceleration>)
+    ->ArgsProduct({{10000, 100000}, {5, 25, 100}})
+    ->Unit(benchmark::kMillisecond);
+
+// Error and cost of the configured multipole order (SolarSim_MULTIPOLE_ORDER) over theta.
+// Compare builds with different orders at equal mean_relative_error. range(1) is theta in percent.
+static void BM_Octree_Forces_Multipole(benchmark::State& state)
+{
+  const auto data = generate_problem(static_cast<std::size_t>(state.range(0)));
+  const auto n    = data.body_positions.size();
+
+  barnes_hut_octree octree(data.body_positions, data.body_masses);
+  octree.set_opening_criterion({opening_criterion::kind::geometric, static_cast<real>(state.range(1)) / 100});
+  std::vector<triple> acceleration(n);
+
+  for (auto _ : state) {
+    for (std::size_t i = 0; i != n; ++i)
+      octree.recompute_acceleration(data.body_positions[i], data.softening_factor, acceleration[i]);
+    benchmark::DoNotOptimize(acceleration.data());
+  }
+
+  const std::size_t samples = std::min<std::size_t>(n, 1000);
+  std::size_t interactions  = 0;
+  for (std::size_t i = 0; i != samples; ++i)
+    interactions += octree.count_interactions(data.body_positions[i]);
+
+  state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(n));
+  state.counters["multipole_order"]       = octree_multipole_order;
+  state.counters["interactions_per_body"] = static_cast<double>(interactions) / static_cast<double>(samples);
+  state.counters["mean_relative_error"]   = sample_relative_error(data, acceleration);
+}
+BENCHMARK(BM_Octree_Forces_Multipole)
+    ->ArgsProduct({{10000, 100000}, {30, 40, 50, 70, 90}})
+    ->Unit(benchmark::kMillisecond);
+
+// range(1) is octree_leaf_options::max_bodies. Rebuild plus one force pass, which is what a tick costs.
+static void BM_Octree_Leaf_Bodies(benchmark::State& state)
+{
+  const auto data = generate_problem(static_cast<std::size_t>(state.range(0)));
+  const auto n    = data.body_positions.size();
+
+  barnes_hut_octree octree;
+  octree.set_leaf_options({static_cast<std::uint32_t>(state.range(1))});
+  std::vector<triple> acceleration(n);
+
+  for (auto _ : state) {
+    octree.rebuild(data.body_positions, data.body_masses);
+    for (std::size_t i = 0; i != n; ++i)
+      octree.recompute_acceleration(data.body_positions[i], data.softening_factor, acceleration[i]);
+    benchmark::DoNotOptimize(acceleration.data());
+  }
+  set_octree_counters(state, octree, n);
+  state.counters["mean_relative_error"] = sample_relative_error(data, acceleration);
+}
+BENCHMARK(BM_Octree_Leaf_Bodies)->ArgsProduct({{10000, 100000}, {1, 4, 8, 16, 32}})->Unit(benchmark::kMillisecond);
+
+// Per-body walks vs. one walk per group of up to barnes_hut_octree::max_group_size bodies.
+// range(1) is theta in percent.
+template <bool Grouped>
+static void BM_Octree_Forces_Grouped(benchmark::State& state)
+{
+  const auto data = generate_problem(static_cast<std::size_t>(state.range(0)));
+  const auto n    = data.body_positions.size();
+
+  barnes_hut_octree octree(data.body_positions, data.body_masses);
+  octree.set_opening_criterion({opening_criterion::kind::geometric, static_cast<real>(state.range(1)) / 100});
+  std::vector<triple> acceleration(n);
+
+  for (auto _ : state) {
+    if constexpr (Grouped) {
+      octree.recompute_group_accelerations(data.softening_factor, acceleration);
+    } else {
+      for (std::size_t i = 0; i != n; ++i)
+        octree.recompute_acceleration(data.body_positions[i], data.softening_factor, acceleration[i]);
+    }
+    benchmark::DoNotOptimize(acceleration.data());
+  }
+  state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(n));
+  state.counters["groups"]              = static_cast<double>(octree.group_count());
+  state.counters["mean_relative_error"] = sample_relative_error(data, acceleration);
+}
+BENCHMARK(BM_Octree_Forces_Grouped<false>)->ArgsProduct({{10000, 100000}, {50, 70}})->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Octree_Forces_Grouped<true>)->ArgsProduct({{10000, 100000}, {50, 70}})->Unit(benchmark::kMillisecond);
+
+// A walk per body vs. packet walks (barnes_hut_octree::packet_size bodies in tree order walking together).
+// range(1) is theta in percent.
+template <bool Packet>
+static void BM_Octree_Forces_Packet(benchmark::State& state)
+{
+  const auto data = generate_problem(static_cast<std::size_t>(state.range(0)));
+  const auto n    = data.body_positions.size();
+
+  barnes_hut_octree octree(data.body_positions, data.body_masses);
+  octree.set_opening_criterion({opening_criterion::kind::geometric, static_cast<real>(state.range(1)) / 100});
+  std::vector<triple> acceleration(n);
+
+  for (auto _ : state) {
+    if constexpr (Packet) {
+      for (std::size_t chunk = 0, chunks = octree.chunk_count(); chunk != chunks; ++chunk)
+        octree.recompute_chunk_accelerations(chunk, data.softening_factor, acceleration);
+    } else {
+      for (std::size_t i = 0; i != n; ++i)
+        octree.recompute_acceleration(data.body_positions[i], data.softening_factor, acceleration[i]);
+    }
+    benchmark::DoNotOptimize(acceleration.data());
+  }
+  state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(n));
+  state.counters["mean_relative_error"] = sample_relative_error(data, acceleration);
+}
+BENCHMARK(BM_Octree_Forces_Packet<false>)->ArgsProduct({{10000, 100000}, {50, 70}})->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Octree_Forces_Packet<true>)->ArgsProduct({{10000, 100000}, {50, 70}})->Unit(benchmark::kMillisecond);
+
+// Eagerly built vs. lazily expanded trees, for every |range(1)|-th body. Evaluating only a few bodies (e.g. the ones
+// due for an update with individual time steps) leaves most of a lazy tree unbuilt.
+template <bool Lazy, bool Clustered>
+static void BM_Octree_Lazy(benchmark::State& state)
+{
+  const auto n    = static_cast<std::size_t>(state.range(0));
+  const auto data = Clustered ? generate_clustered_problem(n) : generate_problem(n);
+  const auto step = static_cast<std::size_t>(state.range(1));
+  std::vector<triple> acceleration(n);
+
+  auto run = [&](auto& octree) {
+    for (auto _ : state) {
+      octree.rebuild(data.body_positions, data.body_masses);
+      for (std::size_t i = 0; i < n; i += step)
+        octree.apply_forces_to(data.body_positions[i], data.softening_factor, acceleration[i]);
+      benchmark::DoNotOptimize(acceleration.data());
+    }
+    state.counters["bytes_per_body"] = static_cast<double>(octree.allocated_bytes()) / static_cast<double>(n);
+    state.counters["nodes_per_body"] = static_cast<double>(octree.node_count()) / static_cast<double>(n);
+  };
+  if constexpr (Lazy) {
+    lazy_octree octree;
+    run(octree);
+  } else {
+    barnes_hut_octree octree;
+    run(octree);
+  }
+  state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>((n + step - 1) / step));
+}
+BENCHMARK(BM_Octree_Lazy<false, false>)->ArgsProduct({{100000, 1000000}, {1, 100}})->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Octree_Lazy<true, false>)->ArgsProduct({{100000, 1000000}, {1, 100}})->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Octree_Lazy<false, true>)->ArgsProduct({{100000, 1000000}, {1, 100}})->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Octree_Lazy<true, true>)->ArgsProduct({{100000, 1000000}, {1, 100}})->Unit(benchmark::kMillisecond);
+
+// 64-byte linear nodes vs. 32-byte nodes with float32 centers of mass relative to their parent
+// vs. wide nodes holding all children side by side
+template <octree_node_format Format>
+static void BM_Octree_Forces_Format(benchmark::State& state)
+{
+  const auto data = generate_problem(static_cast<std::size_t>(state.range(0)));
+  const auto n    = data.body_positions.size();
+
+  barnes_hut_octree octree(data.body_positions, data.body_masses);
+  octree.set_node_format(Format);
+  std::vector<triple> acceleration(n);
+
+  for (auto _ : state) {
+    for (std::size_t i = 0; i != n; ++i)
+      octree.apply_forces_to(data.body_positions[i], data.softening_factor, acceleration[i]);
+    benchmark::DoNotOptimize(acceleration.data());
+  }
+  state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(n));
+  state.counters["bytes_per_body"]      = static_cast<double>(octree.allocated_bytes()) / static_cast<double>(n);
+  state.counters["mean_relative_error"] = sample_relative_error(data, acceleration);
+}
+BENCHMARK(BM_Octree_Forces_Format<octree_node_format::linear>)
+    ->RangeMultiplier(10)
+    ->Range(100000, 1000000)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Octree_Forces_Format<octree_node_format::compact>)
+    ->RangeMultiplier(10)
+    ->Range(100000, 1000000)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Octree_Forces_Format<octree_node_format::wide>)
+    ->RangeMultiplier(10)
+    ->Range(100000, 1000000)
+    ->Unit(benchmark::kMillisecond);
+
+//
+// Spatial queries vs. brute force (backend-independent, single-threaded)
+//
+// Each iteration runs |octree_query_count| queries around random bodies, items are queries.
+// The tree is built once up front, so this is only the query cost.
+//
+
+inline constexpr std::size_t octree_query_count = 256;
+
+// Radius of a sphere holding |count| of generate_problem()'s |n| bodies on average
+inline real query_radius(std::size_t n, std::size_t count)
+{
+  // (4/3) pi r^3 / (2 p)^3 = count / n
+  return parsec_in_km * std::cbrt(6 * static_cast<real>(count) / (std::numbers::pi_v<real> * static_cast<real>(n)));
+}
+
+// range(1) is the average number of bodies found
+template <bool BruteForce>
+static void BM_Octree_RadiusQuery(benchmark::State& state)
+{
+  const auto data   = generate_problem(static_cast<std::size_t>(state.range(0)));
+  const auto n      = data.body_positions.size();
+  const real radius = query_radius(n, static_cast<std::size_t>(state.range(1)));
+
+  const barnes_hut_octree octree(data.body_positions, data.body_masses);
+  std::vector<std::uint32_t> found;
+  std::size_t total_found = 0;
+
+  for (auto _ : state) {
+    for (std::size_t q = 0; q != octree_query_count; ++q) {
+      const triple& center = data.body_positions[(q * 7919) % n];
+      found.clear();
+      if constexpr (BruteForce) {
+        for (std::uint32_t i = 0; i != n; ++i) {
+          if (squared_length(data.body_positions[i] - center) <= radius * radius)
+            found.push_back(i);
+        }
+      } else {
+        octree.find_bodies_in_radius(center, radius, found);
+      }
+      total_found += found.size();
+      benchmark::DoNotOptimize(found.data());
+    }
+  }
+  const auto queries = state.iterations() * static_cast<std::int64_t>(octree_query_count);
+  state.SetItemsProcessed(queries);
+  state.counters["found_per_query"] = static_cast<double>(total_found) / static_cast<double>(queries);
+}
+BENCHMARK(BM_Octree_RadiusQuery<false>)
+    ->ArgsProduct({{100000, 1000000, 10000000}, {32}})
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_Octree_RadiusQuery<true>)
+    ->ArgsProduct({{100000, 1000000, 10000000}, {32}})
+    ->Unit(benchmark::kMillisecond);
+
+// range(1) is k
+template <bool BruteForce>
+static void BM_Octree_NearestQuery(benchmark::State& state)
+{
+  const auto data = generate_problem(static_cast<std::size_t>(state.range(0)));
+  const auto n    = data.body_positions.size();
+  const auto k    = static_cast<std::size_t>(state.range(1));
+
+  const barnes_hut_octree octree(data.body_positions, data.body_masses);
+  std::vector<octree_neighbor> neighbors;
+
+  for (auto _ : state) {
+    for (std::size_t q = 0; q != octree_query_count; ++q) {
+      const triple& point = data.body_positions[(q * 7919) % n];
+      if constexpr (BruteForce) {
+        neighbors.resize(n);
+        for (std::uint32_t i = 0; i != n; ++i)
+          neighbors[i] = {i, squared_length(data.body_positions[i] - point)};
+        std::nth_element(neighbors.begin(), neighbors.begin() + static_cast<std::ptrdiff_t>(k - 1), neighbors.end(),
+                         [](const octree_neighbor& a, const octree_neighbor& b) {
+                           return a.distance_squared < b.distance_squared;
+                         });
+        neighbors.resize(k);
+      } else {
+        octree.find_nearest_bodies(point, k, neighbors);
+      }
+      benchmark::DoNotOptimize(neighbors.data());
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(octree_query_count));
+}
+BENCHMARK(BM_Octree_NearestQuery<false>)
+    ->ArgsProduct({{100000, 1000000, 10000000}, {1, 16, 64}})
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_Octree_NearestQuery<true>)
+    ->ArgsProduct({{100000, 1000000, 10000000}, {1, 16, 64}})
+    ->Unit(benchmark::kMillisecond);
+
+//
+// Collision detection and merging with collision_merger, against checking all pairs.
+// The tree is built once up front (it's shared with the force computation), items are bodies.
+//
+
+// range(1) is the sphere volume per body, relative to the average volume per body, in parts per million.
+// Small values make for few collisions, like in a real system.
+template <bool BruteForce>
+static void BM_Octree_Collisions(benchmark::State& state)
+{
+  auto data    = generate_problem(static_cast<std::size_t>(state.range(0)));
+  const auto n = data.body_positions.size();
+  data.body_radii.assign(n, query_radius(n, 1) * std::cbrt(static_cast<real>(state.range(1)) * 1e-6));
+
+  const barnes_hut_octree octree(data.body_positions, data.body_masses);
+  collision_merger merger;
+  std::size_t found = 0;
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    simulation_state copy = data;
+    state.ResumeTiming();
+
+    if constexpr (BruteForce) {
+      std::vector<body_collision> collisions;
+      for (std::uint32_t i = 0; i != n; ++i) {
+        for (std::uint32_t j = i + 1; j != n; ++j) {
+          const real radius_sum = copy.body_radii[i] + copy.body_radii[j];
+          if (squared_length(copy.body_positions[j] - copy.body_positions[i]) <= radius_sum * radius_sum)
+            collisions.push_back({i, j});
+        }
+      }
+      found = collisions.size();
+      benchmark::DoNotOptimize(collisions.data());
+    } else {
+      merger.merge(copy, octree, 0);
+      found = merger.collisions().size();
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(n));
+  state.counters["collisions_per_body"] = static_cast<double>(found) / static_cast<double>(n);
+}
+BENCHMARK(BM_Octree_Collisions<false>)
+    ->ArgsProduct({{10000, 100000, 1000000, 10000000}, {1000, 10000}})
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Octree_Collisions<true>)->ArgsProduct({{10000, 100000}, {1000, 10000}})->Unit(benchmark::kMillisecond);
+
+SOLARSIM_NS_END
@@ -0,0 +1,53 @@
+/// @copyright Copyright (c) Tim Niederhausen (tim@rnc-ag.de)
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the GNU General Public License as published by
+/// the Free Software Foundation, either version 3 of the License, or
+/// (at your option) any later version.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+/// GNU General Public License for more details.
+///
+/// You should have received a copy of the GNU General Public License
+/// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include "benchmark_common.hpp"
+#include "benchmark_octree.hpp"
+
+#include <solarsim/treepm.hpp>
+
+#include <benchmark/benchmark.h>
+
+SOLARSIM_NS_BEGIN
+
+//
+// TreePM (backend-independent, single-threaded)
+//
+// Includes the mesh setup and the tree build, compare with BM_BH_Tick at equal mean_relative_error.
+//
+
+// range(1) is the mesh size
+static void BM_TreePM_Tick(benchmark::State& state)
+{
+  const auto data = generate_problem(static_cast<std::size_t>(state.range(0)));
+  const auto n    = data.body_positions.size();
+
+  treepm_options options;
+  options.mesh_size = static_cast<std::uint32_t>(state.range(1));
+  treepm_solver solver(options);
+  std::vector<triple> acceleration(n);
+
+  for (auto _ : state) {
+    solver.compute_accelerations(data.body_positions, data.body_masses, data.softening_factor, acceleration);
+    benchmark::DoNotOptimize(acceleration.data());
+  }
+  state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(n));
+  state.counters["bytes_per_body"]      = static_cast<double>(solver.allocated_bytes()) / static_cast<double>(n);
+  state.counters["mean_relative_error"] = sample_relative_error(data, acceleration);
+}
+BENCHMARK(BM_TreePM_Tick)->ArgsProduct({{10000, 100000, 1000000}, {32, 64, 128}})->Unit(benchmark::kMillisecond);
+
+SOLARSIM_NS_END